@@ -0,0 +1,527 @@
+#include "Client.h"
+
+ASYNCCLIENT* CreateAsyncClient()
+{
+    ASYNCCLIENT* client = (ASYNCCLIENT*)calloc(1, sizeof(ASYNCCLIENT));
+    ASYNCCONNECTION** connections = (ASYNCCONNECTION**)malloc(sizeof(ASYNCCONNECTION*) * ASYNC_CONNECTIONS_INITIAL_SIZE);
+    if (client == NULL || connections == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        free(client);
+        free(connections);
+        return NULL;
+    }
+    client->connections = connections;
+    client->connection_capacity = ASYNC_CONNECTIONS_INITIAL_SIZE;
+
+    // the event loop waits on sockets only: a loopback datagram socket connected to itself carries the wake-ups
+    client->wake_receiver = CreateSocket(UDP);
+    client->wake_sender = CreateSocket(UDP);
+    IP loopback;
+    TryParseIPString(DEFAULT_IP, &loopback);
+    ADDRESS address = CreateSocketAddress(loopback, 0);
+    int address_len = sizeof(address);
+    u_long non_blocking = 1;
+    if (client->wake_receiver == INVALID_SOCKET || client->wake_sender == INVALID_SOCKET
+        || bind(client->wake_receiver, (SOCKADDR*)&address, sizeof(address)) == SOCKET_ERROR
+        || getsockname(client->wake_receiver, (SOCKADDR*)&address, (socklen_t*)&address_len) == SOCKET_ERROR
+        || !EstablishConnection(client->wake_sender, address)
+        || ioctlsocket(client->wake_receiver, FIONBIO, &non_blocking) == SOCKET_ERROR) {
+        printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _BIND_SOCKET_FAIL);
+        CloseSocket(client->wake_receiver, CLOSE_NORMAL);
+        CloseSocket(client->wake_sender, CLOSE_NORMAL);
+        free(connections);
+        free(client);
+        return NULL;
+    }
+    InitializeCriticalSection(&client->lock);
+    InitializeConditionVariable(&client->done);
+
+    client->thread = (HANDLE)_beginthreadex(NULL, 0, RunAsyncClient, (void*)client, 0, 0);
+    if (client->thread == 0) {
+        printf("[%s] %s\n", WARNING_FLAGS, _TOO_MANY_THREADS);
+        DeleteCriticalSection(&client->lock);
+        CloseSocket(client->wake_receiver, CLOSE_NORMAL);
+        CloseSocket(client->wake_sender, CLOSE_NORMAL);
+        free(connections);
+        free(client);
+        return NULL;
+    }
+    return client;
+}
+
+void DestroyAsyncClient(ASYNCCLIENT* client)
+{
+    if (client == NULL)
+        return;
+    EnterCriticalSection(&client->lock);
+    client->is_stopping = 1;
+    WakeAsyncClient(client);
+    LeaveCriticalSection(&client->lock);
+    WaitForSingleObject(client->thread, INFINITE);
+    CloseHandle(client->thread);
+
+    // the event loop is gone: fail what it left on this thread
+    TakeSubmitted(client);
+    for (int i = 0; i < client->connection_count; ++i) {
+        ShutAsyncConnection(client->connections[i]);
+        DestroyConnection(client->connections[i]->connection);
+        free(client->connections[i]);
+    }
+    CloseSocket(client->wake_receiver, CLOSE_NORMAL);
+    CloseSocket(client->wake_sender, CLOSE_NORMAL);
+    DeleteCriticalSection(&client->lock);
+    free(client->connections);
+    free(client);
+}
+
+ASYNCCONNECTION* OpenAsyncConnection(ASYNCCLIENT* client, ADDRESS server)
+{
+    SOCKET socket = CreateSocket(TCP);
+    if (socket == INVALID_SOCKET)
+        return NULL;
+    if (!EstablishConnection(socket, server)) {
+        CloseSocket(socket, CLOSE_NORMAL);
+        return NULL;
+    }
+    // pipelined requests are small: do not hold one back until the previous one is acknowledged
+    int no_delay = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&no_delay, sizeof(no_delay));
+    u_long non_blocking = 1;
+    ioctlsocket(socket, FIONBIO, &non_blocking);
+
+    ASYNCCONNECTION* connection = (ASYNCCONNECTION*)calloc(1, sizeof(ASYNCCONNECTION));
+    CONNECTION* _connection = CreateConnection(socket);
+    char* send_buffer = (char*)malloc(APPLICATION_BUFF_MAX_SIZE);
+    if (connection == NULL || _connection == NULL || send_buffer == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        free(connection);
+        DestroyConnection(_connection);
+        free(send_buffer);
+        CloseSocket(socket, CLOSE_SAFELY, SD_BOTH);
+        return NULL;
+    }
+    // a send buffer makes Send() collect the segments: the event loop sends them when the socket takes them
+    _connection->send_buffer = send_buffer;
+    _connection->send_capacity = APPLICATION_BUFF_MAX_SIZE;
+    connection->client = client;
+    connection->connection = _connection;
+
+    EnterCriticalSection(&client->lock);
+    connection->next = client->opened;
+    client->opened = connection;
+    WakeAsyncClient(client);
+    LeaveCriticalSection(&client->lock);
+    return connection;
+}
+
+void CloseAsyncConnection(ASYNCCONNECTION* connection)
+{
+    ASYNCCLIENT* client = connection->client;
+    EnterCriticalSection(&client->lock);
+    connection->is_closing = 1;
+    WakeAsyncClient(client);
+    LeaveCriticalSection(&client->lock);
+}
+
+ASYNCREQUEST* SendAsyncRequest(ASYNCCONNECTION* connection, const char* request, ASYNCCALLBACK callback, void* context)
+{
+    ASYNCCLIENT* client = connection->client;
+    ASYNCREQUEST* _request = (ASYNCREQUEST*)malloc(sizeof(ASYNCREQUEST));
+    MESSAGE message = request == NULL ? NULL : Clone(request, (int)strlen(request) + 1);
+    if (_request == NULL || message == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        free(_request);
+        DestroyMessage(message);
+        return NULL;
+    }
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    _request->connection = connection;
+    _request->request = message;
+    _request->callback = callback;
+    _request->context = context;
+    _request->status = ASYNC_PENDING;
+    _request->response = NULL;
+    _request->submitted = now.QuadPart;
+    _request->completed = 0;
+    _request->references = callback == NULL ? 2 : 1;
+    _request->next = NULL;
+
+    EnterCriticalSection(&client->lock);
+    if (client->submitted_last == NULL)
+        client->submitted_first = _request;
+    else
+        client->submitted_last->next = _request;
+    client->submitted_last = _request;
+    client->requests++;
+    WakeAsyncClient(client);
+    LeaveCriticalSection(&client->lock);
+    return callback == NULL ? _request : NULL;
+}
+
+ASYNCREQUEST* AsyncLogin(ASYNCCONNECTION* connection, const char* account, ASYNCCALLBACK callback, void* context)
+{
+    MESSAGE request = CreateMessage(CM_LOGIN, account);
+    ASYNCREQUEST* future = request == NULL ? NULL : SendAsyncRequest(connection, request, callback, context);
+    DestroyMessage(request);
+    return future;
+}
+
+ASYNCREQUEST* AsyncPost(ASYNCCONNECTION* connection, const char* article, ASYNCCALLBACK callback, void* context)
+{
+    MESSAGE request = CreateMessage(CM_POST, article);
+    ASYNCREQUEST* future = request == NULL ? NULL : SendAsyncRequest(connection, request, callback, context);
+    DestroyMessage(request);
+    return future;
+}
+
+ASYNCREQUEST* AsyncLogout(ASYNCCONNECTION* connection, ASYNCCALLBACK callback, void* context)
+{
+    MESSAGE request = CreateMessage(CM_LOGOUT, NULL);
+    ASYNCREQUEST* future = request == NULL ? NULL : SendAsyncRequest(connection, request, callback, context);
+    DestroyMessage(request);
+    return future;
+}
+
+int WaitAsyncRequest(ASYNCREQUEST* request, DWORD timeout, MESSAGE* oresponse)
+{
+    ASYNCCLIENT* client = request->connection->client;
+    LARGE_INTEGER frequency, start, now;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    EnterCriticalSection(&client->lock);
+    while (request->status == ASYNC_PENDING) {
+        DWORD wait = INFINITE;
+        if (timeout != INFINITE) {
+            QueryPerformanceCounter(&now);
+            long long elapsed = (now.QuadPart - start.QuadPart) * 1000 / frequency.QuadPart;
+            if (elapsed >= timeout)
+                break;
+            wait = timeout - (DWORD)elapsed;
+        }
+        SleepConditionVariableCS(&client->done, &client->lock, wait);
+    }
+    int status = request->status;
+    if (oresponse != NULL) {
+        *oresponse = request->response;
+        request->response = NULL;
+    }
+    LeaveCriticalSection(&client->lock);
+    return status;
+}
+
+void DestroyAsyncRequest(ASYNCREQUEST* request)
+{
+    if (request != NULL)
+        ReleaseAsyncRequest(request);
+}
+
+unsigned __stdcall RunAsyncClient(void* arguments)
+{
+    ASYNCCLIENT* client = (ASYNCCLIENT*)arguments;
+    WSAPOLLFD* fds = NULL;
+    ASYNCCONNECTION** polled = NULL;
+    int capacity = 0;
+    while (1) {
+        EnterCriticalSection(&client->lock);
+        int is_stopping = client->is_stopping;
+        LeaveCriticalSection(&client->lock);
+        if (is_stopping)
+            break;
+        TakeSubmitted(client);
+
+        if (capacity < client->connection_count + 1) {
+            capacity = client->connection_capacity + 1;
+            free(fds);
+            free(polled);
+            fds = (WSAPOLLFD*)malloc(sizeof(WSAPOLLFD) * capacity);
+            polled = (ASYNCCONNECTION**)malloc(sizeof(ASYNCCONNECTION*) * capacity);
+            if (fds == NULL || polled == NULL) {
+                printf("[%s] %s\n", ERROR_FLAGS, _ALLOCATE_MEMORY_FAIL);
+                break;
+            }
+        }
+        fds[0].fd = client->wake_receiver;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        int count = 1;
+        for (int i = 0; i < client->connection_count; ++i) {
+            ASYNCCONNECTION* connection = client->connections[i];
+            // send at once what was framed: most of the time the socket takes all of it, without a poll
+            if (!connection->is_closed && FlushAsyncConnection(connection) == -1)
+                ShutAsyncConnection(connection);
+            if (connection->is_closed)
+                continue;
+            polled[count] = connection;
+            fds[count].fd = connection->connection->socket;
+            fds[count].events = POLLIN | (connection->connection->send_length > 0 ? POLLOUT : 0);
+            fds[count].revents = 0;
+            ++count;
+        }
+
+        int ret = WSAPoll(fds, count, ASYNC_POLL_INTERVAL);
+        if (ret == SOCKET_ERROR) {
+            printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _RECEIVE_FAIL);
+            continue;
+        }
+        if (fds[0].revents != 0) {
+            // drain the wake bytes first: a submit after that sends a new one
+            char drain[64];
+            while (recv(client->wake_receiver, drain, sizeof(drain), 0) > 0);
+            EnterCriticalSection(&client->lock);
+            client->is_wake_pending = 0;
+            LeaveCriticalSection(&client->lock);
+        }
+        for (int i = 1; i < count; ++i) {
+            ASYNCCONNECTION* connection = polled[i];
+            if ((fds[i].revents & (POLLIN | POLLERR | POLLHUP)) && ReceiveAsyncResponses(connection) == -1)
+                ShutAsyncConnection(connection);
+            if (!connection->is_closed && (fds[i].revents & POLLOUT) && FlushAsyncConnection(connection) == -1)
+                ShutAsyncConnection(connection);
+        }
+    }
+    free(fds);
+    free(polled);
+    return 0;
+}
+
+void TakeSubmitted(ASYNCCLIENT* client)
+{
+    EnterCriticalSection(&client->lock);
+    ASYNCCONNECTION* opened = client->opened;
+    ASYNCREQUEST* request = client->submitted_first;
+    client->opened = NULL;
+    client->submitted_first = NULL;
+    client->submitted_last = NULL;
+    LeaveCriticalSection(&client->lock);
+
+    while (opened != NULL) {
+        ASYNCCONNECTION* next = opened->next;
+        if (client->connection_count == client->connection_capacity) {
+            int capacity = client->connection_capacity * 2;
+            ASYNCCONNECTION** connections = (ASYNCCONNECTION**)realloc(client->connections, sizeof(ASYNCCONNECTION*) * capacity);
+            if (connections == NULL) {
+                // leak the connection rather than lose the client: its requests never complete
+                printf("[%s] %s\n", ERROR_FLAGS, _ALLOCATE_MEMORY_FAIL);
+                opened = next;
+                continue;
+            }
+            client->connections = connections;
+            client->connection_capacity = capacity;
+        }
+        client->connections[client->connection_count++] = opened;
+        opened = next;
+    }
+
+    while (request != NULL) {
+        ASYNCREQUEST* next = request->next;
+        ASYNCCONNECTION* connection = request->connection;
+        request->next = NULL;
+        if (connection->is_closed || connection->is_closing
+            || SegmentationSend(connection->connection, request->request, (int)strlen(request->request) + 1, NULL) != 1) {
+            FinishAsyncRequest(request, ASYNC_FAILED, NULL);
+        }
+        else {
+            DestroyMessage(request->request);
+            request->request = NULL;
+            if (connection->last == NULL)
+                connection->first = request;
+            else
+                connection->last->next = request;
+            connection->last = request;
+            connection->in_flight++;
+            client->in_flight++;
+            client->peak_in_flight = max(client->peak_in_flight, client->in_flight);
+        }
+        request = next;
+    }
+
+    for (int i = 0; i < client->connection_count; ++i) {
+        if (client->connections[i]->is_closing)
+            ShutAsyncConnection(client->connections[i]);
+    }
+}
+
+int FlushAsyncConnection(ASYNCCONNECTION* connection)
+{
+    CONNECTION* _connection = connection->connection;
+    if (_connection->send_length == 0)
+        return 1;
+    int ret = send(_connection->socket, _connection->send_buffer, _connection->send_length, 0);
+    _connection->send_calls++;
+    if (ret == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+        if (err == WSAEWOULDBLOCK)
+            return 1;
+        if (err == WSAECONNABORTED || err == WSAECONNRESET)
+            printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
+        else
+            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _SEND_FAIL);
+        return -1;
+    }
+    // keep the rest at the front for the next send
+    memmove(_connection->send_buffer, _connection->send_buffer + ret, (size_t)_connection->send_length - ret);
+    _connection->send_length -= ret;
+    return 1;
+}
+
+int ReceiveAsyncResponses(ASYNCCONNECTION* connection)
+{
+    CONNECTION* receiver = connection->connection;
+    // one recv into the free space right after the last unread byte, as FillReceiveBuffer() does
+    int tail = (receiver->head + receiver->length) % receiver->capacity;
+    int space = receiver->capacity - receiver->length;
+    if (tail + space > receiver->capacity)
+        space = receiver->capacity - tail;
+    if (space > 0) {
+        int ret = recv(receiver->socket, receiver->buffer + tail, space, 0);
+        receiver->recv_calls++;
+        if (ret == SOCKET_ERROR) {
+            int err = WSAGetLastError();
+            if (err != WSAEWOULDBLOCK) {
+                printf("[%s:%d] %s\n", err == WSAECONNABORTED || err == WSAECONNRESET ? ERROR_FLAGS : WARNING_FLAGS, err,
+                    err == WSAECONNABORTED || err == WSAECONNRESET ? _CONNECTION_DROP : _RECEIVE_FAIL);
+                return -1;
+            }
+        }
+        else if (ret == 0) {
+            return -1;
+        }
+        else {
+            receiver->length += ret;
+        }
+    }
+
+    // whole segments only: ReceiveSegment() then never blocks. A message may span many polls
+    while (IsSegmentBuffered(receiver)) {
+        char* segment;
+        int mlen, remain;
+        if (ReceiveSegment(receiver, &segment, &mlen, &remain) != 1) {
+            free(segment);
+            return -1;
+        }
+        if (connection->partial == NULL) {
+            connection->partial = (char*)malloc((size_t)mlen + remain);
+            connection->partial_length = mlen + remain;
+            connection->partial_filled = 0;
+            if (connection->partial == NULL) {
+                printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+                free(segment);
+                return -1;
+            }
+        }
+        if (connection->partial_filled + mlen > connection->partial_length) { // the segment does not belong to this message
+            printf("[%s] %s\n", WARNING_FLAGS, _RECEIVE_UNEXPECTED_MESSAGE);
+            free(segment);
+            return -1;
+        }
+        memcpy_s(connection->partial + connection->partial_filled, connection->partial_length - connection->partial_filled, segment, mlen);
+        connection->partial_filled += mlen;
+        free(segment);
+        if (remain > 0)
+            continue;
+
+        MESSAGE response = connection->partial;
+        connection->partial = NULL;
+        receiver->messages++;
+        if (connection->first == NULL) { // a response without a request
+            printf("[%s] %s\n", WARNING_FLAGS, _RECEIVE_UNEXPECTED_MESSAGE);
+            DestroyMessage(response);
+            return -1;
+        }
+        CompleteAsyncRequest(connection, ASYNC_DONE, response);
+    }
+    return 1;
+}
+
+int IsSegmentBuffered(CONNECTION* connection)
+{
+    if (connection->length < SEGMENT_HEADER_SIZE)
+        return 0;
+    // peek the header: it may wrap around the end of ring
+    unsigned char header[SEGMENT_HEADER_CURRENT_SIZE];
+    for (int i = 0; i < SEGMENT_HEADER_CURRENT_SIZE; ++i)
+        header[i] = (unsigned char)connection->buffer[(connection->head + i) % connection->capacity];
+    int current = ((header[0] << 8) | header[1]) & ~SEGMENT_COMPRESSED_FLAG;
+    // a header that can not fit is let through: ReceiveSegment() rejects it
+    return current + SEGMENT_HEADER_SIZE > APPLICATION_BUFF_MAX_SIZE || connection->length >= SEGMENT_HEADER_SIZE + current;
+}
+
+void CompleteAsyncRequest(ASYNCCONNECTION* connection, int status, MESSAGE response)
+{
+    ASYNCREQUEST* request = connection->first;
+    connection->first = request->next;
+    if (connection->first == NULL)
+        connection->last = NULL;
+    connection->in_flight--;
+    connection->client->in_flight--;
+    request->next = NULL;
+    FinishAsyncRequest(request, status, response);
+}
+
+void FinishAsyncRequest(ASYNCREQUEST* request, int status, MESSAGE response)
+{
+    ASYNCCLIENT* client = request->connection->client;
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    if (status == ASYNC_DONE)
+        client->responses++;
+    else
+        client->failures++;
+
+    if (request->callback != NULL) {
+        request->completed = now.QuadPart;
+        request->status = status;
+        request->callback(request->context, status, response);
+        DestroyMessage(response);
+    }
+    else {
+        EnterCriticalSection(&client->lock);
+        request->response = response;
+        request->completed = now.QuadPart;
+        request->status = status;
+        LeaveCriticalSection(&client->lock);
+        WakeAllConditionVariable(&client->done);
+    }
+    ReleaseAsyncRequest(request);
+}
+
+void ShutAsyncConnection(ASYNCCONNECTION* connection)
+{
+    if (connection->is_closed)
+        return;
+    connection->is_closed = 1;
+    CloseSocket(connection->connection->socket, CLOSE_NORMAL);
+    connection->connection->socket = INVALID_SOCKET;
+    connection->connection->send_length = 0;
+    free(connection->partial);
+    connection->partial = NULL;
+    while (connection->first != NULL)
+        CompleteAsyncRequest(connection, ASYNC_FAILED, NULL);
+}
+
+void WakeAsyncClient(ASYNCCLIENT* client)
+{
+    if (client->is_wake_pending)
+        return;
+    client->is_wake_pending = 1;
+    send(client->wake_sender, "", 1, 0);
+}
+
+void ReleaseAsyncRequest(ASYNCREQUEST* request)
+{
+    if (InterlockedDecrement(&request->references) > 0)
+        return;
+    DestroyMessage(request->request);
+    DestroyMessage(request->response);
+    free(request);
+}
+
+void PrintAsyncStatistics(ASYNCCLIENT* client)
+{
+    EnterCriticalSection(&client->lock);
+    long long requests = client->requests;
+    LeaveCriticalSection(&client->lock);
+    printf("[%s] Async: %lld requests, %lld responses, %lld failed, at most %d in flight on %d connections\n", INFO_FLAGS,
+        requests, client->responses, client->failures, client->peak_in_flight, client->connection_count);
+}
@@ -0,0 +1,279 @@
+#pragma once
+
+// Requests without blocking: one event-loop thread multiplexes the connections of a client.
+// Requests are framed with SegmentationSend() into the send buffer of their connection and are pipelined:
+// a connection has many requests in flight, and the responses come back in the order of the requests.
+
+#pragma region Header Declarations
+
+#include "CommonHeader.h"
+
+#ifdef _WIN32
+#include <process.h>
+#endif
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define ASYNC_POLL_INTERVAL 1000 // Longest wait of the event loop for sockets, in milliseconds. Submits wake it at once
+#define ASYNC_CONNECTIONS_INITIAL_SIZE 16
+
+#define ASYNC_PENDING 0 // Status of a request without its response yet
+#define ASYNC_DONE 1 // Status of a request that got its response
+#define ASYNC_FAILED -1 // Status of a request whose connection was closed or broken before the response
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+/// <summary>
+/// Called on the event-loop thread when a request completes. It may send requests, but must not wait for futures.
+/// </summary>
+/// <param name="context">The context given with the request</param>
+/// <param name="status">ASYNC_DONE or ASYNC_FAILED</param>
+/// <param name="response">The response. NULL if failed. Freed when the callback returns</param>
+typedef void (*ASYNCCALLBACK)(void* context, int status, MESSAGE response);
+
+typedef struct asyncclient ASYNCCLIENT;
+
+typedef struct asyncconnection ASYNCCONNECTION;
+
+typedef struct asyncrequest {
+
+    ASYNCCONNECTION* connection; // The connection the request is sent on
+
+    MESSAGE request; // The request. Freed once it is framed into the send buffer
+
+    ASYNCCALLBACK callback; // Called when the request completes. NULL for a future: wait with WaitAsyncRequest()
+
+    void* context; // Passed to callback
+
+    volatile int status; // ASYNC_PENDING, ASYNC_DONE or ASYNC_FAILED
+
+    MESSAGE response; // The response. NULL until done
+
+    long long submitted; // Time the request was submitted, in QueryPerformanceCounter() ticks
+
+    long long completed; // Time the request completed, in ticks. 0 until then
+
+    volatile LONG references; // The event loop and the waiter of a future each hold one. Freed when both let go
+
+    struct asyncrequest* next; // Next request in the submit queue, then in the in-flight queue of the connection
+
+}ASYNCREQUEST;
+
+struct asyncconnection {
+
+    ASYNCCLIENT* client; // The client the connection belongs to
+
+    CONNECTION* connection; // The connection. Its send buffer collects framed requests until the socket is writable
+
+    ASYNCREQUEST* first; // The oldest request in flight. Responses complete requests from here
+
+    ASYNCREQUEST* last; // The newest request in flight
+
+    int in_flight; // Number of requests in flight
+
+    char* partial; // The message being reassembled from its segments. NULL between messages
+
+    int partial_length; // Size of the message, in bytes
+
+    int partial_filled; // Number of bytes of the message received
+
+    volatile int is_closing; // 1 once CloseAsyncConnection() is called
+
+    int is_closed; // 1 once the socket is closed. Requests sent on it fail at once
+
+    struct asyncconnection* next; // Next connection in the open queue
+
+};
+
+struct asyncclient {
+
+    ASYNCCONNECTION** connections; // The connections of the event loop. Only the event loop touches them
+
+    int connection_count; // Number of connections
+
+    int connection_capacity; // Number of entries of connections
+
+    CRITICAL_SECTION lock; // Guards the queues, is_stopping and the status of futures
+
+    CONDITION_VARIABLE done; // Signaled when a future completes
+
+    ASYNCCONNECTION* opened; // Connections opened and not taken by the event loop yet
+
+    ASYNCREQUEST* submitted_first; // Requests submitted and not taken by the event loop yet, oldest first
+
+    ASYNCREQUEST* submitted_last; // The newest submitted request
+
+    SOCKET wake_sender; // Loopback UDP socket. A byte sent on it wakes the event loop
+
+    SOCKET wake_receiver; // Loopback UDP socket the event loop polls for wake bytes
+
+    int is_wake_pending; // 1 if a wake byte is sent and not drained yet: a burst of submits sends one
+
+    int is_stopping; // 1 once DestroyAsyncClient() is called
+
+    HANDLE thread; // The event-loop thread
+
+    long long requests; // Number of requests submitted
+
+    long long responses; // Number of requests that got their response
+
+    long long failures; // Number of requests that failed
+
+    int peak_in_flight; // Most requests in flight at once, on all connections
+
+    int in_flight; // Number of requests in flight, on all connections. Event loop only
+
+};
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Create a client and Start its event-loop thread. [Call WSInitialize() first]
+/// </summary>
+/// <returns>The client. Free with DestroyAsyncClient(). NULL if have errors</returns>
+ASYNCCLIENT* CreateAsyncClient();
+
+/// <summary>
+/// Stop the event loop, Fail the requests in flight and Close all connections of a client.
+/// Callbacks of the failed requests are called on the calling thread.
+/// </summary>
+/// <param name="client">The client</param>
+void DestroyAsyncClient(ASYNCCLIENT* client);
+
+/// <summary>
+/// Connect to server and Hand the connection over to the event loop. The connect blocks the calling thread.
+/// </summary>
+/// <param name="client">The client</param>
+/// <param name="server">The server address</param>
+/// <returns>The connection. Freed by DestroyAsyncClient(). NULL if have errors</returns>
+ASYNCCONNECTION* OpenAsyncConnection(ASYNCCLIENT* client, ADDRESS server);
+
+/// <summary>
+/// Close a connection. Its requests in flight fail. The connection itself is freed by DestroyAsyncClient().
+/// </summary>
+/// <param name="connection">The connection</param>
+void CloseAsyncConnection(ASYNCCONNECTION* connection);
+
+/// <summary>
+/// Send a request without waiting for its response. Thread-safe, also from callbacks.
+/// </summary>
+/// <param name="connection">The connection the request is sent on</param>
+/// <param name="request">The request, e.g. from CreateMessage(). Copied</param>
+/// <param name="callback">Called when the request completes. NULL to get a future instead</param>
+/// <param name="context">Passed to callback</param>
+/// <returns>The future: wait with WaitAsyncRequest() then Free with DestroyAsyncRequest(). NULL if a callback is given, or if fail to allocate memory [callback is then not called]</returns>
+ASYNCREQUEST* SendAsyncRequest(ASYNCCONNECTION* connection, const char* request, ASYNCCALLBACK callback, void* context);
+
+/// <summary>
+/// Log in without waiting. See SendAsyncRequest().
+/// </summary>
+ASYNCREQUEST* AsyncLogin(ASYNCCONNECTION* connection, const char* account, ASYNCCALLBACK callback = NULL, void* context = NULL);
+
+/// <summary>
+/// Post an article without waiting. See SendAsyncRequest().
+/// </summary>
+ASYNCREQUEST* AsyncPost(ASYNCCONNECTION* connection, const char* article, ASYNCCALLBACK callback = NULL, void* context = NULL);
+
+/// <summary>
+/// Log out without waiting. See SendAsyncRequest().
+/// </summary>
+ASYNCREQUEST* AsyncLogout(ASYNCCONNECTION* connection, ASYNCCALLBACK callback = NULL, void* context = NULL);
+
+/// <summary>
+/// Wait for a future to complete.
+/// </summary>
+/// <param name="request">The future</param>
+/// <param name="timeout">Longest wait, in milliseconds. INFINITE to wait until it completes</param>
+/// <param name="oresponse">[Output] The response, owned by the caller: Free with DestroyMessage(). NULL if not done. [Optional]</param>
+/// <returns>ASYNC_DONE or ASYNC_FAILED. ASYNC_PENDING if timed out</returns>
+int WaitAsyncRequest(ASYNCREQUEST* request, DWORD timeout, MESSAGE* oresponse = NULL);
+
+/// <summary>
+/// Let go of a future. It may still be in flight: the event loop frees it when it completes.
+/// </summary>
+/// <param name="request">The future</param>
+void DestroyAsyncRequest(ASYNCREQUEST* request);
+
+/// <summary>
+/// Run the event loop of a client until it is destroyed: Take submitted requests, Send what sockets take,
+/// and Complete requests with the responses received. [Call on the thread created by CreateAsyncClient()]
+/// </summary>
+/// <param name="arguments">The client. [ASYNCCLIENT*]</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall RunAsyncClient(void* arguments);
+
+/// <summary>
+/// Move the opened connections and the submitted requests of a client to the event loop, and Frame the requests
+/// into the send buffers of their connections. [Event loop only]
+/// </summary>
+/// <param name="client">The client</param>
+void TakeSubmitted(ASYNCCLIENT* client);
+
+/// <summary>
+/// Send as much of the send buffer of a connection as the socket takes now. [Event loop only]
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <returns>1 if success, bytes may be left. -1 if the connection is broken</returns>
+int FlushAsyncConnection(ASYNCCONNECTION* connection);
+
+/// <summary>
+/// Receive what the socket of a connection has now, and Complete a request with each whole response. [Event loop only]
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <returns>1 if success. -1 if the connection is closed, broken or out of step</returns>
+int ReceiveAsyncResponses(ASYNCCONNECTION* connection);
+
+/// <summary>
+/// Check whether a whole segment is in the read-ahead buffer: ReceiveSegment() then returns without blocking.
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <returns>1 if it is. 0 otherwise</returns>
+int IsSegmentBuffered(CONNECTION* connection);
+
+/// <summary>
+/// Complete the oldest request in flight of a connection. [Event loop only]
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <param name="status">ASYNC_DONE or ASYNC_FAILED</param>
+/// <param name="response">The response. Owned by the request. NULL if failed</param>
+void CompleteAsyncRequest(ASYNCCONNECTION* connection, int status, MESSAGE response);
+
+/// <summary>
+/// Hand a completed request to its callback, or to the waiter of its future.
+/// </summary>
+/// <param name="request">The request. Not in flight any more</param>
+/// <param name="status">ASYNC_DONE or ASYNC_FAILED</param>
+/// <param name="response">The response. Owned by the request. NULL if failed</param>
+void FinishAsyncRequest(ASYNCREQUEST* request, int status, MESSAGE response);
+
+/// <summary>
+/// Close the socket of a connection and Fail its requests in flight. [Event loop only]
+/// </summary>
+/// <param name="connection">The connection</param>
+void ShutAsyncConnection(ASYNCCONNECTION* connection);
+
+/// <summary>
+/// Wake the event loop of a client. [Call with client->lock held]
+/// </summary>
+/// <param name="client">The client</param>
+void WakeAsyncClient(ASYNCCLIENT* client);
+
+/// <summary>
+/// Free a request when its last holder lets go.
+/// </summary>
+/// <param name="request">The request</param>
+void ReleaseAsyncRequest(ASYNCREQUEST* request);
+
+/// <summary>
+/// Print the request counts of a client to console.
+/// </summary>
+/// <param name="client">The client</param>
+void PrintAsyncStatistics(ASYNCCLIENT* client);
+
+#pragma endregion
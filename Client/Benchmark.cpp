@@ -0,0 +1,340 @@
+#include "Client.h"
+
+int CompareLatency(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+int RunCycleBenchmark(CONNECTION* connection, const char* account, int cycles, BENCHMARKRESULT* oresult)
+{
+    oresult->cycles = 0;
+    oresult->failures = 0;
+    oresult->elapsed = 0;
+    oresult->latencies = (double*)malloc(sizeof(double) * (cycles > 0 ? cycles : 1));
+    MESSAGE login = CreateMessage(CM_LOGIN, account);
+    MESSAGE post = CreateMessage(CM_POST, BENCH_ARTICLE);
+    MESSAGE logout = CreateMessage(CM_LOGOUT, NULL);
+    if (oresult->latencies == NULL || login == NULL || post == NULL || logout == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        DestroyMessage(login);
+        DestroyMessage(post);
+        DestroyMessage(logout);
+        return 0;
+    }
+
+    LARGE_INTEGER frequency, begin, start, end;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&begin);
+    int status = 1;
+    while (oresult->cycles < cycles) {
+        QueryPerformanceCounter(&start);
+        int ok = 1;
+        status = RunSilently(connection, login, S_LOGIN_SUCC);
+        ok &= (status == 1);
+        if (status != -1) {
+            status = RunSilently(connection, post, S_POST_SUCC);
+            ok &= (status == 1);
+        }
+        if (status != -1) {
+            status = RunSilently(connection, logout, S_LOGOUT_SUCC);
+            ok &= (status == 1);
+        }
+        if (status == -1)
+            break;
+        QueryPerformanceCounter(&end);
+
+        oresult->latencies[oresult->cycles++] = (double)(end.QuadPart - start.QuadPart) * 1000000.0 / frequency.QuadPart;
+        oresult->failures += !ok;
+    }
+    QueryPerformanceCounter(&end);
+    oresult->elapsed = (double)(end.QuadPart - begin.QuadPart) * 1000.0 / frequency.QuadPart;
+    qsort(oresult->latencies, oresult->cycles, sizeof(double), CompareLatency);
+
+    DestroyMessage(login);
+    DestroyMessage(post);
+    DestroyMessage(logout);
+    return status != -1;
+}
+
+int RunConnectStorm(ADDRESS server, int connections, int threads, int hold, BENCHMARKRESULT* oresult)
+{
+    if (threads < 1)
+        threads = 1;
+    if (threads > connections)
+        threads = max(connections, 1);
+    oresult->cycles = 0;
+    oresult->failures = 0;
+    oresult->elapsed = 0;
+    oresult->latencies = (double*)malloc(sizeof(double) * (connections > 0 ? connections : 1));
+    STORMWORKER* workers = (STORMWORKER*)malloc(sizeof(STORMWORKER) * threads);
+    HANDLE* handles = (HANDLE*)malloc(sizeof(HANDLE) * threads);
+    SOCKET* sockets = hold > 0 ? (SOCKET*)malloc(sizeof(SOCKET) * (connections > 0 ? connections : 1)) : NULL;
+    if (oresult->latencies == NULL || workers == NULL || handles == NULL || (hold > 0 && sockets == NULL)) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        free(workers);
+        free(handles);
+        free(sockets);
+        return 0;
+    }
+
+    LARGE_INTEGER frequency, begin, end;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&begin);
+    int assigned = 0;
+    for (int i = 0; i < threads; ++i) {
+        workers[i].server = server;
+        workers[i].connections = connections / threads + (i < connections % threads);
+        workers[i].latencies = oresult->latencies + assigned;
+        workers[i].sockets = sockets == NULL ? NULL : sockets + assigned;
+        workers[i].failures = 0;
+        assigned += workers[i].connections;
+        handles[i] = (HANDLE)_beginthreadex(NULL, 0, RunStormWorker, (void*)&workers[i], 0, 0);
+        if (handles[i] == 0) // run it here instead
+            RunStormWorker((void*)&workers[i]);
+    }
+    for (int i = 0; i < threads; ++i) {
+        if (handles[i] != 0) {
+            WaitForSingleObject(handles[i], INFINITE);
+            CloseHandle(handles[i]);
+        }
+        oresult->cycles += workers[i].connections;
+        oresult->failures += workers[i].failures;
+    }
+    QueryPerformanceCounter(&end);
+    oresult->elapsed = (double)(end.QuadPart - begin.QuadPart) * 1000.0 / frequency.QuadPart;
+    qsort(oresult->latencies, oresult->cycles, sizeof(double), CompareLatency);
+
+    if (sockets != NULL) {
+        printf("[%s] Holding %d connections for %d s...\n", OUTPUT_FLAGS, oresult->cycles - oresult->failures, hold);
+        Sleep(hold * 1000);
+        for (int i = 0; i < oresult->cycles; ++i) {
+            if (sockets[i] != INVALID_SOCKET)
+                CloseSocket(sockets[i], CLOSE_NORMAL);
+        }
+    }
+    free(workers);
+    free(handles);
+    free(sockets);
+    return 1;
+}
+
+unsigned __stdcall RunStormWorker(void* arguments)
+{
+    STORMWORKER* worker = (STORMWORKER*)arguments;
+    LARGE_INTEGER frequency, start, end;
+    QueryPerformanceFrequency(&frequency);
+    for (int i = 0; i < worker->connections; ++i) {
+        QueryPerformanceCounter(&start);
+        SOCKET socket = CreateSocket(TCP);
+        // connect() directly: a refused connection is counted, not printed
+        int ok = socket != INVALID_SOCKET && connect(socket, (SOCKADDR*)&worker->server, sizeof(worker->server)) != SOCKET_ERROR;
+        QueryPerformanceCounter(&end);
+        if (socket != INVALID_SOCKET && (!ok || worker->sockets == NULL)) {
+            CloseSocket(socket, CLOSE_NORMAL);
+            socket = INVALID_SOCKET;
+        }
+        if (worker->sockets != NULL)
+            worker->sockets[i] = socket;
+
+        worker->latencies[i] = (double)(end.QuadPart - start.QuadPart) * 1000000.0 / frequency.QuadPart;
+        worker->failures += !ok;
+    }
+    return 0;
+}
+
+int RunParallelBenchmark(ADDRESS server, int connections, int requests, BENCHMARKRESULT* oresult)
+{
+    if (connections < 1)
+        connections = 1;
+    oresult->cycles = 0;
+    oresult->failures = 0;
+    oresult->elapsed = 0;
+    oresult->latencies = (double*)malloc(sizeof(double) * connections * (requests > 0 ? requests : 1));
+    PARALLELWORKER* workers = (PARALLELWORKER*)malloc(sizeof(PARALLELWORKER) * connections);
+    HANDLE* handles = (HANDLE*)malloc(sizeof(HANDLE) * connections);
+    if (oresult->latencies == NULL || workers == NULL || handles == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        free(workers);
+        free(handles);
+        return 0;
+    }
+
+    LARGE_INTEGER frequency, begin, end;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&begin);
+    for (int i = 0; i < connections; ++i) {
+        workers[i].server = server;
+        workers[i].requests = requests;
+        workers[i].latencies = oresult->latencies + (size_t)i * requests;
+        workers[i].completed = 0;
+        workers[i].failures = 0;
+        handles[i] = (HANDLE)_beginthreadex(NULL, 0, RunParallelWorker, (void*)&workers[i], 0, 0);
+        if (handles[i] == 0) // run it here instead
+            RunParallelWorker((void*)&workers[i]);
+    }
+    int is_ok = 1;
+    for (int i = 0; i < connections; ++i) {
+        if (handles[i] != 0) {
+            WaitForSingleObject(handles[i], INFINITE);
+            CloseHandle(handles[i]);
+        }
+        // a broken connection leaves a gap in its slice: move the measured latencies together
+        memmove(oresult->latencies + oresult->cycles, workers[i].latencies, sizeof(double) * workers[i].completed);
+        oresult->cycles += workers[i].completed;
+        oresult->failures += workers[i].failures;
+        is_ok &= (workers[i].completed == requests);
+    }
+    QueryPerformanceCounter(&end);
+    oresult->elapsed = (double)(end.QuadPart - begin.QuadPart) * 1000.0 / frequency.QuadPart;
+    qsort(oresult->latencies, oresult->cycles, sizeof(double), CompareLatency);
+
+    free(workers);
+    free(handles);
+    return is_ok;
+}
+
+unsigned __stdcall RunParallelWorker(void* arguments)
+{
+    PARALLELWORKER* worker = (PARALLELWORKER*)arguments;
+    SOCKET socket = CreateSocket(TCP);
+    if (socket == INVALID_SOCKET)
+        return 0;
+    CONNECTION* connection = NULL;
+    MESSAGE request = CreateMessage(CM_TOKEN, NULL);
+    if (request != NULL && connect(socket, (SOCKADDR*)&worker->server, sizeof(worker->server)) != SOCKET_ERROR) {
+        SetReceiveTimeout(socket, RECEIVE_TIMEOUT_INTERVAL);
+        connection = CreateConnection(socket);
+    }
+
+    LARGE_INTEGER frequency, start, end;
+    QueryPerformanceFrequency(&frequency);
+    while (connection != NULL && worker->completed < worker->requests) {
+        // not logged in: the server answers at once, without touching storage
+        QueryPerformanceCounter(&start);
+        int status = RunSilently(connection, request, S_NOT_LOGIN);
+        QueryPerformanceCounter(&end);
+        if (status == -1)
+            break;
+
+        worker->latencies[worker->completed++] = (double)(end.QuadPart - start.QuadPart) * 1000000.0 / frequency.QuadPart;
+        worker->failures += (status == 0);
+    }
+    DestroyMessage(request);
+    DestroyConnection(connection);
+    CloseSocket(socket, CLOSE_SAFELY, SD_BOTH);
+    return 0;
+}
+
+int RunAsyncBenchmark(ADDRESS server, int connections, int requests, int depth, BENCHMARKRESULT* oresult)
+{
+    if (connections < 1)
+        connections = 1;
+    if (depth < 1)
+        depth = 1;
+    int total = connections * (requests > 0 ? requests : 0);
+    int window_size = connections * depth;
+    oresult->cycles = 0;
+    oresult->failures = 0;
+    oresult->elapsed = 0;
+    oresult->latencies = (double*)malloc(sizeof(double) * (total > 0 ? total : 1));
+    ASYNCCONNECTION** handles = (ASYNCCONNECTION**)malloc(sizeof(ASYNCCONNECTION*) * connections);
+    ASYNCREQUEST** window = (ASYNCREQUEST**)malloc(sizeof(ASYNCREQUEST*) * window_size);
+    MESSAGE request = CreateMessage(CM_TOKEN, NULL);
+    if (oresult->latencies == NULL || handles == NULL || window == NULL || request == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        free(handles);
+        free(window);
+        DestroyMessage(request);
+        return 0;
+    }
+    ASYNCCLIENT* client = CreateAsyncClient();
+    int is_ok = client != NULL;
+    for (int i = 0; is_ok && i < connections; ++i) {
+        handles[i] = OpenAsyncConnection(client, server);
+        is_ok = handles[i] != NULL;
+    }
+
+    LARGE_INTEGER frequency, begin, end;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&begin);
+    // request k goes to connection k % connections, and waits in slot k % window_size until its response
+    int sent = 0, done = 0;
+    for (; is_ok && sent < total && sent < window_size; ++sent)
+        window[sent] = SendAsyncRequest(handles[sent % connections], request, NULL, NULL);
+    while (done < sent) {
+        ASYNCREQUEST* future = window[done % window_size];
+        MESSAGE response = NULL;
+        int status = future == NULL ? ASYNC_FAILED : WaitAsyncRequest(future, RECEIVE_TIMEOUT_INTERVAL, &response);
+        if (status == ASYNC_PENDING) // the server stopped answering: the rest are failed by DestroyAsyncClient()
+            break;
+        if (status == ASYNC_DONE) {
+            oresult->latencies[oresult->cycles++] = (double)(future->completed - future->submitted) * 1000000.0 / frequency.QuadPart;
+            oresult->failures += (GetResponseStatus(response) != S_NOT_LOGIN);
+        }
+        is_ok &= (status == ASYNC_DONE);
+        DestroyMessage(response);
+        DestroyAsyncRequest(future);
+        ++done;
+        if (is_ok && sent < total) {
+            window[sent % window_size] = SendAsyncRequest(handles[sent % connections], request, NULL, NULL);
+            ++sent;
+        }
+    }
+    QueryPerformanceCounter(&end);
+    oresult->elapsed = (double)(end.QuadPart - begin.QuadPart) * 1000.0 / frequency.QuadPart;
+    qsort(oresult->latencies, oresult->cycles, sizeof(double), CompareLatency);
+
+    if (client != NULL)
+        PrintAsyncStatistics(client);
+    DestroyAsyncClient(client);
+    for (; done < sent; ++done)
+        DestroyAsyncRequest(window[done % window_size]);
+    free(handles);
+    free(window);
+    DestroyMessage(request);
+    return is_ok && oresult->cycles == total;
+}
+
+int RunSilently(CONNECTION* connection, MESSAGE request, int expected_status)
+{
+    MESSAGE response = NULL;
+    int status = SegmentationSend(connection, request, (int)strlen(request) + 1, NULL);
+    if (status == 1)
+        status = SegmentationReceive(connection, &response);
+    if (status == 1)
+        status = (GetResponseStatus(response) == expected_status);
+    else
+        status = -1;
+    DestroyMessage(response);
+    return status;
+}
+
+double GetPercentile(const double* sorted, int count, double percent)
+{
+    if (count <= 0)
+        return 0;
+    int rank = (int)(percent / 100.0 * count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > count)
+        rank = count;
+    return sorted[rank - 1];
+}
+
+void PrintBenchmarkResult(const char* title, const BENCHMARKRESULT* result)
+{
+    int n = result->cycles;
+    double throughput = result->elapsed > 0 ? n * 1000.0 / result->elapsed : 0;
+    printf("[%s] %s: %d cycles (%d failed) in %.1f ms, %.0f cycles/s\n", OUTPUT_FLAGS, title, n, result->failures, result->elapsed, throughput);
+    printf("[%s] %s: latency us p50=%.1f p90=%.1f p99=%.1f max=%.1f\n", OUTPUT_FLAGS, title,
+        GetPercentile(result->latencies, n, 50), GetPercentile(result->latencies, n, 90),
+        GetPercentile(result->latencies, n, 99), GetPercentile(result->latencies, n, 100));
+}
+
+void DestroyBenchmarkResult(BENCHMARKRESULT* result)
+{
+    free(result->latencies);
+    result->latencies = NULL;
+}
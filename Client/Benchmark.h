@@ -0,0 +1,167 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include "CommonHeader.h"
+#include "AsyncClient.h"
+
+#ifdef _WIN32
+#include <process.h>
+#endif
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define BENCH_ARTICLE "Benchmark article"
+#define BENCH_DEFAULT_ACCOUNT "admin"
+#define STORM_DEFAULT_THREADS 8
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef struct benchmarkresult {
+
+    int cycles; // Number of cycles run
+
+    int failures; // Number of cycles that got an unexpected response
+
+    double elapsed; // Wall time of all cycles, in milliseconds
+
+    double* latencies; // Latency of each cycle, in microseconds. Sorted ascending after the run
+
+}BENCHMARKRESULT;
+
+typedef struct stormworker {
+
+    ADDRESS server; // The server address
+
+    int connections; // Number of connections this worker opens
+
+    double* latencies; // [Output] Time of each connect, in microseconds
+
+    SOCKET* sockets; // [Output] The connected sockets, kept open. NULL to close each at once
+
+    int failures; // [Output] Number of connects that failed
+
+}STORMWORKER;
+
+typedef struct parallelworker {
+
+    ADDRESS server; // The server address
+
+    int requests; // Number of requests this worker sends on its connection
+
+    double* latencies; // [Output] Latency of each request, in microseconds
+
+    int completed; // [Output] Number of requests that got a response
+
+    int failures; // [Output] Number of requests that got an unexpected response
+
+}PARALLELWORKER;
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Run [cycles] login/post/logout cycles on a connection and Measure the latency of each cycle.
+/// Stop early if the connection is broken.
+/// </summary>
+/// <param name="connection">The connection to server</param>
+/// <param name="account">The account used to log in</param>
+/// <param name="cycles">Number of cycles want to run</param>
+/// <param name="oresult">[Output] The measurements. Free with DestroyBenchmarkResult()</param>
+/// <returns>1 if all cycles are run. 0 if fail to allocate memory or the connection is broken</returns>
+int RunCycleBenchmark(CONNECTION* connection, const char* account, int cycles, BENCHMARKRESULT* oresult);
+
+/// <summary>
+/// Open and Close [connections] TCP connections as fast as possible from [threads] threads, like clients reconnecting
+/// all at once after a network blip. Each cycle is one connect.
+/// </summary>
+/// <param name="server">The server address</param>
+/// <param name="connections">Number of connections want to open</param>
+/// <param name="threads">Number of threads connecting at the same time</param>
+/// <param name="hold">Keep all connections open and idle this long after the storm, in seconds. 0 to close each at once</param>
+/// <param name="oresult">[Output] The measurements. Free with DestroyBenchmarkResult()</param>
+/// <returns>1 if all connects are tried. 0 if fail to allocate memory</returns>
+int RunConnectStorm(ADDRESS server, int connections, int threads, int hold, BENCHMARKRESULT* oresult);
+
+/// <summary>
+/// Open and Close the connections of one storm worker. [Call on threads created by RunConnectStorm()]
+/// </summary>
+/// <param name="arguments">The worker. [STORMWORKER*]</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall RunStormWorker(void* arguments);
+
+/// <summary>
+/// Send [requests] requests on each of [connections] connections at the same time, each connection on its own thread,
+/// and Measure the latency of each request. The requests need no login, so the connections share no account:
+/// the tail latency shows how the server places and serves concurrent connections.
+/// </summary>
+/// <param name="server">The server address</param>
+/// <param name="connections">Number of connections, and threads</param>
+/// <param name="requests">Number of requests per connection</param>
+/// <param name="oresult">[Output] The measurements. Each request is one cycle. Free with DestroyBenchmarkResult()</param>
+/// <returns>1 if all requests are sent. 0 if fail to allocate memory or a connection is broken</returns>
+int RunParallelBenchmark(ADDRESS server, int connections, int requests, BENCHMARKRESULT* oresult);
+
+/// <summary>
+/// Connect and Send the requests of one parallel worker. [Call on threads created by RunParallelBenchmark()]
+/// </summary>
+/// <param name="arguments">The worker. [PARALLELWORKER*]</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall RunParallelWorker(void* arguments);
+
+/// <summary>
+/// Send [requests] requests on each of [connections] connections from one event-loop thread, keeping [depth] requests
+/// in flight on each connection, and Measure the latency of each request from its submit to its response.
+/// The requests need no login, like the parallel request benchmark.
+/// </summary>
+/// <param name="server">The server address</param>
+/// <param name="connections">Number of connections</param>
+/// <param name="requests">Number of requests per connection</param>
+/// <param name="depth">Number of requests in flight per connection</param>
+/// <param name="oresult">[Output] The measurements. Each request is one cycle. Free with DestroyBenchmarkResult()</param>
+/// <returns>1 if all requests got a response. 0 if fail to allocate memory or a connection is broken</returns>
+int RunAsyncBenchmark(ADDRESS server, int connections, int requests, int depth, BENCHMARKRESULT* oresult);
+
+/// <summary>
+/// Send a request and Receive its response without printing it.
+/// </summary>
+/// <param name="connection">The connection to server</param>
+/// <param name="request">The request want to send</param>
+/// <param name="expected_status">The status code of a successful response</param>
+/// <returns>1 if the response has [expected_status]. 0 if it has another status. -1 if have errors while sending or receiving</returns>
+int RunSilently(CONNECTION* connection, MESSAGE request, int expected_status);
+
+/// <summary>
+/// Get a percentile from sorted samples [nearest-rank].
+/// </summary>
+/// <param name="sorted">The samples, sorted ascending</param>
+/// <param name="count">Number of samples</param>
+/// <param name="percent">The percentile want to get, from 0 to 100</param>
+/// <returns>The sample at the percentile. 0 if have no samples</returns>
+double GetPercentile(const double* sorted, int count, double percent);
+
+/// <summary>
+/// Compare two latencies [double]. Used with qsort()
+/// </summary>
+/// <returns>Negative if a is smaller, positive if a is larger, 0 if equal</returns>
+int CompareLatency(const void* a, const void* b);
+
+/// <summary>
+/// Print throughput and latency percentiles of a benchmark to console.
+/// </summary>
+/// <param name="title">Name of the benchmark</param>
+/// <param name="result">The measurements</param>
+void PrintBenchmarkResult(const char* title, const BENCHMARKRESULT* result);
+
+/// <summary>
+/// Free memory used for the measurements of a benchmark.
+/// </summary>
+/// <param name="result">The measurements</param>
+void DestroyBenchmarkResult(BENCHMARKRESULT* result);
+
+#pragma endregion
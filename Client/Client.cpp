@@ -5,8 +5,16 @@ int main(int argc, char* argv[])
     int server_port;
     IP server_ip;
     int is_ok = 1;
+    CLIENTOPTIONS options = { 0, NULL, NULL, 0, BENCH_DEFAULT_ACCOUNT, 0, STORM_DEFAULT_THREADS, 0, 0, NULL, 0, POOL_DEFAULT_ATTEMPTS, RTT_DEFAULT_FLOOR, RTT_DEFAULT_CEILING };
+    ExtractOptions(argc, argv, &options);
     // Handle command line
-    if (ExtractCommand(argc, argv, &server_port, &server_ip) == 0) {
+    int is_extracted = ExtractCommand(argc, argv, &server_port, &server_ip);
+    if (is_extracted == 0 && options.script != NULL) {
+        // nobody to ask: the script may be stdin itself
+        printf("[%s] %s\n", WARNING_FLAGS, _CONVERT_ARGUMENTS_FAIL);
+        is_ok = 0;
+    }
+    else if (is_extracted == 0) {
         printf("[%s] %s\n", WARNING_FLAGS, _CONVERT_ARGUMENTS_FAIL);
         printf("[%s] Do you want to use default address? (y/n): ", USER_INPUT_FLAGS);
         char c;
@@ -20,17 +28,36 @@ int main(int argc, char* argv[])
         scanf_s("%c", &c, 1); // consume '\n'
     }
 
-    if (is_ok && WSInitialize()) {
-        SOCKET socket = CreateSocket(TCP);
-        if (socket != INVALID_SOCKET) {
-            SetReceiveTimeout(socket, RECEIVE_TIMEOUT_INTERVAL);
+    if (is_ok && options.script != NULL && WSInitialize()) {
+        // scripts are run by other programs: the exit code tells them whether every request got a response
+        is_ok = RunScriptFile(&options, CreateSocketAddress(server_ip, server_port));
+        WSCleanup();
+    }
+    else if (is_ok && (options.bench_cycles > 0 || options.storm_connections > 0) && WSInitialize()) {
+        RunBenchmarks(&options, CreateSocketAddress(server_ip, server_port));
+        WSCleanup();
+    }
+    else if (is_ok && WSInitialize()) {
+        // a shared memory session needs no socket
+        SOCKET socket = options.shm_name != NULL ? INVALID_SOCKET : CreateSocket(options.unix_path == NULL ? TCP : LOCAL);
+        CONNECTION* connection = NULL;
+        ROUNDTRIP round_trip;
+        InitializeRoundTrip(&round_trip, options.min_timeout, options.max_timeout);
+        if (socket != INVALID_SOCKET || options.shm_name != NULL) {
+            connection = CreateConnection(socket);
 
             ADDRESS server = CreateSocketAddress(server_ip, server_port);
+            DATAGRAMSESSION datagram_session = { INVALID_SOCKET, server, 0, 0 };
 
             int try_establish = 0;
             do {
-                if (EstablishConnection(socket, server)) {
+                if (connection != NULL && EstablishConnection(connection, &options, server)) {
                     try_establish = 0;
+                    if (options.compress) {
+                        // sets the first timeout. No sample: a refusal and a broken connection look the same here
+                        StartRoundTrip(&round_trip, connection);
+                        NegotiateCompression(connection);
+                    }
                     printf("[%s] Ready to communicate...\n", INFO_FLAGS);
                     PrintMenu();
                     MESSAGE request;
@@ -39,7 +66,18 @@ int main(int argc, char* argv[])
                         status = HandleInput(&request);
                         if (status == -1)
                             break;
-                        status = Run(socket, request);
+                        if (status == INPUT_FAST_POST) {
+                            status = SendFastPost(connection, &datagram_session, request);
+                        }
+                        else {
+                            // the token belongs to the logged in account
+                            if (request != NULL && (strncmp(request, CM_LOGIN, strlen(CM_LOGIN)) == 0 || strncmp(request, CM_LOGOUT, strlen(CM_LOGOUT)) == 0))
+                                datagram_session.token = 0;
+                            long long start = StartRoundTrip(&round_trip, connection);
+                            status = Run(connection, request);
+                            if (EndRoundTrip(&round_trip, start, status))
+                                printf("[%s] No response in %d ms.\n", WARNING_FLAGS, round_trip.applied);
+                        }
                         DestroyMessage(request);
                     }
                 }
@@ -53,284 +91,262 @@ int main(int argc, char* argv[])
                     scanf_s("%c", &c, 1); // consume '\n'
                 }
             } while (try_establish);
+            CloseSocket(datagram_session.socket, CLOSE_NORMAL);
+            PrintRoundTrip("Round trip", &round_trip);
 
         }
+        if (connection != NULL)
+            CloseSharedChannel(connection->channel);
+        DestroyConnection(connection);
         CloseSocket(socket, CLOSE_SAFELY, SD_BOTH);
         WSCleanup();
     }
     printf("[%s] Stopping...\n", INFO_FLAGS);
-    return 0;
+    return is_ok ? 0 : 1;
 }
 
-#pragma region Socket Common
+#pragma region Handle Response
 
-int WSInitialize()
+int RunBenchmarks(const CLIENTOPTIONS* options, ADDRESS server)
 {
-    WORD version = MAKEWORD(2, 2);
-    WSADATA wsa_data;
-    if (WSAStartup(version, &wsa_data)) {
-        printf("[%s] %s\n", ERROR_FLAGS, _INITIALIZE_FAIL);
-        WSACleanup();
-        return 0;
+    int is_ok = 1;
+    if (options->storm_connections > 0) {
+        BENCHMARKRESULT result;
+        is_ok = RunConnectStorm(server, options->storm_connections, options->threads, options->hold, &result);
+        if (is_ok)
+            PrintBenchmarkResult("Connect storm", &result);
+        DestroyBenchmarkResult(&result);
+    }
+    if (options->bench_cycles <= 0)
+        return is_ok;
+    if (options->parallel > 0 && options->pipeline > 0) {
+        BENCHMARKRESULT result;
+        is_ok &= RunAsyncBenchmark(server, options->parallel, options->bench_cycles, options->pipeline, &result);
+        PrintBenchmarkResult("Pipelined requests", &result);
+        DestroyBenchmarkResult(&result);
+        return is_ok;
+    }
+    if (options->parallel > 0) {
+        BENCHMARKRESULT result;
+        is_ok &= RunParallelBenchmark(server, options->parallel, options->bench_cycles, &result);
+        PrintBenchmarkResult("Parallel requests", &result);
+        DestroyBenchmarkResult(&result);
+        return is_ok;
+    }
+
+    // each transport on its own connection, one at a time
+    CLIENTOPTIONS transport = *options;
+    transport.unix_path = NULL;
+    transport.shm_name = NULL;
+    is_ok &= RunBenchmark("TCP", &transport, server);
+    if (options->unix_path != NULL) {
+        transport.unix_path = options->unix_path;
+        is_ok &= RunBenchmark("Unix", &transport, server);
+        transport.unix_path = NULL;
+    }
+    if (options->shm_name != NULL) {
+        transport.shm_name = options->shm_name;
+        is_ok &= RunBenchmark("Shared memory", &transport, server);
     }
-    return 1;
-}
-
-int WSCleanup()
-{
-    return WSACleanup();
-}
-
-ADDRESS CreateSocketAddress(IP ip, int port)
-{
-    ADDRESS addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr = ip;
-    return addr;
+    return is_ok;
 }
 
-SOCKET CreateSocket(int protocol)
+int RunBenchmark(const char* title, const CLIENTOPTIONS* options, ADDRESS server)
 {
-    SOCKET s = INVALID_SOCKET;
-    if (protocol == UDP) {
-        s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    }
-    else if (protocol == TCP) {
-        s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    }
-
-    if (s == INVALID_SOCKET) {
-        printf("[%s] %s\n", ERROR_FLAGS, _CREATE_SOCKET_FAIL);
-    }
-    return s;
+    SOCKET socket = INVALID_SOCKET;
+    if (options->shm_name == NULL) {
+        socket = CreateSocket(options->unix_path == NULL ? TCP : LOCAL);
+        if (socket == INVALID_SOCKET)
+            return 0;
+        SetReceiveTimeout(socket, RECEIVE_TIMEOUT_INTERVAL);
+    }
+    CONNECTION* connection = CreateConnection(socket);
+    int is_ok = 0;
+    if (connection != NULL && EstablishConnection(connection, options, server)) {
+        if (options->compress)
+            NegotiateCompression(connection);
+        BENCHMARKRESULT result;
+        is_ok = RunCycleBenchmark(connection, options->bench_account, options->bench_cycles, &result);
+        PrintBenchmarkResult(title, &result);
+        DestroyBenchmarkResult(&result);
+    }
+    if (connection != NULL)
+        CloseSharedChannel(connection->channel);
+    DestroyConnection(connection);
+    CloseSocket(socket, CLOSE_SAFELY, SD_BOTH);
+    return is_ok;
 }
 
-int CloseSocket(SOCKET socket, int mode, int flags)
+int RunScriptFile(const CLIENTOPTIONS* options, ADDRESS server)
 {
-    if (socket == INVALID_SOCKET)
-        return 1;
-    int is_ok = 1;
-    if (mode == CLOSE_SAFELY) {
-        if (shutdown(socket, flags) == SOCKET_ERROR) {
-            is_ok = 0;
-            printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _SHUTDOWN_SOCKET_FAIL);
-        }
-    }
-    if (closesocket(socket) == SOCKET_ERROR) {
-        is_ok = 0;
-        printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _CLOSE_SOCKET_FAIL);
+    FILE* script = stdin;
+    if (strcmp(options->script, SCRIPT_STDIN) != 0 && fopen_s(&script, options->script, "r") != 0) {
+        printf("[%s] Fail to open the script '%s'.\n", ERROR_FLAGS, options->script);
+        return 0;
     }
+    // nobody to ask whether to connect again: the pool does, with a backoff
+    CONNECTIONPOOL* pool = CreateConnectionPool(server, options->unix_path, options->shm_name, options->compress, 1, options->reconnect,
+        options->min_timeout, options->max_timeout);
+    int is_ok = 0;
+    if (pool != NULL) {
+        POOLEDCONNECTION* pooled = AcquirePooledConnection(pool);
+        is_ok = RunScript(pooled, script);
+        ReleasePooledConnection(pooled);
+        PrintPoolStatistics(pool);
+    }
+    DestroyConnectionPool(pool);
+    if (script != stdin)
+        fclose(script);
     return is_ok;
 }
 
-int EstablishConnection(SOCKET socket, ADDRESS address)
+int RunScript(POOLEDCONNECTION* pooled, FILE* script)
 {
-    int ret = connect(socket, (SOCKADDR*)&address, sizeof(address));
-    if (ret == SOCKET_ERROR) {
-        int err = WSAGetLastError();
-        if (err == WSAECONNREFUSED) {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _CONNECTION_REFUSED);
-        }
-        else if (err == WSAEHOSTUNREACH) {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _HOST_UNREACHABLE);
-        }
-        else if (err == WSAETIMEDOUT) {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _ESTABLISH_CONNECTION_TIMEOUT);
-        }
-        else if (err == WSAEISCONN) {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _HAS_CONNECTED);
-        }
-        else {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _ESTABLISH_CONNECTION_FAIL);
-        }
+    char* line = (char*)malloc(SCRIPT_LINE_MAX_SIZE);
+    if (line == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
         return 0;
     }
-    return 1;
+    LARGE_INTEGER frequency, begin, start, end;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&begin);
+    int sequence = 0;
+    int failures = 0;
+    int status = 1;
+    printf("%cseq\tstatus\tlatency_us\tresponse\n", SCRIPT_COMMENT);
+    while (status == 1 && fgets(line, SCRIPT_LINE_MAX_SIZE, script) != NULL) {
+        int length = (int)strcspn(line, "\r\n");
+        if (line[length] == '\0' && !feof(script)) {
+            printf("[%s] Script line %d is too long. Line skipped.\n", WARNING_FLAGS, sequence + 1);
+            // drop the rest of the line
+            while (fgets(line, SCRIPT_LINE_MAX_SIZE, script) != NULL && line[strcspn(line, "\r\n")] == '\0')
+                continue;
+            continue;
+        }
+        line[length] = '\0';
+        if (length == 0 || line[0] == SCRIPT_COMMENT)
+            continue;
+
+        ++sequence;
+        MESSAGE response = NULL;
+        QueryPerformanceCounter(&start);
+        status = RunPooledRequest(pooled, line, &response);
+        QueryPerformanceCounter(&end);
+
+        int response_status = status == 1 ? GetResponseStatus(response) : -1;
+        // success codes of every command end in 0
+        failures += (response_status < 0 || response_status % 10 != 0);
+        PrintScriptResult(sequence, response_status, (double)(end.QuadPart - start.QuadPart) * 1000000.0 / frequency.QuadPart, response);
+        DestroyMessage(response);
+    }
+    QueryPerformanceCounter(&end);
+    printf("%crequests=%d failed=%d elapsed_ms=%.3f\n", SCRIPT_COMMENT, sequence, failures,
+        (double)(end.QuadPart - begin.QuadPart) * 1000.0 / frequency.QuadPart);
+    free(line);
+    return status == 1;
 }
-#pragma endregion
 
-#pragma region Send and Receive
-
-int Send(SOCKET sender, int bytes, const char* byte_stream)
+void PrintScriptResult(int sequence, int status, double latency, const MESSAGE response)
 {
-    int ret = send(sender, byte_stream, bytes, 0);
-    if (ret == SOCKET_ERROR) {
-        int err = WSAGetLastError();
-        if (err == WSAEHOSTUNREACH) {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _HOST_UNREACHABLE);
-        }
-        else if (err == WSAECONNABORTED || err == WSAECONNRESET) {
-            printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
-        }
-        else {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _SEND_FAIL);
-        }
-        return -1;
-    }
-    else if (ret < bytes) {
-        printf("[%s] %s\n", WARNING_FLAGS, _SEND_NOT_ALL);
-        return 0;
+    printf("%d\t%d\t%.1f\t", sequence, status, latency);
+    if (response != NULL && status != -1) {
+        // tabs and line breaks in the text would break the line apart
+        for (const char* c = response + STATUS_LENGTH; *c != '\0'; ++c)
+            putchar((*c == '\t' || *c == '\r' || *c == '\n') ? ' ' : *c);
     }
-    return 1;
+    putchar('\n');
 }
 
-int SegmentationSend(SOCKET sender, const char* message, int message_len, int* obyte_sent)
+int Run(CONNECTION* connection, MESSAGE message)
 {
-    int start_byte = 0; // start byte in message.
-    unsigned short bsend = 0; // number of bytes will send, not include header size.
-    unsigned short bremain = 0; // number of bytes remain.
-
-    char content[APPLICATION_BUFF_MAX_SIZE];
-    while (start_byte < message_len) {
-        // Prepare content for sending: header (number of bytes send | number of bytes remain) + body (a part of message)
-        bsend = message_len - start_byte;
-        if (bsend + SEGMENT_HEADER_SIZE > APPLICATION_BUFF_MAX_SIZE) {
-            bsend = APPLICATION_BUFF_MAX_SIZE - SEGMENT_HEADER_SIZE;
-        }
-        bremain = message_len - start_byte - bsend;
-
-        int bsend_bigendian = htons(bsend); // uniform with many architectures.
-        int bremain_bigendian = htons(bremain);
-
-        memcpy_s(content, SEGMENT_HEADER_CURRENT_SIZE, &bsend_bigendian, SEGMENT_HEADER_CURRENT_SIZE);
-        memcpy_s(content + SEGMENT_HEADER_CURRENT_SIZE, SEGMENT_HEADER_REMAIN_SIZE, &bremain_bigendian, SEGMENT_HEADER_REMAIN_SIZE);
-        memcpy_s(content + SEGMENT_HEADER_SIZE, bsend, message + start_byte, bsend);
-        // Send
-        int ret = Send(sender, bsend + SEGMENT_HEADER_SIZE, content);
-        if (ret == 1) {
-            start_byte += bsend;
-        }
-        else {
-            if (obyte_sent != NULL)
-                *obyte_sent = start_byte;
-            return ret;
+    int status = 0;
+    if (message != NULL) {
+        status = SegmentationSend(connection, message, (int)strlen(message) + 1, NULL);
+        if (status == 1) {
+            status = HandleResponse(connection);
         }
     }
-    if (obyte_sent != NULL)
-        *obyte_sent = start_byte;
-    return 1;
+    return status;
 }
 
-int Receive(SOCKET receiver, int length, char** obyte_stream)
+int NegotiateCompression(CONNECTION* connection)
 {
-    if (length > APPLICATION_BUFF_MAX_SIZE)
-    {
-        printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
-        length = APPLICATION_BUFF_MAX_SIZE;
+    MESSAGE request = CreateMessage(CM_COMPRESS, COMPRESSION_ALGORITHM);
+    MESSAGE response = NULL;
+    int status = 0;
+    if (request != NULL && SegmentationSend(connection, request, (int)strlen(request) + 1, NULL) == 1
+        && SegmentationReceive(connection, &response) == 1) {
+        PrintResponse(response, NULL);
+        // compression starts after the handshake response, on both sides
+        if (GetResponseStatus(response) == S_COMPRESS_SUCC)
+            status = EnableCompression(connection);
     }
-    char buffer[APPLICATION_BUFF_MAX_SIZE];
+    DestroyMessage(request);
+    DestroyMessage(response);
+    return status;
+}
 
-    int ret = recv(receiver, buffer, length, 0);
-    if (ret == SOCKET_ERROR) {
-        int err = WSAGetLastError();
-        if (err == WSAECONNABORTED || err == WSAECONNRESET) {
-            printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
+int RequestToken(CONNECTION* connection, unsigned long long* otoken)
+{
+    MESSAGE request = CreateMessage(CM_TOKEN, NULL);
+    MESSAGE response = NULL;
+    int status = 0;
+    if (request != NULL) {
+        status = SegmentationSend(connection, request, (int)strlen(request) + 1, NULL);
+        if (status == 1)
+            status = SegmentationReceive(connection, &response);
+    }
+    if (status == 1) {
+        char* end;
+        if (GetResponseStatus(response) == S_TOKEN_SUCC) {
+            *otoken = _strtoui64(response + STATUS_LENGTH, &end, 16);
+            status = (*otoken != 0);
         }
         else {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _RECEIVE_FAIL);
+            PrintResponse(response, NULL);
+            status = 0;
         }
-        return -1;
-    }
-    else if (ret == 0) {
-        return -1;
-    }
-    else if (ret < length) {
-        printf("[%s] %s\n", WARNING_FLAGS, _RECEIVE_UNEXPECTED_MESSAGE);
-        *obyte_stream = NULL;
-        return 0;
-    }
-    else {
-        *obyte_stream = Clone(buffer, length);
     }
-    return 1;
+    DestroyMessage(request);
+    DestroyMessage(response);
+    return status;
 }
 
-int ReceiveSegment(SOCKET receiver, char** obyte_stream, int* ostream_len, int* oremain)
+int SendFastPost(CONNECTION* connection, DATAGRAMSESSION* session, MESSAGE request)
 {
-    *obyte_stream = NULL;
-    char* read;
-    int remain;
-    int current;
-    // read number of bytes remain | number of bytes current
-    int ret = Receive(receiver, SEGMENT_HEADER_SIZE, &read);
-    if (ret == 1) {
-        current = ntohs(*(unsigned short*)read);
-        remain = ntohs(*(unsigned short*)(read + SEGMENT_HEADER_CURRENT_SIZE));
-
-        *ostream_len = current;
-        *oremain = remain;
-        free(read);
+    if (request == NULL)
+        return 0;
+    if (session->token == 0) {
+        int status = RequestToken(connection, &session->token);
+        if (status != 1)
+            return status;
+        session->sequence = 0;
     }
-    else {
-        *ostream_len = 0;
-        *oremain = 0;
-        return ret;
+    if (session->socket == INVALID_SOCKET) {
+        session->socket = CreateSocket(UDP);
+        if (session->socket == INVALID_SOCKET)
+            return 0;
     }
 
-    // read message content
-    ret = Receive(receiver, current, &read);
-    if (ret == 1) {
-        *obyte_stream = Clone(read, current);
-        free(read);
+    char datagram[UDP_DATAGRAM_MAX_SIZE + 1];
+    int length = snprintf(datagram, sizeof(datagram), "%016llx %llu %s", session->token, session->sequence + 1, request);
+    if (length < 0 || length > UDP_DATAGRAM_MAX_SIZE) {
+        printf("[%s] The article is too large for a fast post.\n", WARNING_FLAGS);
+        return 0;
     }
-    else {
-        *ostream_len = 0;
-        *oremain = 0;
-        return ret;
+    if (sendto(session->socket, datagram, length, 0, (SOCKADDR*)&session->server, sizeof(session->server)) == SOCKET_ERROR) {
+        printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _SEND_FAIL);
+        return 0;
     }
+    ++session->sequence;
+    printf("[%s] Fast post #%llu sent.\n", OUTPUT_FLAGS, session->sequence);
     return 1;
 }
 
-int SegmentationReceive(SOCKET socket, char** omessage)
-{
-    char* _message;
-    int mlen, remain, start_byte = 0;
-    int status = 1;
-    *omessage = NULL;
-    while (1) {
-        status = ReceiveSegment(socket, &_message, &mlen, &remain);
-        if (status != 1) {
-            free(_message);
-            return status;
-        }
-        if (*omessage == NULL) {
-            *omessage = (char*)malloc((size_t)mlen + remain);
-            if (*omessage == NULL) {
-                printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
-                free(_message);
-                return 0;
-            }
-        }
-        memcpy_s(*omessage + start_byte, mlen, _message, mlen);
-        start_byte += mlen;
-        free(_message);
-        if (remain <= 0)
-            break;
-    }
-    return status;
-}
-
-#pragma endregion
-
-#pragma region Handle Response
-
-int Run(SOCKET socket, MESSAGE message)
-{
-    int status = 0;
-    if (message != NULL) {
-        status = SegmentationSend(socket, message, (int)strlen(message) + 1, NULL);
-        if (status == 1) {
-            status = HandleResponse(socket);
-        }
-    }
-    return status;
-}
-
-int HandleResponse(SOCKET socket)
+int HandleResponse(CONNECTION* connection)
 {
     MESSAGE response = NULL;
-    int status = SegmentationReceive(socket, &response);
+    int status = SegmentationReceive(connection, &response);
     if(status == 1){
         PrintResponse(response, NULL);
     }
@@ -342,12 +358,9 @@ void PrintResponse(const MESSAGE message, const char* title)
 {
     if(title != NULL)
         printf("%s\n", title);
-    if (message != NULL) {
-        int len = (int)strlen(message);
-        if (len >= STATUS_LENGTH) {
-            int status_code = (message[0] - '0') * 10 + (message[1] - '0');
-            printf("[%d]\t%s\n", status_code, message + STATUS_LENGTH);
-        }
+    int status_code = GetResponseStatus(message);
+    if (status_code != -1) {
+        printf("[%d]\t%s\n", status_code, message + STATUS_LENGTH);
     }
 }
 
@@ -362,6 +375,7 @@ void PrintMenu()
     printf("\t#     2. Post status               #\n");
     printf("\t#     3. Log out                   #\n");
     printf("\t#     4. Custom request            #\n");
+    printf("\t#     5. Fast post (UDP)           #\n");
     printf("\t# Other. Exit program              #\n");
     printf("\t####################################\n");
 }
@@ -403,6 +417,13 @@ int HandleInput(MESSAGE* omessage)
         gets_s(request, USER_INPUT_MAX_SIZE);
         *omessage = Clone(request, (int)strlen(request) + 1);
     }
+    else if (c == '5') {
+        printf("[%s] [Fast post] Enter your article: ", USER_INPUT_FLAGS);
+        scanf_s("%c", &c, 1); //consume \n
+        gets_s(request, USER_INPUT_MAX_SIZE);
+        *omessage = CreateMessage(CM_POST, request);
+        status = INPUT_FAST_POST;
+    }
     else {
         status = -1;
     }
@@ -425,57 +446,59 @@ int ExtractCommand(int argc, char* argv[], int* oport, IP* oip)
     return is_ok;
 }
 
-int SetReceiveTimeout(SOCKET socket, int interval)
-{
-    int _interval = interval;
-    int ret = setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&_interval, sizeof(_interval));
-    if (ret == SOCKET_ERROR) {
-        printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _SET_TIMEOUT_FAIL);
-        return 0;
-    }
-    return 1;
-}
-
-int TryParseIPString(const char* str, IP* oip)
-{
-    return inet_pton(AF_INET, str, oip) == 1;
-}
-
-char* Clone(const char* source, int length, int start)
+void ExtractOptions(int argc, char* argv[], CLIENTOPTIONS* ooptions)
 {
-    char* _clone = (char*)malloc((size_t)length + start);
-
-    if (_clone == NULL)
-        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
-    else
-        memcpy_s(_clone + start, length, source, length);
-    return _clone;
-}
-
-MESSAGE CreateMessage(const char* command, const char* arguments)
-{
-    if (command == NULL)
-        return NULL;
-    int command_len = (int)strlen(command) + 1;
-    if (command_len == 1)
-        return NULL;
-    MESSAGE m;
-    if (arguments == NULL) {
-        m = Clone("", 1, command_len);
-    }
-    else {
-        m = Clone(arguments, (int)strlen(arguments) + 1, command_len);
-    }
-    if (m != NULL) {
-        memcpy_s(m, command_len, command, command_len);
-        m[command_len - 1] = ' ';
+    // options follow the port number: a flag, or name=value
+    for (int i = 3; i < argc; ++i) {
+        char* equal_pos = strchr(argv[i], '=');
+        int name_len = equal_pos == NULL ? (int)strlen(argv[i]) : (int)(equal_pos - argv[i]);
+        const char* value = equal_pos == NULL ? "" : equal_pos + 1;
+        if (equal_pos == NULL && strcmp(argv[i], OPT_COMPRESS) == 0) {
+            ooptions->compress = 1;
+        }
+        else if (name_len == (int)strlen(OPT_UNIX) && strncmp(argv[i], OPT_UNIX, name_len) == 0 && strlen(value) < LOCAL_PATH_MAX_SIZE) {
+            ooptions->unix_path = value;
+        }
+        else if (name_len == (int)strlen(OPT_SHM) && strncmp(argv[i], OPT_SHM, name_len) == 0 && strlen(value) > 0) {
+            ooptions->shm_name = value;
+        }
+        else if (name_len == (int)strlen(OPT_BENCH) && strncmp(argv[i], OPT_BENCH, name_len) == 0) {
+            ooptions->bench_cycles = atoi(value);
+        }
+        else if (name_len == (int)strlen(OPT_ACCOUNT) && strncmp(argv[i], OPT_ACCOUNT, name_len) == 0 && strlen(value) > 0) {
+            ooptions->bench_account = value;
+        }
+        else if (name_len == (int)strlen(OPT_STORM) && strncmp(argv[i], OPT_STORM, name_len) == 0) {
+            ooptions->storm_connections = atoi(value);
+        }
+        else if (name_len == (int)strlen(OPT_THREADS) && strncmp(argv[i], OPT_THREADS, name_len) == 0) {
+            ooptions->threads = atoi(value);
+        }
+        else if (name_len == (int)strlen(OPT_HOLD) && strncmp(argv[i], OPT_HOLD, name_len) == 0) {
+            ooptions->hold = atoi(value);
+        }
+        else if (name_len == (int)strlen(OPT_PARALLEL) && strncmp(argv[i], OPT_PARALLEL, name_len) == 0) {
+            ooptions->parallel = atoi(value);
+        }
+        else if (name_len == (int)strlen(OPT_PIPELINE) && strncmp(argv[i], OPT_PIPELINE, name_len) == 0) {
+            ooptions->pipeline = atoi(value);
+        }
+        else if (name_len == (int)strlen(OPT_RECONNECT) && strncmp(argv[i], OPT_RECONNECT, name_len) == 0) {
+            ooptions->reconnect = atoi(value);
+        }
+        else if (name_len == (int)strlen(OPT_MIN_TIMEOUT) && strncmp(argv[i], OPT_MIN_TIMEOUT, name_len) == 0) {
+            ooptions->min_timeout = atoi(value);
+        }
+        else if (name_len == (int)strlen(OPT_MAX_TIMEOUT) && strncmp(argv[i], OPT_MAX_TIMEOUT, name_len) == 0) {
+            ooptions->max_timeout = atoi(value);
+        }
+        else if (name_len == (int)strlen(OPT_SCRIPT) && strncmp(argv[i], OPT_SCRIPT, name_len) == 0 && strlen(value) > 0) {
+            ooptions->script = value;
+        }
+        else {
+            printf("[%s] Unknown option ignored: '%s'\n", WARNING_FLAGS, argv[i]);
+        }
     }
-    return m;
-}
-
-void DestroyMessage(MESSAGE m)
-{
-    free(m);
 }
 #pragma endregion
 
@@ -3,12 +3,91 @@
 #pragma region Header Declarations
 
 #include "CommonHeader.h"
+#include "Benchmark.h"
+#include "ConnectionPool.h"
 
 #pragma endregion
 
 #pragma region Constants Definitions
 
 #define OUTPUT_FLAGS "**"
+
+#define OPT_COMPRESS "compress"
+#define OPT_UNIX "unix"
+#define OPT_SHM "shm"
+#define OPT_BENCH "bench"
+#define OPT_ACCOUNT "account"
+#define OPT_STORM "storm"
+#define OPT_THREADS "threads"
+#define OPT_HOLD "hold"
+#define OPT_PARALLEL "parallel"
+#define OPT_PIPELINE "pipeline"
+#define OPT_RECONNECT "reconnect"
+#define OPT_MIN_TIMEOUT "mintimeout"
+#define OPT_MAX_TIMEOUT "maxtimeout"
+#define OPT_SCRIPT "script"
+
+#define SCRIPT_STDIN "-" // Script path that reads the script from stdin
+#define SCRIPT_COMMENT '#' // Lines starting with it are skipped. Result lines starting with it are not request results
+#define SCRIPT_LINE_MAX_SIZE 65536 // Longest script line, with its line break
+
+#define S_LOGIN_SUCC 10
+#define S_LOGGEDIN 14
+#define S_POST_SUCC 20
+#define S_NOT_LOGIN 21
+#define S_LOGOUT_SUCC 30
+#define S_COMPRESS_SUCC 40
+#define S_TOKEN_SUCC 50
+
+#define INPUT_FAST_POST 2
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef struct clientoptions {
+
+    int compress; // 1 if compression is negotiated after the connection established. Option: compress
+
+    const char* unix_path; // Connect to the Unix domain socket at this path instead of TCP. NULL if not used. Option: unix=<path>
+
+    const char* shm_name; // Connect to the shared memory listener of this name instead of TCP. NULL if not used. Option: shm=<name>
+
+    int bench_cycles; // Run this many login/post/logout cycles instead of the menu. 0 if not used. Option: bench=<cycles>
+
+    const char* bench_account; // The account used by benchmark cycles. Option: account=<name>
+
+    int storm_connections; // Open and close this many connections at once instead of the menu. 0 if not used. Option: storm=<connections>
+
+    int threads; // Number of threads opening connections in the storm. Option: threads=<count>
+
+    int hold; // Keep the storm connections open and idle this long, in seconds. 0 to close each at once. Option: hold=<seconds>
+
+    int parallel; // Send the bench requests from this many connections at once, each on its own thread, instead of the cycles. 0 if not used. Option: parallel=<connections>
+
+    const char* script; // Send the requests of this command script back to back instead of the menu. SCRIPT_STDIN for stdin. NULL if not used. Option: script=<path>
+
+    int pipeline; // Keep this many requests in flight on each parallel connection, all on one event-loop thread. 0 if not used. Option: pipeline=<depth>
+
+    int reconnect; // Connects tried by a script for a request before it stops, with a backoff between them. Option: reconnect=<attempts>
+
+    int min_timeout; // Shortest receive timeout, in milliseconds. Timeouts follow the measured round-trip time. Option: mintimeout=<ms>
+
+    int max_timeout; // Longest receive timeout, in milliseconds. Option: maxtimeout=<ms>
+
+}CLIENTOPTIONS;
+
+typedef struct datagramsession {
+
+    SOCKET socket; // UDP socket used for fast posts. INVALID_SOCKET until the first fast post
+
+    ADDRESS server; // The server address. Same port number as the TCP connection
+
+    unsigned long long token; // Session token issued by server. 0 if not requested yet
+
+    unsigned long long sequence; // Sequence number of the last fast post
+
+}DATAGRAMSESSION;
+
 #pragma endregion
 
 #pragma region Function Declarations
@@ -21,20 +100,136 @@
 /// <returns>1 if success. 0 otherwise, has errors</returns>
 int EstablishConnection(SOCKET socket, ADDRESS address);
 
+/// <summary>
+/// Establish a connection to a Unix domain socket on the same host
+/// </summary>
+/// <param name="socket">The socket want to connect. Created by CreateSocket(LOCAL)</param>
+/// <param name="address">The Unix domain socket address of the server</param>
+/// <returns>1 if success. 0 otherwise, has errors</returns>
+int EstablishConnection(SOCKET socket, LOCAL_ADDRESS address);
+
+/// <summary>
+/// Establish a connection over the transport chosen by options: shared memory, Unix domain socket or TCP
+/// </summary>
+/// <param name="connection">The connection object. Its socket must match the transport [INVALID_SOCKET for shared memory]</param>
+/// <param name="options">The client options. shm_name and unix_path are used</param>
+/// <param name="server">The TCP address of server</param>
+/// <returns>1 if success. 0 otherwise, has errors</returns>
+int EstablishConnection(CONNECTION* connection, const CLIENTOPTIONS* options, ADDRESS server);
+
+/// <summary>
+/// Establish a shared memory session with a server on the same host. Requests and responses then go through
+/// the rings of the session instead of a socket, with the same message framing.
+/// </summary>
+/// <param name="connection">The connection object. Close the channel with CloseSharedChannel(connection->channel)</param>
+/// <param name="name">The shared memory listener name of server [Server option shm=name]</param>
+/// <returns>1 if success. 0 otherwise, has errors</returns>
+int EstablishSharedConnection(CONNECTION* connection, const char* name);
+
+/// <summary>
+/// Establish a connection to an address of any family, Print the reason if fail
+/// </summary>
+/// <param name="socket">The socket want to connect</param>
+/// <param name="address">The socket address of a remote process want to connect to</param>
+/// <param name="address_len">Size of the socket address, in bytes</param>
+/// <returns>1 if success. 0 otherwise, has errors</returns>
+int EstablishConnection(SOCKET socket, const SOCKADDR* address, int address_len);
+
+/// <summary>
+/// Run the connect storm if [options] has it. Then Run the login/post/logout benchmark over loopback TCP,
+/// and also over the Unix domain socket and shared memory if [options] has them.
+/// With parallel connections, Run the parallel request benchmark over TCP instead of the cycles, pipelined if [options] has it.
+/// </summary>
+/// <param name="options">The client options. storm_connections, threads, hold, bench_cycles, bench_account, parallel and pipeline are used</param>
+/// <param name="server">The TCP address of server</param>
+/// <returns>1 if all benchmarks are completed. 0 otherwise</returns>
+int RunBenchmarks(const CLIENTOPTIONS* options, ADDRESS server);
+
+/// <summary>
+/// Run the login/post/logout benchmark on a new connection.
+/// </summary>
+/// <param name="title">Name of the benchmark, printed with its result</param>
+/// <param name="options">The client options. The transport is chosen as EstablishConnection() does</param>
+/// <param name="server">The TCP address of server</param>
+/// <returns>1 if the benchmark is completed. 0 otherwise</returns>
+int RunBenchmark(const char* title, const CLIENTOPTIONS* options, ADDRESS server);
+
+/// <summary>
+/// Open a command script, Connect over the transport chosen by options and Run the script. No question is asked:
+/// a refused or broken connection is connected again with a backoff, and fails after [reconnect] attempts.
+/// </summary>
+/// <param name="options">The client options. script, compress, reconnect, the timeouts and the transport are used</param>
+/// <param name="server">The TCP address of server</param>
+/// <returns>1 if every request got a response. 0 otherwise</returns>
+int RunScriptFile(const CLIENTOPTIONS* options, ADDRESS server);
+
+/// <summary>
+/// Send each request of a command script and Wait for its response before the next one.
+/// Each line is one request, sent as written [USER name, POST article, BYE or any raw request]. Empty lines and SCRIPT_COMMENT lines are skipped.
+/// Print one tab-separated result line per request: sequence, status code, latency in microseconds and response text.
+/// Then Print a SCRIPT_COMMENT summary line. Stop at the first request that gets no response, after the reconnects.
+/// </summary>
+/// <param name="pooled">The pooled connection to server. The account logged in by the script is logged in again after a reconnect</param>
+/// <param name="script">The script</param>
+/// <returns>1 if every request got a response. 0 otherwise</returns>
+int RunScript(POOLEDCONNECTION* pooled, FILE* script);
+
+/// <summary>
+/// Print the result line of a script request, on one line whatever the response holds.
+/// </summary>
+/// <param name="sequence">Number of the request in the script, from 1</param>
+/// <param name="status">Status code of the response. -1 if it got no response</param>
+/// <param name="latency">Time from sending the request to receiving the whole response, in microseconds</param>
+/// <param name="response">The response. NULL if it got no response</param>
+void PrintScriptResult(int sequence, int status, double latency, const MESSAGE response);
+
 /// <summary>
 /// Send request to server and Handle response
 /// </summary>
-/// <param name="socket">The connected socket to server</param>
+/// <param name="connection">The connection to server</param>
 /// <param name="request">The request want to send</param>
 /// <returns>1 if success. 0 if have some errors while sending or receiving. -1 if have errors that the socket should be closed</returns>
-int Run(SOCKET socket, MESSAGE request);
+int Run(CONNECTION* connection, MESSAGE request);
+
+/// <summary>
+/// Negotiate compression with server [Send CM_COMPRESS request] and Enable it on the connection if server accepts.
+/// Must be the first request on the connection.
+/// </summary>
+/// <param name="connection">The connection to server</param>
+/// <returns>1 if compression is enabled. 0 otherwise</returns>
+int NegotiateCompression(CONNECTION* connection);
+
+/// <summary>
+/// Request a session token for fast posts [Send CM_TOKEN request]. The account must be logged in.
+/// </summary>
+/// <param name="connection">The connection to server</param>
+/// <param name="otoken">[Output] The session token</param>
+/// <returns>1 if success. 0 if server refuses. -1 if have errors that the socket should be closed</returns>
+int RequestToken(CONNECTION* connection, unsigned long long* otoken);
+
+/// <summary>
+/// Send a post as a single datagram. Request a session token first if the session has none.
+/// Server does not reply to datagrams: a lost or rejected post is not reported.
+/// </summary>
+/// <param name="connection">The connection to server, used to request the session token</param>
+/// <param name="session">The datagram session</param>
+/// <param name="request">The post request [CM_POST message]</param>
+/// <returns>1 if the datagram is sent. 0 if have some errors. -1 if have errors that the TCP socket should be closed</returns>
+int SendFastPost(CONNECTION* connection, DATAGRAMSESSION* session, MESSAGE request);
+
+/// <summary>
+/// Extract the status code from a response Message object.
+/// </summary>
+/// <param name="message">The response Message object</param>
+/// <returns>The status code. -1 if the message has no status</returns>
+int GetResponseStatus(const MESSAGE message);
 
 /// <summary>
 /// Handle the response from remote process: Collect message segmentations, Merge them and Print to console
 /// </summary>
-/// <param name="socket">The connected socket used to communicate with remote process</param>
+/// <param name="connection">The connection used to communicate with remote process</param>
 /// <returns>1 if success. 0 if cant read response fully. -1 if have errors that the socket should be closed</returns>
-int HandleResponse(SOCKET socket);
+int HandleResponse(CONNECTION* connection);
 
 /// <summary>
 /// Extract infomation in Message object and Print the message to console.
@@ -52,7 +247,7 @@ void PrintMenu();
 /// Get user command and create a Message from the result.
 /// </summary>
 /// <param name="omessage">[Output] The created message</param>
-/// <returns>1 if success. 0 if some user input is invalid. -1 if user choose a unsupported function</returns>
+/// <returns>1 if success. INPUT_FAST_POST if the message should be sent as a fast post. 0 if some user input is invalid. -1 if user choose a unsupported function</returns>
 int HandleInput(MESSAGE* omessage);
 
 /// <summary>
@@ -66,6 +261,14 @@ int HandleInput(MESSAGE* omessage);
 /// <returns>1 if extract successfully. 0 otherwise, has error</returns>
 int ExtractCommand(int argc, char* argv[], int* oport, IP* oip);
 
+/// <summary>
+/// Extract options following the ipv4 string and port number. Unknown options are ignored with a warning.
+/// </summary>
+/// <param name="argc">Number of Arguments [From main()]</param>
+/// <param name="argv">Arguments value [From main()]</param>
+/// <param name="ooptions">[Output] The extracted options. Options not given keep their values</param>
+void ExtractOptions(int argc, char* argv[], CLIENTOPTIONS* ooptions);
+
 /// <summary>
 /// Try parse a string to a IPv4 Address
 /// </summary>
@@ -0,0 +1,225 @@
+#include "Compression.h"
+
+#pragma region Helpers
+
+/// <summary>
+/// Make room for [bytes] bytes after the committed bytes. Keep at least COMPRESSION_WINDOW_SIZE bytes of history.
+/// </summary>
+static void ReserveHistory(COMPRESSOR* c, int bytes)
+{
+	if (c->length + bytes <= 2 * COMPRESSION_WINDOW_SIZE)
+		return;
+	int shift = c->length - COMPRESSION_WINDOW_SIZE;
+	memmove(c->window, c->window + shift, COMPRESSION_WINDOW_SIZE);
+	c->length = COMPRESSION_WINDOW_SIZE;
+	if (c->table != NULL) {
+		for (int i = 0; i < (1 << COMPRESSION_HASH_BITS); ++i)
+			c->table[i] = c->table[i] >= shift ? c->table[i] - shift : -1;
+	}
+}
+
+static unsigned int Read32(const char* p)
+{
+	unsigned int v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static int Hash(const char* p)
+{
+	return (int)((Read32(p) * 2654435761u) >> (32 - COMPRESSION_HASH_BITS));
+}
+
+/// <summary>
+/// Write the extended part of a length (length - 15, in 255 steps) of a sequence.
+/// </summary>
+static int WriteLength(char* op, int length)
+{
+	int n = 0;
+	for (length -= 15; length >= 255; length -= 255)
+		op[n++] = (char)255;
+	op[n++] = (char)length;
+	return n;
+}
+
+static int LengthSize(int length)
+{
+	return length < 15 ? 0 : (length - 15) / 255 + 1;
+}
+
+#pragma endregion
+
+#pragma region Compress and Decompress
+
+COMPRESSOR* CreateCompressor(int is_sender)
+{
+	COMPRESSOR* c = (COMPRESSOR*)malloc(sizeof(COMPRESSOR));
+	if (c == NULL)
+		return NULL;
+	c->window = (char*)malloc(2 * COMPRESSION_WINDOW_SIZE);
+	c->table = NULL;
+	if (c->window == NULL) {
+		DestroyCompressor(c);
+		return NULL;
+	}
+	if (is_sender) {
+		c->table = (int*)malloc(sizeof(int) << COMPRESSION_HASH_BITS);
+		if (c->table == NULL) {
+			DestroyCompressor(c);
+			return NULL;
+		}
+		for (int i = 0; i < (1 << COMPRESSION_HASH_BITS); ++i)
+			c->table[i] = -1;
+	}
+
+	c->length = 0;
+	AppendHistory(c, COMPRESSION_DICTIONARY, (int)strlen(COMPRESSION_DICTIONARY));
+	return c;
+}
+
+void DestroyCompressor(COMPRESSOR* c)
+{
+	if (c == NULL)
+		return;
+	free(c->window);
+	free(c->table);
+	free(c);
+}
+
+void CommitHistory(COMPRESSOR* c, int bytes)
+{
+	c->length += bytes;
+}
+
+void AppendHistory(COMPRESSOR* c, const char* source, int length)
+{
+	ReserveHistory(c, length);
+	memcpy(c->window + c->length, source, length);
+	// index the new bytes, so later blocks can refer to them
+	if (c->table != NULL) {
+		for (int pos = c->length > 3 ? c->length - 3 : 0; pos + COMPRESSION_MIN_MATCH <= c->length + length; ++pos)
+			c->table[Hash(c->window + pos)] = pos;
+	}
+	c->length += length;
+}
+
+int CompressBlock(COMPRESSOR* c, const char* source, int length, char* odestination, int capacity, int* oconsumed)
+{
+	ReserveHistory(c, length);
+	char* base = c->window;
+	int start = c->length;
+	int end = start + length;
+	memcpy(base + start, source, length);
+
+	int pos = start, anchor = start, op = 0;
+	while (pos + COMPRESSION_MIN_MATCH <= end) {
+		int h = Hash(base + pos);
+		int candidate = c->table[h];
+		c->table[h] = pos;
+		if (candidate < 0 || candidate >= pos || pos - candidate > COMPRESSION_WINDOW_SIZE || pos - candidate > 0xFFFF
+			|| Read32(base + candidate) != Read32(base + pos)) {
+			++pos;
+			continue;
+		}
+		int match = COMPRESSION_MIN_MATCH;
+		while (pos + match < end && base[candidate + match] == base[pos + match])
+			++match;
+
+		int literals = pos - anchor;
+		int need = 1 + LengthSize(literals) + literals + 2 + LengthSize(match - COMPRESSION_MIN_MATCH);
+		if (op + need > capacity)
+			break;
+
+		// token: literal length (high 4 bits) | match length - COMPRESSION_MIN_MATCH (low 4 bits)
+		int ml = match - COMPRESSION_MIN_MATCH;
+		odestination[op++] = (char)(((literals < 15 ? literals : 15) << 4) | (ml < 15 ? ml : 15));
+		if (literals >= 15)
+			op += WriteLength(odestination + op, literals);
+		memcpy(odestination + op, base + anchor, literals);
+		op += literals;
+		int offset = pos - candidate;
+		odestination[op++] = (char)(offset & 0xFF);
+		odestination[op++] = (char)(offset >> 8);
+		if (ml >= 15)
+			op += WriteLength(odestination + op, ml);
+
+		pos += match;
+		anchor = pos;
+	}
+
+	// last sequence: literals only, as many as fit. Skipped if no room left for the token
+	int literals = 0;
+	int available = capacity - op - 1;
+	if (available >= 0) {
+		literals = end - anchor;
+		if (literals + LengthSize(literals) > available)
+			literals = available - LengthSize(available);
+		while (literals > 0 && literals + LengthSize(literals) > available)
+			--literals;
+		odestination[op++] = (char)((literals < 15 ? literals : 15) << 4);
+		if (literals >= 15)
+			op += WriteLength(odestination + op, literals);
+		memcpy(odestination + op, base + anchor, literals);
+		op += literals;
+	}
+	*oconsumed = anchor + literals - start;
+	return op;
+}
+
+int DecompressBlock(COMPRESSOR* c, const char* source, int length, char* odestination, int raw_length)
+{
+	ReserveHistory(c, raw_length);
+	char* base = c->window;
+	int start = c->length;
+	int end = start + raw_length;
+	int op = start, ip = 0;
+	while (ip < length) {
+		int token = (unsigned char)source[ip++];
+		// literals
+		int literals = token >> 4;
+		if (literals == 15) {
+			int b;
+			do {
+				if (ip >= length)
+					return 0;
+				b = (unsigned char)source[ip++];
+				literals += b;
+			} while (b == 255);
+		}
+		if (ip + literals > length || op + literals > end)
+			return 0;
+		memcpy(base + op, source + ip, literals);
+		ip += literals;
+		op += literals;
+		if (ip >= length)
+			break; // last sequence
+
+		// match
+		if (ip + 2 > length)
+			return 0;
+		int offset = (unsigned char)source[ip] | ((unsigned char)source[ip + 1] << 8);
+		ip += 2;
+		int match = token & 15;
+		if (match == 15) {
+			int b;
+			do {
+				if (ip >= length)
+					return 0;
+				b = (unsigned char)source[ip++];
+				match += b;
+			} while (b == 255);
+		}
+		match += COMPRESSION_MIN_MATCH;
+		if (offset <= 0 || offset > op || op + match > end)
+			return 0;
+		for (int i = 0; i < match; ++i, ++op) // byte by byte: the match may overlap itself
+			base[op] = base[op - offset];
+	}
+	if (op != end)
+		return 0;
+	memcpy(odestination, base + start, raw_length);
+	c->length = end;
+	return 1;
+}
+
+#pragma endregion
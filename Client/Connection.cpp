@@ -0,0 +1,534 @@
+#include "Client.h"
+
+#pragma region Socket Common
+
+int WSInitialize()
+{
+    WORD version = MAKEWORD(2, 2);
+    WSADATA wsa_data;
+    if (WSAStartup(version, &wsa_data)) {
+        printf("[%s] %s\n", ERROR_FLAGS, _INITIALIZE_FAIL);
+        WSACleanup();
+        return 0;
+    }
+    return 1;
+}
+
+int WSCleanup()
+{
+    return WSACleanup();
+}
+
+ADDRESS CreateSocketAddress(IP ip, int port)
+{
+    ADDRESS addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr = ip;
+    return addr;
+}
+
+LOCAL_ADDRESS CreateLocalSocketAddress(const char* path)
+{
+    LOCAL_ADDRESS addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy_s(addr.sun_path, LOCAL_PATH_MAX_SIZE, path, _TRUNCATE);
+    return addr;
+}
+
+SOCKET CreateSocket(int protocol)
+{
+    SOCKET s = INVALID_SOCKET;
+    if (protocol == UDP) {
+        s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    }
+    else if (protocol == TCP) {
+        s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    }
+    else if (protocol == LOCAL) {
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+    }
+
+    if (s == INVALID_SOCKET) {
+        printf("[%s] %s\n", ERROR_FLAGS, _CREATE_SOCKET_FAIL);
+    }
+    return s;
+}
+
+int CloseSocket(SOCKET socket, int mode, int flags)
+{
+    if (socket == INVALID_SOCKET)
+        return 1;
+    int is_ok = 1;
+    if (mode == CLOSE_SAFELY) {
+        if (shutdown(socket, flags) == SOCKET_ERROR) {
+            is_ok = 0;
+            printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _SHUTDOWN_SOCKET_FAIL);
+        }
+    }
+    if (closesocket(socket) == SOCKET_ERROR) {
+        is_ok = 0;
+        printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _CLOSE_SOCKET_FAIL);
+    }
+    return is_ok;
+}
+
+int EstablishConnection(SOCKET socket, ADDRESS address)
+{
+    return EstablishConnection(socket, (SOCKADDR*)&address, sizeof(address));
+}
+
+int EstablishConnection(SOCKET socket, LOCAL_ADDRESS address)
+{
+    return EstablishConnection(socket, (SOCKADDR*)&address, sizeof(address));
+}
+
+int EstablishConnection(CONNECTION* connection, const CLIENTOPTIONS* options, ADDRESS server)
+{
+    if (options->shm_name != NULL)
+        return EstablishSharedConnection(connection, options->shm_name);
+    if (options->unix_path != NULL)
+        return EstablishConnection(connection->socket, CreateLocalSocketAddress(options->unix_path));
+    return EstablishConnection(connection->socket, server);
+}
+
+int EstablishSharedConnection(CONNECTION* connection, const char* name)
+{
+    SHMCHANNEL* channel = ConnectSharedChannel(name, RECEIVE_TIMEOUT_INTERVAL);
+    if (channel == NULL) {
+        printf("[%s:%lu] %s\n", WARNING_FLAGS, GetLastError(), _CONNECTION_REFUSED);
+        return 0;
+    }
+    CloseSharedChannel(connection->channel);
+    connection->channel = channel;
+    return 1;
+}
+
+int EstablishConnection(SOCKET socket, const SOCKADDR* address, int address_len)
+{
+    int ret = connect(socket, address, address_len);
+    if (ret == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+        if (err == WSAECONNREFUSED) {
+            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _CONNECTION_REFUSED);
+        }
+        else if (err == WSAEHOSTUNREACH) {
+            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _HOST_UNREACHABLE);
+        }
+        else if (err == WSAETIMEDOUT) {
+            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _ESTABLISH_CONNECTION_TIMEOUT);
+        }
+        else if (err == WSAEISCONN) {
+            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _HAS_CONNECTED);
+        }
+        else {
+            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _ESTABLISH_CONNECTION_FAIL);
+        }
+        return 0;
+    }
+    return 1;
+}
+
+int SetReceiveTimeout(SOCKET socket, int interval)
+{
+#ifdef _WIN32
+    int _interval = interval;
+#else
+    struct timeval _interval = { interval / 1000, (interval % 1000) * 1000 };
+#endif
+    int ret = setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&_interval, sizeof(_interval));
+    if (ret == SOCKET_ERROR) {
+        printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _SET_TIMEOUT_FAIL);
+        return 0;
+    }
+    return 1;
+}
+
+int TryParseIPString(const char* str, IP* oip)
+{
+    return inet_pton(AF_INET, str, oip) == 1;
+}
+#pragma endregion
+
+#pragma region Send and Receive
+
+CONNECTION* CreateConnection(SOCKET socket, int buffer_size)
+{
+    if (buffer_size < APPLICATION_BUFF_MAX_SIZE)
+        buffer_size = APPLICATION_BUFF_MAX_SIZE;
+
+    CONNECTION* connection = (CONNECTION*)malloc(sizeof(CONNECTION));
+    if (connection == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        return NULL;
+    }
+    connection->buffer = (char*)malloc(buffer_size);
+    if (connection->buffer == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        free(connection);
+        return NULL;
+    }
+    connection->socket = socket;
+    connection->channel = NULL;
+    connection->send_buffer = NULL;
+    connection->send_length = 0;
+    connection->send_capacity = 0;
+    connection->session = NULL;
+    connection->capacity = buffer_size;
+    connection->head = 0;
+    connection->length = 0;
+    connection->recv_calls = 0;
+    connection->send_calls = 0;
+    connection->messages = 0;
+    connection->send_history = NULL;
+    connection->receive_history = NULL;
+    connection->compress_threshold = COMPRESSION_MIN_SIZE;
+    return connection;
+}
+
+void DestroyConnection(CONNECTION* connection)
+{
+    if (connection == NULL)
+        return;
+    DestroyCompressor(connection->send_history);
+    DestroyCompressor(connection->receive_history);
+    free(connection->send_buffer);
+    free(connection->buffer);
+    free(connection);
+}
+
+int EnableCompression(CONNECTION* connection, int threshold)
+{
+    if (connection->send_history == NULL)
+        connection->send_history = CreateCompressor(1);
+    if (connection->receive_history == NULL)
+        connection->receive_history = CreateCompressor(0);
+    if (connection->send_history == NULL || connection->receive_history == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        return 0;
+    }
+    connection->compress_threshold = threshold;
+    return 1;
+}
+
+int Send(CONNECTION* sender, int bytes, const char* byte_stream)
+{
+    if (sender->send_buffer != NULL)
+        return AppendSendBuffer(sender, bytes, byte_stream);
+    int ret = sender->channel != NULL ? SharedSend(sender->channel, byte_stream, bytes) : send(sender->socket, byte_stream, bytes, 0);
+    sender->send_calls++;
+    if (ret == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+        if (err == WSAEHOSTUNREACH) {
+            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _HOST_UNREACHABLE);
+        }
+        else if (err == WSAECONNABORTED || err == WSAECONNRESET) {
+            printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
+        }
+        else {
+            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _SEND_FAIL);
+        }
+        return -1;
+    }
+    else if (ret < bytes) {
+        printf("[%s] %s\n", WARNING_FLAGS, _SEND_NOT_ALL);
+        return 0;
+    }
+    return 1;
+}
+
+int SegmentationSend(CONNECTION* sender, const char* message, int message_len, int* obyte_sent)
+{
+    int start_byte = 0; // start byte in message.
+    unsigned short bsend = 0; // number of bytes will send, not include header size.
+    unsigned short bremain = 0; // number of bytes remain.
+    unsigned short bcurrent = 0; // number of bytes of the piece on the wire, with SEGMENT_COMPRESSED_FLAG if compressed.
+    int compress = (sender->send_history != NULL && message_len >= sender->compress_threshold);
+
+    char content[APPLICATION_BUFF_MAX_SIZE];
+    while (start_byte < message_len) {
+        // Prepare content for sending: header (number of bytes send | number of bytes remain) + body (a part of message)
+        bsend = message_len - start_byte;
+        if (bsend + SEGMENT_HEADER_SIZE > APPLICATION_BUFF_MAX_SIZE) {
+            bsend = APPLICATION_BUFF_MAX_SIZE - SEGMENT_HEADER_SIZE;
+        }
+        bcurrent = bsend;
+        if (compress) {
+            // compressed body: raw length | compressed block. Keep the raw piece if compression does not help
+            int chunk = message_len - start_byte;
+            if (chunk > COMPRESSION_CHUNK_SIZE)
+                chunk = COMPRESSION_CHUNK_SIZE;
+            int consumed;
+            int clen = CompressBlock(sender->send_history, message + start_byte, chunk,
+                content + SEGMENT_HEADER_SIZE + SEGMENT_RAW_LENGTH_SIZE,
+                APPLICATION_BUFF_MAX_SIZE - SEGMENT_HEADER_SIZE - SEGMENT_RAW_LENGTH_SIZE, &consumed);
+            if (consumed > clen + SEGMENT_RAW_LENGTH_SIZE) {
+                bsend = consumed;
+                bcurrent = (clen + SEGMENT_RAW_LENGTH_SIZE) | SEGMENT_COMPRESSED_FLAG;
+                unsigned short consumed_bigendian = htons(consumed);
+                memcpy_s(content + SEGMENT_HEADER_SIZE, SEGMENT_RAW_LENGTH_SIZE, &consumed_bigendian, SEGMENT_RAW_LENGTH_SIZE);
+            }
+            CommitHistory(sender->send_history, bsend);
+        }
+        else if (sender->send_history != NULL) {
+            AppendHistory(sender->send_history, message + start_byte, bsend);
+        }
+        bremain = message_len - start_byte - bsend;
+
+        int bcurrent_bigendian = htons(bcurrent); // uniform with many architectures.
+        int bremain_bigendian = htons(bremain);
+
+        memcpy_s(content, SEGMENT_HEADER_CURRENT_SIZE, &bcurrent_bigendian, SEGMENT_HEADER_CURRENT_SIZE);
+        memcpy_s(content + SEGMENT_HEADER_CURRENT_SIZE, SEGMENT_HEADER_REMAIN_SIZE, &bremain_bigendian, SEGMENT_HEADER_REMAIN_SIZE);
+        if (bcurrent == bsend) {
+            memcpy_s(content + SEGMENT_HEADER_SIZE, bsend, message + start_byte, bsend);
+        }
+        // Send
+        int ret = Send(sender, (bcurrent & ~SEGMENT_COMPRESSED_FLAG) + SEGMENT_HEADER_SIZE, content);
+        if (ret == 1) {
+            start_byte += bsend;
+        }
+        else {
+            if (obyte_sent != NULL)
+                *obyte_sent = start_byte;
+            return ret;
+        }
+    }
+    if (obyte_sent != NULL)
+        *obyte_sent = start_byte;
+    return 1;
+}
+
+int AppendSendBuffer(CONNECTION* sender, int bytes, const char* byte_stream)
+{
+    if (sender->send_length + bytes > sender->send_capacity) {
+        int capacity = max(sender->send_capacity * 2, sender->send_length + bytes);
+        char* buffer = (char*)realloc(sender->send_buffer, capacity);
+        if (buffer == NULL) {
+            printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+            return -1;
+        }
+        sender->send_buffer = buffer;
+        sender->send_capacity = capacity;
+    }
+    memcpy_s(sender->send_buffer + sender->send_length, sender->send_capacity - sender->send_length, byte_stream, bytes);
+    sender->send_length += bytes;
+    return 1;
+}
+int FillReceiveBuffer(CONNECTION* receiver, int bytes)
+{
+    while (receiver->length < bytes) {
+        // read into the free space right after the last unread byte, until the end of ring or the first unread byte
+        int tail = (receiver->head + receiver->length) % receiver->capacity;
+        int space = receiver->capacity - receiver->length;
+        if (tail + space > receiver->capacity)
+            space = receiver->capacity - tail;
+
+        int ret = receiver->channel != NULL ? SharedReceive(receiver->channel, receiver->buffer + tail, space) : recv(receiver->socket, receiver->buffer + tail, space, 0);
+        receiver->recv_calls++;
+        if (ret == SOCKET_ERROR) {
+            int err = WSAGetLastError();
+            if (err == WSAECONNABORTED || err == WSAECONNRESET) {
+                printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
+            }
+            else {
+                printf("[%s:%d] %s\n", WARNING_FLAGS, err, _RECEIVE_FAIL);
+            }
+            return -1;
+        }
+        else if (ret == 0) {
+            return -1;
+        }
+        receiver->length += ret;
+    }
+    return 1;
+}
+
+void ReadReceiveBuffer(CONNECTION* receiver, int bytes, char* odestination)
+{
+    // the unread bytes may wrap around the end of ring
+    int first = receiver->capacity - receiver->head;
+    if (first > bytes)
+        first = bytes;
+    memcpy_s(odestination, bytes, receiver->buffer + receiver->head, first);
+    memcpy_s(odestination + first, bytes - first, receiver->buffer, bytes - first);
+
+    receiver->head = (receiver->head + bytes) % receiver->capacity;
+    receiver->length -= bytes;
+}
+
+int Receive(CONNECTION* receiver, int length, char** obyte_stream)
+{
+    *obyte_stream = NULL;
+    if (length > receiver->capacity)
+    {
+        printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
+        length = receiver->capacity;
+    }
+
+    int ret = FillReceiveBuffer(receiver, length);
+    if (ret != 1) {
+        return ret;
+    }
+
+    *obyte_stream = (char*)malloc(length);
+    if (*obyte_stream == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        // drop the bytes to keep the stream at segment boundary
+        receiver->head = (receiver->head + length) % receiver->capacity;
+        receiver->length -= length;
+        return 0;
+    }
+    ReadReceiveBuffer(receiver, length, *obyte_stream);
+    return 1;
+}
+
+int ReceiveSegment(CONNECTION* receiver, char** obyte_stream, int* ostream_len, int* oremain)
+{
+    *obyte_stream = NULL;
+    *ostream_len = 0;
+    *oremain = 0;
+    char header[SEGMENT_HEADER_SIZE];
+    // read number of bytes remain | number of bytes current
+    int ret = FillReceiveBuffer(receiver, SEGMENT_HEADER_SIZE);
+    if (ret != 1) {
+        return ret;
+    }
+    ReadReceiveBuffer(receiver, SEGMENT_HEADER_SIZE, header);
+    int current = ntohs(*(unsigned short*)header);
+    int remain = ntohs(*(unsigned short*)(header + SEGMENT_HEADER_CURRENT_SIZE));
+    int is_compressed = (current & SEGMENT_COMPRESSED_FLAG) != 0;
+    current &= ~SEGMENT_COMPRESSED_FLAG;
+    if (current <= 0 || current + SEGMENT_HEADER_SIZE > APPLICATION_BUFF_MAX_SIZE
+        || (is_compressed && (receiver->receive_history == NULL || current <= SEGMENT_RAW_LENGTH_SIZE))) {
+        printf("[%s] %s\n", WARNING_FLAGS, _RECEIVE_UNEXPECTED_MESSAGE);
+        return -1; // lost segment boundary
+    }
+
+    // read message content
+    ret = Receive(receiver, current, obyte_stream);
+    if (ret != 1) {
+        // a dropped piece breaks the compression history
+        return receiver->receive_history != NULL ? -1 : ret;
+    }
+
+    if (is_compressed) {
+        int raw_length = ntohs(*(unsigned short*)*obyte_stream);
+        char* raw = NULL;
+        if (raw_length > 0 && raw_length <= COMPRESSION_CHUNK_SIZE)
+            raw = (char*)malloc(raw_length);
+        if (raw == NULL || !DecompressBlock(receiver->receive_history, *obyte_stream + SEGMENT_RAW_LENGTH_SIZE,
+            current - SEGMENT_RAW_LENGTH_SIZE, raw, raw_length)) {
+            printf("[%s] %s\n", WARNING_FLAGS, _RECEIVE_UNEXPECTED_MESSAGE);
+            free(raw);
+            free(*obyte_stream);
+            *obyte_stream = NULL;
+            return -1;
+        }
+        free(*obyte_stream);
+        *obyte_stream = raw;
+        current = raw_length;
+    }
+    else if (receiver->receive_history != NULL) {
+        AppendHistory(receiver->receive_history, *obyte_stream, current);
+    }
+    *ostream_len = current;
+    *oremain = remain;
+    return 1;
+}
+
+int MergeSegments(CONNECTION* connection, char* segment, int mlen, int remain, char** omessage)
+{
+    int total = mlen + remain, start_byte = 0;
+    int status = 1;
+    *omessage = (char*)malloc((size_t)total);
+    if (*omessage == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        free(segment);
+        return 0;
+    }
+    while (1) {
+        if (start_byte + mlen > total) { // the segment does not belong to this message
+            printf("[%s] %s\n", WARNING_FLAGS, _RECEIVE_UNEXPECTED_MESSAGE);
+            free(segment);
+            return -1;
+        }
+        memcpy_s(*omessage + start_byte, mlen, segment, mlen);
+        start_byte += mlen;
+        free(segment);
+        if (remain <= 0)
+            break;
+        status = ReceiveSegment(connection, &segment, &mlen, &remain);
+        if (status != 1) {
+            free(segment);
+            return status;
+        }
+    }
+    return status;
+}
+
+int SegmentationReceive(CONNECTION* connection, char** omessage)
+{
+    char* _message;
+    int mlen, remain;
+    *omessage = NULL;
+    int status = ReceiveSegment(connection, &_message, &mlen, &remain);
+    if (status != 1) {
+        free(_message);
+        return status;
+    }
+    status = MergeSegments(connection, _message, mlen, remain, omessage);
+    if (status == 1)
+        connection->messages++;
+    return status;
+}
+
+#pragma endregion
+
+#pragma region Messages
+
+int GetResponseStatus(const MESSAGE message)
+{
+    if (message == NULL || (int)strlen(message) < STATUS_LENGTH)
+        return -1;
+    return (message[0] - '0') * 10 + (message[1] - '0');
+}
+
+char* Clone(const char* source, int length, int start)
+{
+    char* _clone = (char*)malloc((size_t)length + start);
+
+    if (_clone == NULL)
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+    else
+        memcpy_s(_clone + start, length, source, length);
+    return _clone;
+}
+
+MESSAGE CreateMessage(const char* command, const char* arguments)
+{
+    if (command == NULL)
+        return NULL;
+    int command_len = (int)strlen(command) + 1;
+    if (command_len == 1)
+        return NULL;
+    MESSAGE m;
+    if (arguments == NULL) {
+        m = Clone("", 1, command_len);
+    }
+    else {
+        m = Clone(arguments, (int)strlen(arguments) + 1, command_len);
+    }
+    if (m != NULL) {
+        memcpy_s(m, command_len, command, command_len);
+        m[command_len - 1] = ' ';
+    }
+    return m;
+}
+
+void DestroyMessage(MESSAGE m)
+{
+    free(m);
+}
+#pragma endregion
@@ -0,0 +1,344 @@
+#include "Client.h"
+
+CONNECTIONPOOL* CreateConnectionPool(ADDRESS server, const char* unix_path, const char* shm_name, int compress, int size,
+    int attempts, int timeout_floor, int timeout_ceiling)
+{
+    if (size < 1)
+        size = 1;
+    CONNECTIONPOOL* pool = (CONNECTIONPOOL*)malloc(sizeof(CONNECTIONPOOL));
+    POOLEDCONNECTION* connections = (POOLEDCONNECTION*)malloc(sizeof(POOLEDCONNECTION) * size);
+    if (pool == NULL || connections == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        free(pool);
+        free(connections);
+        return NULL;
+    }
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    memset(pool, 0, sizeof(CONNECTIONPOOL));
+    pool->server = server;
+    pool->unix_path = unix_path;
+    pool->shm_name = shm_name;
+    pool->compress = compress;
+    pool->connections = connections;
+    pool->size = size;
+    pool->attempts = attempts < 1 ? 1 : attempts;
+    // clients started together must not draw the same jitter
+    pool->random = (unsigned long long)now.QuadPart ^ ((unsigned long long)(size_t)pool << 16) ^ 0x9E3779B97F4A7C15ULL;
+    pool->created = now.QuadPart;
+    InitializeCriticalSection(&pool->lock);
+    InitializeConditionVariable(&pool->released);
+    for (int i = 0; i < size; ++i) {
+        connections[i].pool = pool;
+        connections[i].socket = INVALID_SOCKET;
+        connections[i].connection = NULL;
+        connections[i].account = NULL;
+        connections[i].is_busy = 0;
+        connections[i].is_dropped = 0;
+        connections[i].last_used = 0;
+        connections[i].acquired = 0;
+        connections[i].busy = 0;
+        connections[i].requests = 0;
+        InitializeRoundTrip(&connections[i].round_trip, timeout_floor, timeout_ceiling);
+    }
+    return pool;
+}
+
+void DestroyConnectionPool(CONNECTIONPOOL* pool)
+{
+    if (pool == NULL)
+        return;
+    for (int i = 0; i < pool->size; ++i) {
+        DropPooledConnection(&pool->connections[i], 0);
+        free(pool->connections[i].account);
+    }
+    DeleteCriticalSection(&pool->lock);
+    free(pool->connections);
+    free(pool);
+}
+
+POOLEDCONNECTION* AcquirePooledConnection(CONNECTIONPOOL* pool)
+{
+    EnterCriticalSection(&pool->lock);
+    POOLEDCONNECTION* chosen = NULL;
+    int has_waited = 0;
+    while (1) {
+        for (int i = 0; i < pool->size; ++i) {
+            POOLEDCONNECTION* pooled = &pool->connections[i];
+            if (pooled->is_busy)
+                continue;
+            // a connected one saves a connect. Then the least recently used, to spread the requests
+            if (chosen == NULL || (pooled->connection != NULL && chosen->connection == NULL)
+                || ((pooled->connection != NULL) == (chosen->connection != NULL) && pooled->last_used < chosen->last_used))
+                chosen = pooled;
+        }
+        if (chosen != NULL)
+            break;
+        has_waited = 1;
+        SleepConditionVariableCS(&pool->released, &pool->lock, INFINITE);
+    }
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    chosen->is_busy = 1;
+    chosen->acquired = now.QuadPart;
+    pool->acquires++;
+    pool->waits += has_waited;
+    LeaveCriticalSection(&pool->lock);
+    return chosen;
+}
+
+void ReleasePooledConnection(POOLEDCONNECTION* pooled)
+{
+    CONNECTIONPOOL* pool = pooled->pool;
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    EnterCriticalSection(&pool->lock);
+    pooled->busy += now.QuadPart - pooled->acquired;
+    pooled->last_used = now.QuadPart;
+    pooled->is_busy = 0;
+    LeaveCriticalSection(&pool->lock);
+    WakeConditionVariable(&pool->released);
+}
+
+int RunPooledRequest(POOLEDCONNECTION* pooled, MESSAGE request, MESSAGE* oresponse)
+{
+    CONNECTIONPOOL* pool = pooled->pool;
+    *oresponse = NULL;
+    // the server may have closed an idle connection, e.g. when it restarted: connect again before sending
+    if (pooled->connection != NULL && !IsPooledConnectionOpen(pooled))
+        DropPooledConnection(pooled, 1);
+
+    for (int is_retry = 0; is_retry < 2; ++is_retry) {
+        if (pooled->connection == NULL && !ConnectPooledConnection(pooled))
+            break;
+        long long start = StartRoundTrip(&pooled->round_trip, pooled->connection);
+        int status = SegmentationSend(pooled->connection, request, (int)strlen(request) + 1, NULL);
+        if (status == 1) {
+            status = SegmentationReceive(pooled->connection, oresponse);
+            EndRoundTrip(&pooled->round_trip, start, status);
+            if (status == 1) {
+                TrackPooledSession(pooled, request, *oresponse);
+                EnterCriticalSection(&pool->lock);
+                pooled->requests++;
+                LeaveCriticalSection(&pool->lock);
+                return 1;
+            }
+            // sent: the server may have run it, so it is not sent again. A late response would answer the next request
+            DestroyMessage(*oresponse);
+            *oresponse = NULL;
+            DropPooledConnection(pooled, 1);
+            break;
+        }
+        DropPooledConnection(pooled, 1);
+        if (is_retry == 0) {
+            EnterCriticalSection(&pool->lock);
+            pool->retries++;
+            LeaveCriticalSection(&pool->lock);
+        }
+    }
+    EnterCriticalSection(&pool->lock);
+    pool->failures++;
+    LeaveCriticalSection(&pool->lock);
+    return -1;
+}
+
+int RunPoolRequest(CONNECTIONPOOL* pool, MESSAGE request, MESSAGE* oresponse)
+{
+    POOLEDCONNECTION* pooled = AcquirePooledConnection(pool);
+    int status = RunPooledRequest(pooled, request, oresponse);
+    ReleasePooledConnection(pooled);
+    return status;
+}
+
+int ConnectPooledConnection(POOLEDCONNECTION* pooled)
+{
+    CONNECTIONPOOL* pool = pooled->pool;
+    int failures = 0;
+    for (int attempt = 0; attempt < pool->attempts; ++attempt) {
+        // a broken connection waits too: the server that broke it may be restarting, with all its clients coming back
+        if (attempt > 0 || pooled->is_dropped) {
+            DWORD delay = GetBackoffDelay(pool, failures);
+            printf("[%s] Connect again in %lu ms (attempt %d/%d)...\n", INFO_FLAGS, (unsigned long)delay, attempt + 1, pool->attempts);
+            Sleep(delay);
+        }
+        SOCKET socket = INVALID_SOCKET;
+        if (pool->shm_name == NULL)
+            socket = CreateSocket(pool->unix_path == NULL ? TCP : LOCAL);
+        CONNECTION* connection = (socket != INVALID_SOCKET || pool->shm_name != NULL) ? CreateConnection(socket) : NULL;
+        int is_connected = 0;
+        if (connection != NULL) {
+            if (pool->shm_name != NULL)
+                is_connected = EstablishSharedConnection(connection, pool->shm_name);
+            else if (pool->unix_path != NULL)
+                is_connected = EstablishConnection(socket, CreateLocalSocketAddress(pool->unix_path));
+            else
+                is_connected = EstablishConnection(socket, pool->server);
+        }
+        if (is_connected) {
+            pooled->socket = socket;
+            pooled->connection = connection;
+            pooled->round_trip.applied = 0; // a new socket has no timeout yet
+            int status = RestorePooledSession(pooled);
+            if (status != -1) {
+                EnterCriticalSection(&pool->lock);
+                pool->connects++;
+                pool->reconnects += pooled->is_dropped;
+                LeaveCriticalSection(&pool->lock);
+                pooled->is_dropped = 0;
+                return 1;
+            }
+            // broke again right away: drop it as a failed connect
+            DropPooledConnection(pooled, pooled->is_dropped);
+        }
+        else {
+            if (connection != NULL)
+                CloseSharedChannel(connection->channel);
+            DestroyConnection(connection);
+            CloseSocket(socket, CLOSE_NORMAL);
+        }
+        ++failures;
+        EnterCriticalSection(&pool->lock);
+        pool->connect_failures++;
+        LeaveCriticalSection(&pool->lock);
+    }
+    printf("[%s] %s\n", WARNING_FLAGS, _POOL_GIVE_UP);
+    return 0;
+}
+
+int RestorePooledSession(POOLEDCONNECTION* pooled)
+{
+    CONNECTIONPOOL* pool = pooled->pool;
+    CONNECTION* connection = pooled->connection;
+    MESSAGE response = NULL;
+    if (pool->compress) {
+        MESSAGE request = CreateMessage(CM_COMPRESS, COMPRESSION_ALGORITHM);
+        int status = request == NULL ? 0 : RunTimedRequest(connection, &pooled->round_trip, request, &response);
+        DestroyMessage(request);
+        if (status != 1) {
+            DestroyMessage(response);
+            return -1;
+        }
+        // compression starts after the handshake response, on both sides
+        if (GetResponseStatus(response) == S_COMPRESS_SUCC)
+            EnableCompression(connection);
+        DestroyMessage(response);
+        response = NULL;
+    }
+    if (pooled->account == NULL)
+        return 1;
+
+    MESSAGE request = CreateMessage(CM_LOGIN, pooled->account);
+    int status = request == NULL ? 0 : RunTimedRequest(connection, &pooled->round_trip, request, &response);
+    DestroyMessage(request);
+    if (status != 1) {
+        DestroyMessage(response);
+        return -1;
+    }
+    int response_status = GetResponseStatus(response);
+    DestroyMessage(response);
+    if (response_status != S_LOGIN_SUCC && response_status != S_LOGGEDIN) {
+        // e.g. the server logged the account in elsewhere meanwhile: the caller sees it on its next request
+        printf("[%s:%d] %s\n", WARNING_FLAGS, response_status, _POOL_RELOGIN_FAIL);
+        free(pooled->account);
+        pooled->account = NULL;
+        return 0;
+    }
+    EnterCriticalSection(&pool->lock);
+    pool->relogins++;
+    LeaveCriticalSection(&pool->lock);
+    return 1;
+}
+
+int IsPooledConnectionOpen(POOLEDCONNECTION* pooled)
+{
+    CONNECTION* connection = pooled->connection;
+    if (connection->channel != NULL) // a shared memory session has no close to see
+        return 1;
+    // no response is due on an idle connection: anything readable is a close or an error
+    if (connection->length > 0)
+        return 0;
+    WSAPOLLFD polled;
+    polled.fd = connection->socket;
+    polled.events = POLLIN;
+    polled.revents = 0;
+    return WSAPoll(&polled, 1, 0) == 0;
+}
+
+void DropPooledConnection(POOLEDCONNECTION* pooled, int is_broken)
+{
+    if (pooled->connection == NULL)
+        return;
+    CloseSharedChannel(pooled->connection->channel);
+    DestroyConnection(pooled->connection);
+    CloseSocket(pooled->socket, is_broken ? CLOSE_NORMAL : CLOSE_SAFELY, SD_BOTH);
+    pooled->connection = NULL;
+    pooled->socket = INVALID_SOCKET;
+    pooled->is_dropped = is_broken;
+}
+
+void TrackPooledSession(POOLEDCONNECTION* pooled, const MESSAGE request, const MESSAGE response)
+{
+    int status = GetResponseStatus(response);
+    int login_len = (int)strlen(CM_LOGIN);
+    if (strncmp(request, CM_LOGIN, login_len) == 0 && request[login_len] == ' ' && status == S_LOGIN_SUCC) {
+        const char* account = request + login_len + 1;
+        char* _account = Clone(account, (int)strlen(account) + 1);
+        if (_account != NULL) { // without it, the session is only not restored
+            free(pooled->account);
+            pooled->account = _account;
+        }
+    }
+    else if (strncmp(request, CM_LOGOUT, strlen(CM_LOGOUT)) == 0 && status == S_LOGOUT_SUCC) {
+        free(pooled->account);
+        pooled->account = NULL;
+    }
+}
+
+DWORD GetBackoffDelay(CONNECTIONPOOL* pool, int failures)
+{
+    DWORD ceiling = POOL_BACKOFF_MAX;
+    if (failures < 16 && ((DWORD)POOL_BACKOFF_BASE << failures) < ceiling)
+        ceiling = (DWORD)POOL_BACKOFF_BASE << failures;
+    EnterCriticalSection(&pool->lock);
+    // xorshift64*: rand() is shared by all threads of the process
+    pool->random ^= pool->random >> 12;
+    pool->random ^= pool->random << 25;
+    pool->random ^= pool->random >> 27;
+    unsigned int random = (unsigned int)((pool->random * 0x2545F4914F6CDD1DULL) >> 32);
+    LeaveCriticalSection(&pool->lock);
+    return (DWORD)(random % (ceiling + 1));
+}
+
+void PrintPoolStatistics(CONNECTIONPOOL* pool)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    EnterCriticalSection(&pool->lock);
+    long long busy = 0;
+    long long least = -1, most = 0;
+    long long samples = 0, timeouts = 0;
+    double srtt = 0;
+    int longest = 0;
+    for (int i = 0; i < pool->size; ++i) {
+        POOLEDCONNECTION* pooled = &pool->connections[i];
+        busy += pooled->busy + (pooled->is_busy ? now.QuadPart - pooled->acquired : 0);
+        samples += pooled->round_trip.samples;
+        timeouts += pooled->round_trip.timeouts;
+        srtt += pooled->round_trip.srtt * pooled->round_trip.samples;
+        if (pooled->round_trip.timeout > longest)
+            longest = pooled->round_trip.timeout;
+        if (least < 0 || pooled->requests < least)
+            least = pooled->requests;
+        if (pooled->requests > most)
+            most = pooled->requests;
+    }
+    long long elapsed = now.QuadPart - pool->created;
+    double utilization = elapsed > 0 ? busy * 100.0 / ((double)elapsed * pool->size) : 0;
+    printf("[%s] Pool: %d connections, %.1f%% utilized, %lld acquires (%lld waited), %lld to %lld requests per connection\n", INFO_FLAGS,
+        pool->size, utilization, pool->acquires, pool->waits, least, most);
+    printf("[%s] Pool: %lld connects, %lld reconnects, %lld connects failed, %lld logins restored, %lld requests sent again, %lld failed\n", INFO_FLAGS,
+        pool->connects, pool->reconnects, pool->connect_failures, pool->relogins, pool->retries, pool->failures);
+    printf("[%s] Pool: srtt=%.3f ms, longest timeout %d ms [%d, %d], %lld responses, %lld timed out\n", INFO_FLAGS,
+        samples > 0 ? srtt / samples : 0, longest, pool->connections[0].round_trip.floor, pool->connections[0].round_trip.ceiling, samples, timeouts);
+    LeaveCriticalSection(&pool->lock);
+}
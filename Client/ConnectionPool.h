@@ -0,0 +1,208 @@
+#pragma once
+
+// Connections for clients that run unattended: a broken or refused connection is connected again with a
+// jittered exponential backoff instead of asking the user, and the account logged in on it is logged in again.
+// Requests are spread over the connections of the pool: each request takes the idle connection used least recently.
+
+#pragma region Header Declarations
+
+#include "CommonHeader.h"
+#include "RoundTrip.h"
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define POOL_DEFAULT_ATTEMPTS 8 // Connects tried for a request before it fails
+#define POOL_BACKOFF_BASE 100 // Longest wait before the first connect again, in milliseconds. Doubled at each failed connect
+#define POOL_BACKOFF_MAX 5000 // Longest wait between two connects, in milliseconds
+
+#define _POOL_GIVE_UP "Fail to connect to server again. The request fails."
+#define _POOL_RELOGIN_FAIL "Fail to log in again after the reconnect. The session is lost."
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef struct connectionpool CONNECTIONPOOL;
+
+typedef struct pooledconnection {
+
+    CONNECTIONPOOL* pool; // The pool the connection belongs to
+
+    SOCKET socket; // The socket. INVALID_SOCKET while not connected, and for shared memory
+
+    CONNECTION* connection; // The connection. NULL while not connected
+
+    char* account; // The account logged in on the connection, logged in again after a reconnect. NULL if none
+
+    int is_busy; // 1 while a caller has the connection
+
+    int is_dropped; // 1 if the connection was connected and is broken: the next connect waits a backoff first
+
+    long long last_used; // Time the connection was last released, in QueryPerformanceCounter() ticks
+
+    long long acquired; // Time the connection was acquired, in ticks
+
+    long long busy; // Time the connection has been used by callers, in ticks
+
+    long long requests; // Number of requests that got a response on the connection
+
+    ROUNDTRIP round_trip; // Round-trip estimate and receive timeout of the connection. Kept over reconnects: the server is the same
+
+}POOLEDCONNECTION;
+
+struct connectionpool {
+
+    ADDRESS server; // The TCP address of server
+
+    const char* unix_path; // Connect to the Unix domain socket at this path instead of TCP. NULL if not used
+
+    const char* shm_name; // Connect to the shared memory listener of this name instead of TCP. NULL if not used
+
+    int compress; // 1 if compression is negotiated after each connect
+
+    POOLEDCONNECTION* connections; // The connections
+
+    int size; // Number of connections
+
+    int attempts; // Connects tried for a request before it fails
+
+    CRITICAL_SECTION lock; // Guards is_busy, the counters and random
+
+    CONDITION_VARIABLE released; // Signaled when a connection is released
+
+    unsigned long long random; // State of the random number generator of the backoff jitter
+
+    long long created; // Time the pool was created, in ticks
+
+    long long acquires; // Number of connections acquired
+
+    long long waits; // Number of acquires that waited for a busy connection
+
+    long long connects; // Number of successful connects, the first ones included
+
+    long long reconnects; // Number of successful connects of broken connections
+
+    long long connect_failures; // Number of connects that failed
+
+    long long relogins; // Number of accounts logged in again after a reconnect
+
+    long long retries; // Number of requests sent again after their connection broke before sending them
+
+    long long failures; // Number of requests that failed: no response after all attempts
+
+};
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Create a pool of connections to server. Nothing is connected until a request needs it. [Call WSInitialize() first]
+/// </summary>
+/// <param name="server">The TCP address of server</param>
+/// <param name="unix_path">Connect to the Unix domain socket at this path instead of TCP. NULL if not used. Kept, not copied</param>
+/// <param name="shm_name">Connect to the shared memory listener of this name instead of TCP. NULL if not used. Kept, not copied</param>
+/// <param name="compress">1 to negotiate compression after each connect</param>
+/// <param name="size">Number of connections</param>
+/// <param name="attempts">Connects tried for a request before it fails. At least 1</param>
+/// <param name="timeout_floor">Shortest receive timeout, in milliseconds. The timeouts follow the round-trip time of each connection</param>
+/// <param name="timeout_ceiling">Longest receive timeout, in milliseconds</param>
+/// <returns>The pool. Free with DestroyConnectionPool(). NULL if fail to allocate memory</returns>
+CONNECTIONPOOL* CreateConnectionPool(ADDRESS server, const char* unix_path, const char* shm_name, int compress, int size,
+    int attempts = POOL_DEFAULT_ATTEMPTS, int timeout_floor = RTT_DEFAULT_FLOOR, int timeout_ceiling = RTT_DEFAULT_CEILING);
+
+/// <summary>
+/// Close all connections of a pool and Free it. No connection may be acquired.
+/// </summary>
+/// <param name="pool">The pool</param>
+void DestroyConnectionPool(CONNECTIONPOOL* pool);
+
+/// <summary>
+/// Take the idle connection of a pool used least recently, and Wait if all are busy. Connected ones go first.
+/// The account logged in on it stays logged in: a caller that logs in should keep its connection until it logs out.
+/// </summary>
+/// <param name="pool">The pool</param>
+/// <returns>The connection. Give it back with ReleasePooledConnection()</returns>
+POOLEDCONNECTION* AcquirePooledConnection(CONNECTIONPOOL* pool);
+
+/// <summary>
+/// Give a connection back to its pool.
+/// </summary>
+/// <param name="pooled">The connection</param>
+void ReleasePooledConnection(POOLEDCONNECTION* pooled);
+
+/// <summary>
+/// Send a request on a pooled connection and Receive its response, connecting first if it is not connected.
+/// A request is sent again after a reconnect only if its connection broke before it was sent:
+/// once sent, the server may have run it. A request that times out drops its connection, whose stream is out of step.
+/// </summary>
+/// <param name="pooled">The connection. Acquired by the caller</param>
+/// <param name="request">The request</param>
+/// <param name="oresponse">[Output] The response. Free with DestroyMessage(). NULL if failed</param>
+/// <returns>1 if success. -1 if the request got no response</returns>
+int RunPooledRequest(POOLEDCONNECTION* pooled, MESSAGE request, MESSAGE* oresponse);
+
+/// <summary>
+/// Acquire a connection, Run a request on it and Release it. See RunPooledRequest().
+/// </summary>
+/// <param name="pool">The pool</param>
+/// <param name="request">The request. It must need no login, or the whole session must be in the one request</param>
+/// <param name="oresponse">[Output] The response. Free with DestroyMessage(). NULL if failed</param>
+/// <returns>1 if success. -1 if the request got no response</returns>
+int RunPoolRequest(CONNECTIONPOOL* pool, MESSAGE request, MESSAGE* oresponse);
+
+/// <summary>
+/// Connect a pooled connection, waiting a jittered backoff before each connect after a failure or a broken connection.
+/// Then Negotiate compression and Log in again the account it had.
+/// </summary>
+/// <param name="pooled">The connection. Not connected</param>
+/// <returns>1 if connected. 0 if all attempts failed</returns>
+int ConnectPooledConnection(POOLEDCONNECTION* pooled);
+
+/// <summary>
+/// Negotiate compression and Log in again the account of a connection just connected. Print nothing but failures.
+/// </summary>
+/// <param name="pooled">The connection</param>
+/// <returns>1 if success. 0 if a refusal lost the session. -1 if the connection broke</returns>
+int RestorePooledSession(POOLEDCONNECTION* pooled);
+
+/// <summary>
+/// Check whether a connection idle in the pool was closed by server, e.g. by a restart, without blocking.
+/// </summary>
+/// <param name="pooled">The connection. Connected</param>
+/// <returns>1 if it is still open. 0 if it is closed or broken</returns>
+int IsPooledConnectionOpen(POOLEDCONNECTION* pooled);
+
+/// <summary>
+/// Close the socket of a pooled connection. The account stays to be logged in again.
+/// </summary>
+/// <param name="pooled">The connection</param>
+/// <param name="is_broken">1 if the connection broke: the next connect waits a backoff first</param>
+void DropPooledConnection(POOLEDCONNECTION* pooled, int is_broken);
+
+/// <summary>
+/// Remember the account logged in or out by a request that got a response, to log it in again after a reconnect.
+/// </summary>
+/// <param name="pooled">The connection</param>
+/// <param name="request">The request</param>
+/// <param name="response">The response</param>
+void TrackPooledSession(POOLEDCONNECTION* pooled, const MESSAGE request, const MESSAGE response);
+
+/// <summary>
+/// Get the wait before a connect [full jitter]: uniform in [0, min(POOL_BACKOFF_MAX, POOL_BACKOFF_BASE * 2^failures)].
+/// Clients dropped together by a server restart then come back spread out instead of all at once.
+/// </summary>
+/// <param name="pool">The pool</param>
+/// <param name="failures">Number of connects failed in a row</param>
+/// <returns>The wait, in milliseconds</returns>
+DWORD GetBackoffDelay(CONNECTIONPOOL* pool, int failures);
+
+/// <summary>
+/// Print the utilization, the reconnect counts and the timeouts of a pool to console.
+/// </summary>
+/// <param name="pool">The pool</param>
+void PrintPoolStatistics(CONNECTIONPOOL* pool);
+
+#pragma endregion
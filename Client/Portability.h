@@ -0,0 +1,298 @@
+#pragma once
+
+// The Winsock and Win32 names the client uses, on top of POSIX sockets and threads: the client builds on Linux as well.
+// Included by the shared headers instead of WinSock2.h when _WIN32 is not defined. [Client only]
+
+#pragma region Header Declarations
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+
+#define SD_RECEIVE SHUT_RD
+#define SD_SEND SHUT_WR
+#define SD_BOTH SHUT_RDWR
+
+#define UNIX_PATH_MAX ((int)sizeof(((struct sockaddr_un*)0)->sun_path))
+
+#define WSAECONNRESET ECONNRESET
+#define WSAECONNABORTED ECONNABORTED
+#define WSAECONNREFUSED ECONNREFUSED
+#define WSAEHOSTUNREACH EHOSTUNREACH
+#define WSAETIMEDOUT ETIMEDOUT
+#define WSAEISCONN EISCONN
+#define WSAENOTSOCK ENOTSOCK
+#define WSAEWOULDBLOCK WSAETIMEDOUT // EAGAIN is both a receive timeout and a would-block, see WSAGetLastError()
+
+#define INFINITE 0xFFFFFFFF
+#define ERROR_TIMEOUT ETIMEDOUT
+#define _TRUNCATE ((size_t)-1)
+
+#define __stdcall
+#define MAKEWORD(low, high) ((WORD)(((BYTE)(low)) | ((WORD)((BYTE)(high))) << 8))
+
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+#define _strtoui64 strtoull
+#define _stricmp strcasecmp
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef int SOCKET;
+typedef unsigned char BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef int64_t LONG64;
+typedef int BOOL;
+typedef void* HANDLE;
+
+typedef struct sockaddr SOCKADDR;
+typedef struct sockaddr_in SOCKADDR_IN;
+typedef struct sockaddr_un SOCKADDR_UN;
+typedef struct sockaddr_storage SOCKADDR_STORAGE;
+typedef struct in_addr IN_ADDR;
+
+typedef union _LARGE_INTEGER {
+
+	int64_t QuadPart; // Ticks of QueryPerformanceCounter(), or ticks per second
+
+}LARGE_INTEGER;
+
+typedef struct WSAData {
+
+	int unused; // Nothing to start on POSIX
+
+}WSADATA;
+
+typedef struct pollfd WSAPOLLFD;
+
+typedef pthread_mutex_t CRITICAL_SECTION;
+
+typedef pthread_cond_t CONDITION_VARIABLE;
+
+typedef struct portablethread {
+
+	pthread_t thread; // The thread
+
+	unsigned (*start)(void* arguments); // The thread function
+
+	void* arguments; // Passed to start
+
+}PORTABLETHREAD;
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Start sockets. A write to a closed connection fails with EPIPE instead of raising SIGPIPE, as on Winsock.
+/// </summary>
+inline int WSAStartup(WORD version, WSADATA* odata)
+{
+	signal(SIGPIPE, SIG_IGN);
+	return 0;
+}
+
+inline int WSACleanup() { return 0; }
+
+/// <summary>
+/// Get the error of the last socket call. A receive timeout is reported as WSAETIMEDOUT, like Winsock does.
+/// </summary>
+inline int WSAGetLastError() { return (errno == EAGAIN || errno == EWOULDBLOCK) ? WSAETIMEDOUT : errno; }
+
+inline void WSASetLastError(int error) { errno = error; }
+
+inline unsigned long GetLastError() { return (unsigned long)errno; }
+
+inline int closesocket(SOCKET socket) { return close(socket); }
+
+inline int ioctlsocket(SOCKET socket, long command, unsigned long* argument) { return ioctl(socket, command, argument); }
+
+inline int WSAPoll(WSAPOLLFD* fds, unsigned long count, int timeout) { return poll(fds, (nfds_t)count, timeout); }
+
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER* ofrequency)
+{
+	ofrequency->QuadPart = 1000000000LL;
+	return 1;
+}
+
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER* ocounter)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ocounter->QuadPart = (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+	return 1;
+}
+
+inline void Sleep(DWORD milliseconds) { usleep((useconds_t)milliseconds * 1000); }
+
+inline LONG InterlockedIncrement(volatile LONG* target) { return __atomic_add_fetch(target, 1, __ATOMIC_SEQ_CST); }
+
+inline LONG InterlockedDecrement(volatile LONG* target) { return __atomic_sub_fetch(target, 1, __ATOMIC_SEQ_CST); }
+
+inline LONG InterlockedExchange(volatile LONG* target, LONG value) { return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST); }
+
+inline LONG64 InterlockedExchange64(volatile LONG64* target, LONG64 value) { return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST); }
+
+inline void InitializeCriticalSection(CRITICAL_SECTION* lock) { pthread_mutex_init(lock, NULL); }
+
+inline void DeleteCriticalSection(CRITICAL_SECTION* lock) { pthread_mutex_destroy(lock); }
+
+inline void EnterCriticalSection(CRITICAL_SECTION* lock) { pthread_mutex_lock(lock); }
+
+inline void LeaveCriticalSection(CRITICAL_SECTION* lock) { pthread_mutex_unlock(lock); }
+
+inline void InitializeConditionVariable(CONDITION_VARIABLE* condition) { pthread_cond_init(condition, NULL); }
+
+inline void WakeConditionVariable(CONDITION_VARIABLE* condition) { pthread_cond_signal(condition); }
+
+inline void WakeAllConditionVariable(CONDITION_VARIABLE* condition) { pthread_cond_broadcast(condition); }
+
+/// <summary>
+/// Wait for a condition variable, at most [milliseconds]. INFINITE to wait without a limit.
+/// </summary>
+/// <returns>Nonzero if woken. 0 if timed out [errno is ERROR_TIMEOUT]</returns>
+inline BOOL SleepConditionVariableCS(CONDITION_VARIABLE* condition, CRITICAL_SECTION* lock, DWORD milliseconds)
+{
+	if (milliseconds == INFINITE)
+		return pthread_cond_wait(condition, lock) == 0;
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += milliseconds / 1000;
+	deadline.tv_nsec += (long)(milliseconds % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	int error = pthread_cond_timedwait(condition, lock, &deadline);
+	errno = error;
+	return error == 0;
+}
+
+inline int memcpy_s(void* destination, size_t size, const void* source, size_t count)
+{
+	if (count > size)
+		return ERANGE;
+	memcpy(destination, source, count);
+	return 0;
+}
+
+inline int strncpy_s(char* destination, size_t size, const char* source, size_t count)
+{
+	// _TRUNCATE: copy as much as fits, always terminated
+	size_t length = strnlen(source, count == _TRUNCATE ? size - 1 : min(count, size - 1));
+	memcpy(destination, source, length);
+	destination[length] = '\0';
+	return 0;
+}
+
+inline int fopen_s(FILE** ofile, const char* path, const char* mode)
+{
+	*ofile = fopen(path, mode);
+	return *ofile == NULL ? errno : 0;
+}
+
+/// <summary>
+/// Read formatted input from stdin. The size argument after each %c is left unused, as vscanf() never reads it.
+/// </summary>
+inline int scanf_s(const char* format, ...)
+{
+	va_list arguments;
+	va_start(arguments, format);
+	int count = vscanf(format, arguments);
+	va_end(arguments);
+	return count;
+}
+
+/// <summary>
+/// Read a line from stdin without its line break.
+/// </summary>
+inline char* gets_s(char* buffer, size_t size)
+{
+	if (fgets(buffer, (int)size, stdin) == NULL) {
+		buffer[0] = '\0';
+		return NULL;
+	}
+	buffer[strcspn(buffer, "\r\n")] = '\0';
+	return buffer;
+}
+
+/// <summary>
+/// Run the thread function of a portable thread. [pthread start routine]
+/// </summary>
+inline void* RunPortableThread(void* arguments)
+{
+	PORTABLETHREAD* thread = (PORTABLETHREAD*)arguments;
+	thread->start(thread->arguments);
+	return NULL;
+}
+
+/// <summary>
+/// Begin a thread. The handle is released by WaitForSingleObject() then CloseHandle().
+/// </summary>
+/// <returns>The thread handle. 0 if have errors [errno is set]</returns>
+inline uintptr_t _beginthreadex(void* security, unsigned stack_size, unsigned (*start)(void*), void* arguments, unsigned flags, unsigned* oid)
+{
+	PORTABLETHREAD* thread = (PORTABLETHREAD*)malloc(sizeof(PORTABLETHREAD));
+	if (thread == NULL) {
+		errno = ENOMEM;
+		return 0;
+	}
+	thread->start = start;
+	thread->arguments = arguments;
+	int error = pthread_create(&thread->thread, NULL, RunPortableThread, thread);
+	if (error != 0) {
+		free(thread);
+		errno = error;
+		return 0;
+	}
+	return (uintptr_t)thread;
+}
+
+/// <summary>
+/// Wait for a thread begun by _beginthreadex() to end. Only INFINITE waits on threads are used by the client.
+/// </summary>
+inline DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds)
+{
+	pthread_join(((PORTABLETHREAD*)handle)->thread, NULL);
+	return 0;
+}
+
+inline BOOL CloseHandle(HANDLE handle)
+{
+	free(handle);
+	return 1;
+}
+
+#pragma endregion
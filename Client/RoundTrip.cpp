@@ -0,0 +1,92 @@
+#include "Client.h"
+
+void InitializeRoundTrip(ROUNDTRIP* round_trip, int floor, int ceiling)
+{
+    round_trip->floor = floor > 0 ? floor : RTT_DEFAULT_FLOOR;
+    round_trip->ceiling = ceiling > 0 ? ceiling : RTT_DEFAULT_CEILING;
+    if (round_trip->ceiling < round_trip->floor)
+        round_trip->ceiling = round_trip->floor;
+    round_trip->srtt = 0;
+    round_trip->rttvar = 0;
+    round_trip->last = 0;
+    round_trip->timeout = min(max(RTT_INITIAL_TIMEOUT, round_trip->floor), round_trip->ceiling);
+    round_trip->applied = 0;
+    round_trip->samples = 0;
+    round_trip->timeouts = 0;
+}
+
+long long StartRoundTrip(ROUNDTRIP* round_trip, CONNECTION* connection)
+{
+    // one setsockopt() per change, not per request. A shared memory channel has its own timeout
+    if (connection->channel == NULL && round_trip->applied != round_trip->timeout
+        && SetReceiveTimeout(connection->socket, round_trip->timeout))
+        round_trip->applied = round_trip->timeout;
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+    return start.QuadPart;
+}
+
+int EndRoundTrip(ROUNDTRIP* round_trip, long long start, int status)
+{
+    LARGE_INTEGER frequency, end;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&end);
+    double elapsed = (double)(end.QuadPart - start) * 1000.0 / frequency.QuadPart;
+    if (status == 1) {
+        UpdateRoundTrip(round_trip, elapsed);
+        return 0;
+    }
+    // the receive error is printed and gone by now: a failure that took the whole timeout is the timeout
+    if (round_trip->applied == 0 || elapsed < round_trip->applied)
+        return 0;
+    BackOffRoundTrip(round_trip);
+    return 1;
+}
+
+int RunTimedRequest(CONNECTION* connection, ROUNDTRIP* round_trip, const MESSAGE request, MESSAGE* oresponse)
+{
+    *oresponse = NULL;
+    long long start = StartRoundTrip(round_trip, connection);
+    int status = SegmentationSend(connection, request, (int)strlen(request) + 1, NULL);
+    if (status == 1)
+        status = SegmentationReceive(connection, oresponse);
+    EndRoundTrip(round_trip, start, status);
+    return status;
+}
+
+void UpdateRoundTrip(ROUNDTRIP* round_trip, double sample)
+{
+    if (round_trip->samples == 0) {
+        round_trip->srtt = sample;
+        round_trip->rttvar = sample / 2;
+    }
+    else {
+        // the variance first: it uses the smoothed RTT before this sample
+        double deviation = round_trip->srtt > sample ? round_trip->srtt - sample : sample - round_trip->srtt;
+        round_trip->rttvar = (1 - RTT_BETA) * round_trip->rttvar + RTT_BETA * deviation;
+        round_trip->srtt = (1 - RTT_ALPHA) * round_trip->srtt + RTT_ALPHA * sample;
+    }
+    round_trip->last = sample;
+    round_trip->samples++;
+
+    double timeout = round_trip->srtt + max((double)RTT_CLOCK_GRANULARITY, RTT_K * round_trip->rttvar);
+    if (timeout < round_trip->floor)
+        timeout = round_trip->floor;
+    if (timeout > round_trip->ceiling)
+        timeout = round_trip->ceiling;
+    // a sample also ends a back off
+    round_trip->timeout = (int)(timeout + 0.5);
+}
+
+void BackOffRoundTrip(ROUNDTRIP* round_trip)
+{
+    round_trip->timeouts++;
+    round_trip->timeout = round_trip->timeout > round_trip->ceiling / 2 ? round_trip->ceiling : round_trip->timeout * 2;
+}
+
+void PrintRoundTrip(const char* title, const ROUNDTRIP* round_trip)
+{
+    printf("[%s] %s: srtt=%.3f ms rttvar=%.3f ms timeout=%d ms [%d, %d], %lld responses, %lld timed out\n", INFO_FLAGS, title,
+        round_trip->srtt, round_trip->rttvar, round_trip->timeout, round_trip->floor, round_trip->ceiling,
+        round_trip->samples, round_trip->timeouts);
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+// Receive timeouts that follow the measured round-trip time of a connection, as TCP derives its retransmission
+// timeout [RFC 6298]: a smoothed RTT and its variance are kept, and the timeout is SRTT + 4 * RTTVAR, clamped.
+// A dead server is given up on soon, and a slow one is waited for as long as it has been slow before.
+
+#pragma region Header Declarations
+
+#include "CommonHeader.h"
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define RTT_DEFAULT_FLOOR 1000 // Shortest timeout, in milliseconds. TCP uses the same minimum
+#define RTT_DEFAULT_CEILING RECEIVE_TIMEOUT_INTERVAL // Longest timeout, in milliseconds. The fixed timeout it replaces
+#define RTT_INITIAL_TIMEOUT 3000 // Timeout before the first sample, in milliseconds
+#define RTT_CLOCK_GRANULARITY 10 // Least room left for the variance, in milliseconds
+#define RTT_ALPHA 0.125 // Gain of a sample on the smoothed RTT
+#define RTT_BETA 0.25 // Gain of a sample on the RTT variance
+#define RTT_K 4 // Number of variances added to the smoothed RTT
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef struct roundtrip {
+
+    double srtt; // Smoothed round-trip time, in milliseconds. 0 until the first sample
+
+    double rttvar; // Round-trip time variance, in milliseconds
+
+    double last; // The last sample, in milliseconds
+
+    int floor; // Shortest timeout, in milliseconds
+
+    int ceiling; // Longest timeout, in milliseconds
+
+    int timeout; // Timeout of the next request, in milliseconds
+
+    int applied; // Timeout set on the socket, in milliseconds. 0 if none: set before the next request
+
+    long long samples; // Number of requests that got their response
+
+    long long timeouts; // Number of requests that timed out
+
+}ROUNDTRIP;
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Initialize a round-trip estimator with no samples.
+/// </summary>
+/// <param name="round_trip">The estimator</param>
+/// <param name="floor">Shortest timeout, in milliseconds. RTT_DEFAULT_FLOOR if 0 or less</param>
+/// <param name="ceiling">Longest timeout, in milliseconds. RTT_DEFAULT_CEILING if 0 or less. At least floor</param>
+void InitializeRoundTrip(ROUNDTRIP* round_trip, int floor, int ceiling);
+
+/// <summary>
+/// Set the receive timeout of the estimator on a connection if it changed, and Start timing a request.
+/// </summary>
+/// <param name="round_trip">The estimator</param>
+/// <param name="connection">The connection the request is sent on</param>
+/// <returns>Start of the request, in QueryPerformanceCounter() ticks. Pass to EndRoundTrip()</returns>
+long long StartRoundTrip(ROUNDTRIP* round_trip, CONNECTION* connection);
+
+/// <summary>
+/// End timing a request: a response is a sample, and a receive that failed after the timeout doubles the timeout
+/// until the next sample. Other failures are not counted.
+/// </summary>
+/// <param name="round_trip">The estimator</param>
+/// <param name="start">Start of the request, from StartRoundTrip()</param>
+/// <param name="status">1 if the request got its response. Otherwise failed</param>
+/// <returns>1 if the request timed out. 0 otherwise</returns>
+int EndRoundTrip(ROUNDTRIP* round_trip, long long start, int status);
+
+/// <summary>
+/// Send a request and Receive its response within the timeout of the estimator, and Update it.
+/// A request that timed out leaves its response on the way: the connection should be closed.
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <param name="round_trip">The estimator of the connection</param>
+/// <param name="request">The request</param>
+/// <param name="oresponse">[Output] The response. Free with DestroyMessage(). NULL if failed</param>
+/// <returns>1 if success. 0 or -1 as SegmentationSend() and SegmentationReceive() return</returns>
+int RunTimedRequest(CONNECTION* connection, ROUNDTRIP* round_trip, const MESSAGE request, MESSAGE* oresponse);
+
+/// <summary>
+/// Add a round-trip time sample [RFC 6298] and Compute the timeout from it.
+/// </summary>
+/// <param name="round_trip">The estimator</param>
+/// <param name="sample">Time from sending a request to receiving its whole response, in milliseconds</param>
+void UpdateRoundTrip(ROUNDTRIP* round_trip, double sample);
+
+/// <summary>
+/// Double the timeout after a request timed out, up to the ceiling [RFC 6298 back off].
+/// </summary>
+/// <param name="round_trip">The estimator</param>
+void BackOffRoundTrip(ROUNDTRIP* round_trip);
+
+/// <summary>
+/// Print the round-trip estimate, the timeout and the timeout count of a connection to console.
+/// </summary>
+/// <param name="title">Name of the connection</param>
+/// <param name="round_trip">The estimator</param>
+void PrintRoundTrip(const char* title, const ROUNDTRIP* round_trip);
+
+#pragma endregion
@@ -0,0 +1,349 @@
+#include "SharedRing.h"
+
+int ReadSharedRing(const SHMRING* ring, LONG64* ohead, LONG64* otail)
+{
+	// each counter is read once: the checked values are the ones used
+	*ohead = ring->head;
+	*otail = ring->tail;
+	LONG64 count = *ohead - *otail;
+	if (*otail < 0 || count < 0 || count > SHM_RING_SIZE)
+		return -1;
+	return (int)count;
+}
+
+#ifdef _WIN32
+
+SHMLISTENER* CreateSharedListener(const char* name)
+{
+	char object_name[SHM_NAME_MAX_SIZE];
+	SHMLISTENER* listener = (SHMLISTENER*)malloc(sizeof(SHMLISTENER));
+	if (listener == NULL)
+		return NULL;
+	strncpy_s(listener->name, SHM_NAME_MAX_SIZE, name, _TRUNCATE);
+	listener->control = NULL;
+	listener->accept_event = NULL;
+	listener->accepted = 0;
+
+	snprintf(object_name, SHM_NAME_MAX_SIZE, "%s%s", SHM_NAME_PREFIX, name);
+	listener->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(SHMCONTROL), object_name);
+	if (listener->mapping == NULL || GetLastError() == ERROR_ALREADY_EXISTS) {
+		DestroySharedListener(listener);
+		return NULL;
+	}
+	listener->control = (SHMCONTROL*)MapViewOfFile(listener->mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SHMCONTROL));
+	snprintf(object_name, SHM_NAME_MAX_SIZE, "%s%s_accept", SHM_NAME_PREFIX, name);
+	listener->accept_event = CreateEventA(NULL, FALSE, FALSE, object_name);
+	if (listener->control == NULL || listener->accept_event == NULL) {
+		DestroySharedListener(listener);
+		return NULL;
+	}
+	listener->control->next_id = 0;
+	listener->control->server_pid = GetCurrentProcessId();
+	InterlockedExchange(&listener->control->magic, SHM_MAGIC);
+	return listener;
+}
+
+SHMCHANNEL* AcceptSharedChannel(SHMLISTENER* listener)
+{
+	ULONGLONG pending_since = 0;
+	while (1) {
+		LONG id = listener->accepted + 1;
+		if (id <= listener->control->next_id) {
+			SHMCHANNEL* channel = OpenSharedChannel(listener->name, id);
+			if (channel != NULL) {
+				listener->accepted = id;
+				return channel;
+			}
+			// the client reserved the id but has not published its session yet
+			if (pending_since == 0) {
+				pending_since = GetTickCount64();
+			}
+			else if (GetTickCount64() - pending_since > SHM_CONNECT_TIMEOUT) {
+				listener->accepted = id; // abandoned, the client died in between
+				pending_since = 0;
+				continue;
+			}
+		}
+		WaitForSingleObject(listener->accept_event, SHM_ACCEPT_POLL_INTERVAL);
+	}
+}
+
+void DestroySharedListener(SHMLISTENER* listener)
+{
+	if (listener == NULL)
+		return;
+	if (listener->control != NULL)
+		UnmapViewOfFile(listener->control);
+	if (listener->mapping != NULL)
+		CloseHandle(listener->mapping);
+	if (listener->accept_event != NULL)
+		CloseHandle(listener->accept_event);
+	free(listener);
+}
+
+SHMCHANNEL* ConnectSharedChannel(const char* name, int timeout)
+{
+	char object_name[SHM_NAME_MAX_SIZE];
+	snprintf(object_name, SHM_NAME_MAX_SIZE, "%s%s", SHM_NAME_PREFIX, name);
+	HANDLE control_mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, object_name);
+	if (control_mapping == NULL)
+		return NULL;
+	SHMCONTROL* control = (SHMCONTROL*)MapViewOfFile(control_mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SHMCONTROL));
+	snprintf(object_name, SHM_NAME_MAX_SIZE, "%s%s_accept", SHM_NAME_PREFIX, name);
+	HANDLE accept_event = OpenEventA(EVENT_MODIFY_STATE, FALSE, object_name);
+
+	SHMCHANNEL* channel = NULL;
+	if (control != NULL && accept_event != NULL && control->magic == SHM_MAGIC)
+		channel = (SHMCHANNEL*)calloc(1, sizeof(SHMCHANNEL));
+	if (channel != NULL) {
+		LONG id = InterlockedIncrement(&control->next_id);
+		snprintf(object_name, SHM_NAME_MAX_SIZE, "%s%s_%ld", SHM_NAME_PREFIX, name, id);
+		channel->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(SHMSEGMENT), object_name);
+		if (channel->mapping != NULL)
+			channel->segment = (SHMSEGMENT*)MapViewOfFile(channel->mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SHMSEGMENT));
+		snprintf(object_name, SHM_NAME_MAX_SIZE, "%s%s_%ld_client", SHM_NAME_PREFIX, name, id);
+		channel->wake = CreateEventA(NULL, FALSE, FALSE, object_name);
+		snprintf(object_name, SHM_NAME_MAX_SIZE, "%s%s_%ld_server", SHM_NAME_PREFIX, name, id);
+		channel->peer_wake = CreateEventA(NULL, FALSE, FALSE, object_name);
+		channel->peer = OpenProcess(SYNCHRONIZE, FALSE, control->server_pid);
+
+		if (channel->segment == NULL || channel->wake == NULL || channel->peer_wake == NULL || channel->peer == NULL) {
+			CloseSharedChannel(channel);
+			channel = NULL;
+		}
+		else {
+			// a new mapping is zero-filled: both rings are empty and open
+			channel->inbound = &channel->segment->responses;
+			channel->outbound = &channel->segment->requests;
+			channel->timeout = timeout;
+			channel->segment->client_pid = GetCurrentProcessId();
+			InterlockedExchange(&channel->segment->ready, 1);
+			SetEvent(accept_event);
+		}
+	}
+
+	if (accept_event != NULL)
+		CloseHandle(accept_event);
+	if (control != NULL)
+		UnmapViewOfFile(control);
+	CloseHandle(control_mapping);
+	return channel;
+}
+
+SHMCHANNEL* OpenSharedChannel(const char* name, LONG id)
+{
+	char object_name[SHM_NAME_MAX_SIZE];
+	SHMCHANNEL* channel = (SHMCHANNEL*)calloc(1, sizeof(SHMCHANNEL));
+	if (channel == NULL)
+		return NULL;
+	snprintf(object_name, SHM_NAME_MAX_SIZE, "%s%s_%ld", SHM_NAME_PREFIX, name, id);
+	channel->mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, object_name);
+	if (channel->mapping != NULL)
+		channel->segment = (SHMSEGMENT*)MapViewOfFile(channel->mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SHMSEGMENT));
+	if (channel->segment == NULL || channel->segment->ready != 1) {
+		CloseSharedChannel(channel);
+		return NULL;
+	}
+	snprintf(object_name, SHM_NAME_MAX_SIZE, "%s%s_%ld_server", SHM_NAME_PREFIX, name, id);
+	channel->wake = OpenEventA(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, object_name);
+	snprintf(object_name, SHM_NAME_MAX_SIZE, "%s%s_%ld_client", SHM_NAME_PREFIX, name, id);
+	channel->peer_wake = OpenEventA(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, object_name);
+	channel->peer = OpenProcess(SYNCHRONIZE, FALSE, channel->segment->client_pid);
+	if (channel->wake == NULL || channel->peer_wake == NULL || channel->peer == NULL) {
+		CloseSharedChannel(channel);
+		return NULL;
+	}
+	channel->inbound = &channel->segment->requests;
+	channel->outbound = &channel->segment->responses;
+	channel->timeout = 0;
+	return channel;
+}
+
+void CloseSharedChannel(SHMCHANNEL* channel)
+{
+	if (channel == NULL)
+		return;
+	if (channel->outbound != NULL) {
+		InterlockedExchange(&channel->outbound->closed, 1);
+		SetEvent(channel->peer_wake);
+	}
+	if (channel->segment != NULL)
+		UnmapViewOfFile(channel->segment);
+	if (channel->mapping != NULL)
+		CloseHandle(channel->mapping);
+	if (channel->wake != NULL)
+		CloseHandle(channel->wake);
+	if (channel->peer_wake != NULL)
+		CloseHandle(channel->peer_wake);
+	if (channel->peer != NULL)
+		CloseHandle(channel->peer);
+	free(channel);
+}
+
+int SharedSend(SHMCHANNEL* channel, const char* bytes, int length)
+{
+	SHMRING* ring = channel->outbound;
+	int written = 0;
+	while (written < length) {
+		if (!WaitSharedRing(channel, 1))
+			return SOCKET_ERROR;
+		if (channel->inbound->closed) {
+			WSASetLastError(WSAECONNRESET);
+			return SOCKET_ERROR;
+		}
+		LONG64 head, tail;
+		int used = ReadSharedRing(ring, &head, &tail);
+		if (used < 0) { // the ring was written over: handled as a dead peer
+			WSASetLastError(WSAECONNRESET);
+			return SOCKET_ERROR;
+		}
+		int space = SHM_RING_SIZE - used;
+		int position = (int)(head % SHM_RING_SIZE);
+		int count = min(space, length - written);
+		// copy up to the end of ring, then the rest from the beginning
+		int first = min(count, SHM_RING_SIZE - position);
+		memcpy(ring->data + position, bytes + written, first);
+		memcpy(ring->data, bytes + written + first, (size_t)count - first);
+
+		// publish, then check for a sleeping reader [full barriers on both sides, so no wakeup is lost]
+		InterlockedExchange64(&ring->head, head + count);
+		if (ring->reader_waiting)
+			SetEvent(channel->peer_wake);
+		written += count;
+	}
+	return written;
+}
+
+int SharedReceive(SHMCHANNEL* channel, char* obuffer, int capacity)
+{
+	SHMRING* ring = channel->inbound;
+	if (!WaitSharedRing(channel, 0))
+		return SOCKET_ERROR;
+	LONG64 head, tail;
+	int available = ReadSharedRing(ring, &head, &tail);
+	if (available < 0) { // the ring was written over: handled as a dead peer
+		WSASetLastError(WSAECONNRESET);
+		return SOCKET_ERROR;
+	}
+	if (available == 0) // closed and drained
+		return 0;
+	int position = (int)(tail % SHM_RING_SIZE);
+	int count = min(available, capacity);
+	int first = min(count, SHM_RING_SIZE - position);
+	memcpy(obuffer, ring->data + position, first);
+	memcpy(obuffer + first, ring->data, (size_t)count - first);
+
+	InterlockedExchange64(&ring->tail, tail + count);
+	if (ring->writer_waiting)
+		SetEvent(channel->peer_wake);
+	return count;
+}
+
+int IsSharedRingReady(SHMCHANNEL* channel, int for_space)
+{
+	// invalid counters make the side go on, to report them
+	LONG64 head, tail;
+	if (for_space) {
+		int count = ReadSharedRing(channel->outbound, &head, &tail);
+		return count < 0 || count < SHM_RING_SIZE || channel->inbound->closed;
+	}
+	int count = ReadSharedRing(channel->inbound, &head, &tail);
+	return count != 0 || channel->inbound->closed;
+}
+
+int WaitSharedRing(SHMCHANNEL* channel, int for_space)
+{
+	// the peer is usually about to publish: spinning is cheaper than sleeping
+	for (int i = 0; i < SHM_SPIN_COUNT; ++i) {
+		if (IsSharedRingReady(channel, for_space))
+			return 1;
+		YieldProcessor();
+	}
+
+	volatile LONG* waiting = for_space ? &channel->outbound->writer_waiting : &channel->inbound->reader_waiting;
+	HANDLE handles[2] = { channel->wake, channel->peer };
+	ULONGLONG start = GetTickCount64();
+	int is_ok = 1;
+	InterlockedExchange(waiting, 1);
+	// check again after announcing, the peer may have published in between
+	while (is_ok && !IsSharedRingReady(channel, for_space)) {
+		DWORD interval = INFINITE;
+		if (channel->timeout > 0) {
+			ULONGLONG elapsed = GetTickCount64() - start;
+			interval = elapsed >= (ULONGLONG)channel->timeout ? 0 : (DWORD)(channel->timeout - elapsed);
+		}
+		DWORD ret = WaitForMultipleObjects(2, handles, FALSE, interval);
+		if (ret == WAIT_OBJECT_0 + 1) {
+			WSASetLastError(WSAECONNRESET); // peer process exited without closing
+			is_ok = 0;
+		}
+		else if (ret == WAIT_TIMEOUT) {
+			WSASetLastError(WSAETIMEDOUT);
+			is_ok = 0;
+		}
+		else if (ret == WAIT_FAILED) {
+			WSASetLastError(WSAENOTSOCK);
+			is_ok = 0;
+		}
+	}
+	InterlockedExchange(waiting, 0);
+	return is_ok || IsSharedRingReady(channel, for_space);
+}
+
+#else
+
+// named shared memory and events are Windows only: elsewhere no listener is found and sessions go over sockets
+
+SHMLISTENER* CreateSharedListener(const char* name)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+SHMCHANNEL* AcceptSharedChannel(SHMLISTENER* listener)
+{
+	return NULL;
+}
+
+void DestroySharedListener(SHMLISTENER* listener)
+{
+}
+
+SHMCHANNEL* ConnectSharedChannel(const char* name, int timeout)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+SHMCHANNEL* OpenSharedChannel(const char* name, LONG id)
+{
+	return NULL;
+}
+
+void CloseSharedChannel(SHMCHANNEL* channel)
+{
+}
+
+int SharedSend(SHMCHANNEL* channel, const char* bytes, int length)
+{
+	WSASetLastError(ENOSYS);
+	return SOCKET_ERROR;
+}
+
+int SharedReceive(SHMCHANNEL* channel, char* obuffer, int capacity)
+{
+	WSASetLastError(ENOSYS);
+	return SOCKET_ERROR;
+}
+
+int IsSharedRingReady(SHMCHANNEL* channel, int for_space)
+{
+	return 0;
+}
+
+int WaitSharedRing(SHMCHANNEL* channel, int for_space)
+{
+	return 0;
+}
+
+#endif
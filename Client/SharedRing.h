@@ -0,0 +1,197 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#else
+#include "Portability.h"
+#endif
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define SHM_NAME_PREFIX "Local\\"
+#define SHM_NAME_MAX_SIZE 128
+#define SHM_MAGIC 0x52494E47 // "RING"
+#define SHM_RING_SIZE 65536 // Power of 2
+#define SHM_SPIN_COUNT 1024 // Spins before a side sleeps on its event
+#define SHM_CONNECT_TIMEOUT 1000 // A reserved session not published after this, in milliseconds, is skipped
+#define SHM_ACCEPT_POLL_INTERVAL 100
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef struct shmring {
+
+	volatile LONG64 head; // Total bytes written. Changed by producer only
+
+	char head_padding[64 - sizeof(LONG64)]; // Keep head and tail on separate cache lines
+
+	volatile LONG64 tail; // Total bytes read. Changed by consumer only
+
+	char tail_padding[64 - sizeof(LONG64)];
+
+	volatile LONG reader_waiting; // 1 if consumer sleeps until data is written
+
+	volatile LONG writer_waiting; // 1 if producer sleeps until space is freed
+
+	volatile LONG closed; // 1 if producer closed its side. Bytes written before are still read
+
+	char data[SHM_RING_SIZE]; // Ring storage. Byte i of the stream is at data[i % SHM_RING_SIZE]
+
+}SHMRING;
+
+typedef struct shmsegment {
+
+	volatile LONG ready; // 1 when client has initialized the segment
+
+	DWORD client_pid; // Process id of client, watched for crashes
+
+	SHMRING requests; // Client to server
+
+	SHMRING responses; // Server to client
+
+}SHMSEGMENT;
+
+typedef struct shmcontrol {
+
+	volatile LONG magic; // SHM_MAGIC when server has initialized the control block
+
+	DWORD server_pid; // Process id of server, watched for crashes
+
+	volatile LONG next_id; // Last session id reserved by a client
+
+}SHMCONTROL;
+
+typedef struct shmlistener {
+
+	char name[SHM_NAME_MAX_SIZE]; // The listener name. Session objects are named after it
+
+	HANDLE mapping; // File mapping of the control block
+
+	SHMCONTROL* control; // The control block
+
+	HANDLE accept_event; // Signaled by clients after publishing a session
+
+	LONG accepted; // Last session id accepted
+
+}SHMLISTENER;
+
+typedef struct shmchannel {
+
+	HANDLE mapping; // File mapping of the session segment
+
+	SHMSEGMENT* segment; // The session segment
+
+	SHMRING* inbound; // Ring this side reads from
+
+	SHMRING* outbound; // Ring this side writes to
+
+	HANDLE wake; // Event this side sleeps on
+
+	HANDLE peer_wake; // Event the peer sleeps on
+
+	HANDLE peer; // The peer process. Signaled if it exits
+
+	int timeout; // Maximum time to wait for the peer, in milliseconds. 0 for no limit
+
+}SHMCHANNEL;
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Create the control block and accept event of a shared memory listener.
+/// </summary>
+/// <param name="name">The listener name, shared with clients</param>
+/// <returns>The listener. NULL if have errors or another process already listens on [name]</returns>
+SHMLISTENER* CreateSharedListener(const char* name);
+
+/// <summary>
+/// Wait for the next client session and Open its channel. This function blocks until a client connects.
+/// </summary>
+/// <param name="listener">The listener</param>
+/// <returns>The channel to the client</returns>
+SHMCHANNEL* AcceptSharedChannel(SHMLISTENER* listener);
+
+/// <summary>
+/// Free a listener and its objects. Open channels are not affected.
+/// </summary>
+/// <param name="listener">The listener</param>
+void DestroySharedListener(SHMLISTENER* listener);
+
+/// <summary>
+/// Create a session on a shared memory listener of another process on the same host.
+/// </summary>
+/// <param name="name">The listener name</param>
+/// <param name="timeout">Maximum time to wait for the server on each call, in milliseconds. 0 for no limit</param>
+/// <returns>The channel to the server. NULL if have errors or no server listens on [name]</returns>
+SHMCHANNEL* ConnectSharedChannel(const char* name, int timeout);
+
+/// <summary>
+/// Open the channel of a session published by client. [Server side]
+/// </summary>
+/// <param name="name">The listener name</param>
+/// <param name="id">The session id</param>
+/// <returns>The channel. NULL if the session is not published yet</returns>
+SHMCHANNEL* OpenSharedChannel(const char* name, LONG id);
+
+/// <summary>
+/// Close this side of a channel, Wake the peer and Free the channel. Bytes already written can still be read by the peer.
+/// </summary>
+/// <param name="channel">The channel. NULL is ignored</param>
+void CloseSharedChannel(SHMCHANNEL* channel);
+
+/// <summary>
+/// Write bytes to the outbound ring. Block while the ring is full. [Same result as send()]
+/// </summary>
+/// <param name="channel">The channel</param>
+/// <param name="bytes">The bytes want to write</param>
+/// <param name="length">Number of bytes</param>
+/// <returns>[length] if success. SOCKET_ERROR if the peer is gone or timeout, see WSAGetLastError()</returns>
+int SharedSend(SHMCHANNEL* channel, const char* bytes, int length);
+
+/// <summary>
+/// Read available bytes from the inbound ring. Block while the ring is empty. [Same result as recv()]
+/// </summary>
+/// <param name="channel">The channel</param>
+/// <param name="obuffer">[Output] The bytes read</param>
+/// <param name="capacity">Maximum number of bytes want to read</param>
+/// <returns>Number of bytes read. 0 if the peer closed its side. SOCKET_ERROR if the peer is gone or timeout, see WSAGetLastError()</returns>
+int SharedReceive(SHMCHANNEL* channel, char* obuffer, int capacity);
+
+/// <summary>
+/// Read the counters of a ring once each and Check them: the peer can write the whole segment, so they are not trusted.
+/// </summary>
+/// <param name="ring">The ring</param>
+/// <param name="ohead">[Output] Total bytes written</param>
+/// <param name="otail">[Output] Total bytes read</param>
+/// <returns>Number of bytes in the ring. -1 if the counters are invalid: tail negative, or head before tail or ahead by more than SHM_RING_SIZE</returns>
+int ReadSharedRing(const SHMRING* ring, LONG64* ohead, LONG64* otail);
+
+/// <summary>
+/// Check whether a side can go on: the inbound ring has data, or the outbound ring has space.
+/// The side can also go on if the peer closed, to report it.
+/// </summary>
+/// <param name="channel">The channel</param>
+/// <param name="for_space">1 to check the outbound ring for space. 0 to check the inbound ring for data</param>
+/// <returns>1 if ready. 0 otherwise</returns>
+int IsSharedRingReady(SHMCHANNEL* channel, int for_space);
+
+/// <summary>
+/// Wait until IsSharedRingReady(). Spin a while first, then Announce the wait and Sleep on the event of this side.
+/// </summary>
+/// <param name="channel">The channel</param>
+/// <param name="for_space">1 to wait for space in the outbound ring. 0 to wait for data in the inbound ring</param>
+/// <returns>1 if ready. 0 if the peer is gone or timeout, see WSAGetLastError()</returns>
+int WaitSharedRing(SHMCHANNEL* channel, int for_space);
+
+#pragma endregion
@@ -0,0 +1,73 @@
+#include "Histogram.h"
+
+void ResetHistogram(HISTOGRAM* histogram)
+{
+    memset(histogram, 0, sizeof(HISTOGRAM));
+    histogram->min = ~0ULL;
+}
+
+void RecordValue(HISTOGRAM* histogram, unsigned long long value)
+{
+    histogram->counts[GetBucketIndex(value)]++;
+    histogram->total++;
+    histogram->sum += value;
+    if (value < histogram->min)
+        histogram->min = value;
+    if (value > histogram->max)
+        histogram->max = value;
+}
+
+void MergeHistogram(HISTOGRAM* destination, const HISTOGRAM* source)
+{
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+        destination->counts[i] += source->counts[i];
+    destination->total += source->total;
+    destination->sum += source->sum;
+    if (source->min < destination->min)
+        destination->min = source->min;
+    if (source->max > destination->max)
+        destination->max = source->max;
+}
+
+unsigned long long GetValueAtPercentile(const HISTOGRAM* histogram, double percent)
+{
+    if (histogram->total == 0)
+        return 0;
+    unsigned long long rank = (unsigned long long)(percent / 100.0 * histogram->total + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > histogram->total)
+        rank = histogram->total;
+    unsigned long long seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += histogram->counts[i];
+        if (seen >= rank) {
+            // the bucket bound may be past the largest value seen
+            unsigned long long value = GetBucketHighestValue(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+int GetBucketIndex(unsigned long long value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS)
+        return (int)value;
+    // shift the value into [HALF_BUCKETS, SUB_BUCKETS): the shift is its magnitude
+    int magnitude = 0;
+    while ((value >> magnitude) >= HISTOGRAM_SUB_BUCKETS)
+        ++magnitude;
+    if (magnitude > HISTOGRAM_MAGNITUDES)
+        return HISTOGRAM_BUCKETS - 1;
+    return (magnitude + 1) * HISTOGRAM_HALF_BUCKETS + (int)(value >> magnitude) - HISTOGRAM_HALF_BUCKETS;
+}
+
+unsigned long long GetBucketHighestValue(int index)
+{
+    if (index < HISTOGRAM_SUB_BUCKETS)
+        return (unsigned long long)index;
+    int magnitude = index / HISTOGRAM_HALF_BUCKETS - 1;
+    unsigned long long lowest = (unsigned long long)(index % HISTOGRAM_HALF_BUCKETS + HISTOGRAM_HALF_BUCKETS) << magnitude;
+    return lowest + (1ULL << magnitude) - 1;
+}
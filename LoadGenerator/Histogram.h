@@ -0,0 +1,86 @@
+#pragma once
+
+// Log-linear latency histogram, like HdrHistogram: fixed memory, and about 2 significant digits at any magnitude.
+// Values from 0 to HISTOGRAM_SUB_BUCKETS are counted exactly. Above, each power of 2 is split into HISTOGRAM_SUB_BUCKETS / 2 buckets.
+
+#pragma region Header Declarations
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define HISTOGRAM_SUB_BUCKET_BITS 8
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS) // Buckets of values below it. Relative error of larger values is 2 / HISTOGRAM_SUB_BUCKETS
+#define HISTOGRAM_HALF_BUCKETS (HISTOGRAM_SUB_BUCKETS / 2)
+#define HISTOGRAM_MAGNITUDES 30 // Number of powers of 2 above HISTOGRAM_SUB_BUCKETS. Larger values are counted in the last bucket
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAGNITUDES + 2) * HISTOGRAM_HALF_BUCKETS)
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef struct histogram {
+
+    unsigned long long counts[HISTOGRAM_BUCKETS]; // Number of values of each bucket
+
+    unsigned long long total; // Number of values
+
+    unsigned long long sum; // Sum of all values, for the mean
+
+    unsigned long long min; // The smallest value. Exact
+
+    unsigned long long max; // The largest value. Exact
+
+}HISTOGRAM;
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Empty a histogram.
+/// </summary>
+/// <param name="histogram">The histogram</param>
+void ResetHistogram(HISTOGRAM* histogram);
+
+/// <summary>
+/// Count a value.
+/// </summary>
+/// <param name="histogram">The histogram</param>
+/// <param name="value">The value, e.g. a latency in microseconds</param>
+void RecordValue(HISTOGRAM* histogram, unsigned long long value);
+
+/// <summary>
+/// Add the values of a histogram to another one. Used to merge the histograms of threads after the run.
+/// </summary>
+/// <param name="destination">The histogram added to</param>
+/// <param name="source">The histogram added</param>
+void MergeHistogram(HISTOGRAM* destination, const HISTOGRAM* source);
+
+/// <summary>
+/// Get a percentile [nearest-rank]. The value is the largest value of its bucket, so the percentile is never under-reported.
+/// </summary>
+/// <param name="histogram">The histogram</param>
+/// <param name="percent">The percentile want to get, from 0 to 100</param>
+/// <returns>The value at the percentile. 0 if have no values</returns>
+unsigned long long GetValueAtPercentile(const HISTOGRAM* histogram, double percent);
+
+/// <summary>
+/// Get the bucket a value is counted in.
+/// </summary>
+/// <param name="value">The value</param>
+/// <returns>Index of the bucket</returns>
+int GetBucketIndex(unsigned long long value);
+
+/// <summary>
+/// Get the largest value counted in a bucket.
+/// </summary>
+/// <param name="index">Index of the bucket</param>
+/// <returns>The value</returns>
+unsigned long long GetBucketHighestValue(int index);
+
+#pragma endregion
@@ -0,0 +1,412 @@
+#include "LoadGenerator.h"
+
+const char* LoadOperationNames[LOAD_OPERATIONS] = { "login", "post", "logout" };
+
+int main(int argc, char* argv[])
+{
+    LOADOPTIONS options = { 0 };
+    options.connections = LOAD_DEFAULT_CONNECTIONS;
+    options.threads = LOAD_DEFAULT_THREADS;
+    options.duration = LOAD_DEFAULT_DURATION;
+    options.rampup = LOAD_DEFAULT_RAMPUP;
+    options.think = LOAD_DEFAULT_THINK;
+    options.mix[LOAD_LOGIN] = 1;
+    options.mix[LOAD_POST] = 8;
+    options.mix[LOAD_LOGOUT] = 1;
+    options.account = LOAD_DEFAULT_ACCOUNT;
+    if (!ExtractLoadOptions(argc, argv, &options)) {
+        printf("[%s] %s\n", WARNING_FLAGS, _CONVERT_ARGUMENTS_FAIL);
+        printf("[%s] %s\n", INFO_FLAGS, _LOAD_USAGE);
+        return 1;
+    }
+    if (options.account_file != NULL)
+        return WriteAccountFile(&options) ? 0 : 1;
+
+    int is_ok = WSInitialize();
+    if (is_ok) {
+        is_ok = RunLoad(&options);
+        WSCleanup();
+    }
+    printf("[%s] Stopping...\n", INFO_FLAGS);
+    return is_ok ? 0 : 1;
+}
+
+#pragma region Run
+
+int RunLoad(const LOADOPTIONS* options)
+{
+    int threads = min(max(options->threads, 1), max(options->connections, 1));
+    LOADWORKER* workers = (LOADWORKER*)calloc(threads, sizeof(LOADWORKER));
+    LOADSESSION* sessions = (LOADSESSION*)calloc(max(options->connections, 1), sizeof(LOADSESSION));
+    HANDLE* handles = (HANDLE*)malloc(sizeof(HANDLE) * threads);
+    LOADWORKER* total = (LOADWORKER*)calloc(1, sizeof(LOADWORKER));
+    if (workers == NULL || sessions == NULL || handles == NULL || total == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        free(workers);
+        free(sessions);
+        free(handles);
+        free(total);
+        return 0;
+    }
+
+    printf("[%s] Load: %d connections on %d threads, ramp-up %d s, measured %d s, think %d ms, mix %d,%d,%d\n", OUTPUT_FLAGS,
+        options->connections, threads, options->rampup, options->duration, options->think,
+        options->mix[LOAD_LOGIN], options->mix[LOAD_POST], options->mix[LOAD_LOGOUT]);
+    LARGE_INTEGER frequency, begin;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&begin);
+    long long measure_start = begin.QuadPart + (long long)options->rampup * frequency.QuadPart;
+    long long end = measure_start + (long long)options->duration * frequency.QuadPart;
+    int assigned = 0;
+    for (int i = 0; i < threads; ++i) {
+        workers[i].options = options;
+        workers[i].sessions = sessions + assigned;
+        workers[i].session_count = options->connections / threads + (i < options->connections % threads);
+        workers[i].measure_start = measure_start;
+        workers[i].end = end;
+        workers[i].random = 0x9E3779B97F4A7C15ULL * (i + 1);
+        for (int j = 0; j < LOAD_OPERATIONS; ++j)
+            ResetHistogram(&workers[i].latencies[j]);
+        for (int j = 0; j < workers[i].session_count; ++j) {
+            // connections of all workers open in turn, evenly over the ramp-up
+            LOADSESSION* session = &workers[i].sessions[j];
+            session->index = assigned + j;
+            session->socket = INVALID_SOCKET;
+            session->connection = NULL;
+            session->is_login = 0;
+            session->due = begin.QuadPart + (long long)options->rampup * frequency.QuadPart * (j * threads + i) / max(options->connections, 1);
+        }
+        assigned += workers[i].session_count;
+    }
+    for (int i = 0; i < threads; ++i) {
+        handles[i] = (HANDLE)_beginthreadex(NULL, 0, RunLoadWorker, (void*)&workers[i], 0, 0);
+        if (handles[i] == 0) // run it here instead
+            RunLoadWorker((void*)&workers[i]);
+    }
+
+    long long stopped = end;
+    for (int j = 0; j < LOAD_OPERATIONS; ++j)
+        ResetHistogram(&total->latencies[j]);
+    for (int i = 0; i < threads; ++i) {
+        if (handles[i] != 0) {
+            WaitForSingleObject(handles[i], INFINITE);
+            CloseHandle(handles[i]);
+        }
+        for (int j = 0; j < LOAD_OPERATIONS; ++j) {
+            MergeHistogram(&total->latencies[j], &workers[i].latencies[j]);
+            total->requests[j] += workers[i].requests[j];
+            total->failures[j] += workers[i].failures[j];
+        }
+        for (int j = 0; j < LOAD_STATUS_CODES; ++j)
+            total->statuses[j] += workers[i].statuses[j];
+        total->connects += workers[i].connects;
+        total->connect_failures += workers[i].connect_failures;
+        total->broken += workers[i].broken;
+        stopped = max(stopped, workers[i].stopped);
+    }
+    PrintLoadReport(total, threads, (double)(stopped - measure_start) * 1000.0 / frequency.QuadPart);
+
+    int is_ok = (total->requests[LOAD_LOGIN] + total->requests[LOAD_POST] + total->requests[LOAD_LOGOUT]) > 0;
+    free(workers);
+    free(sessions);
+    free(handles);
+    free(total);
+    return is_ok;
+}
+
+unsigned __stdcall RunLoadWorker(void* arguments)
+{
+    LOADWORKER* worker = (LOADWORKER*)arguments;
+    LARGE_INTEGER frequency, now;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&now);
+    while (now.QuadPart < worker->end && worker->session_count > 0) {
+        LOADSESSION* next = &worker->sessions[0];
+        for (int i = 1; i < worker->session_count; ++i) {
+            if (worker->sessions[i].due < next->due)
+                next = &worker->sessions[i];
+        }
+        if (next->due > now.QuadPart) {
+            // round down: oversleeping is recorded as latency of the request that is due
+            long long wait = min(next->due, worker->end) - now.QuadPart;
+            Sleep((DWORD)min(wait * 1000 / frequency.QuadPart, LOAD_SLEEP_MAX));
+        }
+        else if (next->connection == NULL) {
+            OpenLoadSession(worker, next);
+        }
+        else {
+            RunLoadRequest(worker, next);
+            QueryPerformanceCounter(&now);
+            next->due = now.QuadPart + GetThinkTime(worker, frequency.QuadPart);
+        }
+        QueryPerformanceCounter(&now);
+    }
+    worker->stopped = now.QuadPart;
+
+    for (int i = 0; i < worker->session_count; ++i)
+        CloseLoadSession(&worker->sessions[i]);
+    return 0;
+}
+
+int OpenLoadSession(LOADWORKER* worker, LOADSESSION* session)
+{
+    LARGE_INTEGER frequency, now;
+    QueryPerformanceFrequency(&frequency);
+    worker->connects++;
+    session->socket = CreateSocket(TCP);
+    // connect() directly: a refused connection is counted, not printed
+    if (session->socket != INVALID_SOCKET && connect(session->socket, (SOCKADDR*)&worker->options->server, sizeof(worker->options->server)) != SOCKET_ERROR) {
+        SetReceiveTimeout(session->socket, RECEIVE_TIMEOUT_INTERVAL);
+        session->connection = CreateConnection(session->socket);
+    }
+    QueryPerformanceCounter(&now);
+    if (session->connection == NULL) {
+        worker->connect_failures++;
+        CloseLoadSession(session);
+        session->due = now.QuadPart + (long long)LOAD_RETRY_INTERVAL * frequency.QuadPart / 1000;
+        return 0;
+    }
+    session->is_login = 0;
+    session->due = now.QuadPart;
+    return 1;
+}
+
+void CloseLoadSession(LOADSESSION* session)
+{
+    // a socket that failed to connect has nothing to shut down
+    int mode = session->connection != NULL ? CLOSE_SAFELY : CLOSE_NORMAL;
+    DestroyConnection(session->connection);
+    session->connection = NULL;
+    if (session->socket != INVALID_SOCKET)
+        CloseSocket(session->socket, mode, SD_BOTH);
+    session->socket = INVALID_SOCKET;
+    session->is_login = 0;
+}
+
+int RunLoadRequest(LOADWORKER* worker, LOADSESSION* session)
+{
+    int operation = ChooseLoadOperation(worker, session);
+    MESSAGE request = NULL;
+    int expected_status;
+    if (operation == LOAD_LOGIN) {
+        char name[LOAD_ACCOUNT_NAME_SIZE];
+        GetLoadAccountName(worker->options, session->index, name);
+        request = CreateMessage(CM_LOGIN, name);
+        expected_status = session->is_login ? S_LOGGEDIN : S_LOGIN_SUCC;
+    }
+    else if (operation == LOAD_POST) {
+        request = CreateMessage(CM_POST, BENCH_ARTICLE);
+        expected_status = S_POST_SUCC;
+    }
+    else {
+        request = CreateMessage(CM_LOGOUT, NULL);
+        expected_status = S_LOGOUT_SUCC;
+    }
+    if (request == NULL)
+        return 0;
+
+    LARGE_INTEGER frequency, end;
+    QueryPerformanceFrequency(&frequency);
+    // measure from when the request was due, not when it is sent: the time it waits behind
+    // the other sessions of the worker is part of its latency [no coordinated omission]
+    long long start = max(session->due, worker->measure_start);
+    MESSAGE response = NULL;
+    int status = SegmentationSend(session->connection, request, (int)strlen(request) + 1, NULL);
+    if (status == 1)
+        status = SegmentationReceive(session->connection, &response);
+    QueryPerformanceCounter(&end);
+    DestroyMessage(request);
+    if (status != 1) {
+        DestroyMessage(response);
+        worker->broken++;
+        CloseLoadSession(session);
+        return -1;
+    }
+
+    int response_status = GetResponseStatus(response);
+    DestroyMessage(response);
+    int is_expected = (response_status == expected_status);
+    if (response_status == S_LOGIN_SUCC)
+        session->is_login = 1;
+    else if (response_status == S_LOGOUT_SUCC)
+        session->is_login = 0;
+
+    if (end.QuadPart >= worker->measure_start) {
+        RecordValue(&worker->latencies[operation], (unsigned long long)((end.QuadPart - start) * 1000000 / frequency.QuadPart));
+        worker->requests[operation]++;
+        worker->failures[operation] += !is_expected;
+        if (response_status >= 0 && response_status < LOAD_STATUS_CODES)
+            worker->statuses[response_status]++;
+    }
+    return is_expected;
+}
+
+int ChooseLoadOperation(LOADWORKER* worker, const LOADSESSION* session)
+{
+    const int* mix = worker->options->mix;
+    int weights = mix[LOAD_LOGIN] + mix[LOAD_POST] + mix[LOAD_LOGOUT];
+    if (!session->is_login || weights <= 0)
+        return LOAD_LOGIN;
+    int pick = (int)(NextRandom(&worker->random) % (unsigned int)weights);
+    for (int i = 0; i < LOAD_OPERATIONS; ++i) {
+        if (pick < mix[i])
+            return i;
+        pick -= mix[i];
+    }
+    return LOAD_POST;
+}
+
+long long GetThinkTime(LOADWORKER* worker, long long frequency)
+{
+    if (worker->options->think <= 0)
+        return 0;
+    unsigned int pause = NextRandom(&worker->random) % (2U * worker->options->think + 1);
+    return (long long)pause * frequency / 1000;
+}
+
+unsigned int NextRandom(unsigned long long* state)
+{
+    unsigned long long x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return (unsigned int)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+#pragma endregion
+
+#pragma region Report
+
+void PrintLoadReport(const LOADWORKER* total, int threads, double elapsed)
+{
+    int requests = 0, failures = 0;
+    HISTOGRAM* all = (HISTOGRAM*)malloc(sizeof(HISTOGRAM));
+    if (all != NULL)
+        ResetHistogram(all);
+    for (int i = 0; i < LOAD_OPERATIONS; ++i) {
+        requests += total->requests[i];
+        failures += total->failures[i];
+        if (all != NULL)
+            MergeHistogram(all, &total->latencies[i]);
+    }
+    double throughput = elapsed > 0 ? requests * 1000.0 / elapsed : 0;
+    printf("[%s] Load: %d requests (%d failed) in %.1f ms, %.0f requests/s\n", OUTPUT_FLAGS, requests, failures, elapsed, throughput);
+    printf("[%s] Load: %d connects (%d failed), %d connections broken\n", OUTPUT_FLAGS, total->connects, total->connect_failures, total->broken);
+    printf("[%s] Load: at most %d requests in flight (one per thread, not per connection), latency measured from when each request was due\n", OUTPUT_FLAGS, threads);
+    if (all != NULL)
+        PrintLatencies("all", all);
+    for (int i = 0; i < LOAD_OPERATIONS; ++i) {
+        if (total->requests[i] > 0)
+            PrintLatencies(LoadOperationNames[i], &total->latencies[i]);
+    }
+    printf("[%s] Load: status", OUTPUT_FLAGS);
+    for (int i = 0; i < LOAD_STATUS_CODES; ++i) {
+        if (total->statuses[i] > 0)
+            printf(" %02d=%d", i, total->statuses[i]);
+    }
+    printf("\n");
+    free(all);
+}
+
+void PrintLatencies(const char* title, const HISTOGRAM* histogram)
+{
+    double mean = histogram->total > 0 ? (double)histogram->sum / histogram->total : 0;
+    printf("[%s] Load: %-6s latency us p50=%llu p99=%llu p999=%llu max=%llu mean=%.1f (%llu requests)\n", OUTPUT_FLAGS, title,
+        GetValueAtPercentile(histogram, 50), GetValueAtPercentile(histogram, 99), GetValueAtPercentile(histogram, 99.9),
+        histogram->max, mean, histogram->total);
+}
+
+#pragma endregion
+
+#pragma region Utilities
+
+void GetLoadAccountName(const LOADOPTIONS* options, int index, char* oname)
+{
+    int accounts = options->accounts > 0 ? options->accounts : options->connections;
+    snprintf(oname, LOAD_ACCOUNT_NAME_SIZE, "%s%d", options->account, index % max(accounts, 1));
+}
+
+int WriteAccountFile(const LOADOPTIONS* options)
+{
+    FILE* fp;
+    fopen_s(&fp, options->account_file, "w");
+    if (fp == NULL) {
+        printf("[%s] %s '%s'\n", ERROR_FLAGS, _WRITE_ACCOUNT_FILE_FAIL, options->account_file);
+        return 0;
+    }
+    int accounts = options->accounts > 0 ? options->accounts : options->connections;
+    char name[LOAD_ACCOUNT_NAME_SIZE];
+    for (int i = 0; i < accounts; ++i) {
+        GetLoadAccountName(options, i, name);
+        fprintf(fp, "%s %d\n", name, 0); // AS_FREE
+    }
+    int is_ok = (fclose(fp) == 0);
+    if (is_ok)
+        printf("[%s] %d accounts written to '%s'.\n", INFO_FLAGS, accounts, options->account_file);
+    return is_ok;
+}
+
+int ExtractLoadOptions(int argc, char* argv[], LOADOPTIONS* ooptions)
+{
+    IP ip;
+    int port = argc < 3 ? 0 : atoi(argv[2]);
+    if (port == 0 || !TryParseIPString(argv[1], &ip))
+        return 0;
+    ooptions->server = CreateSocketAddress(ip, port);
+    for (int i = 3; i < argc; ++i) {
+        char* equal_pos = strchr(argv[i], '=');
+        int name_len = equal_pos == NULL ? (int)strlen(argv[i]) : (int)(equal_pos - argv[i]);
+        const char* value = equal_pos == NULL ? "" : equal_pos + 1;
+        if (name_len == (int)strlen(OPT_CONNECTIONS) && strncmp(argv[i], OPT_CONNECTIONS, name_len) == 0 && atoi(value) > 0) {
+            ooptions->connections = atoi(value);
+        }
+        else if (name_len == (int)strlen(OPT_THREADS) && strncmp(argv[i], OPT_THREADS, name_len) == 0 && atoi(value) > 0) {
+            ooptions->threads = atoi(value);
+        }
+        else if (name_len == (int)strlen(OPT_DURATION) && strncmp(argv[i], OPT_DURATION, name_len) == 0 && atoi(value) > 0) {
+            ooptions->duration = atoi(value);
+        }
+        else if (name_len == (int)strlen(OPT_RAMPUP) && strncmp(argv[i], OPT_RAMPUP, name_len) == 0) {
+            ooptions->rampup = max(atoi(value), 0);
+        }
+        else if (name_len == (int)strlen(OPT_THINK) && strncmp(argv[i], OPT_THINK, name_len) == 0) {
+            ooptions->think = max(atoi(value), 0);
+        }
+        else if (name_len == (int)strlen(OPT_MIX) && strncmp(argv[i], OPT_MIX, name_len) == 0 && strlen(value) > 0) {
+            ExtractIntegerList(value, ooptions->mix, LOAD_OPERATIONS);
+            for (int j = 0; j < LOAD_OPERATIONS; ++j)
+                ooptions->mix[j] = max(ooptions->mix[j], 0);
+        }
+        else if (name_len == (int)strlen(OPT_ACCOUNT) && strncmp(argv[i], OPT_ACCOUNT, name_len) == 0 && strlen(value) > 0) {
+            ooptions->account = value;
+        }
+        else if (name_len == (int)strlen(OPT_ACCOUNTS) && strncmp(argv[i], OPT_ACCOUNTS, name_len) == 0) {
+            ooptions->accounts = max(atoi(value), 0);
+        }
+        else if (name_len == (int)strlen(OPT_ACCOUNT_FILE) && strncmp(argv[i], OPT_ACCOUNT_FILE, name_len) == 0 && strlen(value) > 0) {
+            ooptions->account_file = value;
+        }
+        else {
+            printf("[%s] Unknown option ignored: '%s'\n", WARNING_FLAGS, argv[i]);
+        }
+    }
+    return 1;
+}
+
+int ExtractIntegerList(const char* text, int* ovalues, int capacity)
+{
+    int count = 0;
+    while (count < capacity) {
+        ovalues[count++] = atoi(text);
+        text = strchr(text, ',');
+        if (text == NULL)
+            break;
+        ++text;
+    }
+    for (int i = count; i < capacity; ++i)
+        ovalues[i] = ovalues[count - 1];
+    return count;
+}
+
+#pragma endregion
@@ -0,0 +1,229 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include "Client.h"
+#include "Histogram.h"
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define OPT_CONNECTIONS "connections" // Also OPT_THREADS and OPT_ACCOUNT of the client
+#define OPT_DURATION "duration"
+#define OPT_RAMPUP "rampup"
+#define OPT_THINK "think"
+#define OPT_MIX "mix"
+#define OPT_ACCOUNTS "accounts"
+#define OPT_ACCOUNT_FILE "accountfile"
+
+#define LOAD_DEFAULT_CONNECTIONS 1000
+#define LOAD_DEFAULT_THREADS 16
+#define LOAD_DEFAULT_DURATION 10 // Measured run time, in seconds. After the ramp-up
+#define LOAD_DEFAULT_RAMPUP 5 // Time the connections are opened over, in seconds. Not measured
+#define LOAD_DEFAULT_THINK 100 // Mean pause of a session between two requests, in milliseconds
+#define LOAD_DEFAULT_ACCOUNT "load"
+#define LOAD_RETRY_INTERVAL 1000 // Pause of a session before it connects again after a failure, in milliseconds
+#define LOAD_SLEEP_MAX 100 // Longest sleep of a worker waiting for its next request, in milliseconds: the end of the run is not missed
+#define LOAD_ACCOUNT_NAME_SIZE 64
+
+#define LOAD_LOGIN 0
+#define LOAD_POST 1
+#define LOAD_LOGOUT 2
+#define LOAD_OPERATIONS 3
+
+#define LOAD_STATUS_CODES 100 // Status codes are 2 digits
+
+#define _LOAD_USAGE "Usage: LoadGenerator <ip> <port> [connections=<n>] [threads=<n>] [duration=<s>] [rampup=<s>] [think=<ms>] [mix=<login>,<post>,<logout>] [account=<prefix>] [accounts=<n>] [accountfile=<path>]"
+#define _WRITE_ACCOUNT_FILE_FAIL "Fail to write the account file."
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef struct loadoptions {
+
+    ADDRESS server; // The server address
+
+    int connections; // Number of sessions, each on its own connection. Option: connections=<n>
+
+    int threads; // Number of threads the sessions are spread over. Option: threads=<n>
+
+    int duration; // Measured run time, in seconds. Option: duration=<s>
+
+    int rampup; // Time the connections are opened over, evenly, in seconds. Option: rampup=<s>
+
+    int think; // Mean pause between two requests of a session, in milliseconds. Each pause is uniform in [0, 2 * think]. Option: think=<ms>
+
+    int mix[LOAD_OPERATIONS]; // Weights of the next request of a logged in session, by LOAD_ operation. A logged out session always logs in. Option: mix=<login>,<post>,<logout>
+
+    const char* account; // Accounts are named <account><index>. Option: account=<prefix>
+
+    int accounts; // Number of accounts. Session i uses account i % accounts. 0 for one account per session. Option: accounts=<n>
+
+    const char* account_file; // Write the accounts to this file for the server and exit, instead of the run. NULL if not used. Option: accountfile=<path>
+
+}LOADOPTIONS;
+
+typedef struct loadsession {
+
+    int index; // Index of the session among all sessions
+
+    SOCKET socket; // The socket. INVALID_SOCKET while not connected
+
+    CONNECTION* connection; // The connection. NULL while not connected
+
+    int is_login; // 1 if the account of the session is logged in
+
+    long long due; // Time of the next request or connect, in QueryPerformanceCounter() ticks
+
+}LOADSESSION;
+
+typedef struct loadworker {
+
+    const LOADOPTIONS* options; // The run options
+
+    LOADSESSION* sessions; // The sessions this worker drives. Only one request of them is in flight at a time
+
+    int session_count; // Number of sessions
+
+    long long measure_start; // Responses received from this time on are measured, in ticks. The end of the ramp-up
+
+    long long end; // No requests are sent from this time on, in ticks
+
+    long long stopped; // [Output] Time the last response was received, in ticks
+
+    unsigned long long random; // State of the random number generator of the worker
+
+    HISTOGRAM latencies[LOAD_OPERATIONS]; // [Output] Latency of measured requests by LOAD_ operation, in microseconds
+
+    int requests[LOAD_OPERATIONS]; // [Output] Number of measured requests that got a response, by LOAD_ operation
+
+    int failures[LOAD_OPERATIONS]; // [Output] Number of measured requests that got an unexpected response, by LOAD_ operation
+
+    int statuses[LOAD_STATUS_CODES]; // [Output] Number of measured responses of each status code
+
+    int connects; // [Output] Number of connects tried, ramp-up included
+
+    int connect_failures; // [Output] Number of connects that failed
+
+    int broken; // [Output] Number of connections broken while sending or receiving
+
+}LOADWORKER;
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Run the sessions: open the connections over the ramp-up, then Measure the requests of the sessions for the duration,
+/// and Print throughput and latency percentiles.
+/// </summary>
+/// <param name="options">The run options</param>
+/// <returns>1 if the run is done and has measured requests. 0 if fail to allocate memory or have no responses</returns>
+int RunLoad(const LOADOPTIONS* options);
+
+/// <summary>
+/// Drive the sessions of one worker until the end of the run: Send the request of the session that is due first,
+/// or Sleep until it is due. [Call on threads created by RunLoad()]
+/// </summary>
+/// <param name="arguments">The worker. [LOADWORKER*]</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall RunLoadWorker(void* arguments);
+
+/// <summary>
+/// Connect a session to server. A session that fails to connect is due again after LOAD_RETRY_INTERVAL.
+/// </summary>
+/// <param name="worker">The worker of the session</param>
+/// <param name="session">The session</param>
+/// <returns>1 if success. 0 otherwise</returns>
+int OpenLoadSession(LOADWORKER* worker, LOADSESSION* session);
+
+/// <summary>
+/// Close the connection of a session. The account is logged out by server when the connection is closed.
+/// </summary>
+/// <param name="session">The session</param>
+void CloseLoadSession(LOADSESSION* session);
+
+/// <summary>
+/// Send the next request of a session and Receive its response. Count it if its response arrives in the measured time.
+/// Its latency is from when it was due [or the start of the measured time], so a request delayed by the other sessions of the worker is not under-counted.
+/// The session is closed if the connection is broken.
+/// </summary>
+/// <param name="worker">The worker of the session</param>
+/// <param name="session">The session</param>
+/// <returns>1 if the response has the expected status. 0 if it has another status. -1 if the connection is broken</returns>
+int RunLoadRequest(LOADWORKER* worker, LOADSESSION* session);
+
+/// <summary>
+/// Choose the next request of a session by the weights of the mix.
+/// </summary>
+/// <param name="worker">The worker of the session</param>
+/// <param name="session">The session</param>
+/// <returns>The LOAD_ operation</returns>
+int ChooseLoadOperation(LOADWORKER* worker, const LOADSESSION* session);
+
+/// <summary>
+/// Get a pause of a session between two requests: uniform in [0, 2 * think].
+/// </summary>
+/// <param name="worker">The worker of the session</param>
+/// <param name="frequency">Ticks per second</param>
+/// <returns>The pause, in ticks</returns>
+long long GetThinkTime(LOADWORKER* worker, long long frequency);
+
+/// <summary>
+/// Get the next number of a worker's random number generator [xorshift64*]. rand() is shared by all threads.
+/// </summary>
+/// <param name="state">The state of the generator. Not 0</param>
+/// <returns>The number</returns>
+unsigned int NextRandom(unsigned long long* state);
+
+/// <summary>
+/// Get the account name of a session.
+/// </summary>
+/// <param name="options">The run options</param>
+/// <param name="index">Index of the session</param>
+/// <param name="oname">[Output] The name. LOAD_ACCOUNT_NAME_SIZE bytes</param>
+void GetLoadAccountName(const LOADOPTIONS* options, int index, char* oname);
+
+/// <summary>
+/// Write the accounts of the run as an account file of server: one free account per line.
+/// </summary>
+/// <param name="options">The run options. account_file, account, accounts and connections are used</param>
+/// <returns>1 if success. 0 otherwise</returns>
+int WriteAccountFile(const LOADOPTIONS* options);
+
+/// <summary>
+/// Print throughput, failures, status codes and latency percentiles of a run to console.
+/// </summary>
+/// <param name="total">The counts of all workers added together</param>
+/// <param name="threads">Number of workers, which bounds the requests in flight</param>
+/// <param name="elapsed">Measured run time, in milliseconds</param>
+void PrintLoadReport(const LOADWORKER* total, int threads, double elapsed);
+
+/// <summary>
+/// Print the latency percentiles of a histogram to console.
+/// </summary>
+/// <param name="title">Name of the requests</param>
+/// <param name="histogram">The latencies, in microseconds</param>
+void PrintLatencies(const char* title, const HISTOGRAM* histogram);
+
+/// <summary>
+/// Extract the server address and the options from command line. Options follow the port number: name=value
+/// </summary>
+/// <param name="argc">Number of arguments</param>
+/// <param name="argv">The arguments</param>
+/// <param name="ooptions">[Output] The options. Keep the default of options not given</param>
+/// <returns>1 if the address is valid. 0 otherwise</returns>
+int ExtractLoadOptions(int argc, char* argv[], LOADOPTIONS* ooptions);
+
+/// <summary>
+/// Extract a comma separated list of integers. Missing values repeat the last one given.
+/// </summary>
+/// <param name="text">The list</param>
+/// <param name="ovalues">[Output] The integers</param>
+/// <param name="capacity">Number of entries of ovalues</param>
+/// <returns>Number of integers given</returns>
+int ExtractIntegerList(const char* text, int* ovalues, int capacity);
+
+#pragma endregion
@@ -7,8 +7,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef _WIN32
 #include <WinSock2.h>
 #include <WS2tcpip.h>
+#include <afunix.h>
+#else
+#include "Portability.h"
+#endif
+
+#include "Compression.h"
+#include "SharedRing.h"
 
 #pragma endregion
 
@@ -16,6 +24,7 @@
 
 #define RECEIVE_TIMEOUT_INTERVAL 10000
 #define APPLICATION_BUFF_MAX_SIZE 1024
+#define READ_AHEAD_BUFFER_SIZE 8192
 #define USER_INPUT_MAX_SIZE 1023
 #define MESSAGE_MAX_SIZE 1023
 
@@ -24,6 +33,9 @@
 
 #define UDP 0
 #define TCP 1
+#define LOCAL 2 // Unix domain stream socket, same host only
+
+#define LOCAL_PATH_MAX_SIZE UNIX_PATH_MAX
 
 #define CLOSE_NORMAL 0
 #define CLOSE_SAFELY 1
@@ -31,14 +43,26 @@
 #define SEGMENT_HEADER_REMAIN_SIZE 2
 #define SEGMENT_HEADER_CURRENT_SIZE 2
 #define SEGMENT_HEADER_SIZE 4
+#define SEGMENT_COMPRESSED_FLAG 0x8000
+#define SEGMENT_RAW_LENGTH_SIZE 2
+#define SEGMENT_MESSAGE_MAX_SIZE 65535 // Largest message sent in segments: its remaining bytes must fit SEGMENT_HEADER_REMAIN_SIZE bytes
 
 #define C_LOGIN 1
 #define C_POST 2
 #define C_LOGOUT 3
+#define C_COMPRESS 4
+#define C_TOKEN 5
+#define C_STATS 6
 
 #define CM_LOGIN "USER"
 #define CM_POST "POST"
 #define CM_LOGOUT "BYE"
+#define CM_COMPRESS "COMP"
+#define CM_TOKEN "TOKEN"
+#define CM_STATS "STATS"
+
+#define UDP_DATAGRAM_MAX_SIZE 1472 // Fits in one Ethernet frame
+#define TOKEN_TEXT_SIZE 17 // 16 hexadecimal digits and null
 
 #define COMMAND_LENGTH 5
 #define STATUS_LENGTH 2
@@ -47,9 +71,48 @@
 #pragma region Type Definitions
 
 #define ADDRESS SOCKADDR_IN
+#define LOCAL_ADDRESS SOCKADDR_UN
 #define IP IN_ADDR
 #define MESSAGE char*
 
+typedef struct connection {
+
+	SOCKET socket; // The connected socket
+
+	SHMCHANNEL* channel; // Shared memory channel used instead of socket. NULL for socket connections
+
+	char* buffer; // Read-ahead ring buffer. Bytes are pulled from socket in bulk and served from here
+
+	int capacity; // Size of read-ahead buffer, in bytes
+
+	int head; // Position of the first unread byte in buffer
+
+	int length; // Number of unread bytes in buffer
+
+	long long recv_calls; // Number of recv() calls made on this connection
+
+	long long send_calls; // Number of send() calls made on this connection
+
+	long long messages; // Number of complete messages received on this connection
+
+	COMPRESSOR* send_history; // Compression history for sent bytes. NULL if compression is not negotiated
+
+	COMPRESSOR* receive_history; // Compression history for received bytes. NULL if compression is not negotiated
+
+	int compress_threshold; // Messages shorter than this are sent without compression
+
+	char* send_buffer; // Output collected by Send() to be sent later in one call. NULL to send immediately
+
+	int send_length; // Number of bytes in send_buffer
+
+	int send_capacity; // Size of send_buffer, in bytes
+
+	void* session; // State the server keeps for the session, such as its timeouts. NULL if not used
+
+	void* stream; // The request streamed as its segments arrive, on the completion engine. NULL if none
+
+}CONNECTION;
+
 #pragma endregion
 
 #pragma region Error Debugging
@@ -118,11 +181,11 @@ int WSInitialize();
 int WSCleanup();
 
 /// <summary>
-/// Create a TCP/UDP Socket.
+/// Create a TCP/UDP/Unix domain Socket.
 /// </summary>
-/// <param name="protocol">TCP or UDP</param>
+/// <param name="protocol">TCP, UDP or LOCAL</param>
 /// <returns>
-/// Created TCP/UDP Socket.
+/// Created TCP/UDP/Unix domain Socket.
 /// INVALID_SOCKET if protocol is unexpected or have error on Winsock
 /// </returns>
 SOCKET CreateSocket(int protocol);
@@ -145,53 +208,124 @@ int CloseSocket(SOCKET socket, int mode, int flags = 0);
 ADDRESS CreateSocketAddress(IP ip, int port);
 
 /// <summary>
-/// Write a byte stream to the connected socket buffer and send
+/// Create a Unix domain socket address from a file system path
 /// </summary>
-/// <param name="sender">The connected socket that is used for sending byte stream</param>
+/// <param name="path">The socket file path. Truncated if longer than LOCAL_PATH_MAX_SIZE - 1</param>
+/// <returns>Created socket address</returns>
+LOCAL_ADDRESS CreateLocalSocketAddress(const char* path);
+
+/// <summary>
+/// Create a connection object with a read-ahead buffer for a connected socket.
+/// </summary>
+/// <param name="socket">The connected socket</param>
+/// <param name="buffer_size">Size of read-ahead buffer. Never smaller than APPLICATION_BUFF_MAX_SIZE. 0 for no buffer: the caller sets one up</param>
+/// <returns>The created connection. NULL if fail to allocate memory</returns>
+CONNECTION* CreateConnection(SOCKET socket, int buffer_size = READ_AHEAD_BUFFER_SIZE);
+
+/// <summary>
+/// Free memory used for a connection object. [The socket is not closed]
+/// </summary>
+/// <param name="connection">The connection want to free</param>
+void DestroyConnection(CONNECTION* connection);
+
+/// <summary>
+/// Enable compression on a connection after the handshake [CM_COMPRESS request and its response] is completed.
+/// Both sides start with histories preloaded with the shared dictionary.
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <param name="threshold">Messages shorter than this are sent without compression</param>
+/// <returns>1 if success. 0 if fail to allocate memory</returns>
+int EnableCompression(CONNECTION* connection, int threshold = COMPRESSION_MIN_SIZE);
+
+/// <summary>
+/// Write a byte stream to the connected socket buffer and send.
+/// If the connection collects output [send_buffer is not NULL], the bytes are appended to it instead
+/// </summary>
+/// <param name="sender">The connection that is used for sending byte stream</param>
 /// <param name="bytes">Number of bytes expected to send</param>
 /// <param name="byte_stream">The byte stream want to send</param>
 /// <returns>1 if success. 0 if number of bytes sent less than expected. -1 if have errors that the socket should be closed</returns>
-int Send(SOCKET sender, int bytes, const char* byte_stream);
+int Send(CONNECTION* sender, int bytes, const char* byte_stream);
+
+/// <summary>
+/// Append bytes to the output collected on a connection. The buffer grows as needed
+/// </summary>
+/// <param name="sender">The connection that collects output</param>
+/// <param name="bytes">Number of bytes</param>
+/// <param name="byte_stream">The bytes want to append</param>
+/// <returns>1 if success. -1 if fail to allocate memory</returns>
+int AppendSendBuffer(CONNECTION* sender, int bytes, const char* byte_stream);
 
 /// <summary>
 /// Segmentation a message into pieces/segment and Send them with a connected socket.
 /// Each piece attached with the header consists of SEGMENT_HEADER_CURRENT_SIZE first bytes
 /// is the length of message in the piece (not include header size) and SEGMENT_HEADER_REMAIN_SIZE next bytes
 /// is the number of bytes on message that has not been sent.
+/// If compression is enabled, a piece may be compressed: its length has SEGMENT_COMPRESSED_FLAG set
+/// and SEGMENT_RAW_LENGTH_SIZE first bytes of the piece are the number of message bytes it holds.
 /// </summary>
-/// <param name="sender">The connected socket used for sending</param>
+/// <param name="sender">The connection used for sending</param>
 /// <param name="message">The message want to segmentation and send</param>
-/// <param name="message_len">The length of the message</param>
+/// <param name="message_len">The length of the message. A message longer than SEGMENT_MESSAGE_MAX_SIZE is not sent</param>
 /// <param name="obyte_sent">[Output] Number of bytes sent successfully</param>
 /// <returns>1 if success. 0 if number of bytes sent less than expected. -1 if have errors that the socket should be closed</returns>
-int SegmentationSend(SOCKET sender, const char* message, int message_len, int* obyte_sent);
+int SegmentationSend(CONNECTION* sender, const char* message, int message_len, int* obyte_sent);
+
+/// <summary>
+/// Make sure at least [bytes] bytes are available on the read-ahead buffer.
+/// Each recv() call pulls as many bytes as the socket has, up to the free space of the buffer.
+/// </summary>
+/// <param name="receiver">The connection that is used for receiving bytes stream</param>
+/// <param name="bytes">Number of bytes need to be available. Not exceed the buffer capacity</param>
+/// <returns>1 if success. -1 if have errors that the socket should be closed</returns>
+int FillReceiveBuffer(CONNECTION* receiver, int bytes);
+
+/// <summary>
+/// Copy [bytes] first unread bytes from the read-ahead buffer and Mark them as read. [Call FillReceiveBuffer() first]
+/// </summary>
+/// <param name="receiver">The connection holds the read-ahead buffer</param>
+/// <param name="bytes">Number of bytes want to copy</param>
+/// <param name="odestination">[Output] The memory space receives the bytes</param>
+void ReadReceiveBuffer(CONNECTION* receiver, int bytes, char* odestination);
 
 /// <summary>
-/// Read a byte stream from a connected socket 
+/// Read a byte stream from a connection. The bytes are served from read-ahead buffer.
 /// </summary>
-/// <param name="receiver">The connected socket that is used for receiving bytes stream</param>
+/// <param name="receiver">The connection that is used for receiving bytes stream</param>
 /// <param name="bytes">Number of bytes want to read</param>
 /// <param name="obyte_stream">[Output] The byte streams read</param>
 /// <returns>1 if read successfully. 0 if cant read fully. -1 if have errors that the socket should be closed</returns>
-int Receive(SOCKET receiver, int bytes, char** obyte_stream);
+int Receive(CONNECTION* receiver, int bytes, char** obyte_stream);
 
 /// <summary>
 /// Read and Extract one part of/a segment of a message from a connected socket.
+/// Compressed segments are decompressed, so the output is always the raw part of message.
 /// </summary>
-/// <param name="receiver">The connected socket that is used for receiving byte streams</param>
+/// <param name="receiver">The connection that is used for receiving byte streams</param>
 /// <param name="obyte_stream">[Output] The extracted segment, after removing SEGMENT_HEADER_SIZE first bytes from byte stream</param>
 /// <param name="ostream_len">[Output] The segment size, in bytes</param>
 /// <param name="oremain">[Output] Number of bytes in source message that have not been received</param>
 /// <returns>1 if success. 0 if cant read fully. -1 if have errors that the socket should be closed</returns>
-int ReceiveSegment(SOCKET receiver, char** obyte_stream, int* ostream_len, int* oremain);
+int ReceiveSegment(CONNECTION* receiver, char** obyte_stream, int* ostream_len, int* oremain);
+
+/// <summary>
+/// Merge the first segment of a message and the following segments read from a connected socket into a complete message.
+/// </summary>
+/// <param name="connection">The connection used to receive segments</param>
+/// <param name="segment">The first segment. [Freed by this function]</param>
+/// <param name="mlen">The first segment size, in bytes</param>
+/// <param name="remain">Number of bytes in message after the first segment</param>
+/// <param name="omessage">[Output] The merged message</param>
+/// <returns>1 if success. 0 if cant read fully. -1 if have errors that the socket should be closed</returns>
+int MergeSegments(CONNECTION* connection, char* segment, int mlen, int remain, char** omessage);
 
 /// <summary>
 /// Read segments from a connected socket and Merge them into a complete message.
 /// </summary>
-/// <param name="socket">The connected socket used to receive segments</param>
+/// <param name="connection">The connection used to receive segments</param>
 /// <param name="omessage">[Output] The merged message</param>
 /// <returns>1 if success. 0 if cant read fully. -1 if have errors that the socket should be closed</returns>
-int SegmentationReceive(SOCKET socket, char** omessage);
+int SegmentationReceive(CONNECTION* connection, char** omessage);
 
 /// <summary>
 /// Create a new memory space and Copy [length] bytes from [source] to it.
@@ -0,0 +1,398 @@
+#include "CompletionEngine.h"
+
+COMPLETIONENGINE* CreateCompletionEngine(SOCKET listener, const SESSIONHANDLER* handler, int buffer_size, int accepts,
+	const NUMANODE* nodes, int node_count)
+{
+	COMPLETIONENGINE* engine = (COMPLETIONENGINE*)malloc(sizeof(COMPLETIONENGINE));
+	ENGINEPOOL* pools = (ENGINEPOOL*)calloc(max(node_count, 1), sizeof(ENGINEPOOL));
+	if (engine == NULL || pools == NULL) {
+		printf("[%s] %s\n", ERROR_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		free(engine);
+		free(pools);
+		return NULL;
+	}
+	engine->listener = listener;
+	engine->handler = handler;
+	engine->buffer_size = max(buffer_size, APPLICATION_BUFF_MAX_SIZE);
+	engine->start_session = NULL;
+	engine->scheduler = NULL;
+	engine->pools = pools;
+	engine->nodes = nodes;
+	engine->node_count = node_count;
+	for (int i = 0; i < max(node_count, 1); ++i) {
+		InitializeSListHead(&pools[i].buffers);
+		pools[i].node = node_count > 0 ? &nodes[i] : NULL;
+		pools[i].carved = 0;
+	}
+
+	GUID accept_ex_id = WSAID_ACCEPTEX;
+	DWORD bytes;
+	engine->port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+	if (engine->port == NULL
+		|| CreateIoCompletionPort((HANDLE)listener, engine->port, 0, 0) == NULL
+		|| WSAIoctl(listener, SIO_GET_EXTENSION_FUNCTION_POINTER, &accept_ex_id, sizeof(accept_ex_id),
+			&engine->accept_ex, sizeof(engine->accept_ex), &bytes, NULL, NULL) == SOCKET_ERROR) {
+		printf("[%s:%lu] %s\n", ERROR_FLAGS, GetLastError(), _CREATE_ENGINE_FAIL);
+		if (engine->port != NULL)
+			CloseHandle(engine->port);
+		free(engine);
+		free(pools);
+		return NULL;
+	}
+
+	int posted = 0;
+	for (int i = 0; i < accepts; ++i) {
+		IOCONTEXT* io = (IOCONTEXT*)calloc(1, sizeof(IOCONTEXT));
+		if (io != NULL && PostAccept(engine, io))
+			++posted;
+		else
+			free(io);
+	}
+	if (posted == 0) {
+		printf("[%s] %s\n", ERROR_FLAGS, _CREATE_ENGINE_FAIL);
+		CloseHandle(engine->port);
+		free(engine);
+		free(pools);
+		return NULL;
+	}
+	return engine;
+}
+
+void RunCompletionEngine(COMPLETIONENGINE* engine, int workers)
+{
+	if (workers <= 0 && engine->node_count > 0) {
+		workers = 0;
+		for (int i = 0; i < engine->node_count; ++i)
+			workers += engine->nodes[i].processors;
+	}
+	else if (workers <= 0) {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		workers = (int)info.dwNumberOfProcessors;
+	}
+	// worker w runs on processor [w / node_count] of node [w % node_count]: the nodes take turns, so few workers still cover all of them
+	const NUMANODE* node = NULL;
+	for (int i = 1; i < workers; ++i) {
+		if (engine->node_count > 0)
+			node = &engine->nodes[i % engine->node_count];
+		if (BeginPlacedThread(RunCompletionWorker, (void*)engine, node, i / max(engine->node_count, 1)) == 0)
+			printf("[%s] %s\n", WARNING_FLAGS, _TOO_MANY_THREADS);
+	}
+	if (engine->node_count > 0)
+		PinThread(GetCurrentThread(), &engine->nodes[0], 0);
+	RunCompletionWorker((void*)engine);
+}
+
+unsigned __stdcall RunCompletionWorker(void* arguments)
+{
+	COMPLETIONENGINE* engine = (COMPLETIONENGINE*)arguments;
+	OVERLAPPED_ENTRY entries[ENGINE_BATCH_SIZE];
+	ULONG count;
+	while (GetQueuedCompletionStatusEx(engine->port, entries, ENGINE_BATCH_SIZE, &count, INFINITE, FALSE)) {
+		for (ULONG i = 0; i < count; ++i) {
+			IOCONTEXT* io = (IOCONTEXT*)entries[i].lpOverlapped;
+			// the status of the operation is left in the OVERLAPPED, 0 if it succeeded
+			int is_ok = (io->overlapped.Internal == 0);
+			if (io->resume != NULL) {
+				io->resume(io->waiter, entries[i].dwNumberOfBytesTransferred, is_ok);
+			}
+			else if (io->operation == OP_ACCEPT) {
+				CompleteAccept(engine, io, is_ok);
+			}
+			else if (io->operation == OP_RECEIVE) {
+				CompleteReceive(engine, io, is_ok);
+			}
+			else if (io->operation == OP_SEND) {
+				CompleteSend(engine, io, entries[i].dwNumberOfBytesTransferred, is_ok);
+			}
+		}
+	}
+	printf("[%s:%lu] %s\n", ERROR_FLAGS, GetLastError(), _ENGINE_WAIT_FAIL);
+	return 0;
+}
+
+int PostAccept(COMPLETIONENGINE* engine, IOCONTEXT* io)
+{
+	io->operation = OP_ACCEPT;
+	io->connection = NULL;
+	io->socket = CreateSocket(TCP);
+	if (io->socket == INVALID_SOCKET)
+		return 0;
+	memset(&io->overlapped, 0, sizeof(io->overlapped));
+	DWORD received;
+	if (!engine->accept_ex(engine->listener, io->socket, io->addresses, 0, ENGINE_ADDRESS_SIZE, ENGINE_ADDRESS_SIZE, &received, &io->overlapped)
+		&& WSAGetLastError() != ERROR_IO_PENDING) {
+		LogEvent(LOG_ACCEPT_SOCKET_FAIL, WSAGetLastError());
+		CloseSocket(io->socket, CLOSE_NORMAL);
+		return 0;
+	}
+	return 1;
+}
+
+int PostReceive(COMPLETIONENGINE* engine, IOCONTEXT* io)
+{
+	io->operation = OP_RECEIVE;
+	io->wsabuf.buf = NULL;
+	io->wsabuf.len = 0;
+	memset(&io->overlapped, 0, sizeof(io->overlapped));
+	DWORD flags = 0;
+	if (WSARecv(io->connection->socket, &io->wsabuf, 1, NULL, &flags, &io->overlapped, NULL) == SOCKET_ERROR
+		&& WSAGetLastError() != WSA_IO_PENDING) {
+		return 0;
+	}
+	return 1;
+}
+
+int PostSend(COMPLETIONENGINE* engine, IOCONTEXT* io)
+{
+	CONNECTION* connection = io->connection;
+	io->operation = OP_SEND;
+	io->wsabuf.buf = connection->send_buffer;
+	io->wsabuf.len = connection->send_length;
+	memset(&io->overlapped, 0, sizeof(io->overlapped));
+	connection->send_calls++;
+	if (WSASend(connection->socket, &io->wsabuf, 1, NULL, 0, &io->overlapped, NULL) == SOCKET_ERROR
+		&& WSAGetLastError() != WSA_IO_PENDING) {
+		LogEvent(LOG_SEND_FAIL, WSAGetLastError());
+		return 0;
+	}
+	return 1;
+}
+
+void CompleteAccept(COMPLETIONENGINE* engine, IOCONTEXT* io, int is_ok)
+{
+	SOCKET socket = io->socket;
+	IOCONTEXT* session = NULL;
+	CONNECTION* connection = NULL;
+	if (is_ok) {
+		// the accepted socket takes the properties of listener only after this
+		setsockopt(socket, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, (const char*)&engine->listener, sizeof(engine->listener));
+		session = (IOCONTEXT*)calloc(1, sizeof(IOCONTEXT));
+		if (session != NULL) {
+			// the worker is pinned: the node it runs on now is the node it accepted on
+			const NUMANODE* node = FindCurrentNumaNode(engine->nodes, engine->node_count);
+			session->node = node != NULL ? (int)(node - engine->nodes) : 0;
+			// idle until the first request: the read-ahead buffer is taken from the pool when bytes arrive
+			connection = CreateConnection(socket, 0);
+		}
+		if (connection != NULL)
+			connection->send_buffer = (char*)malloc(ENGINE_SEND_BUFFER_SIZE);
+	}
+	// admitted last, then opened at once: a refused connection is answered by the handler and closed below
+	if (connection != NULL && connection->send_buffer != NULL
+		&& CreateIoCompletionPort((HANDLE)socket, engine->port, 0, 0) != NULL
+		&& engine->handler->admit(socket)) {
+		connection->send_capacity = ENGINE_SEND_BUFFER_SIZE;
+		session->connection = connection;
+		engine->handler->open(connection);
+		if (engine->start_session != NULL)
+			engine->start_session(engine, session);
+		else if (!PostReceive(engine, session))
+			CloseCompletionConnection(engine, session);
+	}
+	else {
+		DestroyConnection(connection);
+		free(session);
+		CloseSocket(socket, CLOSE_NORMAL);
+	}
+
+	// keep the accept posted
+	if (!PostAccept(engine, io))
+		free(io);
+}
+
+void CompleteReceive(COMPLETIONENGINE* engine, IOCONTEXT* io, int is_ok)
+{
+	if (!is_ok || !ReceiveAvailable(engine, io)) {
+		CloseCompletionConnection(engine, io);
+		return;
+	}
+	// the connection has no operation pending until the task posts one: its requests never run out of order
+	if (engine->scheduler != NULL && IsRequestBuffered(io->connection) != 0) {
+		TASK task = { RunRequestTask, engine, io, engine->handler->classify(io->connection) };
+		if (SubmitTask(engine->scheduler, task, io->node))
+			return;
+	}
+	CompleteRequests(engine, io);
+}
+
+void RunRequestTask(void* context, void* argument)
+{
+	CompleteRequests((COMPLETIONENGINE*)context, (IOCONTEXT*)argument);
+}
+
+void CompleteRequests(COMPLETIONENGINE* engine, IOCONTEXT* io)
+{
+	CONNECTION* connection = io->connection;
+	if (!HandleBufferedRequests(engine, connection)) {
+		CloseCompletionConnection(engine, io);
+		return;
+	}
+
+	if (connection->length == 0)
+		ReleaseReceiveBuffer(engine, io);
+	// responses of all handled requests go out in one send
+	int posted = connection->send_length > 0 ? PostSend(engine, io) : PostReceive(engine, io);
+	if (!posted)
+		CloseCompletionConnection(engine, io);
+}
+
+void CompleteSend(COMPLETIONENGINE* engine, IOCONTEXT* io, DWORD bytes, int is_ok)
+{
+	CONNECTION* connection = io->connection;
+	if (!is_ok || (int)bytes != connection->send_length) {
+		LogEvent(LOG_SEND_NOT_ALL);
+		CloseCompletionConnection(engine, io);
+		return;
+	}
+	connection->send_length = 0;
+	if (!PostReceive(engine, io))
+		CloseCompletionConnection(engine, io);
+}
+
+int ReceiveAvailable(COMPLETIONENGINE* engine, IOCONTEXT* io)
+{
+	CONNECTION* connection = io->connection;
+	u_long available = 0;
+	// a zero-byte receive completes with nothing to read only if the peer closed
+	if (ioctlsocket(connection->socket, FIONREAD, &available) == SOCKET_ERROR || available == 0)
+		return 0;
+	int space = ReserveReceiveBuffer(engine, io);
+	return space > 0 && FillReceiveBuffer(connection, connection->length + min(space, (int)available)) == 1;
+}
+
+int HandleBufferedRequests(COMPLETIONENGINE* engine, CONNECTION* connection)
+{
+	int status;
+	while (1) {
+		// a streamed request takes its segments as they come: it is never buffered whole
+		int streamed = engine->handler->stream != NULL ? engine->handler->stream(connection) : 0;
+		if (streamed == -1)
+			return 0;
+		if (streamed == 1)
+			return 1;
+		if ((status = IsRequestBuffered(connection)) != 1)
+			break;
+		if (engine->handler->handle(connection) == -1)
+			return 0;
+	}
+	if (status == -1) {
+		LogEvent(LOG_RECEIVE_UNEXPECTED_MESSAGE);
+		return 0;
+	}
+	return 1;
+}
+
+void CloseCompletionConnection(COMPLETIONENGINE* engine, IOCONTEXT* io)
+{
+	CONNECTION* connection = io->connection;
+	engine->handler->close(connection);
+	CloseSocket(connection->socket, CLOSE_SAFELY);
+	connection->length = 0;
+	ReleaseReceiveBuffer(engine, io);
+	DestroyConnection(connection);
+	free(io);
+}
+
+int IsRequestBuffered(CONNECTION* connection)
+{
+	char header[SEGMENT_HEADER_SIZE];
+	int offset = 0;
+	while (offset + SEGMENT_HEADER_SIZE <= connection->length) {
+		PeekReceiveBuffer(connection, offset, SEGMENT_HEADER_SIZE, header);
+		int current = ntohs(*(unsigned short*)header) & ~SEGMENT_COMPRESSED_FLAG;
+		int remain = ntohs(*(unsigned short*)(header + SEGMENT_HEADER_CURRENT_SIZE));
+		if (current <= 0 || current + SEGMENT_HEADER_SIZE > APPLICATION_BUFF_MAX_SIZE)
+			return -1;
+		offset += SEGMENT_HEADER_SIZE + current;
+		if (offset > connection->length)
+			return 0;
+		if (remain == 0)
+			return 1;
+	}
+	return 0;
+}
+
+void PeekReceiveBuffer(CONNECTION* connection, int offset, int bytes, char* odestination)
+{
+	int start = (connection->head + offset) % connection->capacity;
+	int first = min(bytes, connection->capacity - start);
+	memcpy_s(odestination, bytes, connection->buffer + start, first);
+	memcpy_s(odestination + first, bytes - first, connection->buffer, bytes - first);
+}
+
+int ReserveReceiveBuffer(COMPLETIONENGINE* engine, IOCONTEXT* io)
+{
+	CONNECTION* connection = io->connection;
+	if (connection->buffer == NULL) {
+		connection->buffer = TakePooledBuffer(engine, &engine->pools[io->node], &io->is_pooled);
+		if (connection->buffer == NULL) {
+			LogEvent(LOG_ALLOCATE_MEMORY_FAIL);
+			return 0;
+		}
+		connection->capacity = engine->buffer_size;
+		connection->head = 0;
+	}
+	// grown only when full: a streamed request is taken out as it comes, and holds no more than the buffer
+	if (connection->length == connection->capacity && connection->capacity < ENGINE_MESSAGE_MAX_SIZE) {
+		// a request larger than the buffer, and not streamed, must still be buffered whole before it is handled
+		int capacity = min(connection->capacity * 2, ENGINE_MESSAGE_MAX_SIZE);
+		char* buffer = (char*)malloc(capacity);
+		if (buffer == NULL) {
+			LogEvent(LOG_ALLOCATE_MEMORY_FAIL);
+			return 0;
+		}
+		int length = connection->length;
+		ReadReceiveBuffer(connection, length, buffer);
+		connection->length = 0;
+		ReleaseReceiveBuffer(engine, io);
+		connection->buffer = buffer;
+		connection->capacity = capacity;
+		connection->length = length;
+		io->is_pooled = 0;
+	}
+	return connection->capacity - connection->length;
+}
+
+void ReleaseReceiveBuffer(COMPLETIONENGINE* engine, IOCONTEXT* io)
+{
+	CONNECTION* connection = io->connection;
+	if (connection->buffer != NULL) {
+		// only buffers taken from the pool go back to it: node pools hold memory of their node only. Grown ones are freed
+		ENGINEPOOL* pool = &engine->pools[io->node];
+		if (io->is_pooled && (pool->node != NULL || QueryDepthSList(&pool->buffers) < ENGINE_POOL_MAX))
+			InterlockedPushEntrySList(&pool->buffers, (PSLIST_ENTRY)connection->buffer);
+		else
+			free(connection->buffer);
+	}
+	connection->buffer = NULL;
+	connection->capacity = engine->buffer_size;
+	connection->head = 0;
+	io->is_pooled = 0;
+}
+
+char* TakePooledBuffer(COMPLETIONENGINE* engine, ENGINEPOOL* pool, int* ois_pooled)
+{
+	*ois_pooled = 1;
+	char* buffer = (char*)InterlockedPopEntrySList(&pool->buffers);
+	if (buffer != NULL)
+		return buffer;
+	if (pool->node == NULL)
+		return (char*)malloc(engine->buffer_size);
+	// slabs are never freed, so a node carves a bounded number: past that, buffers come from the heap for a while
+	if (InterlockedExchangeAdd(&pool->carved, ENGINE_POOL_SLAB) + ENGINE_POOL_SLAB > ENGINE_POOL_MAX) {
+		InterlockedExchangeAdd(&pool->carved, -ENGINE_POOL_SLAB);
+		*ois_pooled = 0;
+		return (char*)malloc(engine->buffer_size);
+	}
+	// carve the buffers from pages of the node, aligned for the pool links
+	size_t stride = ((size_t)engine->buffer_size + MEMORY_ALLOCATION_ALIGNMENT - 1) & ~(size_t)(MEMORY_ALLOCATION_ALIGNMENT - 1);
+	char* slab = (char*)AllocateOnNode(pool->node, stride * ENGINE_POOL_SLAB);
+	if (slab == NULL) {
+		InterlockedExchangeAdd(&pool->carved, -ENGINE_POOL_SLAB);
+		return NULL;
+	}
+	for (int i = 1; i < ENGINE_POOL_SLAB; ++i)
+		InterlockedPushEntrySList(&pool->buffers, (PSLIST_ENTRY)(slab + stride * i));
+	return slab;
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include "CommonHeader.h"
+#include "TaskScheduler.h"
+#include "Logger.h"
+#include <MSWSock.h>
+#include <process.h>
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define ENGINE_ACCEPT_BACKLOG 16 // AcceptEx calls kept posted on the listener, per acceptor
+#define ENGINE_BATCH_SIZE 64 // Completions dequeued per call
+#define ENGINE_MESSAGE_MAX_SIZE (1 << 17) // Largest message buffered before it is handled, in bytes. Streamed requests are not buffered whole
+#define ENGINE_SEND_BUFFER_SIZE 256 // Initial size of the output buffer of a connection. Grown for larger output
+#define ENGINE_ADDRESS_SIZE (sizeof(SOCKADDR_STORAGE) + 16) // Space for one address in AcceptEx output
+#define ENGINE_POOL_SLAB 16 // Read-ahead buffers allocated at once in memory of a node, when its pool is empty
+#define ENGINE_POOL_MAX 1024 // Read-ahead buffers kept in a pool, and carved from slabs of its node. Past that they are malloc()ed and freed
+
+#define OP_ACCEPT 1
+#define OP_RECEIVE 2
+#define OP_SEND 3
+
+#define _CREATE_ENGINE_FAIL "Fail to create the I/O completion port engine."
+#define _ENGINE_WAIT_FAIL "Fail to dequeue completions. Worker stopped."
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef struct sessionhandler {
+
+	int (*admit)(SOCKET socket); // A connection is accepted. Return 0 to refuse it: the socket is then closed without a session. Once admitted, it is opened
+
+	void (*open)(CONNECTION* connection); // A connection is admitted. Called once, before its first request
+
+	int (*handle)(CONNECTION* connection); // Handle one request, already buffered in full. Return -1 to close the connection
+
+	int (*stream)(CONNECTION* connection); // Take the buffered segments of a request handled as they arrive. Return 1 while the request goes on, 0 if none does, -1 to close the connection. NULL if none is
+
+	int (*classify)(CONNECTION* connection); // Class of the first buffered request, for the scheduler. See TASK_PRIORITY_ for some definitions
+
+	void (*close)(CONNECTION* connection); // The connection is closing. Called once, before the socket is closed
+
+}SESSIONHANDLER;
+
+typedef struct iocontext {
+
+	OVERLAPPED overlapped; // Must be the first field: completions are mapped back from it
+
+	int operation; // The pending operation. See OP_ for some definitions
+
+	SOCKET socket; // The accepted socket [OP_ACCEPT]
+
+	CONNECTION* connection; // The connection [OP_RECEIVE, OP_SEND]
+
+	WSABUF wsabuf; // The buffer of the pending receive or send
+
+	char addresses[2 * ENGINE_ADDRESS_SIZE]; // AcceptEx output: local and remote address
+
+	void (*resume)(void* waiter, DWORD bytes, int is_ok); // Called on completion instead of the OP_ handlers. NULL if not used
+
+	void* waiter; // Passed to resume: the state waiting for the completion
+
+	int node; // Index of the node of the worker that accepted the connection. Its buffers and tasks stay on that node. 0 if not placed
+
+	int is_pooled; // The read-ahead buffer was taken from the pool of the node and goes back to it. 0 if it is freed
+
+}IOCONTEXT;
+
+typedef struct enginepool {
+
+	SLIST_HEADER buffers; // Pool of read-ahead buffers. Only connections with unread bytes hold one
+
+	const NUMANODE* node; // The node the buffers are in memory of. NULL if not placed
+
+	volatile LONG carved; // Number of buffers carved from slabs of the node. At most ENGINE_POOL_MAX
+
+}ENGINEPOOL;
+
+typedef struct completionengine {
+
+	HANDLE port; // The I/O completion port
+
+	SOCKET listener; // The listening socket
+
+	LPFN_ACCEPTEX accept_ex; // AcceptEx() of the provider of listener
+
+	const SESSIONHANDLER* handler; // Called for requests and closing connections
+
+	int buffer_size; // Size of read-ahead buffers in the pool, in bytes
+
+	ENGINEPOOL* pools; // One pool of read-ahead buffers per node, or a single one if not placed
+
+	const NUMANODE* nodes; // The NUMA nodes the workers are spread over. Worker w is pinned to a processor of node [w % node_count]
+
+	int node_count; // Number of nodes. 0 if not placed
+
+	void (*start_session)(struct completionengine* engine, IOCONTEXT* io); // Drive an accepted connection. NULL to drive it by CompleteReceive() and CompleteSend()
+
+	TASKSCHEDULER* scheduler; // Runs buffered requests off the I/O workers. NULL to run them on the worker that read them
+
+}COMPLETIONENGINE;
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Create a completion engine on a listening socket and Post the first accepts.
+/// </summary>
+/// <param name="listener">The bound, listening socket</param>
+/// <param name="handler">Called for requests and closing connections</param>
+/// <param name="buffer_size">Size of read-ahead buffers. Grown per connection for larger messages</param>
+/// <param name="accepts">Number of AcceptEx calls kept posted. More absorb bursts of new connections</param>
+/// <param name="nodes">The NUMA nodes to place the workers and buffers on. NULL if not placed</param>
+/// <param name="node_count">Number of nodes</param>
+/// <returns>The engine. NULL if have errors</returns>
+COMPLETIONENGINE* CreateCompletionEngine(SOCKET listener, const SESSIONHANDLER* handler, int buffer_size, int accepts,
+	const NUMANODE* nodes = NULL, int node_count = 0);
+
+/// <summary>
+/// Run worker threads on the engine. This function blocks: the calling thread is one of the workers.
+/// On a placed engine each worker is pinned to one processor, spread over the nodes in turn.
+/// </summary>
+/// <param name="engine">The engine</param>
+/// <param name="workers">Number of worker threads. 0 for one per processor [of the nodes, if placed]</param>
+void RunCompletionEngine(COMPLETIONENGINE* engine, int workers);
+
+/// <summary>
+/// Dequeue completions in batches and Handle them. [Call on threads created by RunCompletionEngine()]
+/// </summary>
+/// <param name="arguments">The engine. [Cast directly]</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall RunCompletionWorker(void* arguments);
+
+/// <summary>
+/// Post an AcceptEx on the listener with a new socket.
+/// </summary>
+/// <param name="engine">The engine</param>
+/// <param name="io">The accept context, reused for each accept</param>
+/// <returns>1 if posted. 0 if have errors</returns>
+int PostAccept(COMPLETIONENGINE* engine, IOCONTEXT* io);
+
+/// <summary>
+/// Post a zero-byte receive: The connection holds no buffer while it waits for data.
+/// </summary>
+/// <param name="engine">The engine</param>
+/// <param name="io">The context of the connection</param>
+/// <returns>1 if posted. 0 if have errors</returns>
+int PostReceive(COMPLETIONENGINE* engine, IOCONTEXT* io);
+
+/// <summary>
+/// Post one send with all output collected while handling the buffered requests.
+/// </summary>
+/// <param name="engine">The engine</param>
+/// <param name="io">The context of the connection</param>
+/// <returns>1 if posted. 0 if have errors</returns>
+int PostSend(COMPLETIONENGINE* engine, IOCONTEXT* io);
+
+/// <summary>
+/// Set up an accepted connection, if the handler admits it, and Post its first receive. Post the next accept.
+/// The connection belongs to the node of the calling worker from then on.
+/// </summary>
+/// <param name="engine">The engine</param>
+/// <param name="io">The accept context</param>
+/// <param name="is_ok">0 if the accept failed</param>
+void CompleteAccept(COMPLETIONENGINE* engine, IOCONTEXT* io, int is_ok);
+
+/// <summary>
+/// Read available bytes into the read-ahead buffer. Then Complete the requests, or Submit them to the scheduler if the engine has one,
+/// in the class of the first request, to the workers of the node of the connection.
+/// </summary>
+/// <param name="engine">The engine</param>
+/// <param name="io">The context of the connection</param>
+/// <param name="is_ok">0 if the receive failed</param>
+void CompleteReceive(COMPLETIONENGINE* engine, IOCONTEXT* io, int is_ok);
+
+/// <summary>
+/// Complete the requests of a connection on a scheduler worker. [TASK run]
+/// </summary>
+/// <param name="context">The engine. [COMPLETIONENGINE*]</param>
+/// <param name="argument">The context of the connection. [IOCONTEXT*]</param>
+void RunRequestTask(void* context, void* argument);
+
+/// <summary>
+/// Handle every complete request in the read-ahead buffer. Then Post the collected output, or the next receive if there is none.
+/// </summary>
+/// <param name="engine">The engine</param>
+/// <param name="io">The context of the connection</param>
+void CompleteRequests(COMPLETIONENGINE* engine, IOCONTEXT* io);
+
+/// <summary>
+/// Finish a send and Post the next receive.
+/// </summary>
+/// <param name="engine">The engine</param>
+/// <param name="io">The context of the connection</param>
+/// <param name="bytes">Number of bytes sent</param>
+/// <param name="is_ok">0 if the send failed</param>
+void CompleteSend(COMPLETIONENGINE* engine, IOCONTEXT* io, DWORD bytes, int is_ok);
+
+/// <summary>
+/// Read the bytes available on a connection into its read-ahead buffer. [After a zero-byte receive completed]
+/// </summary>
+/// <param name="engine">The engine</param>
+/// <param name="io">The context of the connection</param>
+/// <returns>1 if success. 0 if the peer closed or have errors</returns>
+int ReceiveAvailable(COMPLETIONENGINE* engine, IOCONTEXT* io);
+
+/// <summary>
+/// Handle every complete request in the read-ahead buffer, and Pass the segments of a streamed request to the stream handler as they arrive.
+/// Their output is collected in the send buffer.
+/// </summary>
+/// <param name="engine">The engine</param>
+/// <param name="connection">The connection</param>
+/// <returns>1 if success. 0 if the connection should be closed</returns>
+int HandleBufferedRequests(COMPLETIONENGINE* engine, CONNECTION* connection);
+
+/// <summary>
+/// Close a connection: Call the close handler, Close the socket and Free the connection and its context.
+/// </summary>
+/// <param name="engine">The engine</param>
+/// <param name="io">The context of the connection</param>
+void CloseCompletionConnection(COMPLETIONENGINE* engine, IOCONTEXT* io);
+
+/// <summary>
+/// Check whether the read-ahead buffer holds a whole request: segments up to the one with no remaining bytes.
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <returns>1 if a whole request is buffered. 0 if more bytes are needed. -1 if the segment header is invalid</returns>
+int IsRequestBuffered(CONNECTION* connection);
+
+/// <summary>
+/// Copy bytes from the read-ahead buffer without consuming them.
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <param name="offset">Offset from the first unread byte</param>
+/// <param name="bytes">Number of bytes. [offset + bytes] must not exceed the unread bytes</param>
+/// <param name="odestination">[Output] The copied bytes</param>
+void PeekReceiveBuffer(CONNECTION* connection, int offset, int bytes, char* odestination);
+
+/// <summary>
+/// Make sure a connection has a read-ahead buffer with free space. Take one from the pool of its node,
+/// or Grow a full buffer up to ENGINE_MESSAGE_MAX_SIZE for a large request. Bytes that do not fit stay on the socket.
+/// </summary>
+/// <param name="engine">The engine</param>
+/// <param name="io">The context of the connection</param>
+/// <returns>Number of free bytes. 0 if fail to allocate memory or the buffer is full at its largest size</returns>
+int ReserveReceiveBuffer(COMPLETIONENGINE* engine, IOCONTEXT* io);
+
+/// <summary>
+/// Give the read-ahead buffer of a drained connection back to the pool of its node [or Free it if it was grown, or the pool is full].
+/// </summary>
+/// <param name="engine">The engine</param>
+/// <param name="io">The context of the connection. Must have no unread bytes</param>
+void ReleaseReceiveBuffer(COMPLETIONENGINE* engine, IOCONTEXT* io);
+
+/// <summary>
+/// Take a read-ahead buffer from a pool. Refill an empty pool of a node with a slab of ENGINE_POOL_SLAB buffers in memory of the node,
+/// until ENGINE_POOL_MAX are carved: past that the buffer is malloc()ed and not pooled.
+/// </summary>
+/// <param name="engine">The engine</param>
+/// <param name="pool">The pool</param>
+/// <param name="ois_pooled">[Output] 1 if the buffer goes back to the pool. 0 if it is freed</param>
+/// <returns>The buffer, of buffer_size bytes. NULL if fail to allocate memory</returns>
+char* TakePooledBuffer(COMPLETIONENGINE* engine, ENGINEPOOL* pool, int* ois_pooled);
+
+#pragma endregion
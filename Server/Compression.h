@@ -0,0 +1,106 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include <stdlib.h>
+#include <string.h>
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define COMPRESSION_ALGORITHM "LZ"
+#define COMPRESSION_MIN_SIZE 128
+#define COMPRESSION_WINDOW_SIZE 16384
+#define COMPRESSION_CHUNK_SIZE 4096
+#define COMPRESSION_HASH_BITS 12
+#define COMPRESSION_MIN_MATCH 4
+
+// Shared dictionary. Both sides preload their history with it, so even the first message finds matches
+#define COMPRESSION_DICTIONARY \
+	"USER POST BYE COMP LZ Login successfully Account locked Account does not exist " \
+	"Another client is working on this account You already logged in Post the article successfully " \
+	"Fail to store the article No permission because you are not logged in Log out successfully " \
+	"Unregconize command Compression enabled " \
+	"the of and to in is that for it with as was on be at by this had not are but from or have an they which " \
+	"one you were her all she there would their we him been has when who will more no if out so said what up " \
+	"its about into than them can only other new some could time these two may then do first any my now such " \
+	"like our over man me even most made after also did many before must through back years where much your " \
+	"way well down should because each just those people how too little state good very make world still own " \
+	"see men work long get here between both life being under never day same another know while last might " \
+	"us great old year off come since against go came right used take three. , \r\n"
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef struct compressor {
+
+	char* window; // History of raw bytes. Size: 2 * COMPRESSION_WINDOW_SIZE. The bytes after [length] are staged but not committed
+
+	int length; // Number of committed bytes in window
+
+	int* table; // Hash of 4-byte sequence -> Position in window. NULL for receiver history
+
+}COMPRESSOR;
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Create a compression history preloaded with the shared dictionary. [See COMPRESSION_DICTIONARY]
+/// One history is used for each direction of a connection: the sender compresses and the receiver decompresses against the same bytes.
+/// </summary>
+/// <param name="is_sender">1 if the history is used for compressing. The sender history also indexes its bytes</param>
+/// <returns>The created history. NULL if fail to allocate memory</returns>
+COMPRESSOR* CreateCompressor(int is_sender);
+
+/// <summary>
+/// Free memory used for a compression history
+/// </summary>
+/// <param name="c">The history want to free</param>
+void DestroyCompressor(COMPRESSOR* c);
+
+/// <summary>
+/// Compress as many bytes of [source] as the compressed block fits in [capacity] bytes.
+/// The consumed bytes are staged on history but not committed. [See CommitHistory()]
+/// Block format (LZ4-like): sequences of [token | literal length | literals | offset | match length].
+/// The last sequence has literals only.
+/// </summary>
+/// <param name="c">The sender history</param>
+/// <param name="source">The raw bytes</param>
+/// <param name="length">Number of raw bytes. Not exceed COMPRESSION_CHUNK_SIZE</param>
+/// <param name="odestination">[Output] The compressed block</param>
+/// <param name="capacity">Size of [odestination]</param>
+/// <param name="oconsumed">[Output] Number of raw bytes the block holds</param>
+/// <returns>Size of the compressed block, in bytes</returns>
+int CompressBlock(COMPRESSOR* c, const char* source, int length, char* odestination, int capacity, int* oconsumed);
+
+/// <summary>
+/// Decompress a block and Append the raw bytes to history.
+/// </summary>
+/// <param name="c">The receiver history</param>
+/// <param name="source">The compressed block</param>
+/// <param name="length">Size of the compressed block</param>
+/// <param name="odestination">[Output] The raw bytes</param>
+/// <param name="raw_length">Number of raw bytes the block holds. Not exceed COMPRESSION_CHUNK_SIZE</param>
+/// <returns>1 if success. 0 if the block is corrupted</returns>
+int DecompressBlock(COMPRESSOR* c, const char* source, int length, char* odestination, int raw_length);
+
+/// <summary>
+/// Commit first [bytes] staged bytes to history. [Call after CompressBlock()]
+/// </summary>
+/// <param name="c">The sender history</param>
+/// <param name="bytes">Number of bytes actually sent</param>
+void CommitHistory(COMPRESSOR* c, int bytes);
+
+/// <summary>
+/// Append raw bytes sent or received without compression to history, to keep both sides in sync.
+/// </summary>
+/// <param name="c">The history</param>
+/// <param name="source">The raw bytes</param>
+/// <param name="length">Number of raw bytes. Not exceed COMPRESSION_CHUNK_SIZE</param>
+void AppendHistory(COMPRESSOR* c, const char* source, int length);
+
+#pragma endregion
@@ -0,0 +1,114 @@
+#include "CoroutineSession.h"
+
+SLIST_HEADER SessionFrames; // Pool of coroutine frames of SESSION_FRAME_SIZE bytes
+
+void* SESSIONTASK::promise_type::operator new(size_t size)
+{
+	return AllocateSessionFrame(size);
+}
+
+void SESSIONTASK::promise_type::operator delete(void* frame, size_t size)
+{
+	FreeSessionFrame(frame, size);
+}
+
+bool IOAWAITABLE::await_suspend(std::coroutine_handle<> handle)
+{
+	session = handle;
+	io->resume = ResumeCoroutineSession;
+	io->waiter = this;
+	// once posted, the completion may resume the session on another worker: nothing is touched after
+	int posted = operation == OP_SEND ? PostSend(engine, io) : PostReceive(engine, io);
+	if (!posted) {
+		is_ok = 0;
+		return false;
+	}
+	return true;
+}
+
+int IOAWAITABLE::await_resume()
+{
+	if (operation == OP_SEND)
+		return is_ok && bytes == io->wsabuf.len;
+	return is_ok;
+}
+
+bool SCHEDULEAWAITABLE::await_suspend(std::coroutine_handle<> handle)
+{
+	TASK task = { ResumeScheduledSession, handle.address(), NULL, priority };
+	return SubmitTask(scheduler, task, node) != 0;
+}
+
+void EnableCoroutineSessions(COMPLETIONENGINE* engine)
+{
+	InitializeSListHead(&SessionFrames);
+	engine->start_session = StartCoroutineSession;
+}
+
+void StartCoroutineSession(COMPLETIONENGINE* engine, IOCONTEXT* io)
+{
+	RunCoroutineSession(engine, io);
+}
+
+SESSIONTASK RunCoroutineSession(COMPLETIONENGINE* engine, IOCONTEXT* io)
+{
+	CONNECTION* connection = io->connection;
+	while (co_await IOAWAITABLE{ engine, io, OP_RECEIVE } && ReceiveAvailable(engine, io)) {
+		// go on on a scheduler worker. Nothing is pending on the connection meanwhile, so its requests stay in order
+		if (IsRequestBuffered(connection) != 0)
+			co_await SCHEDULEAWAITABLE{ engine->scheduler, engine->handler->classify(connection), io->node };
+		if (!HandleBufferedRequests(engine, connection))
+			break;
+		// responses of all handled requests go out in one send
+		if (connection->send_length > 0) {
+			if (!co_await IOAWAITABLE{ engine, io, OP_SEND }) {
+				LogEvent(LOG_SEND_NOT_ALL);
+				break;
+			}
+			connection->send_length = 0;
+		}
+		if (connection->length == 0)
+			ReleaseReceiveBuffer(engine, io);
+	}
+	CloseCompletionConnection(engine, io);
+}
+
+void ResumeCoroutineSession(void* waiter, DWORD bytes, int is_ok)
+{
+	IOAWAITABLE* awaitable = (IOAWAITABLE*)waiter;
+	awaitable->bytes = bytes;
+	awaitable->is_ok = is_ok;
+	awaitable->session.resume();
+}
+
+void ResumeScheduledSession(void* context, void* argument)
+{
+	std::coroutine_handle<>::from_address(context).resume();
+}
+
+void* AllocateSessionFrame(size_t size)
+{
+	void* frame = NULL;
+	if (size <= SESSION_FRAME_SIZE) {
+		frame = InterlockedPopEntrySList(&SessionFrames);
+		if (frame == NULL)
+			frame = malloc(SESSION_FRAME_SIZE);
+	}
+	else {
+		frame = malloc(size);
+	}
+	if (frame == NULL) {
+		printf("[%s] %s\n", ERROR_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		abort();
+	}
+	return frame;
+}
+
+void FreeSessionFrame(void* frame, size_t size)
+{
+	// pooled frames are kept for reuse, like read-ahead buffers
+	if (size <= SESSION_FRAME_SIZE)
+		InterlockedPushEntrySList(&SessionFrames, (PSLIST_ENTRY)frame);
+	else
+		free(frame);
+}
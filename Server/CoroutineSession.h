@@ -0,0 +1,135 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include <coroutine>
+
+#include "CompletionEngine.h"
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define SESSION_FRAME_SIZE 512 // Size of pooled coroutine frames, in bytes. Larger frames are allocated on their own
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef struct sessiontask {
+
+	struct promise_type {
+
+		sessiontask get_return_object() { return {}; }
+
+		std::suspend_never initial_suspend() noexcept { return {}; } // Run until the first co_await
+
+		std::suspend_never final_suspend() noexcept { return {}; } // The frame is freed when the session ends
+
+		void return_void() {}
+
+		void unhandled_exception() { abort(); }
+
+		static void* operator new(size_t size); // Frames come from the pool, see AllocateSessionFrame()
+
+		static void operator delete(void* frame, size_t size);
+
+	};
+
+}SESSIONTASK;
+
+typedef struct ioawaitable {
+
+	COMPLETIONENGINE* engine; // The engine
+
+	IOCONTEXT* io; // The context of the connection
+
+	int operation; // OP_RECEIVE or OP_SEND
+
+	std::coroutine_handle<> session; // The suspended session
+
+	DWORD bytes; // Number of bytes transferred
+
+	int is_ok; // 0 if the operation failed
+
+	bool await_ready() { return false; }
+
+	bool await_suspend(std::coroutine_handle<> handle); // Post the operation. Resume at once if it can not be posted
+
+	int await_resume(); // 1 if the operation completed in full
+
+}IOAWAITABLE;
+
+typedef struct scheduleawaitable {
+
+	TASKSCHEDULER* scheduler; // The scheduler. NULL to go on without suspending
+
+	int priority; // Class of the task the session goes on as. See TASK_PRIORITY_ for some definitions
+
+	int node; // Index of the node of the session. It goes on on a worker of that node
+
+	bool await_ready() { return scheduler == NULL; }
+
+	bool await_suspend(std::coroutine_handle<> handle); // Submit the session as a task. Go on here if it can not be submitted
+
+	void await_resume() {}
+
+}SCHEDULEAWAITABLE;
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Drive the sessions of an engine by coroutines instead of completion callbacks. [Call before RunCompletionEngine()]
+/// </summary>
+/// <param name="engine">The engine</param>
+void EnableCoroutineSessions(COMPLETIONENGINE* engine);
+
+/// <summary>
+/// Start the session coroutine of an accepted connection. [COMPLETIONENGINE start_session]
+/// </summary>
+/// <param name="engine">The engine</param>
+/// <param name="io">The context of the connection</param>
+void StartCoroutineSession(COMPLETIONENGINE* engine, IOCONTEXT* io);
+
+/// <summary>
+/// Receive requests, Handle them and Send the responses until the connection is closed.
+/// Suspend on each receive and send: an idle session holds no thread and no read-ahead buffer.
+/// Requests are handled on a scheduler worker if the engine has a scheduler.
+/// </summary>
+/// <param name="engine">The engine</param>
+/// <param name="io">The context of the connection. Freed when the session ends</param>
+/// <returns>The coroutine. [Not awaited: it runs on its own]</returns>
+SESSIONTASK RunCoroutineSession(COMPLETIONENGINE* engine, IOCONTEXT* io);
+
+/// <summary>
+/// Resume the session waiting for a completion. [IOCONTEXT resume]
+/// </summary>
+/// <param name="waiter">The awaitable the session is suspended on</param>
+/// <param name="bytes">Number of bytes transferred</param>
+/// <param name="is_ok">0 if the operation failed</param>
+void ResumeCoroutineSession(void* waiter, DWORD bytes, int is_ok);
+
+/// <summary>
+/// Resume a session on a scheduler worker. [TASK run]
+/// </summary>
+/// <param name="context">The suspended session. [coroutine handle address]</param>
+/// <param name="argument">Unused</param>
+void ResumeScheduledSession(void* context, void* argument);
+
+/// <summary>
+/// Allocate a coroutine frame. Take one from the pool if it fits in SESSION_FRAME_SIZE.
+/// </summary>
+/// <param name="size">Size of the frame, in bytes</param>
+/// <returns>The frame. Aborts if fail to allocate memory [a coroutine can not report it]</returns>
+void* AllocateSessionFrame(size_t size);
+
+/// <summary>
+/// Give a coroutine frame back to the pool [or Free it if it was allocated on its own].
+/// </summary>
+/// <param name="frame">The frame</param>
+/// <param name="size">Size of the frame, in bytes</param>
+void FreeSessionFrame(void* frame, size_t size);
+
+#pragma endregion
@@ -0,0 +1,222 @@
+#include "Logger.h"
+
+LOGRING* volatile LogRings = NULL; // All rings ever taken. Read without lock: rings are pushed, never removed
+__declspec(thread) LOGRING* CurrentLogRing = NULL; // The ring of the calling thread. NULL until it logs
+volatile LONG LoggerStarted = 0; // 1 once the logger thread runs: messages go through the rings
+int LogRate = 0; // Records of a message type written per window. 0 if not limited
+CRITICAL_SECTION LogFlushLock; // Held while the rings are drained. Never taken by a thread that logs
+
+// the state of the consumer, guarded by LogFlushLock
+char LogOutput[LOG_OUTPUT_BUFFER_SIZE];
+int LogOutputLength = 0;
+ULONGLONG LogWindowStart = 0;
+LONG64 LogWritten[LOG_TYPE_COUNT] = { 0 }; // Records written in the window, by type
+LONG64 LogSuppressed[LOG_TYPE_COUNT] = { 0 }; // Records over the rate in the window, by type
+LONG64 LogDropsReported[LOG_TYPE_COUNT] = { 0 }; // Ring drops summarized so far, by type
+
+const LOGTYPE LogTypes[LOG_TYPE_COUNT] = {
+	{ ERROR_FLAGS, _CONNECTION_DROP, 1 },
+	{ WARNING_FLAGS, _HOST_UNREACHABLE, 1 },
+	{ WARNING_FLAGS, _SEND_FAIL, 1 },
+	{ WARNING_FLAGS, _SEND_NOT_ALL, 0 },
+	{ WARNING_FLAGS, _RECEIVE_FAIL, 1 },
+	{ WARNING_FLAGS, _TOO_MUCH_BYTES, 0 },
+	{ WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL, 0 },
+	{ WARNING_FLAGS, _RECEIVE_UNEXPECTED_MESSAGE, 0 },
+	{ WARNING_FLAGS, _NOT_LISTEN_SOCKET, 1 },
+	{ WARNING_FLAGS, _ACCEPT_SOCKET_FAIL, 1 },
+	{ INFO_FLAGS, "Session closed", 0 },
+	{ WARNING_FLAGS, _WRITE_ARTICLE_FAIL, 1 },
+	{ INFO_FLAGS, "Session timed out waiting for", 0 },
+	{ WARNING_FLAGS, _MESSAGE_EXTREME_LARGE, 0 },
+};
+
+int StartLogger(int rate)
+{
+	if (LoggerStarted)
+		return 1;
+	LogRate = rate > 0 ? rate : 0;
+	InitializeCriticalSection(&LogFlushLock);
+	LogWindowStart = GetTickCount64();
+
+	HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, RunLogger, NULL, 0, NULL);
+	if (thread == NULL) {
+		DeleteCriticalSection(&LogFlushLock);
+		return 0;
+	}
+	CloseHandle(thread);
+	InterlockedExchange(&LoggerStarted, 1);
+	return 1;
+}
+
+void LogEvent(int type, int error, const LONG64* values, int count)
+{
+	if (type < 0 || type >= LOG_TYPE_COUNT)
+		return;
+	LOGRECORD record;
+	record.type = type;
+	record.error = error;
+	count = values == NULL ? 0 : min(count, LOG_VALUE_COUNT);
+	for (int i = 0; i < LOG_VALUE_COUNT; i++)
+		record.values[i] = i < count ? values[i] : 0;
+
+	LOGRING* ring = LoggerStarted ? GetLogRing() : NULL;
+	if (ring == NULL) {
+		// no logger yet: written at once, as before
+		char line[512];
+		FormatLogRecord(&record, line, sizeof(line));
+		fputs(line, stdout);
+		return;
+	}
+
+	LONG64 tail = ring->tail;
+	if (tail - ring->head >= LOG_RING_SIZE) {
+		// never wait for the logger: the loss is counted and summarized instead
+		ring->dropped[type]++;
+		return;
+	}
+	ring->records[tail % LOG_RING_SIZE] = record;
+	// a full barrier: the logger sees the record before the index that covers it
+	InterlockedExchange64(&ring->tail, tail + 1);
+}
+
+LOGRING* GetLogRing()
+{
+	LOGRING* ring = CurrentLogRing;
+	if (ring != NULL)
+		return ring;
+
+	for (ring = LogRings; ring != NULL; ring = ring->next) {
+		if (ring->owner == 0 && InterlockedCompareExchange(&ring->owner, 1, 0) == 0)
+			break;
+	}
+	if (ring == NULL) {
+		ring = (LOGRING*)_aligned_malloc(sizeof(LOGRING), LOG_CACHE_LINE);
+		if (ring == NULL)
+			return NULL;
+		memset(ring, 0, sizeof(LOGRING));
+		ring->owner = 1;
+		do {
+			ring->next = LogRings;
+		} while (InterlockedCompareExchangePointer((PVOID volatile*)&LogRings, ring, ring->next) != ring->next);
+	}
+	CurrentLogRing = ring;
+	return ring;
+}
+
+void ReleaseLogRing()
+{
+	LOGRING* ring = CurrentLogRing;
+	if (ring == NULL)
+		return;
+	CurrentLogRing = NULL;
+	// a full barrier: the next owner goes on from the tail of this thread
+	InterlockedExchange(&ring->owner, 0);
+}
+
+/// <summary>
+/// Append a line to the output, and Write the output to console first if the line does not fit. [Call with the flush lock held]
+/// </summary>
+static void AppendLogOutput(const char* line, int length)
+{
+	if (LogOutputLength + length > LOG_OUTPUT_BUFFER_SIZE) {
+		fwrite(LogOutput, 1, LogOutputLength, stdout);
+		LogOutputLength = 0;
+	}
+	memcpy(LogOutput + LogOutputLength, line, length);
+	LogOutputLength += length;
+}
+
+void FlushLogs()
+{
+	if (!LoggerStarted)
+		return;
+	EnterCriticalSection(&LogFlushLock);
+
+	char line[512];
+	for (LOGRING* ring = LogRings; ring != NULL; ring = ring->next) {
+		LONG64 head = ring->head;
+		LONG64 tail = ring->tail;
+		for (; head < tail; head++) {
+			const LOGRECORD* record = &ring->records[head % LOG_RING_SIZE];
+			if (LogRate > 0 && LogWritten[record->type] >= LogRate) {
+				LogSuppressed[record->type]++;
+				continue;
+			}
+			LogWritten[record->type]++;
+			AppendLogOutput(line, FormatLogRecord(record, line, sizeof(line)));
+		}
+		// the slots are given back only after the records are copied out
+		InterlockedExchange64(&ring->head, tail);
+	}
+
+	ULONGLONG now = GetTickCount64();
+	if (now - LogWindowStart >= LOG_RATE_WINDOW) {
+		SummarizeLogLosses();
+		memset(LogWritten, 0, sizeof(LogWritten));
+		memset(LogSuppressed, 0, sizeof(LogSuppressed));
+		LogWindowStart = now;
+	}
+
+	if (LogOutputLength > 0) {
+		fwrite(LogOutput, 1, LogOutputLength, stdout);
+		fflush(stdout);
+		LogOutputLength = 0;
+	}
+	LeaveCriticalSection(&LogFlushLock);
+}
+
+unsigned __stdcall RunLogger(void* arguments)
+{
+	while (1) {
+		Sleep(LOG_FLUSH_INTERVAL);
+		FlushLogs();
+	}
+	return 0;
+}
+
+int FormatLogRecord(const LOGRECORD* record, char* obuffer, int size)
+{
+	const LOGTYPE* type = &LogTypes[record->type];
+	int length;
+	if (record->type == LOG_SESSION_CLOSED) {
+		// the ratios are computed here, off the connection thread
+		const LONG64* values = record->values;
+		LONG64 messages = values[0] > 0 ? values[0] : 1;
+		LONG64 requests = values[3] > 0 ? values[3] : 1;
+		length = snprintf(obuffer, size, "[%s] %s: %lld requests, %.2f recv/request, %.2f send/request. [Total: %.2f recv/request, %.2f send/request]\n",
+			type->flags, type->text, values[0],
+			(double)values[1] / messages, (double)values[2] / messages,
+			(double)values[4] / requests, (double)values[5] / requests);
+	}
+	else if (record->type == LOG_SESSION_TIMEOUT) {
+		LONG64 timeout = record->values[0];
+		length = snprintf(obuffer, size, "[%s] %s %s.\n", type->flags, type->text,
+			timeout == 3 ? "login" : timeout == 2 ? "the rest of a request" : "a request");
+	}
+	else if (type->has_error)
+		length = snprintf(obuffer, size, "[%s:%d] %s\n", type->flags, record->error, type->text);
+	else
+		length = snprintf(obuffer, size, "[%s] %s\n", type->flags, type->text);
+	return length < 0 ? 0 : min(length, size - 1);
+}
+
+void SummarizeLogLosses()
+{
+	LONG64 dropped[LOG_TYPE_COUNT] = { 0 };
+	for (LOGRING* ring = LogRings; ring != NULL; ring = ring->next) {
+		for (int type = 0; type < LOG_TYPE_COUNT; type++)
+			dropped[type] += ring->dropped[type];
+	}
+
+	char line[512];
+	for (int type = 0; type < LOG_TYPE_COUNT; type++) {
+		LONG64 new_drops = dropped[type] - LogDropsReported[type];
+		if (LogSuppressed[type] == 0 && new_drops == 0)
+			continue;
+		LogDropsReported[type] = dropped[type];
+		int length = snprintf(line, sizeof(line), "[%s] %s: %lld more not written [rate limit], %lld dropped [ring full].\n",
+			WARNING_FLAGS, LogTypes[type].text, LogSuppressed[type], new_drops);
+		AppendLogOutput(line, length < 0 ? 0 : min(length, (int)sizeof(line) - 1));
+	}
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <process.h>
+
+#include "CommonHeader.h"
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define LOG_CACHE_LINE 64 // Rings are aligned to cache lines, and their indexes kept on lines of their own
+#define LOG_RING_SIZE 256 // Records a thread may have waiting for the logger. More are dropped and counted
+#define LOG_VALUE_COUNT 6 // Numbers a record carries besides its error code
+#define LOG_FLUSH_INTERVAL 50 // The logger writes out the waiting records this often, in milliseconds
+#define LOG_RATE_WINDOW 1000 // Period of the rate limits, in milliseconds
+#define LOG_DEFAULT_RATE 100 // Records of a message type written per window. The rest are counted and summarized
+#define LOG_OUTPUT_BUFFER_SIZE 65536 // Formatted lines are written to console in pieces of this size, at most
+
+#define LOG_CONNECTION_DROP 0 // The peer reset or aborted the connection. [error]
+#define LOG_HOST_UNREACHABLE 1 // [error]
+#define LOG_SEND_FAIL 2 // [error]
+#define LOG_SEND_NOT_ALL 3
+#define LOG_RECEIVE_FAIL 4 // [error]
+#define LOG_TOO_MUCH_BYTES 5
+#define LOG_ALLOCATE_MEMORY_FAIL 6
+#define LOG_RECEIVE_UNEXPECTED_MESSAGE 7
+#define LOG_NOT_LISTEN_SOCKET 8 // [error]
+#define LOG_ACCEPT_SOCKET_FAIL 9 // [error]
+#define LOG_SESSION_CLOSED 10 // [requests, recv calls, send calls of the session, then the same totals of the server]
+#define LOG_WRITE_ARTICLE_FAIL 11 // [errno]
+#define LOG_SESSION_TIMEOUT 12 // [what the session waited for: 1 a request, 2 the rest of a request, 3 login. See TIMEOUT_ in Server.h]
+#define LOG_MESSAGE_EXTREME_LARGE 13
+#define LOG_TYPE_COUNT 14
+
+#define _WRITE_ARTICLE_FAIL "Fail to write the article to storage."
+#define _START_LOGGER_FAIL "Fail to start the logger thread. Messages are written at once"
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef struct logtype {
+
+	const char* flags; // The flags of the message. See _FLAGS for some definitions
+
+	const char* text; // The message text
+
+	int has_error; // 1 if the message is written with its error code
+
+}LOGTYPE;
+
+typedef struct logrecord {
+
+	int type; // The message type. See LOG_ for some definitions
+
+	int error; // The error code. 0 if none
+
+	LONG64 values[LOG_VALUE_COUNT]; // Numbers of the message, by type
+
+}LOGRECORD; // A message as it is logged: formatted by the logger thread, not the thread that logs it
+
+typedef struct logring {
+
+	volatile LONG owner; // 1 while a thread logs into the ring. Released rings are taken over
+
+	struct logring* next; // Next ring. Linked List, only ever pushed
+
+	volatile LONG64 head; // Index of the oldest waiting record. Changed by the logger only
+
+	char padding[LOG_CACHE_LINE]; // Keep the indexes the logger and the thread write on separate cache lines
+
+	volatile LONG64 tail; // Index after the newest record. Changed by the owner thread only
+
+	volatile LONG64 dropped[LOG_TYPE_COUNT]; // Records dropped because the ring was full, by type. Changed by the owner thread only
+
+	char padding_records[LOG_CACHE_LINE]; // Keep the records off the line of tail
+
+	LOGRECORD records[LOG_RING_SIZE]; // The records, at index % LOG_RING_SIZE
+
+}LOGRING; // Single producer, single consumer: neither side takes a lock
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Begin the logger thread. Until it runs, messages are written at once by the thread that logs them.
+/// </summary>
+/// <param name="rate">Records of a message type written per LOG_RATE_WINDOW. 0 if not limited</param>
+/// <returns>1 if success. 0 if have errors</returns>
+int StartLogger(int rate);
+
+/// <summary>
+/// Log a message without waiting for console: the record is put in the ring of the calling thread.
+/// A full ring drops the record and counts it.
+/// </summary>
+/// <param name="type">The message type. See LOG_ for some definitions</param>
+/// <param name="error">The error code. 0 if none</param>
+/// <param name="values">Numbers of the message. NULL if none</param>
+/// <param name="count">Number of values. At most LOG_VALUE_COUNT</param>
+void LogEvent(int type, int error = 0, const LONG64* values = NULL, int count = 0);
+
+/// <summary>
+/// Get the ring of the calling thread, and Take one if it has none: a released ring, or a new one.
+/// </summary>
+/// <returns>The ring. NULL if fail to allocate memory</returns>
+LOGRING* GetLogRing();
+
+/// <summary>
+/// Give the ring of the calling thread back before the thread ends. Its waiting records are still written.
+/// </summary>
+void ReleaseLogRing();
+
+/// <summary>
+/// Write the waiting records of all rings to console, and Summarize the rate-limited and dropped ones once per window.
+/// Thread-safe: the logger and a thread stopping the server may flush at once.
+/// </summary>
+void FlushLogs();
+
+/// <summary>
+/// Call FlushLogs() every LOG_FLUSH_INTERVAL milliseconds. [Call on a thread of its own]
+/// </summary>
+/// <param name="arguments">Not used</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall RunLogger(void* arguments);
+
+/// <summary>
+/// Format a record as one line.
+/// </summary>
+/// <param name="record">The record</param>
+/// <param name="obuffer">[Output] The line, with its newline, null-terminated</param>
+/// <param name="size">Size of obuffer, in bytes</param>
+/// <returns>Length of the line, in bytes. Cut at size - 1 if longer</returns>
+int FormatLogRecord(const LOGRECORD* record, char* obuffer, int size);
+
+/// <summary>
+/// Print the number of records rate-limited and dropped in the last window, by type. [Call with the flush lock held]
+/// </summary>
+void SummarizeLogLosses();
+
+#pragma endregion
@@ -0,0 +1,497 @@
+#include "Metrics.h"
+
+METRICSSHARD* volatile MetricsShards = NULL; // All shards ever taken. Read without lock: shards are pushed, never removed
+__declspec(thread) METRICSSHARD* CurrentMetricsShard = NULL; // The shard of the calling thread. NULL until it counts
+const char* MetricsCommandNames[METRICS_COMMAND_COUNT] = { "UNKNOWN", CM_LOGIN, CM_POST, CM_LOGOUT, CM_COMPRESS, CM_TOKEN, CM_STATS };
+const char* MetricsStageNames[METRICS_STAGE_COUNT] = { "receive", "parse", "lock", "handler", "send" };
+const char* LockSiteNames[LOCK_SITE_COUNT] = { "login", "logout", "post", "end-session", "token", "stats", "datagram" };
+LONG64 MetricsClockFrequency = 0; // Ticks of the metrics clock per second. See InitializeMetrics()
+LOCKPROFILE* LockProfile = NULL; // The profiled lock, exported with the metrics. NULL if none
+const METRICSPAGE* MetricsPages[METRICS_PAGE_MAX]; // Pages served besides the metrics. See AddMetricsPage()
+int MetricsPageCount = 0;
+#if METRICS_STAGE_TIMING
+__declspec(thread) LONG64 StageLockWait = 0; // The critical_section waits of the calling thread since TakeStageLockWait(), in ticks
+#endif
+
+void InitializeMetrics()
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	MetricsClockFrequency = frequency.QuadPart;
+}
+
+METRICSSHARD* GetMetricsShard()
+{
+	METRICSSHARD* shard = CurrentMetricsShard;
+	if (shard != NULL)
+		return shard;
+
+	// connection threads come and go: their shards are reused instead of piling up
+	for (shard = MetricsShards; shard != NULL; shard = shard->next) {
+		if (shard->owner == 0 && InterlockedCompareExchange(&shard->owner, 1, 0) == 0)
+			break;
+	}
+	if (shard == NULL) {
+		size_t size = (sizeof(METRICSSHARD) + METRICS_CACHE_LINE - 1) & ~(size_t)(METRICS_CACHE_LINE - 1);
+		shard = (METRICSSHARD*)_aligned_malloc(size, METRICS_CACHE_LINE);
+		if (shard == NULL)
+			return NULL;
+		memset(shard, 0, size);
+		shard->owner = 1;
+		do {
+			shard->next = MetricsShards;
+		} while (InterlockedCompareExchangePointer((PVOID volatile*)&MetricsShards, shard, shard->next) != shard->next);
+	}
+	CurrentMetricsShard = shard;
+	return shard;
+}
+
+void ReleaseMetricsShard()
+{
+	METRICSSHARD* shard = CurrentMetricsShard;
+	if (shard == NULL)
+		return;
+	CurrentMetricsShard = NULL;
+	// a full barrier: the next owner sees every count of this thread
+	InterlockedExchange(&shard->owner, 0);
+}
+
+void CountRequest(int command)
+{
+	METRICSSHARD* shard = GetMetricsShard();
+	if (shard == NULL)
+		return;
+	if (command < 0 || command >= METRICS_COMMAND_COUNT)
+		command = 0;
+	shard->commands[command]++;
+}
+
+void CountResponse(int status)
+{
+	METRICSSHARD* shard = GetMetricsShard();
+	if (shard != NULL && status >= 0 && status < METRICS_STATUS_COUNT)
+		shard->statuses[status]++;
+}
+
+void CountBytesIn(int bytes)
+{
+	METRICSSHARD* shard = GetMetricsShard();
+	if (shard != NULL)
+		shard->bytes_in += bytes;
+}
+
+void CountBytesOut(int bytes)
+{
+	METRICSSHARD* shard = GetMetricsShard();
+	if (shard != NULL)
+		shard->bytes_out += bytes;
+}
+
+void ChangeActiveSessions(int delta)
+{
+	METRICSSHARD* shard = GetMetricsShard();
+	if (shard != NULL)
+		shard->sessions += delta;
+}
+
+void ChangeLoggedInAccounts(int delta)
+{
+	METRICSSHARD* shard = GetMetricsShard();
+	if (shard != NULL)
+		shard->logins += delta;
+}
+
+LONG64 ReadMetricsClock()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+int GetHistogramBucket(LONG64 ticks)
+{
+	// bucket i holds [2^(i-1), 2^i) microseconds: the bit length of the duration
+	unsigned long long microseconds = ticks > 0 && MetricsClockFrequency > 0 ? (unsigned long long)ticks * 1000000 / MetricsClockFrequency : 0;
+	int bucket = 0;
+	while (microseconds != 0 && bucket < METRICS_HISTOGRAM_BUCKETS - 1) {
+		microseconds >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+#if METRICS_STAGE_TIMING
+void RecordStage(int command, int stage, LONG64 ticks)
+{
+	METRICSSHARD* shard = GetMetricsShard();
+	if (shard == NULL)
+		return;
+	if (command < 0 || command >= METRICS_COMMAND_COUNT)
+		command = 0;
+	shard->stages[command][stage][GetHistogramBucket(ticks)]++;
+	shard->stage_ticks[command][stage] += ticks;
+}
+
+void AddStageLockWait(LONG64 ticks)
+{
+	StageLockWait += ticks;
+}
+
+LONG64 TakeStageLockWait()
+{
+	LONG64 ticks = StageLockWait;
+	StageLockWait = 0;
+	return ticks;
+}
+#endif
+
+void EnableLockProfile(LOCKPROFILE* profile)
+{
+	memset(profile, 0, sizeof(LOCKPROFILE));
+	LockProfile = profile;
+}
+
+void BeginLockHold(LOCKPROFILE* profile, int site, LONG64 wait)
+{
+	profile->site = site;
+	profile->acquired = ReadMetricsClock();
+	profile->acquires[site]++;
+	profile->contended[site] += wait > 0;
+	profile->waits[site][GetHistogramBucket(wait)]++;
+	profile->wait_ticks[site] += wait;
+}
+
+void EndLockHold(LOCKPROFILE* profile)
+{
+	LONG64 hold = ReadMetricsClock() - profile->acquired;
+	profile->holds[profile->site][GetHistogramBucket(hold)]++;
+	profile->hold_ticks[profile->site] += hold;
+}
+
+double GetHistogramQuantile(const LONG64* buckets, double quantile)
+{
+	LONG64 count = 0;
+	for (int i = 0; i < METRICS_HISTOGRAM_BUCKETS; ++i)
+		count += buckets[i];
+	if (count == 0)
+		return 0;
+	LONG64 rank = (LONG64)(quantile * count + 0.5);
+	LONG64 cumulative = 0;
+	int i = 0;
+	for (; i < METRICS_HISTOGRAM_BUCKETS - 1; ++i) {
+		cumulative += buckets[i];
+		if (cumulative >= rank)
+			break;
+	}
+	return (double)(1LL << i);
+}
+
+void PrintLockProfile(const LOCKPROFILE* profile)
+{
+	// read without the lock: a count may be a hold behind the others
+	for (int i = 0; i < LOCK_SITE_COUNT; ++i) {
+		LONG64 acquires = profile->acquires[i];
+		if (acquires == 0)
+			continue;
+		printf("[%s] Lock at %s: %lld acquires, %.2f%% contended, wait mean %.2f us p99 <= %.0f us, hold mean %.2f us p99 <= %.0f us\n",
+			INFO_FLAGS, LockSiteNames[i], acquires, 100.0 * profile->contended[i] / acquires,
+			(double)profile->wait_ticks[i] * 1000000 / MetricsClockFrequency / acquires, GetHistogramQuantile(profile->waits[i], 0.99),
+			(double)profile->hold_ticks[i] * 1000000 / MetricsClockFrequency / acquires, GetHistogramQuantile(profile->holds[i], 0.99));
+	}
+}
+
+void CollectMetrics(METRICSSNAPSHOT* osnapshot)
+{
+	memset(osnapshot, 0, sizeof(METRICSSNAPSHOT));
+	for (METRICSSHARD* shard = MetricsShards; shard != NULL; shard = shard->next) {
+		for (int i = 0; i < METRICS_COMMAND_COUNT; ++i)
+			osnapshot->commands[i] += shard->commands[i];
+		for (int i = 0; i < METRICS_STATUS_COUNT; ++i)
+			osnapshot->statuses[i] += shard->statuses[i];
+		osnapshot->bytes_in += shard->bytes_in;
+		osnapshot->bytes_out += shard->bytes_out;
+		osnapshot->sessions += shard->sessions;
+		osnapshot->logins += shard->logins;
+#if METRICS_STAGE_TIMING
+		for (int i = 0; i < METRICS_COMMAND_COUNT; ++i) {
+			for (int j = 0; j < METRICS_STAGE_COUNT; ++j) {
+				for (int k = 0; k < METRICS_HISTOGRAM_BUCKETS; ++k)
+					osnapshot->stages[i][j][k] += shard->stages[i][j][k];
+				osnapshot->stage_ticks[i][j] += shard->stage_ticks[i][j];
+			}
+		}
+#endif
+		osnapshot->shards++;
+	}
+	// a close counted before its open is read can make a gauge dip under 0 for a moment
+	if (osnapshot->sessions < 0)
+		osnapshot->sessions = 0;
+	if (osnapshot->logins < 0)
+		osnapshot->logins = 0;
+}
+
+// The rest of the buffer, for snprintf(): past its end the text is measured, not written
+#define METRICS_TAIL (obuffer != NULL && length < size ? obuffer + length : NULL), (obuffer != NULL && length < size ? size - length : 0)
+
+int FormatHistogram(const char* name, const char* labels, const LONG64* buckets, LONG64 ticks, char* obuffer, int size)
+{
+	int length = 0;
+	LONG64 count = 0;
+	for (int i = 0; i < METRICS_HISTOGRAM_BUCKETS; ++i) {
+		count += buckets[i];
+		if (i < METRICS_HISTOGRAM_BUCKETS - 1)
+			length += snprintf(METRICS_TAIL, "%s_bucket{%s,le=\"%g\"} %lld\n", name, labels, (double)(1LL << i) / 1000000, count);
+	}
+	length += snprintf(METRICS_TAIL, "%s_bucket{%s,le=\"+Inf\"} %lld\n%s_sum{%s} %.9f\n%s_count{%s} %lld\n",
+		name, labels, count, name, labels, MetricsClockFrequency > 0 ? (double)ticks / MetricsClockFrequency : 0.0, name, labels, count);
+	return length;
+}
+
+int FormatQuantiles(const char* name, const char* labels, const LONG64* buckets, LONG64 ticks, char* obuffer, int size)
+{
+	LONG64 count = 0;
+	for (int i = 0; i < METRICS_HISTOGRAM_BUCKETS; ++i)
+		count += buckets[i];
+	const double quantiles[] = { 0.5, 0.99 };
+	int length = 0;
+	int bucket = 0;
+	LONG64 below = buckets[0];
+	for (int q = 0; q < 2; ++q) {
+		// the first bucket reaching the rank. The last one has no upper bound
+		while (bucket < METRICS_HISTOGRAM_BUCKETS - 1 && below < quantiles[q] * count)
+			below += buckets[++bucket];
+		if (bucket < METRICS_HISTOGRAM_BUCKETS - 1)
+			length += snprintf(METRICS_TAIL, "%s{%s,quantile=\"%g\"} %g\n", name, labels, quantiles[q], (double)(1LL << bucket) / 1000000);
+		else
+			length += snprintf(METRICS_TAIL, "%s{%s,quantile=\"%g\"} +Inf\n", name, labels, quantiles[q]);
+	}
+	length += snprintf(METRICS_TAIL, "%s_sum{%s} %.9f\n%s_count{%s} %lld\n",
+		name, labels, MetricsClockFrequency > 0 ? (double)ticks / MetricsClockFrequency : 0.0, name, labels, count);
+	return length;
+}
+
+int FormatMetrics(const METRICSSNAPSHOT* snapshot, int format, char* obuffer, int size)
+{
+	int length = 0;
+	char labels[METRICS_LABELS_MAX_SIZE];
+	int is_annotated = (format == METRICS_FORMAT_EXPOSITION);
+	// STATS responses are limited to one message: their histograms are summed up in a few lines
+	int (*format_histogram)(const char*, const char*, const LONG64*, LONG64, char*, int) =
+		format == METRICS_FORMAT_EXPOSITION ? FormatHistogram : FormatQuantiles;
+	// snprintf() returns the length it would have written: once the buffer is full, the rest is only measured
+#define APPEND_METRICS(...) length += snprintf(METRICS_TAIL, __VA_ARGS__)
+
+	if (is_annotated) {
+		APPEND_METRICS("# HELP bbs_requests_total Requests handled, by command.\n");
+		APPEND_METRICS("# TYPE bbs_requests_total counter\n");
+	}
+	for (int i = 0; i < METRICS_COMMAND_COUNT; ++i)
+		APPEND_METRICS("bbs_requests_total{command=\"%s\"} %lld\n", MetricsCommandNames[i], snapshot->commands[i]);
+
+	if (is_annotated) {
+		APPEND_METRICS("# HELP bbs_responses_total Responses sent, by status code.\n");
+		APPEND_METRICS("# TYPE bbs_responses_total counter\n");
+	}
+	for (int i = 0; i < METRICS_STATUS_COUNT; ++i) {
+		if (snapshot->statuses[i] > 0)
+			APPEND_METRICS("bbs_responses_total{status=\"%02d\"} %lld\n", i, snapshot->statuses[i]);
+	}
+
+	if (is_annotated) {
+		APPEND_METRICS("# HELP bbs_received_bytes_total Bytes received on connections.\n");
+		APPEND_METRICS("# TYPE bbs_received_bytes_total counter\n");
+	}
+	APPEND_METRICS("bbs_received_bytes_total %lld\n", snapshot->bytes_in);
+	if (is_annotated) {
+		APPEND_METRICS("# HELP bbs_sent_bytes_total Bytes sent on connections.\n");
+		APPEND_METRICS("# TYPE bbs_sent_bytes_total counter\n");
+	}
+	APPEND_METRICS("bbs_sent_bytes_total %lld\n", snapshot->bytes_out);
+	if (is_annotated) {
+		APPEND_METRICS("# HELP bbs_active_sessions Sessions open now.\n");
+		APPEND_METRICS("# TYPE bbs_active_sessions gauge\n");
+	}
+	APPEND_METRICS("bbs_active_sessions %lld\n", snapshot->sessions);
+	if (is_annotated) {
+		APPEND_METRICS("# HELP bbs_logged_in_accounts Accounts logged in now.\n");
+		APPEND_METRICS("# TYPE bbs_logged_in_accounts gauge\n");
+	}
+	APPEND_METRICS("bbs_logged_in_accounts %lld\n", snapshot->logins);
+
+#if METRICS_STAGE_TIMING
+	if (is_annotated) {
+		APPEND_METRICS("# HELP bbs_request_stage_seconds Time requests spend in each stage of HandleRequest, by command.\n");
+		APPEND_METRICS("# TYPE bbs_request_stage_seconds histogram\n");
+	}
+	for (int i = 0; i < METRICS_COMMAND_COUNT; ++i) {
+		for (int j = 0; j < METRICS_STAGE_COUNT; ++j) {
+			LONG64 count = 0;
+			for (int k = 0; k < METRICS_HISTOGRAM_BUCKETS; ++k)
+				count += snapshot->stages[i][j][k];
+			// commands never requested would add hundreds of empty lines
+			if (count == 0)
+				continue;
+			snprintf(labels, sizeof(labels), "command=\"%s\",stage=\"%s\"", MetricsCommandNames[i], MetricsStageNames[j]);
+			length += format_histogram("bbs_request_stage_seconds", labels, snapshot->stages[i][j], snapshot->stage_ticks[i][j],
+				METRICS_TAIL);
+		}
+	}
+#endif
+
+	// read without the lock: a count may be a hold behind the others
+	const LOCKPROFILE* profile = LockProfile;
+	if (profile != NULL) {
+		if (is_annotated) {
+			APPEND_METRICS("# HELP bbs_lock_acquires_total Acquires of the account lock, by call site.\n");
+			APPEND_METRICS("# TYPE bbs_lock_acquires_total counter\n");
+		}
+		for (int i = 0; i < LOCK_SITE_COUNT; ++i)
+			APPEND_METRICS("bbs_lock_acquires_total{site=\"%s\"} %lld\n", LockSiteNames[i], profile->acquires[i]);
+		if (is_annotated) {
+			APPEND_METRICS("# HELP bbs_lock_contended_total Acquires of the account lock that waited, by call site.\n");
+			APPEND_METRICS("# TYPE bbs_lock_contended_total counter\n");
+		}
+		for (int i = 0; i < LOCK_SITE_COUNT; ++i)
+			APPEND_METRICS("bbs_lock_contended_total{site=\"%s\"} %lld\n", LockSiteNames[i], profile->contended[i]);
+		if (is_annotated) {
+			APPEND_METRICS("# HELP bbs_lock_wait_seconds Time waited for the account lock, by call site.\n");
+			APPEND_METRICS("# TYPE bbs_lock_wait_seconds histogram\n");
+		}
+		for (int i = 0; i < LOCK_SITE_COUNT; ++i) {
+			// sites never acquired would add empty histograms, as commands never requested would
+			if (profile->acquires[i] == 0)
+				continue;
+			snprintf(labels, sizeof(labels), "site=\"%s\"", LockSiteNames[i]);
+			length += format_histogram("bbs_lock_wait_seconds", labels, profile->waits[i], profile->wait_ticks[i], METRICS_TAIL);
+		}
+		if (is_annotated) {
+			APPEND_METRICS("# HELP bbs_lock_hold_seconds Time the account lock is held, by call site.\n");
+			APPEND_METRICS("# TYPE bbs_lock_hold_seconds histogram\n");
+		}
+		for (int i = 0; i < LOCK_SITE_COUNT; ++i) {
+			if (profile->acquires[i] == 0)
+				continue;
+			snprintf(labels, sizeof(labels), "site=\"%s\"", LockSiteNames[i]);
+			length += format_histogram("bbs_lock_hold_seconds", labels, profile->holds[i], profile->hold_ticks[i], METRICS_TAIL);
+		}
+	}
+
+#undef APPEND_METRICS
+	return length;
+}
+
+char* CreateMetricsText(const METRICSSNAPSHOT* snapshot, int format, int* olength)
+{
+	*olength = 0;
+	int size = METRICS_TEXT_INITIAL_SIZE;
+	char* text = (char*)malloc(size);
+	while (text != NULL) {
+		int length = FormatMetrics(snapshot, format, text, size);
+		if (length < size) {
+			*olength = length;
+			return text;
+		}
+		// the lock profile is read live: it may have grown since it was measured
+		free(text);
+		size = length + METRICS_TEXT_INITIAL_SIZE / 4;
+		text = (char*)malloc(size);
+	}
+	return NULL;
+}
+
+const char* GetCommandName(int command)
+{
+	return command >= 0 && command < METRICS_COMMAND_COUNT ? MetricsCommandNames[command] : MetricsCommandNames[0];
+}
+
+const char* GetLockSiteName(int site)
+{
+	return site >= 0 && site < LOCK_SITE_COUNT ? LockSiteNames[site] : "unknown";
+}
+
+int AddMetricsPage(const METRICSPAGE* page)
+{
+	if (MetricsPageCount >= METRICS_PAGE_MAX)
+		return 0;
+	MetricsPages[MetricsPageCount++] = page;
+	return 1;
+}
+
+unsigned __stdcall RunMetricsListener(void* arguments)
+{
+	SOCKET listener = (SOCKET)arguments;
+	while (1) {
+		SOCKET scraper = accept(listener, NULL, NULL);
+		if (scraper == INVALID_SOCKET)
+			break;
+		ServeMetricsRequest(scraper);
+		CloseSocket(scraper, CLOSE_SAFELY);
+	}
+	CloseSocket(listener, CLOSE_NORMAL);
+	return 0;
+}
+
+void ServeMetricsRequest(SOCKET socket)
+{
+	char request[METRICS_REQUEST_MAX_SIZE];
+	int length = 0;
+	DWORD timeout = METRICS_RECEIVE_TIMEOUT;
+	setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+	// the request line is all that is needed, but the headers are read as well: closing on unread bytes resets the connection
+	while (length < METRICS_REQUEST_MAX_SIZE - 1) {
+		int ret = recv(socket, request + length, METRICS_REQUEST_MAX_SIZE - 1 - length, 0);
+		if (ret <= 0)
+			return;
+		length += ret;
+		request[length] = '\0';
+		if (strstr(request, "\r\n\r\n") != NULL)
+			break;
+	}
+	request[length] = '\0';
+
+	const char* path = strncmp(request, "GET ", 4) == 0 ? request + 4 : NULL;
+	if (path != NULL && !IsRequestPath(path, METRICS_PATH)) {
+		for (int i = 0; i < MetricsPageCount; i++) {
+			if (!IsRequestPath(path, MetricsPages[i]->path))
+				continue;
+			char* page = NULL;
+			int page_len = MetricsPages[i]->format(&page);
+			if (page_len >= 0) {
+				char header[METRICS_REQUEST_MAX_SIZE];
+				int header_len = sprintf_s(header, sizeof(header), MetricsPages[i]->header, page_len);
+				if (send(socket, header, header_len, 0) == header_len)
+					send(socket, page, page_len, 0);
+			}
+			free(page);
+			return;
+		}
+		path = NULL;
+	}
+	if (path == NULL) {
+		send(socket, METRICS_HTTP_NOT_FOUND, (int)strlen(METRICS_HTTP_NOT_FOUND), 0);
+		return;
+	}
+
+	METRICSSNAPSHOT* snapshot = (METRICSSNAPSHOT*)malloc(sizeof(METRICSSNAPSHOT));
+	char* body = NULL;
+	int body_len = 0;
+	if (snapshot != NULL) {
+		CollectMetrics(snapshot);
+		body = CreateMetricsText(snapshot, METRICS_FORMAT_EXPOSITION, &body_len);
+	}
+	if (body != NULL) {
+		char header[sizeof(METRICS_HTTP_OK) + 16];
+		int header_len = sprintf_s(header, sizeof(header), METRICS_HTTP_OK, body_len);
+		// a blocking socket takes all bytes before send() returns
+		if (send(socket, header, header_len, 0) == header_len)
+			send(socket, body, body_len, 0);
+	}
+	free(snapshot);
+	free(body);
+}
+
+int IsRequestPath(const char* path, const char* expected)
+{
+	size_t length = strlen(expected);
+	return strncmp(path, expected, length) == 0 && (path[length] == ' ' || path[length] == '?');
+}
@@ -0,0 +1,367 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CommonHeader.h"
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#ifndef METRICS_STAGE_TIMING
+#define METRICS_STAGE_TIMING 1 // 1 to time the stages of each request. Build with METRICS_STAGE_TIMING=0 to compile the timing out
+#endif
+
+#define METRICS_CACHE_LINE 64 // Shards are aligned and sized to whole cache lines: threads never write to the same line
+#define METRICS_COMMAND_COUNT (C_STATS + 1) // Request counters, by command code. 0 counts unknown commands
+#define METRICS_STATUS_COUNT 100 // Response counters, by status code [2 digits]
+#define METRICS_TEXT_INITIAL_SIZE 65536 // First size of the buffer the metrics text is written to, in bytes. Grown to fit
+#define METRICS_REQUEST_MAX_SIZE 2048 // Bytes of an HTTP request read before it is answered
+#define METRICS_RECEIVE_TIMEOUT 2000 // A scrape that sends nothing for this long is closed, in milliseconds
+#define METRICS_LABELS_MAX_SIZE 128 // Largest size of the labels of a series, in bytes
+#define METRICS_PATH "/metrics"
+#define METRICS_FORMAT_SUMMARY 0 // Each histogram as its p50, p99, sum and count, with no HELP or TYPE lines: fits one STATS response
+#define METRICS_FORMAT_EXPOSITION 1 // Full histograms, with the HELP and TYPE lines of each metric: served at METRICS_PATH
+#define METRICS_PAGE_MAX 4 // Pages served besides the metrics. See AddMetricsPage()
+
+#define STAGE_RECEIVE 0 // The rest of the request received and merged, after its first segment
+#define STAGE_PARSE 1 // The command extracted
+#define STAGE_LOCK 2 // Waiting for critical_section, in the handler
+#define STAGE_HANDLER 3 // The handler, without its lock waits
+#define STAGE_SEND 4 // The response segmented and sent
+#define METRICS_STAGE_COUNT 5
+#define METRICS_HISTOGRAM_BUCKETS 22 // Bucket i counts durations up to 2^i microseconds. The last one counts longer ones [about 1 s]
+
+#if METRICS_STAGE_TIMING
+#define STAGE_CLOCK(variable) LONG64 variable = ReadMetricsClock() // Declare a time stamp, in QueryPerformanceCounter() ticks
+#define STAGE_RECORD(command, stage, start, end) RecordStage(command, stage, (end) - (start))
+#define STAGE_TAKE_LOCK_WAIT(variable) LONG64 variable = TakeStageLockWait() // Declare the lock waits of the request so far, and Reset them
+#define STAGE_RESET_LOCK_WAIT() TakeStageLockWait()
+#else
+#define STAGE_CLOCK(variable)
+#define STAGE_RECORD(command, stage, start, end)
+#define STAGE_TAKE_LOCK_WAIT(variable)
+#define STAGE_RESET_LOCK_WAIT()
+#endif
+
+#define LOCK_SITE_LOGIN 0 // Call sites of the account lock [critical_section]
+#define LOCK_SITE_LOGOUT 1
+#define LOCK_SITE_POST 2
+#define LOCK_SITE_END_SESSION 3
+#define LOCK_SITE_TOKEN 4
+#define LOCK_SITE_STATS 5
+#define LOCK_SITE_DATAGRAM 6
+#define LOCK_SITE_COUNT 7
+
+#define METRICS_HTTP_OK "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: %d\r\nConnection: close\r\n\r\n"
+#define METRICS_HTTP_NOT_FOUND "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef struct metricspage {
+
+	const char* path; // Path of the page. Matched as METRICS_PATH is
+
+	const char* header; // The HTTP response header, with %d for the length of the body
+
+	int (*format)(char** obody); // Write the body. obody is allocated: free with free(). Returns its length, -1 if failed
+
+}METRICSPAGE; // A page served with the metrics, by another module
+
+typedef struct metricsshard {
+
+	volatile LONG owner; // 1 while a thread writes to the shard. Released shards are taken over, counters and all
+
+	struct metricsshard* next; // Next shard. Linked List, only ever pushed
+
+	volatile LONG64 commands[METRICS_COMMAND_COUNT]; // Requests handled, by command code
+
+	volatile LONG64 statuses[METRICS_STATUS_COUNT]; // Responses sent, by status code
+
+	volatile LONG64 bytes_in; // Bytes received on connections
+
+	volatile LONG64 bytes_out; // Bytes sent on connections
+
+	volatile LONG64 sessions; // Sessions opened minus sessions closed on this shard. Summed over shards, the open sessions
+
+	volatile LONG64 logins; // Accounts logged in minus accounts logged out on this shard. Summed over shards, the logged in accounts
+
+#if METRICS_STAGE_TIMING
+	volatile LONG64 stages[METRICS_COMMAND_COUNT][METRICS_STAGE_COUNT][METRICS_HISTOGRAM_BUCKETS]; // Stage durations, by command and stage. Not cumulative
+
+	volatile LONG64 stage_ticks[METRICS_COMMAND_COUNT][METRICS_STAGE_COUNT]; // Total time of each stage, in QueryPerformanceCounter() ticks
+#endif
+
+}METRICSSHARD;
+
+typedef struct metricssnapshot {
+
+	LONG64 commands[METRICS_COMMAND_COUNT]; // Requests handled, by command code
+
+	LONG64 statuses[METRICS_STATUS_COUNT]; // Responses sent, by status code
+
+	LONG64 bytes_in; // Bytes received on connections
+
+	LONG64 bytes_out; // Bytes sent on connections
+
+	LONG64 sessions; // Sessions open now
+
+	LONG64 logins; // Accounts logged in now
+
+#if METRICS_STAGE_TIMING
+	LONG64 stages[METRICS_COMMAND_COUNT][METRICS_STAGE_COUNT][METRICS_HISTOGRAM_BUCKETS]; // Stage durations, by command and stage. Not cumulative
+
+	LONG64 stage_ticks[METRICS_COMMAND_COUNT][METRICS_STAGE_COUNT]; // Total time of each stage, in ticks
+#endif
+
+	int shards; // Number of shards summed: threads that counted something, at most
+
+}METRICSSNAPSHOT;
+
+typedef struct lockprofile {
+
+	int site; // Call site of the holder. See LOCK_SITE_ for some definitions
+
+	LONG64 acquired; // When the holder got the lock, in QueryPerformanceCounter() ticks
+
+	LONG64 acquires[LOCK_SITE_COUNT]; // Acquires, by call site
+
+	LONG64 contended[LOCK_SITE_COUNT]; // Acquires that found the lock held and waited, by call site
+
+	LONG64 waits[LOCK_SITE_COUNT][METRICS_HISTOGRAM_BUCKETS]; // Waits before the acquires, by call site. Not cumulative
+
+	LONG64 holds[LOCK_SITE_COUNT][METRICS_HISTOGRAM_BUCKETS]; // Times from acquire to release, by call site. Not cumulative
+
+	LONG64 wait_ticks[LOCK_SITE_COUNT]; // Total wait, by call site, in ticks
+
+	LONG64 hold_ticks[LOCK_SITE_COUNT]; // Total hold, by call site, in ticks
+
+}LOCKPROFILE; // Written only by the holder of the lock it profiles: the lock itself guards it
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Read the frequency of the metrics clock. [Call once before any thread counts]
+/// </summary>
+void InitializeMetrics();
+
+/// <summary>
+/// Get the shard of the calling thread, and Take one if it has none: a released shard, or a new one.
+/// Only its thread writes to a shard, with plain adds: counting takes no lock and no interlocked instruction.
+/// </summary>
+/// <returns>The shard. NULL if fail to allocate memory: nothing is counted</returns>
+METRICSSHARD* GetMetricsShard();
+
+/// <summary>
+/// Give the shard of the calling thread back before the thread ends. Its counters stay and go on with the next thread taking it.
+/// </summary>
+void ReleaseMetricsShard();
+
+/// <summary>
+/// Count a request handled.
+/// </summary>
+/// <param name="command">The command code. See C_ for some definitions. 0 or out of range for unknown</param>
+void CountRequest(int command);
+
+/// <summary>
+/// Count a response sent.
+/// </summary>
+/// <param name="status">The status code. Out of range codes are not counted</param>
+void CountResponse(int status);
+
+/// <summary>
+/// Count bytes received on a connection.
+/// </summary>
+/// <param name="bytes">Number of bytes</param>
+void CountBytesIn(int bytes);
+
+/// <summary>
+/// Count bytes sent on a connection.
+/// </summary>
+/// <param name="bytes">Number of bytes</param>
+void CountBytesOut(int bytes);
+
+/// <summary>
+/// Change the number of open sessions. A session may close on another thread than it opened: the gauge is only right summed.
+/// </summary>
+/// <param name="delta">1 when a session opens. -1 when it closes</param>
+void ChangeActiveSessions(int delta);
+
+/// <summary>
+/// Change the number of logged in accounts.
+/// </summary>
+/// <param name="delta">1 when an account logs in. -1 when it logs out or its session ends</param>
+void ChangeLoggedInAccounts(int delta);
+
+/// <summary>
+/// Read the clock stages and locks are timed with.
+/// </summary>
+/// <returns>Now, in QueryPerformanceCounter() ticks: the TSC on current hardware</returns>
+LONG64 ReadMetricsClock();
+
+/// <summary>
+/// Find the histogram bucket of a duration.
+/// </summary>
+/// <param name="ticks">The duration, in QueryPerformanceCounter() ticks</param>
+/// <returns>The bucket: bucket i counts durations up to 2^i microseconds</returns>
+int GetHistogramBucket(LONG64 ticks);
+
+/// <summary>
+/// Estimate a quantile of a histogram, as the upper bound of its bucket.
+/// </summary>
+/// <param name="buckets">The histogram. METRICS_HISTOGRAM_BUCKETS counts, not cumulative</param>
+/// <param name="quantile">The quantile, from 0 to 1</param>
+/// <returns>The upper bound, in microseconds. 0 if the histogram is empty</returns>
+double GetHistogramQuantile(const LONG64* buckets, double quantile);
+
+#if METRICS_STAGE_TIMING
+
+/// <summary>
+/// Count the duration of a stage of a request in its histogram.
+/// </summary>
+/// <param name="command">The command code of the request. See C_ for some definitions</param>
+/// <param name="stage">The stage. See STAGE_ for some definitions</param>
+/// <param name="ticks">The duration, in QueryPerformanceCounter() ticks</param>
+void RecordStage(int command, int stage, LONG64 ticks);
+
+/// <summary>
+/// Add a wait for critical_section to the request the calling thread handles.
+/// </summary>
+/// <param name="ticks">The wait, in QueryPerformanceCounter() ticks</param>
+void AddStageLockWait(LONG64 ticks);
+
+/// <summary>
+/// Get the critical_section waits of the calling thread since the last call, and Reset them.
+/// </summary>
+/// <returns>The waits, in QueryPerformanceCounter() ticks</returns>
+LONG64 TakeStageLockWait();
+#endif
+
+/// <summary>
+/// Reset a lock profile, and Export it with the metrics from now on.
+/// </summary>
+/// <param name="profile">The profile. It lives as long as the process</param>
+void EnableLockProfile(LOCKPROFILE* profile);
+
+/// <summary>
+/// Count an acquire of a profiled lock, and Start timing its hold. [Call with the lock held]
+/// </summary>
+/// <param name="profile">The profile of the lock</param>
+/// <param name="site">The call site. See LOCK_SITE_ for some definitions</param>
+/// <param name="wait">Time waited for the lock, in QueryPerformanceCounter() ticks. 0 if it was free</param>
+void BeginLockHold(LOCKPROFILE* profile, int site, LONG64 wait);
+
+/// <summary>
+/// Count the hold of a profiled lock. [Call with the lock held, right before releasing it]
+/// </summary>
+/// <param name="profile">The profile of the lock</param>
+void EndLockHold(LOCKPROFILE* profile);
+
+/// <summary>
+/// Print the acquires, contention, waits and holds of a lock to console, by call site.
+/// </summary>
+/// <param name="profile">The profile of the lock</param>
+void PrintLockProfile(const LOCKPROFILE* profile);
+
+/// <summary>
+/// Sum the counters of all shards. Nothing is stopped: each counter is read once, the sums are not taken at one instant.
+/// </summary>
+/// <param name="osnapshot">[Output] The sums</param>
+void CollectMetrics(METRICSSNAPSHOT* osnapshot);
+
+/// <summary>
+/// Write a histogram in the Prometheus text exposition format: cumulative buckets in seconds, sum and count.
+/// </summary>
+/// <param name="name">Name of the metric</param>
+/// <param name="labels">Labels of the series, without braces</param>
+/// <param name="buckets">The histogram. METRICS_HISTOGRAM_BUCKETS counts, not cumulative</param>
+/// <param name="ticks">Sum of the durations, in QueryPerformanceCounter() ticks</param>
+/// <param name="obuffer">[Output] The text. NULL to measure it only</param>
+/// <param name="size">Size of obuffer, in bytes</param>
+/// <returns>Length of the whole text, in bytes, as snprintf() returns it. size or more if cut</returns>
+int FormatHistogram(const char* name, const char* labels, const LONG64* buckets, LONG64 ticks, char* obuffer, int size);
+
+/// <summary>
+/// Write a histogram as a Prometheus summary: its p50 and p99 in seconds, as the upper bounds of their buckets, sum and count.
+/// </summary>
+/// <param name="name">Name of the metric</param>
+/// <param name="labels">Labels of the series, without braces</param>
+/// <param name="buckets">The histogram. METRICS_HISTOGRAM_BUCKETS counts, not cumulative</param>
+/// <param name="ticks">Sum of the durations, in QueryPerformanceCounter() ticks</param>
+/// <param name="obuffer">[Output] The text. NULL to measure it only</param>
+/// <param name="size">Size of obuffer, in bytes</param>
+/// <returns>Length of the whole text, in bytes, as snprintf() returns it. size or more if cut</returns>
+int FormatQuantiles(const char* name, const char* labels, const LONG64* buckets, LONG64 ticks, char* obuffer, int size);
+
+/// <summary>
+/// Write the metrics in the Prometheus text exposition format. The lock profile enabled is written as well.
+/// </summary>
+/// <param name="snapshot">The metrics</param>
+/// <param name="format">METRICS_FORMAT_EXPOSITION or METRICS_FORMAT_SUMMARY</param>
+/// <param name="obuffer">[Output] The text, null-terminated. NULL to measure it only</param>
+/// <param name="size">Size of obuffer, in bytes</param>
+/// <returns>Length of the whole text, in bytes, as snprintf() returns it. size or more if cut: the text then ends
+/// in the middle of a line, and must be written again to a buffer of more than this length</returns>
+int FormatMetrics(const METRICSSNAPSHOT* snapshot, int format, char* obuffer, int size);
+
+/// <summary>
+/// Write the metrics in the Prometheus text exposition format to a buffer large enough for all of them.
+/// </summary>
+/// <param name="snapshot">The metrics</param>
+/// <param name="format">METRICS_FORMAT_EXPOSITION or METRICS_FORMAT_SUMMARY</param>
+/// <param name="olength">[Output] Length of the text, in bytes. 0 if failed</param>
+/// <returns>The text, null-terminated. Free with free(). NULL if fail to allocate memory</returns>
+char* CreateMetricsText(const METRICSSNAPSHOT* snapshot, int format, int* olength);
+
+/// <summary>
+/// Get the name of a command, as the metrics label it.
+/// </summary>
+/// <param name="command">The command code. See C_ for some definitions</param>
+/// <returns>The name. "UNKNOWN" if out of range</returns>
+const char* GetCommandName(int command);
+
+/// <summary>
+/// Get the name of a lock call site, as the metrics label it.
+/// </summary>
+/// <param name="site">The call site. See LOCK_SITE_ for some definitions</param>
+/// <returns>The name. "unknown" if out of range</returns>
+const char* GetLockSiteName(int site);
+
+/// <summary>
+/// Serve a page with the metrics from now on. [Call before the metrics listener begins]
+/// </summary>
+/// <param name="page">The page. It lives as long as the process</param>
+/// <returns>1 if success. 0 if METRICS_PAGE_MAX pages are served already</returns>
+int AddMetricsPage(const METRICSPAGE* page);
+
+/// <summary>
+/// Serve the metrics over HTTP to scrapers until the listener fails: GET /metrics answers the annotated text,
+/// and the added pages answer their own paths.
+/// One scrape is served at a time. [Call on a thread of its own]
+/// </summary>
+/// <param name="arguments">The listener socket, bound and listening. [SOCKET]</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall RunMetricsListener(void* arguments);
+
+/// <summary>
+/// Read an HTTP request from a scraper and Answer it.
+/// </summary>
+/// <param name="socket">The scraper connection</param>
+void ServeMetricsRequest(SOCKET socket);
+
+/// <summary>
+/// Check the path of an HTTP request.
+/// </summary>
+/// <param name="path">The path of the request, up to the end of the request line</param>
+/// <param name="expected">The path of a page</param>
+/// <returns>1 if the request is for the page, with or without a query. 0 otherwise</returns>
+int IsRequestPath(const char* path, const char* expected);
+
+#pragma endregion
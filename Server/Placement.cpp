@@ -0,0 +1,73 @@
+#include "Placement.h"
+
+int LoadNumaNodes(NUMANODE* onodes, int capacity)
+{
+	ULONG highest;
+	if (!GetNumaHighestNodeNumber(&highest))
+		return 0;
+	int count = 0;
+	for (ULONG node = 0; node <= highest && count < capacity; ++node) {
+		GROUP_AFFINITY affinity;
+		// node numbers may have gaps, and a node may have memory only
+		if (!GetNumaNodeProcessorMaskEx((USHORT)node, &affinity) || affinity.Mask == 0)
+			continue;
+		onodes[count].number = (USHORT)node;
+		onodes[count].affinity = affinity;
+		onodes[count].processors = 0;
+		for (KAFFINITY mask = affinity.Mask; mask != 0; mask &= mask - 1)
+			onodes[count].processors++;
+		++count;
+	}
+	return count;
+}
+
+const NUMANODE* FindCurrentNumaNode(const NUMANODE* nodes, int count)
+{
+	if (count == 0)
+		return NULL;
+	PROCESSOR_NUMBER processor;
+	USHORT number;
+	GetCurrentProcessorNumberEx(&processor);
+	if (!GetNumaProcessorNodeEx(&processor, &number))
+		return NULL;
+	for (int i = 0; i < count; ++i) {
+		if (nodes[i].number == number)
+			return &nodes[i];
+	}
+	return NULL;
+}
+
+int PinThread(HANDLE thread, const NUMANODE* node, int processor)
+{
+	if (node == NULL)
+		return 0;
+	GROUP_AFFINITY affinity = node->affinity;
+	if (processor >= 0) {
+		// keep the [processor % processors]-th set bit of the node mask
+		KAFFINITY mask = node->affinity.Mask;
+		for (int i = processor % node->processors; i > 0; --i)
+			mask &= mask - 1;
+		affinity.Mask = mask & (~mask + 1);
+	}
+	return SetThreadGroupAffinity(thread, &affinity, NULL) != 0;
+}
+
+HANDLE BeginPlacedThread(unsigned (__stdcall* start)(void*), void* arguments, const NUMANODE* node, int processor)
+{
+	if (node == NULL)
+		return (HANDLE)_beginthreadex(NULL, 0, start, arguments, 0, 0);
+	HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, start, arguments, CREATE_SUSPENDED, 0);
+	if (thread == 0)
+		return 0;
+	// a thread that can not be pinned still runs, only without placement
+	PinThread(thread, node, processor);
+	ResumeThread(thread);
+	return thread;
+}
+
+void* AllocateOnNode(const NUMANODE* node, size_t size)
+{
+	if (node == NULL)
+		return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	return VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node->number);
+}
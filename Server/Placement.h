@@ -0,0 +1,78 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <process.h>
+#include <WinSock2.h>
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define PLACEMENT_MAX_NODES 64 // Most NUMA nodes used. Threads on further nodes are not placed
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef struct numanode {
+
+	USHORT number; // The NUMA node number
+
+	GROUP_AFFINITY affinity; // The processors of the node
+
+	int processors; // Number of processors in affinity
+
+}NUMANODE;
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Find the NUMA nodes of the host that have processors.
+/// </summary>
+/// <param name="onodes">[Output] The nodes</param>
+/// <param name="capacity">Number of entries of onodes</param>
+/// <returns>Number of nodes found. 0 if have errors</returns>
+int LoadNumaNodes(NUMANODE* onodes, int capacity);
+
+/// <summary>
+/// Find the node of the processor the calling thread runs on.
+/// </summary>
+/// <param name="nodes">The nodes from LoadNumaNodes()</param>
+/// <param name="count">Number of nodes</param>
+/// <returns>The node. NULL if it is not one of nodes</returns>
+const NUMANODE* FindCurrentNumaNode(const NUMANODE* nodes, int count);
+
+/// <summary>
+/// Let a thread run on the processors of a node only.
+/// </summary>
+/// <param name="thread">The thread</param>
+/// <param name="node">The node. NULL to leave the thread as is</param>
+/// <param name="processor">Index of the one processor among the processors of the node, wrapped around. -1 for any of them</param>
+/// <returns>1 if success. 0 otherwise</returns>
+int PinThread(HANDLE thread, const NUMANODE* node, int processor);
+
+/// <summary>
+/// Begin a thread pinned to a node before it runs: what it allocates and touches first is in memory of the node.
+/// </summary>
+/// <param name="start">The thread function</param>
+/// <param name="arguments">Passed to start</param>
+/// <param name="node">The node. NULL for a thread not placed</param>
+/// <param name="processor">Index of the one processor among the processors of the node. -1 for any of them</param>
+/// <returns>The thread. 0 if have errors [errno is set]</returns>
+HANDLE BeginPlacedThread(unsigned (__stdcall* start)(void*), void* arguments, const NUMANODE* node, int processor);
+
+/// <summary>
+/// Allocate committed pages with physical memory on a node. They are never freed: use it for pools.
+/// </summary>
+/// <param name="node">The node. NULL for any node</param>
+/// <param name="size">Size of memory, in bytes. Rounded up to the page size</param>
+/// <returns>The memory, aligned to a page. NULL if fail to allocate memory</returns>
+void* AllocateOnNode(const NUMANODE* node, size_t size);
+
+#pragma endregion
@@ -2,11 +2,45 @@
 
 ACCOUNTINFO* Accounts = NULL;
 CRITICAL_SECTION critical_section;
+SERVERCONFIG Config = { READ_AHEAD_BUFFER_SIZE, POST_STREAM_THRESHOLD, 1, COMPRESSION_MIN_SIZE, 0, NULL, NULL, ENGINE_THREADS, 0, 1, 0, 0, 0, 0, 0, 0, 0, { 0 }, { 0 }, 0, 0, ADMIN_ACCOUNT, 0, LOG_DEFAULT_RATE, 0 };
+SESSIONHANDLER SessionHandler = { AdmitConnection, StartConnection, HandleRequest, StreamRequest, ClassifyRequest, FinishConnection };
+DATAGRAMSTATISTICS DatagramStatistics = { 0 };
+ACCEPTSTATISTICS AcceptStatistics = { 0 };
+ADMISSIONSTATISTICS AdmissionStatistics = { 0 };
+LOCKPROFILE AccountLockProfile; // Acquires, waits and holds of critical_section by call site. Guarded by critical_section itself
+RATELIMIT PostLimits[RATE_CLASS_COUNT] = { 0 }; // Token bucket parameters of each rate class. See PreparePostLimits()
+STREAMHANDLER PostStreamHandler = { BeginPostStream, WritePostStream, EndPostStream };
+TIMERWHEEL* SessionTimers = NULL; // Enforces the session timeouts. NULL if none is used
+TASKSCHEDULER* Scheduler = NULL; // Runs requests of the completion engine by priority class. NULL if not used
+NUMANODE NumaNodes[PLACEMENT_MAX_NODES]; // The nodes threads are placed on. See LoadNumaNodes()
+int NumaNodeCount = 0; // Number of NumaNodes. 0 if threads are not placed
+char BusyResponse[SEGMENT_HEADER_SIZE + STATUS_LENGTH + sizeof(SM_SERVER_BUSY)]; // One segment with the S_SERVER_BUSY response. See PrepareBusyResponse()
+volatile LONG ArticleSequence = 0; // Sequence number used to name stored articles
+
+volatile LONG64 TotalRequests = 0; // Number of requests received on closed sessions
+volatile LONG64 TotalReceiveCalls = 0; // Number of recv() calls made on closed sessions
+volatile LONG64 TotalSendCalls = 0; // Number of send() calls made on closed sessions
 
 int main(int argc, char* argv[])
 {
 	int running_port;
 	ExtractCommand(argc, argv, &running_port);
+	ExtractOptions(argc, argv, &Config);
+	InitializeMetrics();
+	if (!StartLogger(Config.log_rate))
+		printf("[%s] %s\n", WARNING_FLAGS, _START_LOGGER_FAIL);
+	if (Config.trace_sample > 0) {
+		if (!EnableTracing(Config.trace_sample)) {
+			printf("[%s] %s\n", WARNING_FLAGS, _ENABLE_TRACING_FAIL);
+			Config.trace_sample = 0;
+		}
+		else if (Config.metrics_port == 0) {
+			printf("[%s] %s\n", WARNING_FLAGS, _TRACE_NOT_SERVED);
+		}
+	}
+	if (Config.lock_profile)
+		EnableLockProfile(&AccountLockProfile);
+	SetConsoleCtrlHandler(HandleConsoleControl, TRUE);
 	if (WSInitialize()) {
 		SOCKET listener = CreateSocket(TCP);
 
@@ -18,15 +52,70 @@ int main(int argc, char* argv[])
 
 					printf("[%s] Listenning at port %d...\n", INFO_FLAGS, running_port);
 
-					if (LoadAccountList(ACCOUNT_FILE_PATH)) {
+					if (LoadAccountList(ACCOUNT_FILE_PATH) && CreateArticleStorage(ARTICLE_DIRECTORY)) {
 
 						InitializeCriticalSection(&critical_section);
-						while (1) {
-							SOCKET connector = GetConnectionSocket(listener);
-							if (connector != INVALID_SOCKET) {
-								CreateThreadForConnection(connector);
+						PrepareBusyResponse();
+						PreparePostLimits();
+						if (Config.numa) {
+							NumaNodeCount = LoadNumaNodes(NumaNodes, PLACEMENT_MAX_NODES);
+							if (NumaNodeCount == 0)
+								printf("[%s] %s\n", WARNING_FLAGS, _LOAD_NUMA_NODES_FAIL);
+							else
+								printf("[%s] Placing threads on %d NUMA node(s)...\n", INFO_FLAGS, NumaNodeCount);
+						}
+						if (Config.idle_timeout > 0 || Config.read_timeout > 0 || Config.login_timeout > 0) {
+							SessionTimers = CreateTimerWheel(ExpireSession);
+							if (SessionTimers == NULL)
+								printf("[%s] %s\n", WARNING_FLAGS, _CREATE_TIMER_WHEEL_FAIL);
+						}
+						if (Config.udp) {
+							CreateThreadForDatagrams(socket_address);
+						}
+						if (Config.unix_path != NULL) {
+							CreateThreadForLocalListener(Config.unix_path);
+						}
+						if (Config.shm_name != NULL) {
+							CreateThreadForSharedListener(Config.shm_name);
+						}
+						if (Config.metrics_port > 0) {
+							CreateThreadForMetrics(Config.metrics_port);
+						}
+						CreateThreadForAcceptReport();
+						if (Config.engine != ENGINE_THREADS) {
+							// requests not streamed are buffered whole: posts larger than the buffer must be streamed
+							if (Config.stream_threshold > ENGINE_MESSAGE_MAX_SIZE)
+								Config.stream_threshold = ENGINE_MESSAGE_MAX_SIZE;
+							COMPLETIONENGINE* engine = CreateCompletionEngine(listener, &SessionHandler, Config.read_buffer_size,
+								ENGINE_ACCEPT_BACKLOG * Config.acceptors, NumaNodes, NumaNodeCount);
+							if (engine != NULL) {
+								if (Config.engine == ENGINE_COROUTINE)
+									EnableCoroutineSessions(engine);
+								if (Config.scheduler > 0) {
+									engine->scheduler = Scheduler = CreateTaskScheduler(Config.scheduler, NumaNodes, NumaNodeCount);
+									if (engine->scheduler == NULL)
+										printf("[%s] %s\n", WARNING_FLAGS, _CREATE_SCHEDULER_FAIL);
+								}
+								printf("[%s] Serving with %s engine...\n", INFO_FLAGS,
+									Config.engine == ENGINE_COROUTINE ? ENGINE_NAME_COROUTINE : ENGINE_NAME_COMPLETION);
+								RunCompletionEngine(engine, Config.workers);
+							}
+						}
+						else {
+							// accept() wakes one waiting thread per connection: a reconnect storm is spread over them.
+							// Placed, each node has an acceptor, and its connections are served on the node
+							int acceptors = max(Config.acceptors, NumaNodeCount);
+							for (int i = 1; i < acceptors; ++i) {
+								const NUMANODE* node = NumaNodeCount > 0 ? &NumaNodes[i % NumaNodeCount] : NULL;
+								if (BeginPlacedThread(RunListener, (void*)listener, node, -1) == 0)
+									printf("[%s] %s\n", WARNING_FLAGS, _TOO_MANY_THREADS);
 							}
+							if (NumaNodeCount > 0)
+								PinThread(GetCurrentThread(), &NumaNodes[0], -1);
+							RunListener((void*)listener);
 						}
+						if (Config.lock_profile)
+							PrintLockProfile(&AccountLockProfile);
 						DeleteCriticalSection(&critical_section);
 
 						FreeAccountList(Accounts);
@@ -37,15 +126,25 @@ int main(int argc, char* argv[])
 		CloseSocket(listener, CLOSE_SAFELY);
 		WSCleanup();
 	}
+	FlushLogs();
 	printf("[%s] Stopping...\n", INFO_FLAGS);
 	return 0;
 }
 
 #pragma region Thread and Session
 
-HANDLE CreateThreadForConnection(SOCKET socket)
+HANDLE CreateThreadForConnection(SOCKET socket, LONG64 accepted)
 {
-	HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, Run, (void*)socket, 0, 0);
+	ACCEPTEDSOCKET* arguments = (ACCEPTEDSOCKET*)malloc(sizeof(ACCEPTEDSOCKET));
+	HANDLE thread = 0;
+	if (arguments != NULL) {
+		arguments->socket = socket;
+		arguments->accepted = accepted;
+		// on the node of the accepting thread: the connection allocates its buffers on its own thread, in memory of the node
+		thread = BeginPlacedThread(Run, (void*)arguments, FindCurrentNumaNode(NumaNodes, NumaNodeCount), -1);
+		if (thread == 0)
+			free(arguments);
+	}
 	if (thread == 0) { // has error
 		if (errno == EAGAIN) {
 			printf("[%s] %s\n", WARNING_FLAGS, _TOO_MANY_THREADS);
@@ -53,34 +152,336 @@ HANDLE CreateThreadForConnection(SOCKET socket)
 		else if (errno == EACCES) {
 			printf("[%s] %s\n", WARNING_FLAGS, _INSUFFICIENT_RESOURCES);
 		}
+		// nobody serves the connection: tell the client instead of leaving it waiting
+		InterlockedDecrement(&AdmissionStatistics.connections);
+		RefuseConnection(socket);
+		CloseSocket(socket, CLOSE_NORMAL);
 	}
 	return thread;
 }
 
-unsigned __stdcall Run(void* arguments)
+HANDLE CreateThreadForLocalListener(const char* path)
 {
-	SOCKET connector = (SOCKET)arguments;
-	while (connector != INVALID_SOCKET) {
-		// communicate
-		int status = HandleRequest(connector);
-		if (status == -1) {
-			EndSession(connector);
-			CloseSocket(connector, CLOSE_SAFELY);
-			connector = INVALID_SOCKET;
+	SOCKET listener = CreateSocket(LOCAL);
+	if (listener == INVALID_SOCKET)
+		return 0;
+	if (!BindSocket(listener, CreateLocalSocketAddress(path)) || !SetListenState(listener)) {
+		CloseSocket(listener, CLOSE_NORMAL);
+		return 0;
+	}
+
+	HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, RunListener, (void*)listener, 0, 0);
+	if (thread == 0) {
+		printf("[%s] %s\n", WARNING_FLAGS, _TOO_MANY_THREADS);
+		CloseSocket(listener, CLOSE_NORMAL);
+	}
+	else {
+		printf("[%s] Listenning at '%s'...\n", INFO_FLAGS, path);
+	}
+	return thread;
+}
+
+HANDLE CreateThreadForMetrics(int port)
+{
+	SOCKET listener = CreateSocket(TCP);
+	if (listener == INVALID_SOCKET)
+		return 0;
+	IP loopback;
+	loopback.s_addr = htonl(INADDR_LOOPBACK);
+	if (!BindSocket(listener, CreateSocketAddress(loopback, port)) || !SetListenState(listener)) {
+		CloseSocket(listener, CLOSE_NORMAL);
+		return 0;
+	}
+
+	HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, RunMetricsListener, (void*)listener, 0, 0);
+	if (thread == 0) {
+		printf("[%s] %s\n", WARNING_FLAGS, _TOO_MANY_THREADS);
+		CloseSocket(listener, CLOSE_NORMAL);
+	}
+	else {
+		printf("[%s] Serving metrics at 127.0.0.1:%d%s...\n", INFO_FLAGS, port, METRICS_PATH);
+	}
+	return thread;
+}
+
+unsigned __stdcall RunListener(void* arguments)
+{
+	SOCKET listener = (SOCKET)arguments;
+	while (1) {
+		SOCKET connector = GetConnectionSocket(listener);
+		LONG64 accepted = ReadMetricsClock();
+		if (connector == INVALID_SOCKET) {
+			InterlockedIncrement64(&AcceptStatistics.failed);
+		}
+		else if (!SessionHandler.admit(connector)) {
+			CloseSocket(connector, CLOSE_NORMAL);
+		}
+		else {
+			CreateThreadForConnection(connector, accepted);
 		}
 	}
+	CloseSocket(listener, CLOSE_NORMAL);
+	return 0;
+}
+
+unsigned __stdcall Run(void* arguments)
+{
+	ACCEPTEDSOCKET accepted = *(ACCEPTEDSOCKET*)arguments;
+	free(arguments);
+	SOCKET connector = accepted.socket;
+	CONNECTION* connection = CreateConnection(connector, Config.read_buffer_size);
+	if (connection == NULL) {
+		InterlockedDecrement(&AdmissionStatistics.connections);
+		CloseSocket(connector, CLOSE_SAFELY);
+		return 0;
+	}
+	TraceAccept(accepted.accepted);
+	ServeConnection(connection);
+	CloseSocket(connector, CLOSE_SAFELY);
+	DestroyConnection(connection);
+	ReleaseMetricsShard();
+	ReleaseLogRing();
 	return 0; // terminate thread
 }
 
+HANDLE CreateThreadForSharedListener(const char* name)
+{
+	SHMLISTENER* listener = CreateSharedListener(name);
+	if (listener == NULL) {
+		printf("[%s:%lu] %s: '%s'\n", ERROR_FLAGS, GetLastError(), _CREATE_SHARED_LISTENER_FAIL, name);
+		return 0;
+	}
+	HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, RunSharedListener, (void*)listener, 0, 0);
+	if (thread == 0) {
+		printf("[%s] %s\n", WARNING_FLAGS, _TOO_MANY_THREADS);
+		DestroySharedListener(listener);
+	}
+	else {
+		printf("[%s] Listenning on shared memory '%s'...\n", INFO_FLAGS, name);
+	}
+	return thread;
+}
+
+unsigned __stdcall RunSharedListener(void* arguments)
+{
+	SHMLISTENER* listener = (SHMLISTENER*)arguments;
+	while (1) {
+		SHMCHANNEL* channel = AcceptSharedChannel(listener);
+		if (_beginthreadex(NULL, 0, RunSharedSession, (void*)channel, 0, 0) == 0) {
+			printf("[%s] %s\n", WARNING_FLAGS, _TOO_MANY_THREADS);
+			CloseSharedChannel(channel);
+		}
+	}
+	DestroySharedListener(listener);
+	return 0;
+}
+
+unsigned __stdcall RunSharedSession(void* arguments)
+{
+	SHMCHANNEL* channel = (SHMCHANNEL*)arguments;
+	// sessions are identified by socket. Sockets and events share the handle table of the process,
+	// so the event handle of the channel never equals a socket of another session
+	CONNECTION* connection = CreateConnection((SOCKET)channel->wake, Config.read_buffer_size);
+	if (connection != NULL) {
+		connection->channel = channel;
+		ServeConnection(connection);
+		DestroyConnection(connection);
+	}
+	CloseSharedChannel(channel);
+	ReleaseMetricsShard();
+	ReleaseLogRing();
+	return 0;
+}
+
+void ServeConnection(CONNECTION* connection)
+{
+	SessionHandler.open(connection);
+	// communicate
+	while (SessionHandler.handle(connection) != -1);
+	SessionHandler.close(connection);
+}
+
+int AdmitConnection(SOCKET socket)
+{
+	// counted here, not when the session starts: a burst of accepts must not get past the limit before their threads run
+	LONG connections = InterlockedIncrement(&AdmissionStatistics.connections);
+	if ((Config.max_connections > 0 && connections > Config.max_connections) || AdmissionStatistics.over_memory) {
+		InterlockedDecrement(&AdmissionStatistics.connections);
+		RefuseConnection(socket);
+		return 0;
+	}
+	return 1;
+}
+
+void RefuseConnection(SOCKET socket)
+{
+	InterlockedIncrement64(&AdmissionStatistics.refused_connections);
+	CountResponse(S_SERVER_BUSY);
+	// the socket is new: its send buffer takes the response at once, without blocking the acceptor
+	send(socket, BusyResponse, sizeof(BusyResponse), 0);
+}
+
+int AdmitRequest()
+{
+	LONG requests = InterlockedIncrement(&AdmissionStatistics.requests);
+	if ((Config.max_requests > 0 && requests > Config.max_requests) || AdmissionStatistics.over_memory) {
+		InterlockedDecrement(&AdmissionStatistics.requests);
+		return 0;
+	}
+	return 1;
+}
+
+void FinishRequest()
+{
+	InterlockedDecrement(&AdmissionStatistics.requests);
+}
+
+int RejectRequest(CONNECTION* connection, int remain)
+{
+	char* segment;
+	int mlen, status;
+	while (remain > 0) {
+		status = ReceiveSegment(connection, &segment, &mlen, &remain);
+		free(segment);
+		if (status != 1)
+			return status;
+	}
+	connection->messages++;
+	InterlockedIncrement64(&AdmissionStatistics.refused_requests);
+	CountResponse(S_SERVER_BUSY);
+	// a compressed connection records what it sends: the pre-encoded segment would go around its history
+	if (connection->send_history != NULL)
+		return SegmentationSend(connection, BusyResponse + SEGMENT_HEADER_SIZE, sizeof(BusyResponse) - SEGMENT_HEADER_SIZE, NULL);
+	return Send(connection, sizeof(BusyResponse), BusyResponse);
+}
+
+void PrepareBusyResponse()
+{
+	unsigned short bcurrent_bigendian = htons(sizeof(BusyResponse) - SEGMENT_HEADER_SIZE);
+	unsigned short bremain_bigendian = 0;
+	memcpy_s(BusyResponse, SEGMENT_HEADER_CURRENT_SIZE, &bcurrent_bigendian, SEGMENT_HEADER_CURRENT_SIZE);
+	memcpy_s(BusyResponse + SEGMENT_HEADER_CURRENT_SIZE, SEGMENT_HEADER_REMAIN_SIZE, &bremain_bigendian, SEGMENT_HEADER_REMAIN_SIZE);
+	MESSAGE response = CreateMessage(S_SERVER_BUSY, SM_SERVER_BUSY);
+	if (response != NULL)
+		memcpy_s(BusyResponse + SEGMENT_HEADER_SIZE, sizeof(BusyResponse) - SEGMENT_HEADER_SIZE, response, sizeof(BusyResponse) - SEGMENT_HEADER_SIZE);
+	DestroyMessage(response);
+}
+
+void SampleMemoryUsage()
+{
+	PROCESS_MEMORY_COUNTERS_EX counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&counters, sizeof(counters)))
+		return;
+	InterlockedExchange64(&AdmissionStatistics.memory, (LONG64)counters.PrivateUsage);
+	InterlockedExchange(&AdmissionStatistics.over_memory,
+		Config.max_memory > 0 && counters.PrivateUsage > ((SIZE_T)Config.max_memory << 20));
+}
+
+void StartConnection(CONNECTION* connection)
+{
+	InterlockedIncrement64(&AcceptStatistics.accepted);
+	ChangeActiveSessions(1);
+	// shared memory sessions have no socket to shut down
+	if (SessionTimers == NULL || connection->channel != NULL)
+		return;
+	SESSIONSTATE* session = (SESSIONSTATE*)malloc(sizeof(SESSIONSTATE));
+	if (session == NULL) {
+		LogEvent(LOG_ALLOCATE_MEMORY_FAIL);
+		return;
+	}
+	InitializeTimer(&session->timer);
+	// queued no further than the read timeout: arming it at the start of a request does not move it earlier under the lock
+	if (Config.read_timeout > 0)
+		session->timer.period = Config.read_timeout;
+	session->socket = connection->socket;
+	session->login_deadline = Config.login_timeout > 0 ? GetTickCount64() + Config.login_timeout : 0;
+	session->timeout = TIMEOUT_IDLE;
+	connection->session = session;
+	// a client that connects and sends nothing is idle from the start
+	ArmSessionTimer(connection, TIMEOUT_IDLE);
+}
+
+void FinishConnection(CONNECTION* connection)
+{
+	if (connection->stream != NULL)
+		FinishStreamRequest(connection, 0);
+	SESSIONSTATE* session = (SESSIONSTATE*)connection->session;
+	if (session != NULL) {
+		// the socket is closed after this: the timer must not expire on it anymore
+		StopTimer(SessionTimers, &session->timer);
+		free(session);
+		connection->session = NULL;
+	}
+	// shared memory sessions are not admitted, so not counted
+	if (connection->channel == NULL)
+		InterlockedDecrement(&AdmissionStatistics.connections);
+	ChangeActiveSessions(-1);
+	EndSession(connection->socket);
+	PrintConnectionStatistics(connection);
+}
+
+void ArmSessionTimer(CONNECTION* connection, int timeout)
+{
+	SESSIONSTATE* session = (SESSIONSTATE*)connection->session;
+	if (session == NULL)
+		return;
+	int milliseconds = timeout == TIMEOUT_READ ? Config.read_timeout : Config.idle_timeout;
+	if (milliseconds <= 0 && timeout == TIMEOUT_READ)
+		return;
+
+	ULONGLONG deadline = milliseconds > 0 ? GetTickCount64() + milliseconds : 0;
+	if (session->login_deadline != 0 && (deadline == 0 || session->login_deadline < deadline)) {
+		deadline = session->login_deadline;
+		timeout = TIMEOUT_LOGIN;
+	}
+	InterlockedExchange(&session->timeout, timeout);
+	// deadline 0 stops the timer without the lock: StopTimer() is for the end of the session only
+	SetTimerDeadline(SessionTimers, &session->timer, deadline);
+}
+
+void ExpireSession(TIMER* timer)
+{
+	SESSIONSTATE* session = (SESSIONSTATE*)timer;
+	LONG64 timeout = InterlockedCompareExchange(&session->timeout, 0, 0);
+	// under the lock of the wheel: never wait for console here
+	LogEvent(LOG_SESSION_TIMEOUT, 0, &timeout, 1);
+	// the timer is stopped before the socket is closed, under the same lock: the socket is still open here
+	shutdown(session->socket, SD_BOTH);
+	CancelIoEx((HANDLE)session->socket, NULL);
+}
+
 void EndSession(SOCKET socket)
 {
-	EnterCriticalSection(&critical_section);
+	LockAccounts(LOCK_SITE_END_SESSION);
 	ACCOUNTINFO* acc = FindFirstAccountInfo(Accounts, socket);
 	if (acc != NULL) {
 		acc->status = AS_FREE;
 		acc->socket = INVALID_SOCKET;
+		acc->token = 0;
 	}
-	LeaveCriticalSection(&critical_section);
+	UnlockAccounts();
+	if (acc != NULL)
+		ChangeLoggedInAccounts(-1);
+}
+
+void PrintConnectionStatistics(CONNECTION* connection)
+{
+	LONG64 requests = InterlockedAdd64(&TotalRequests, connection->messages);
+	LONG64 recv_calls = InterlockedAdd64(&TotalReceiveCalls, connection->recv_calls);
+	LONG64 send_calls = InterlockedAdd64(&TotalSendCalls, connection->send_calls);
+
+	LONG64 values[LOG_VALUE_COUNT] = { connection->messages, connection->recv_calls, connection->send_calls, requests, recv_calls, send_calls };
+	LogEvent(LOG_SESSION_CLOSED, 0, values, LOG_VALUE_COUNT);
+}
+
+BOOL WINAPI HandleConsoleControl(DWORD event)
+{
+	// the server has no other way to stop: the logs and the profile are written on the way out
+	FlushLogs();
+	printf("[%s] Stopping...\n", INFO_FLAGS);
+	if (Config.lock_profile)
+		PrintLockProfile(&AccountLockProfile);
+	return FALSE; // the default handler ends the process
 }
 
 #pragma endregion
@@ -89,31 +490,101 @@ void EndSession(SOCKET socket)
 
 MESSAGE HandlePostRequest(SOCKET socket, const char* arguments)
 {
-	EnterCriticalSection(&critical_section);
-	int is_not_log_in = (FindFirstAccountInfo(Accounts, socket) == NULL);
-	LeaveCriticalSection(&critical_section);
+	POSTSTREAM* stream = (POSTSTREAM*)BeginPostStream(socket, (int)strlen(arguments));
+	if (stream != NULL && stream->status == S_POST_SUCC) {
+		WritePostStream(stream, arguments, (int)strlen(arguments));
+	}
+	return EndPostStream(stream, 1);
+}
 
-	if (is_not_log_in) {
-		return CreateMessage(S_NOT_LOGIN, SM_NOT_LOGIN);
+void* BeginPostStream(SOCKET socket, int length)
+{
+	POSTSTREAM* stream = (POSTSTREAM*)malloc(sizeof(POSTSTREAM));
+	if (stream == NULL) {
+		LogEvent(LOG_ALLOCATE_MEMORY_FAIL);
+		return NULL;
+	}
+	stream->file = NULL;
+	stream->status = S_POST_SUCC;
+
+	char* account = NULL;
+	LockAccounts(LOCK_SITE_POST);
+	ACCOUNTINFO* acc = FindFirstAccountInfo(Accounts, socket);
+	if (acc != NULL) {
+		account = Clone(acc->account, (int)strlen(acc->account) + 1);
+	}
+	UnlockAccounts();
+
+	if (acc == NULL) {
+		stream->status = S_NOT_LOGIN;
+	}
+	else if (!TakePostToken(acc)) { // accounts are never freed while serving: no lock needed
+		stream->status = S_POST_LIMITED;
+	}
+	else {
+		stream->file = OpenArticle(ARTICLE_DIRECTORY, account, stream->path);
+		if (stream->file == NULL)
+			stream->status = S_POST_FAIL;
+	}
+	free(account);
+	return stream;
+}
+
+int WritePostStream(void* state, const char* bytes, int length)
+{
+	POSTSTREAM* stream = (POSTSTREAM*)state;
+	if (stream == NULL || stream->status != S_POST_SUCC)
+		return 0;
+	// the article ends at the terminating null character of the request
+	int article_len = (int)strnlen(bytes, length);
+	if (article_len > 0 && fwrite(bytes, 1, article_len, stream->file) != (size_t)article_len) {
+		LogEvent(LOG_WRITE_ARTICLE_FAIL, errno);
+		stream->status = S_POST_FAIL;
+		return 0;
 	}
+	return 1;
+}
 
+MESSAGE EndPostStream(void* state, int completed)
+{
+	POSTSTREAM* stream = (POSTSTREAM*)state;
+	if (stream == NULL)
+		return CreateMessage(S_POST_FAIL, SM_POST_FAIL);
+
+	int status = stream->status;
+	if (stream->file != NULL) {
+		if (CloseArticle(stream->file) == 0)
+			status = S_POST_FAIL;
+		if (!completed || status != S_POST_SUCC)
+			remove(stream->path); // do not keep partial articles
+	}
+	free(stream);
+
+	if (!completed)
+		return NULL;
+	if (status == S_NOT_LOGIN)
+		return CreateMessage(S_NOT_LOGIN, SM_NOT_LOGIN);
+	else if (status == S_POST_LIMITED)
+		return CreateMessage(S_POST_LIMITED, SM_POST_LIMITED);
+	else if (status == S_POST_FAIL)
+		return CreateMessage(S_POST_FAIL, SM_POST_FAIL);
 	return CreateMessage(S_POST_SUCC, SM_POST_SUCC);
 }
 
 MESSAGE HandleLoginRequest(SOCKET socket, const char* arguments)
 {
-	EnterCriticalSection(&critical_section);
+	LockAccounts(LOCK_SITE_LOGIN);
 	int is_login = (FindFirstAccountInfo(Accounts, socket) != NULL);
-	LeaveCriticalSection(&critical_section);
+	UnlockAccounts();
 
 	if (is_login) {
 		return CreateMessage(S_LOGGEDIN, SM_LOGGEDIN);
 	}
 
-	EnterCriticalSection(&critical_section);
+	LockAccounts(LOCK_SITE_LOGIN);
 	ACCOUNTINFO* acc = FindFirstAccountInfo(Accounts, arguments);
 	int status = acc == NULL ? -1 : acc->status;
-	LeaveCriticalSection(&critical_section);
+	UnlockAccounts();
 
 	if (status == -1) {
 		return CreateMessage(S_ACCOUNT_NOT_EXIST, SM_ACCOUNT_NOT_EXIST);
@@ -125,90 +596,723 @@ MESSAGE HandleLoginRequest(SOCKET socket, const char* arguments)
 		return CreateMessage(S_ACCOUNT_LOCK, SM_ACCOUNT_LOCK);
 	}
 	else { // AS_FREE
-		EnterCriticalSection(&critical_section);
+		LockAccounts(LOCK_SITE_LOGIN);
 		acc->status = AS_LOGGED_IN;
 		acc->socket = socket;
-		LeaveCriticalSection(&critical_section);
+		UnlockAccounts();
+		ChangeLoggedInAccounts(1);
 	}
 	return CreateMessage(S_LOGIN_SUCC, SM_LOGIN_SUCC);
 }
 
 MESSAGE HandleLogoutRequest(SOCKET socket)
 {
-	EnterCriticalSection(&critical_section);
+	LockAccounts(LOCK_SITE_LOGOUT);
 	ACCOUNTINFO* acc = FindFirstAccountInfo(Accounts, socket);
 	int is_login = (acc != NULL);
-	LeaveCriticalSection(&critical_section);
+	UnlockAccounts();
 
 	if (!is_login) {
 		return CreateMessage(S_NOT_LOGIN, SM_NOT_LOGIN);
 	}
 	// if logged in
-	EnterCriticalSection(&critical_section);
+	LockAccounts(LOCK_SITE_LOGOUT);
 	acc->status = AS_FREE;
 	acc->socket = INVALID_SOCKET;
-	LeaveCriticalSection(&critical_section);
+	acc->token = 0;
+	UnlockAccounts();
+	ChangeLoggedInAccounts(-1);
+
+	return CreateMessage(S_LOGOUT_SUCC, SM_LOGOUT_SUCC);
+}
+
+MESSAGE HandleTokenRequest(SOCKET socket)
+{
+	unsigned long long token = 0;
+	unsigned int random;
+	// 64-bit random token, never 0 [0 means no token]
+	while (token == 0) {
+		for (int i = 0; i < 2; ++i) {
+			if (rand_s(&random) != 0)
+				return CreateMessage(S_TOKEN_FAIL, SM_TOKEN_FAIL);
+			token = (token << 32) | random;
+		}
+	}
+
+	LockAccounts(LOCK_SITE_TOKEN);
+	ACCOUNTINFO* acc = FindFirstAccountInfo(Accounts, socket);
+	if (acc != NULL) {
+		acc->token = token;
+		acc->last_sequence = 0;
+		acc->sequence_window = 0;
+	}
+	UnlockAccounts();
+
+	if (acc == NULL) {
+		return CreateMessage(S_NOT_LOGIN, SM_NOT_LOGIN);
+	}
+	char text[TOKEN_TEXT_SIZE];
+	snprintf(text, TOKEN_TEXT_SIZE, "%016llx", token);
+	return CreateMessage(S_TOKEN_SUCC, text);
+}
+
+MESSAGE HandleStatsRequest(SOCKET socket)
+{
+	LockAccounts(LOCK_SITE_STATS);
+	ACCOUNTINFO* acc = FindFirstAccountInfo(Accounts, socket);
+	int is_admin = acc != NULL && Config.admin != NULL && ICompare(acc->account, Config.admin) == 0;
+	UnlockAccounts();
+
+	if (!is_admin) {
+		return CreateMessage(S_STATS_REFUSED, SM_STATS_REFUSED);
+	}
+	METRICSSNAPSHOT snapshot;
+	int length;
+	CollectMetrics(&snapshot);
+	char* text = CreateMetricsText(&snapshot, METRICS_FORMAT_SUMMARY, &length);
+	if (text == NULL) {
+		LogEvent(LOG_ALLOCATE_MEMORY_FAIL);
+		return CreateMessage(S_STATS_REFUSED, NULL);
+	}
+	MESSAGE response = CreateMessage(S_STATS_SUCC, text);
+	free(text);
+	if (response != NULL && (int)strlen(response) + 1 > SEGMENT_MESSAGE_MAX_SIZE) {
+		DestroyMessage(response);
+		return CreateMessage(S_STATS_REFUSED, SM_STATS_TOO_LARGE);
+	}
+	return response;
+}
+
+MESSAGE HandleCompressRequest(CONNECTION* connection, const char* arguments, int* oaccepted)
+{
+	*oaccepted = 0;
+	if (!Config.compression || ICompare(arguments, COMPRESSION_ALGORITHM) != 0) {
+		return CreateMessage(S_COMPRESS_REFUSED, SM_COMPRESS_UNSUPPORTED);
+	}
+	if (connection->messages > 1 || connection->send_history != NULL) {
+		return CreateMessage(S_COMPRESS_REFUSED, SM_COMPRESS_TOO_LATE);
+	}
+	*oaccepted = 1;
+	return CreateMessage(S_COMPRESS_SUCC, SM_COMPRESS_SUCC);
+}
+
+int HandleStreamRequest(CONNECTION* connection, const STREAMHANDLER* handler, char* segment, int mlen, int remain)
+{
+	// first segment: skip command text
+	void* state = handler->begin(connection->socket, mlen + remain - COMMAND_LENGTH);
+	int accepted = handler->write(state, segment + COMMAND_LENGTH, mlen - COMMAND_LENGTH); // Otherwise remaining segments are drained
+	free(segment);
+
+	int status;
+	while (remain > 0) {
+		status = ReceiveSegment(connection, &segment, &mlen, &remain);
+		if (status != 1) {
+			free(segment);
+			handler->end(state, 0);
+			return status;
+		}
+		if (accepted) {
+			accepted = handler->write(state, segment, mlen);
+		}
+		free(segment);
+	}
+	connection->messages++;
+	CountRequest(C_POST);
+
+	MESSAGE response = handler->end(state, 1);
+	CountResponse(GetMessageStatus(response));
+	status = SegmentationSend(connection, response, (int)strlen(response) + 1, NULL);
+	DestroyMessage(response);
+	return status;
+}
+
+int StreamRequest(CONNECTION* connection)
+{
+	char header[SEGMENT_HEADER_SIZE];
+	char text[COMMAND_LENGTH];
+	char* segment;
+	int mlen, remain;
+	while (connection->length >= SEGMENT_HEADER_SIZE) {
+		SEGMENTSTREAM* stream = (SEGMENTSTREAM*)connection->stream;
+		PeekReceiveBuffer(connection, 0, SEGMENT_HEADER_SIZE, header);
+		int current = ntohs(*(unsigned short*)header);
+		int is_compressed = (current & SEGMENT_COMPRESSED_FLAG) != 0;
+		current &= ~SEGMENT_COMPRESSED_FLAG;
+		remain = ntohs(*(unsigned short*)(header + SEGMENT_HEADER_CURRENT_SIZE));
+		if (current <= 0 || current + SEGMENT_HEADER_SIZE > APPLICATION_BUFF_MAX_SIZE || (is_compressed && current <= SEGMENT_RAW_LENGTH_SIZE)) {
+			// a request not streamed is checked by the engine and by HandleRequest()
+			if (stream == NULL)
+				return 0;
+			LogEvent(LOG_RECEIVE_UNEXPECTED_MESSAGE);
+			return -1;
+		}
+		if (current + SEGMENT_HEADER_SIZE > connection->length)
+			break;
+
+		if (stream == NULL) {
+			// decided before the segment is taken: a request that is not streamed is left for the handle handler
+			if (is_compressed) {
+				PeekReceiveBuffer(connection, SEGMENT_HEADER_SIZE, SEGMENT_RAW_LENGTH_SIZE, text);
+				mlen = ntohs(*(unsigned short*)text);
+				if (remain == 0 || mlen + remain < Config.stream_threshold)
+					return 0;
+			}
+			else {
+				PeekReceiveBuffer(connection, SEGMENT_HEADER_SIZE, min(current, COMMAND_LENGTH), text);
+				if (!IsStreamRequest(text, current, remain, CM_POST))
+					return 0;
+			}
+			if (ReceiveSegment(connection, &segment, &mlen, &remain) != 1) {
+				free(segment);
+				return -1;
+			}
+			stream = (SEGMENTSTREAM*)calloc(1, sizeof(SEGMENTSTREAM));
+			if (stream == NULL) {
+				LogEvent(LOG_ALLOCATE_MEMORY_FAIL);
+				free(segment);
+				return -1;
+			}
+			connection->stream = stream;
+			// the request started: the rest of it must come within the read timeout
+			ArmSessionTimer(connection, TIMEOUT_READ);
+			stream->admitted = AdmitRequest();
+			if (stream->admitted && IsStreamRequest(segment, mlen, remain, CM_POST)) {
+				stream->handler = &PostStreamHandler;
+				// first segment: skip command text
+				stream->state = stream->handler->begin(connection->socket, mlen + remain - COMMAND_LENGTH);
+				stream->accepted = stream->handler->write(stream->state, segment + COMMAND_LENGTH, mlen - COMMAND_LENGTH);
+			}
+			free(segment);
+		}
+		else {
+			if (ReceiveSegment(connection, &segment, &mlen, &remain) != 1) {
+				free(segment);
+				return -1;
+			}
+			if (stream->handler != NULL && stream->accepted)
+				stream->accepted = stream->handler->write(stream->state, segment, mlen);
+			free(segment);
+		}
+
+		if (remain == 0) {
+			int status = FinishStreamRequest(connection, 1);
+			ArmSessionTimer(connection, TIMEOUT_IDLE);
+			if (status != 1)
+				return -1;
+		}
+	}
+	return connection->stream != NULL ? 1 : 0;
+}
+
+int FinishStreamRequest(CONNECTION* connection, int completed)
+{
+	SEGMENTSTREAM* stream = (SEGMENTSTREAM*)connection->stream;
+	connection->stream = NULL;
+	int status = 1;
+	if (stream->handler != NULL) {
+		MESSAGE response = stream->handler->end(stream->state, completed);
+		if (completed) {
+			connection->messages++;
+			CountRequest(C_POST);
+			CountResponse(GetMessageStatus(response));
+			status = SegmentationSend(connection, response, (int)strlen(response) + 1, NULL);
+		}
+		DestroyMessage(response);
+	}
+	else if (completed) {
+		// all segments are taken already: only the busy response is left
+		status = RejectRequest(connection, 0);
+	}
+	if (stream->admitted)
+		FinishRequest();
+	free(stream);
+	return status;
+}
+
+int IsStreamRequest(const char* segment, int mlen, int remain, const char* command)
+{
+	if (remain == 0 || mlen + remain < Config.stream_threshold || mlen < COMMAND_LENGTH)
+		return 0;
+
+	char text[COMMAND_LENGTH + 1];
+	memcpy_s(text, COMMAND_LENGTH, segment, COMMAND_LENGTH);
+	text[COMMAND_LENGTH] = '\0';
+	return text[COMMAND_LENGTH - 1] == ' ' && ICompare(text, command, COMMAND_LENGTH - 1) == 0;
+}
+
+int HandleRequest(CONNECTION* connection)
+{
+	SOCKET socket = connection->socket;
+	char* segment, *request, *arguments;
+	int mlen, remain;
+	int status = ReceiveSegment(connection, &segment, &mlen, &remain);
+	if (status != 1) {
+		free(segment);
+		return status;
+	}
+	// the request started: the rest of it must come within the read timeout
+	if (remain > 0)
+		ArmSessionTimer(connection, TIMEOUT_READ);
+	if (!AdmitRequest()) {
+		free(segment);
+		status = RejectRequest(connection, remain);
+		ArmSessionTimer(connection, TIMEOUT_IDLE);
+		return status;
+	}
+	// a streamed post receives and writes its article at once: its stages are not timed
+	if (IsStreamRequest(segment, mlen, remain, CM_POST)) {
+		status = HandleStreamRequest(connection, &PostStreamHandler, segment, mlen, remain);
+		FinishRequest();
+		ArmSessionTimer(connection, TIMEOUT_IDLE);
+		return status;
+	}
+	// timed from the first segment: the wait for a request to come is idle time, not latency
+	STAGE_CLOCK(received_first);
+	BeginTrace();
+	status = MergeSegments(connection, segment, mlen, remain, &request);
+	if (status != 1) {
+		free(request);
+		EndTrace(0, -1);
+		FinishRequest();
+		// a connection that survives a failed request is idle again: it must not keep the read timeout
+		ArmSessionTimer(connection, TIMEOUT_IDLE);
+		return status;
+	}
+	connection->messages++;
+
+	MESSAGE response = NULL;
+	int compress_accepted = 0;
+	// Handle request
+	STAGE_CLOCK(received);
+	TRACE_CLOCK(trace_received);
+	int command = ExtractRequestCommand(request, &arguments);
+	CountRequest(command);
+	STAGE_CLOCK(parsed);
+	TRACE_CLOCK(trace_parsed);
+	TraceSpan(TRACE_PARSE, 0, trace_received, trace_parsed);
+	STAGE_RESET_LOCK_WAIT(); // waits of the datagram path and of session ends on this thread are not the handler's
+	if (command == C_POST) {
+		response = HandlePostRequest(socket, arguments);
+	}
+	else if (command == C_LOGIN) {
+		response = HandleLoginRequest(socket, arguments);
+		if (connection->session != NULL && GetMessageStatus(response) == S_LOGIN_SUCC)
+			((SESSIONSTATE*)connection->session)->login_deadline = 0;
+	}
+	else if (command == C_LOGOUT) {
+		response = HandleLogoutRequest(socket);
+		// logged out is not logged in: it must log in again in time
+		if (connection->session != NULL && Config.login_timeout > 0 && GetMessageStatus(response) == S_LOGOUT_SUCC)
+			((SESSIONSTATE*)connection->session)->login_deadline = GetTickCount64() + Config.login_timeout;
+	}
+	else if (command == C_COMPRESS) {
+		response = HandleCompressRequest(connection, arguments, &compress_accepted);
+	}
+	else if (command == C_TOKEN) {
+		response = HandleTokenRequest(socket);
+	}
+	else if (command == C_STATS) {
+		response = HandleStatsRequest(socket);
+	}
+	else {
+		response = CreateMessage(S_UNREGCONIZE_COMMAND, SM_UNREGCONIZE_COMMAND);
+	}
+	free(request);
+	int response_status = GetMessageStatus(response);
+	CountResponse(response_status);
+	STAGE_CLOCK(handled);
+	STAGE_TAKE_LOCK_WAIT(lock_wait);
+	TRACE_CLOCK(trace_handled);
+	TraceSpan(TRACE_HANDLER, 0, trace_parsed, trace_handled);
+
+	// Send response
+	status = SegmentationSend(connection, response, (int)strlen(response) + 1, NULL);
+	DestroyMessage(response);
+	EndTrace(command, response_status);
+	STAGE_CLOCK(sent);
+	STAGE_RECORD(command, STAGE_RECEIVE, received_first, received);
+	STAGE_RECORD(command, STAGE_PARSE, received, parsed);
+	STAGE_RECORD(command, STAGE_LOCK, 0, lock_wait);
+	STAGE_RECORD(command, STAGE_HANDLER, parsed + lock_wait, handled);
+	STAGE_RECORD(command, STAGE_SEND, handled, sent);
+
+	// compression starts after the handshake response, on both sides
+	if (status == 1 && compress_accepted && !EnableCompression(connection, Config.compress_threshold)) {
+		status = -1;
+	}
+	FinishRequest();
+	ArmSessionTimer(connection, TIMEOUT_IDLE);
+	return status;
+}
+
+int ClassifyRequest(CONNECTION* connection)
+{
+	char header[SEGMENT_HEADER_SIZE];
+	char text[CLASSIFY_PEEK_SIZE + 1];
+	unsigned short bcurrent;
+	PeekReceiveBuffer(connection, 0, SEGMENT_HEADER_SIZE, header);
+	memcpy_s(&bcurrent, sizeof(bcurrent), header, SEGMENT_HEADER_CURRENT_SIZE);
+	bcurrent = ntohs(bcurrent);
+	// only long messages are compressed: posts
+	if (bcurrent & SEGMENT_COMPRESSED_FLAG)
+		return TASK_PRIORITY_BULK;
+
+	int length = min((int)bcurrent, min(CLASSIFY_PEEK_SIZE, connection->length - SEGMENT_HEADER_SIZE));
+	PeekReceiveBuffer(connection, SEGMENT_HEADER_SIZE, length, text);
+	text[length] = '\0';
+	char* arguments;
+	int command = ExtractRequestCommand(text, &arguments);
+	if (command == C_LOGIN || command == C_LOGOUT || command == C_COMPRESS)
+		return TASK_PRIORITY_CONTROL;
+	else if (command == C_POST)
+		return TASK_PRIORITY_BULK;
+	return TASK_PRIORITY_READ;
+}
+
+int ExtractRequestCommand(const char* request, char** oarguments)
+{
+	char* space_pos = (char*)memchr(request, ' ', strlen(request));
+	if (space_pos == NULL) {
+		if (ICompare(request, CM_LOGOUT, (int)max(strlen(CM_LOGOUT), strlen(request))) == 0)
+			return C_LOGOUT;
+		if (ICompare(request, CM_TOKEN, (int)max(strlen(CM_TOKEN), strlen(request))) == 0)
+			return C_TOKEN;
+		if (ICompare(request, CM_STATS, (int)max(strlen(CM_STATS), strlen(request))) == 0)
+			return C_STATS;
+		return 0;
+	}
+
+	*oarguments = space_pos + 1;
+	// match command
+	if (ICompare(request, CM_POST,
+		(int)max((int)strlen(CM_POST), (space_pos - request)))
+		== 0)
+		return C_POST;
+	else if (ICompare(request, CM_LOGIN,
+		(int)max((int)strlen(CM_LOGIN), (space_pos - request)))
+		== 0)
+		return C_LOGIN;
+	else if (ICompare(request, CM_LOGOUT,
+		(int)max((int)strlen(CM_LOGOUT), (space_pos - request)))
+		== 0)
+		return C_LOGOUT;
+	else if (ICompare(request, CM_COMPRESS,
+		(int)max((int)strlen(CM_COMPRESS), (space_pos - request)))
+		== 0)
+		return C_COMPRESS;
+	else if (ICompare(request, CM_TOKEN,
+		(int)max((int)strlen(CM_TOKEN), (space_pos - request)))
+		== 0)
+		return C_TOKEN;
+	else if (ICompare(request, CM_STATS,
+		(int)max((int)strlen(CM_STATS), (space_pos - request)))
+		== 0)
+		return C_STATS;
+
+	return 0;
+}
+
+#pragma endregion
+
+#pragma region Datagram Fast Path
+
+HANDLE CreateThreadForDatagrams(ADDRESS address)
+{
+	SOCKET receiver = CreateSocket(UDP);
+	if (receiver == INVALID_SOCKET)
+		return 0;
+	if (!BindSocket(receiver, address)) {
+		CloseSocket(receiver, CLOSE_NORMAL);
+		return 0;
+	}
+	// absorb bursts while a batch is processed
+	int buffer_size = UDP_RECEIVE_BUFFER_SIZE;
+	setsockopt(receiver, SOL_SOCKET, SO_RCVBUF, (const char*)&buffer_size, sizeof(buffer_size));
+	u_long non_blocking = 1;
+	ioctlsocket(receiver, FIONBIO, &non_blocking);
+	// an ICMP port unreachable for a datagram sent from this socket would fail the next recvfrom() with WSAECONNRESET
+	BOOL is_reported = FALSE;
+	DWORD bytes;
+	WSAIoctl(receiver, SIO_UDP_CONNRESET, &is_reported, sizeof(is_reported), NULL, 0, &bytes, NULL, NULL);
+
+	HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, RunDatagramListener, (void*)receiver, 0, 0);
+	if (thread == 0) {
+		printf("[%s] %s\n", WARNING_FLAGS, _TOO_MANY_THREADS);
+		CloseSocket(receiver, CLOSE_NORMAL);
+	}
+	else {
+		printf("[%s] Receiving datagram posts at port %d...\n", INFO_FLAGS, ntohs(address.sin_port));
+	}
+	return thread;
+}
+
+unsigned __stdcall RunDatagramListener(void* arguments)
+{
+	SOCKET receiver = (SOCKET)arguments;
+	DATAGRAM* batch = (DATAGRAM*)malloc(sizeof(DATAGRAM) * UDP_BATCH_SIZE);
+	if (batch == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		CloseSocket(receiver, CLOSE_NORMAL);
+		return 0;
+	}
+	ULONGLONG last_report = GetTickCount64();
+	while (1) {
+		int count = ReceiveDatagramBatch(receiver, batch, UDP_BATCH_SIZE, UDP_REPORT_INTERVAL);
+		if (count < 0)
+			break;
+		if (count > 0)
+			HandleDatagramBatch(batch, count);
+
+		if (GetTickCount64() - last_report >= UDP_REPORT_INTERVAL) {
+			PrintDatagramStatistics();
+			last_report = GetTickCount64();
+		}
+	}
+	free(batch);
+	CloseSocket(receiver, CLOSE_NORMAL);
+	return 0;
+}
+
+int ReceiveDatagramBatch(SOCKET receiver, DATAGRAM* obatch, int capacity, int timeout)
+{
+	fd_set readable;
+	FD_ZERO(&readable);
+	FD_SET(receiver, &readable);
+	timeval interval = { timeout / 1000, (timeout % 1000) * 1000 };
+	int ret = select(0, &readable, NULL, NULL, &interval);
+	if (ret == SOCKET_ERROR) {
+		printf("[%s:%d] %s\n", ERROR_FLAGS, WSAGetLastError(), _RECEIVE_FAIL);
+		return -1;
+	}
+
+	// drain what the socket has, without blocking, up to the batch capacity
+	int count = 0;
+	while (ret > 0 && count < capacity) {
+		int length = recvfrom(receiver, obatch[count].data, UDP_DATAGRAM_MAX_SIZE, 0, NULL, NULL);
+		if (length == SOCKET_ERROR) {
+			int err = WSAGetLastError();
+			if (err == WSAEWOULDBLOCK)
+				break;
+			if (err == WSAEMSGSIZE) { // truncated: too large for a fast post
+				InterlockedIncrement64(&DatagramStatistics.received);
+				InterlockedIncrement64(&DatagramStatistics.malformed);
+				continue;
+			}
+			if (err == WSAECONNRESET) // an unreachable sender: only one datagram is affected
+				continue;
+			// the socket itself failed: it would stay readable and fail again. The batch so far is handled first
+			if (count > 0)
+				break;
+			printf("[%s:%d] %s\n", ERROR_FLAGS, err, _RECEIVE_FAIL);
+			return -1;
+		}
+		InterlockedIncrement64(&DatagramStatistics.received);
+		obatch[count].data[length] = '\0';
+		obatch[count].length = length;
+		++count;
+	}
+	if (count > 0)
+		InterlockedIncrement64(&DatagramStatistics.batches);
+	return count;
+}
+
+int ParseDatagram(DATAGRAM* datagram, unsigned long long* otoken, unsigned long long* osequence, char** oarticle)
+{
+	// <token> <sequence> POST <article>
+	char* cur = datagram->data;
+	char* end;
+	if ((int)strlen(cur) != datagram->length)
+		return 0;
+	*otoken = _strtoui64(cur, &end, 16);
+	if (end == cur || *end != ' ')
+		return 0;
+	cur = end + 1;
+	*osequence = _strtoui64(cur, &end, 10);
+	if (end == cur || *end != ' ' || *osequence == 0)
+		return 0;
+	cur = end + 1;
+	char* arguments;
+	if (ExtractRequestCommand(cur, &arguments) != C_POST)
+		return 0;
+	*oarticle = arguments;
+	return 1;
+}
 
-	return CreateMessage(S_LOGOUT_SUCC, SM_LOGOUT_SUCC);
+int CheckSequence(const ACCOUNTINFO* acc, unsigned long long sequence)
+{
+	if (sequence > acc->last_sequence)
+		return 1;
+	unsigned long long age = acc->last_sequence - sequence;
+	if (age >= UDP_SEQUENCE_WINDOW)
+		return -1; // too old to tell
+	return (acc->sequence_window & (1ULL << age)) ? 0 : 1;
 }
 
-int HandleRequest(SOCKET socket)
+int AcceptSequence(ACCOUNTINFO* acc, unsigned long long sequence)
 {
-	char* request, *arguments;
-	int status = 1;
-	status = SegmentationReceive(socket, &request);
-	if (status != 1) {
-		free(request);
-		return status;
+	int ret = CheckSequence(acc, sequence);
+	if (ret != 1)
+		return ret;
+	if (sequence > acc->last_sequence) {
+		unsigned long long shift = sequence - acc->last_sequence;
+		acc->sequence_window = shift >= UDP_SEQUENCE_WINDOW ? 0 : acc->sequence_window << shift;
+		acc->sequence_window |= 1;
+		acc->last_sequence = sequence;
+		return 1;
 	}
+	acc->sequence_window |= (1ULL << (acc->last_sequence - sequence));
+	return 1;
+}
 
-	MESSAGE response = NULL;
-	// Handle request
-	int command = ExtractRequestCommand(request, &arguments);
-	if (command == C_POST) {
-		response = HandlePostRequest(socket, arguments);
+int TakePostToken(ACCOUNTINFO* acc)
+{
+	const RATELIMIT* limit = &PostLimits[acc->rate_class];
+	if (limit->interval == 0)
+		return 1;
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	// generic cell rate form of the bucket: one timestamp instead of a token count and a refill time
+	LONG64 bucket = acc->post_bucket;
+	while (1) {
+		LONG64 start = bucket > now.QuadPart ? bucket : now.QuadPart;
+		if (start - now.QuadPart > limit->tolerance)
+			return 0;
+		LONG64 seen = InterlockedCompareExchange64(&acc->post_bucket, start + limit->interval, bucket);
+		if (seen == bucket)
+			return 1;
+		bucket = seen;
 	}
-	else if (command == C_LOGIN) {
-		response = HandleLoginRequest(socket, arguments);
+}
+
+void PreparePostLimits()
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	for (int i = 0; i < RATE_CLASS_COUNT; ++i) {
+		if (Config.post_rate[i] <= 0)
+			continue;
+		int burst = Config.post_burst[i] > 0 ? Config.post_burst[i] : max(Config.post_rate[i], 1);
+		PostLimits[i].interval = max(frequency.QuadPart / Config.post_rate[i], 1);
+		PostLimits[i].tolerance = PostLimits[i].interval * (burst - 1);
 	}
-	else if (command == C_LOGOUT) {
-		response = HandleLogoutRequest(socket);
+}
+
+void HandleDatagramBatch(DATAGRAM* batch, int count)
+{
+	unsigned long long token, sequence;
+	char* articles[UDP_BATCH_SIZE];
+	char* accounts[UDP_BATCH_SIZE];
+	int accepted = 0;
+
+	// authenticate the whole batch under one lock
+	LockAccounts(LOCK_SITE_DATAGRAM);
+	for (int i = 0; i < count; ++i) {
+		char* article;
+		if (!ParseDatagram(&batch[i], &token, &sequence, &article)) {
+			InterlockedIncrement64(&DatagramStatistics.malformed);
+			continue;
+		}
+		ACCOUNTINFO* acc = FindAccountInfoByToken(Accounts, token);
+		if (acc == NULL || acc->status != AS_LOGGED_IN) {
+			InterlockedIncrement64(&DatagramStatistics.unauthorized);
+			continue;
+		}
+		// duplicates and stale datagrams are dropped before they take a post from the bucket
+		int ret = CheckSequence(acc, sequence);
+		if (ret == 0) {
+			InterlockedIncrement64(&DatagramStatistics.duplicates);
+			continue;
+		}
+		else if (ret == -1) {
+			InterlockedIncrement64(&DatagramStatistics.stale);
+			continue;
+		}
+		// a limited datagram is not recorded: sent again later, it is not a duplicate
+		if (!TakePostToken(acc)) {
+			InterlockedIncrement64(&DatagramStatistics.limited);
+			continue;
+		}
+		AcceptSequence(acc, sequence);
+		accounts[accepted] = Clone(acc->account, (int)strlen(acc->account) + 1);
+		articles[accepted] = article;
+		++accepted;
 	}
-	else {
-		response = CreateMessage(S_UNREGCONIZE_COMMAND, SM_UNREGCONIZE_COMMAND);
+	UnlockAccounts();
+
+	// store outside the lock
+	for (int i = 0; i < accepted; ++i) {
+		char path[LINE_MAX_SIZE];
+		FILE* fp = accounts[i] == NULL ? NULL : OpenArticle(ARTICLE_DIRECTORY, accounts[i], path);
+		if (fp != NULL) {
+			fwrite(articles[i], 1, strlen(articles[i]), fp);
+			if (CloseArticle(fp))
+				InterlockedIncrement64(&DatagramStatistics.accepted);
+		}
+		free(accounts[i]);
 	}
-	free(request);
+}
 
-	// Send response
-	status = SegmentationSend(socket, response, (int)strlen(response) + 1, NULL);
-	DestroyMessage(response);
-	return status;
+void PrintDatagramStatistics()
+{
+	printf("[%s] Datagrams: %lld received in %lld batches, %lld accepted, %lld malformed, %lld unauthorized, %lld duplicates, %lld stale, %lld limited\n",
+		INFO_FLAGS, DatagramStatistics.received, DatagramStatistics.batches, DatagramStatistics.accepted,
+		DatagramStatistics.malformed, DatagramStatistics.unauthorized, DatagramStatistics.duplicates, DatagramStatistics.stale,
+		DatagramStatistics.limited);
 }
 
-int ExtractRequestCommand(const char* request, char** oarguments)
+HANDLE CreateThreadForAcceptReport()
 {
-	char* space_pos = (char*)memchr(request, ' ', strlen(request));
-	if (space_pos == NULL) {
-		if (ICompare(request, CM_LOGOUT, (int)max(strlen(CM_LOGOUT), strlen(request))) == 0)
-			return C_LOGOUT;
-		return 0;
+	HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, RunAcceptReport, NULL, 0, 0);
+	if (thread == 0) {
+		printf("[%s] %s\n", WARNING_FLAGS, _TOO_MANY_THREADS);
 	}
+	return thread;
+}
 
-	*oarguments = space_pos + 1;
-	// match command
-	if (ICompare(request, CM_POST,
-		(int)max((int)strlen(CM_POST), (space_pos - request)))
-		== 0)
-		return C_POST;
-	else if (ICompare(request, CM_LOGIN,
-		(int)max((int)strlen(CM_LOGIN), (space_pos - request)))
-		== 0)
-		return C_LOGIN;
-	else if (ICompare(request, CM_LOGOUT,
-		(int)max((int)strlen(CM_LOGOUT), (space_pos - request)))
-		== 0)
-		return C_LOGOUT;
-
+unsigned __stdcall RunAcceptReport(void* arguments)
+{
+	LONG64 last_accepted = 0, last_failed = 0;
+	LONG64 last_refused_connections = 0, last_refused_requests = 0;
+	ULONGLONG last_report = GetTickCount64();
+	while (1) {
+		Sleep(ACCEPT_REPORT_INTERVAL);
+		SampleMemoryUsage();
+		LONG64 refused_connections = AdmissionStatistics.refused_connections;
+		LONG64 refused_requests = AdmissionStatistics.refused_requests;
+		if (refused_connections != last_refused_connections || refused_requests != last_refused_requests) {
+			printf("[%s] Refused: %lld connections, %lld requests. [Total: %lld connections, %lld requests refused. Open: %ld connections, %ld requests, %lld MB]\n",
+				WARNING_FLAGS, refused_connections - last_refused_connections, refused_requests - last_refused_requests,
+				refused_connections, refused_requests, AdmissionStatistics.connections, AdmissionStatistics.requests, AdmissionStatistics.memory >> 20);
+			last_refused_connections = refused_connections;
+			last_refused_requests = refused_requests;
+		}
+		if (Scheduler != NULL) {
+			LONG control = TakePeakDepth(Scheduler, TASK_PRIORITY_CONTROL);
+			LONG read = TakePeakDepth(Scheduler, TASK_PRIORITY_READ);
+			LONG bulk = TakePeakDepth(Scheduler, TASK_PRIORITY_BULK);
+			if (control > 0 || read > 0 || bulk > 0) {
+				printf("[%s] Queued requests: peak %ld control, %ld read, %ld bulk. [Now: %ld control, %ld read, %ld bulk]\n",
+					INFO_FLAGS, control, read, bulk, Scheduler->depth[TASK_PRIORITY_CONTROL],
+					Scheduler->depth[TASK_PRIORITY_READ], Scheduler->depth[TASK_PRIORITY_BULK]);
+			}
+		}
+		LONG64 accepted = AcceptStatistics.accepted;
+		LONG64 failed = AcceptStatistics.failed;
+		ULONGLONG now = GetTickCount64();
+		if (accepted == last_accepted && failed == last_failed) {
+			last_report = now;
+			continue;
+		}
+		// quiet intervals are not printed
+		LONG64 rate = (accepted - last_accepted) * 1000 / (LONG64)max(now - last_report, 1);
+		if (rate > AcceptStatistics.peak_rate)
+			AcceptStatistics.peak_rate = rate;
+		printf("[%s] Accepts: %lld/s, %lld failed. [Total: %lld accepted, peak %lld/s]\n",
+			INFO_FLAGS, rate, failed - last_failed, accepted, AcceptStatistics.peak_rate);
+		last_accepted = accepted;
+		last_failed = failed;
+		last_report = now;
+	}
 	return 0;
 }
 
@@ -216,6 +1320,33 @@ int ExtractRequestCommand(const char* request, char** oarguments)
 
 #pragma region AccountInfo and Linked List
 
+void LockAccounts(int site)
+{
+	LONG64 wait = 0;
+	// an uncontended lock is taken at once: only waits read the clock
+	if (!TryEnterCriticalSection(&critical_section)) {
+		LONG64 start = ReadMetricsClock();
+		EnterCriticalSection(&critical_section);
+		wait = ReadMetricsClock() - start;
+	}
+#if METRICS_STAGE_TIMING
+	AddStageLockWait(wait);
+#endif
+	if (Config.lock_profile)
+		BeginLockHold(&AccountLockProfile, site, wait);
+	if (IsRequestTraced()) {
+		LONG64 now = ReadMetricsClock();
+		TraceSpan(TRACE_LOCK, site, now - wait, now);
+	}
+}
+
+void UnlockAccounts()
+{
+	if (Config.lock_profile)
+		EndLockHold(&AccountLockProfile);
+	LeaveCriticalSection(&critical_section);
+}
+
 ACCOUNTINFO* Append(ACCOUNTINFO* prev, ACCOUNTINFO* current)
 {
 	if (prev != NULL) {
@@ -229,7 +1360,7 @@ ACCOUNTINFO* Append(ACCOUNTINFO* prev, ACCOUNTINFO* current)
 	return current;
 }
 
-ACCOUNTINFO* CreateAccountInfo(const char* username, int namelen, int status)
+ACCOUNTINFO* CreateAccountInfo(const char* username, int namelen, int status, int rate_class)
 {
 	ACCOUNTINFO* acc = (ACCOUNTINFO*)malloc(sizeof(ACCOUNTINFO));
 	if (acc != NULL) {
@@ -237,6 +1368,11 @@ ACCOUNTINFO* CreateAccountInfo(const char* username, int namelen, int status)
 		acc->account[namelen] = '\0';
 		acc->socket = INVALID_SOCKET;
 		acc->status = status;
+		acc->token = 0;
+		acc->last_sequence = 0;
+		acc->sequence_window = 0;
+		acc->rate_class = rate_class >= 0 && rate_class < RATE_CLASS_COUNT ? rate_class : 0;
+		acc->post_bucket = 0;
 		acc->next = NULL;
 	}
 	return acc;
@@ -264,6 +1400,17 @@ ACCOUNTINFO* FindFirstAccountInfo(ACCOUNTINFO* start, const char* username)
 	return NULL;
 }
 
+ACCOUNTINFO* FindAccountInfoByToken(ACCOUNTINFO* start, unsigned long long token)
+{
+	ACCOUNTINFO* cur = start;
+	while (cur != NULL) {
+		if (token != 0 && token == cur->token)
+			return cur;
+		cur = cur->next;
+	}
+	return NULL;
+}
+
 void FreeAccountList(ACCOUNTINFO* first)
 {
 	ACCOUNTINFO* cur = first;
@@ -301,13 +1448,48 @@ int LoadAccountList(const char* file)
 		}
 		else {
 			status = atoi(space_pos + 1);
-			cur = Append(cur, CreateAccountInfo(line, (int)(space_pos - line), status));
+			// optional third column: the rate class
+			char* class_pos = strchr(space_pos + 1, ' ');
+			cur = Append(cur, CreateAccountInfo(line, (int)(space_pos - line), status, class_pos == NULL ? 0 : atoi(class_pos + 1)));
 		}
 	}
 	fclose(fp);
 	return 1;
 }
 
+int CreateArticleStorage(const char* directory)
+{
+	if (!CreateDirectoryA(directory, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+		printf("[%s] Fail to create article directory: '%s'\n", ERROR_FLAGS, directory);
+		return 0;
+	}
+	return 1;
+}
+
+FILE* OpenArticle(const char* directory, const char* account, char* opath)
+{
+	char* path = opath;
+	snprintf(path, LINE_MAX_SIZE, "%s//article_%lld_%ld.txt", directory, (long long)time(NULL), InterlockedIncrement(&ArticleSequence));
+
+	FILE* fp;
+	fopen_s(&fp, path, "wb");
+	if (fp == NULL) {
+		LogEvent(LOG_WRITE_ARTICLE_FAIL, errno);
+		return NULL;
+	}
+	fprintf(fp, "%s\n", account);
+	return fp;
+}
+
+int CloseArticle(FILE* fp)
+{
+	if (fclose(fp) != 0) {
+		LogEvent(LOG_WRITE_ARTICLE_FAIL, errno);
+		return 0;
+	}
+	return 1;
+}
+
 #pragma endregion
 
 #pragma region Socket Common
@@ -338,6 +1520,15 @@ ADDRESS CreateSocketAddress(IP ip, int port)
 	return addr;
 }
 
+LOCAL_ADDRESS CreateLocalSocketAddress(const char* path)
+{
+	LOCAL_ADDRESS addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy_s(addr.sun_path, LOCAL_PATH_MAX_SIZE, path, _TRUNCATE);
+	return addr;
+}
+
 SOCKET CreateSocket(int protocol)
 {
 	SOCKET s = INVALID_SOCKET;
@@ -347,6 +1538,9 @@ SOCKET CreateSocket(int protocol)
 	else if (protocol == TCP) {
 		s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 	}
+	else if (protocol == LOCAL) {
+		s = socket(AF_UNIX, SOCK_STREAM, 0);
+	}
 
 	if (s == INVALID_SOCKET) {
 		printf("[%s] %s\n", ERROR_FLAGS, _CREATE_SOCKET_FAIL);
@@ -374,7 +1568,19 @@ int CloseSocket(SOCKET socket, int mode, int flags)
 
 int BindSocket(SOCKET socket, ADDRESS addr)
 {
-	if (bind(socket, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+	return BindSocket(socket, (SOCKADDR*)&addr, sizeof(addr));
+}
+
+int BindSocket(SOCKET socket, LOCAL_ADDRESS addr)
+{
+	// the socket file outlives the process, a restarted server must replace it
+	DeleteFileA(addr.sun_path);
+	return BindSocket(socket, (SOCKADDR*)&addr, sizeof(addr));
+}
+
+int BindSocket(SOCKET socket, const SOCKADDR* addr, int addr_len)
+{
+	if (bind(socket, addr, addr_len) == SOCKET_ERROR) {
 		int err = WSAGetLastError();
 		if (err == WSAEADDRINUSE) {
 			printf("[%s:%d] %s\"\n", ERROR_FLAGS, err, _ADDRESS_IN_USE);
@@ -418,10 +1624,10 @@ SOCKET GetConnectionSocket(SOCKET listener, ADDRESS* osender_address)
 	if (result == INVALID_SOCKET) {
 		int err = WSAGetLastError();
 		if (err == WSAEINVAL) {
-			printf("[%s:%d] %s\n", WARNING_FLAGS, err, _NOT_LISTEN_SOCKET);
+			LogEvent(LOG_NOT_LISTEN_SOCKET, err);
 		}
 		else {
-			printf("[%s:%d] %s\n", WARNING_FLAGS, err, _ACCEPT_SOCKET_FAIL);
+			LogEvent(LOG_ACCEPT_SOCKET_FAIL, err);
 		}
 	}
 	return result;
@@ -431,52 +1637,152 @@ SOCKET GetConnectionSocket(SOCKET listener, ADDRESS* osender_address)
 
 #pragma region Send and Receive
 
-int Send(SOCKET sender, int bytes, const char* byte_stream)
+CONNECTION* CreateConnection(SOCKET socket, int buffer_size)
+{
+	if (buffer_size > 0 && buffer_size < APPLICATION_BUFF_MAX_SIZE)
+		buffer_size = APPLICATION_BUFF_MAX_SIZE;
+
+	CONNECTION* connection = (CONNECTION*)malloc(sizeof(CONNECTION));
+	if (connection == NULL) {
+		LogEvent(LOG_ALLOCATE_MEMORY_FAIL);
+		return NULL;
+	}
+	connection->buffer = buffer_size > 0 ? (char*)malloc(buffer_size) : NULL;
+	if (connection->buffer == NULL && buffer_size > 0) {
+		LogEvent(LOG_ALLOCATE_MEMORY_FAIL);
+		free(connection);
+		return NULL;
+	}
+	connection->socket = socket;
+	connection->channel = NULL;
+	connection->send_buffer = NULL;
+	connection->send_length = 0;
+	connection->send_capacity = 0;
+	connection->session = NULL;
+	connection->stream = NULL;
+	connection->capacity = buffer_size;
+	connection->head = 0;
+	connection->length = 0;
+	connection->recv_calls = 0;
+	connection->send_calls = 0;
+	connection->messages = 0;
+	connection->send_history = NULL;
+	connection->receive_history = NULL;
+	connection->compress_threshold = COMPRESSION_MIN_SIZE;
+	return connection;
+}
+
+void DestroyConnection(CONNECTION* connection)
 {
-	int ret = send(sender, byte_stream, bytes, 0);
+	if (connection == NULL)
+		return;
+	DestroyCompressor(connection->send_history);
+	DestroyCompressor(connection->receive_history);
+	free(connection->send_buffer);
+	free(connection->buffer);
+	free(connection);
+}
+
+int EnableCompression(CONNECTION* connection, int threshold)
+{
+	if (connection->send_history == NULL)
+		connection->send_history = CreateCompressor(1);
+	if (connection->receive_history == NULL)
+		connection->receive_history = CreateCompressor(0);
+	if (connection->send_history == NULL || connection->receive_history == NULL) {
+		LogEvent(LOG_ALLOCATE_MEMORY_FAIL);
+		return 0;
+	}
+	connection->compress_threshold = threshold;
+	return 1;
+}
+
+int Send(CONNECTION* sender, int bytes, const char* byte_stream)
+{
+	if (sender->send_buffer != NULL)
+		return AppendSendBuffer(sender, bytes, byte_stream);
+	int ret = sender->channel != NULL ? SharedSend(sender->channel, byte_stream, bytes) : send(sender->socket, byte_stream, bytes, 0);
+	sender->send_calls++;
 	if (ret == SOCKET_ERROR) {
 		int err = WSAGetLastError();
 		if (err == WSAEHOSTUNREACH) {
-			printf("[%s:%d] %s\n", WARNING_FLAGS, err, _HOST_UNREACHABLE);
+			LogEvent(LOG_HOST_UNREACHABLE, err);
 		}
 		else if (err == WSAECONNABORTED || err == WSAECONNRESET) {
-			printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
+			LogEvent(LOG_CONNECTION_DROP, err);
 		}
 		else {
-			printf("[%s:%d] %s\n", WARNING_FLAGS, err, _SEND_FAIL);
+			LogEvent(LOG_SEND_FAIL, err);
 		}
 		return -1;
 	}
 	else if (ret < bytes) {
-		printf("[%s] %s\n", WARNING_FLAGS, _SEND_NOT_ALL);
+		LogEvent(LOG_SEND_NOT_ALL);
+		CountBytesOut(ret);
 		return 0;
 	}
+	CountBytesOut(bytes);
 	return 1;
 }
 
-int SegmentationSend(SOCKET sender, const char* message, int message_len, int* obyte_sent)
+int SegmentationSend(CONNECTION* sender, const char* message, int message_len, int* obyte_sent)
 {
 	int start_byte = 0; // start byte in message.
 	unsigned short bsend = 0; // number of bytes will send, not include header size.
 	unsigned short bremain = 0; // number of bytes remain.
+	unsigned short bcurrent = 0; // number of bytes of the piece on the wire, with SEGMENT_COMPRESSED_FLAG if compressed.
+	int compress = (sender->send_history != NULL && message_len >= sender->compress_threshold);
+	if (obyte_sent != NULL)
+		*obyte_sent = 0;
+	// the remaining bytes would wrap in the header: the peer would take the message for a shorter one
+	if (message_len > SEGMENT_MESSAGE_MAX_SIZE) {
+		LogEvent(LOG_MESSAGE_EXTREME_LARGE);
+		return 0;
+	}
 
 	char content[APPLICATION_BUFF_MAX_SIZE];
 	while (start_byte < message_len) {
+		TRACE_CLOCK(segment_start); // the compression of the piece is part of its send
 		// Prepare content for sending: header (number of bytes send | number of bytes remain) + body (a part of message)
 		bsend = message_len - start_byte;
 		if (bsend + SEGMENT_HEADER_SIZE > APPLICATION_BUFF_MAX_SIZE) {
 			bsend = APPLICATION_BUFF_MAX_SIZE - SEGMENT_HEADER_SIZE;
 		}
+		bcurrent = bsend;
+		if (compress) {
+			// compressed body: raw length | compressed block. Keep the raw piece if compression does not help
+			int chunk = message_len - start_byte;
+			if (chunk > COMPRESSION_CHUNK_SIZE)
+				chunk = COMPRESSION_CHUNK_SIZE;
+			int consumed;
+			int clen = CompressBlock(sender->send_history, message + start_byte, chunk,
+				content + SEGMENT_HEADER_SIZE + SEGMENT_RAW_LENGTH_SIZE,
+				APPLICATION_BUFF_MAX_SIZE - SEGMENT_HEADER_SIZE - SEGMENT_RAW_LENGTH_SIZE, &consumed);
+			if (consumed > clen + SEGMENT_RAW_LENGTH_SIZE) {
+				bsend = consumed;
+				bcurrent = (clen + SEGMENT_RAW_LENGTH_SIZE) | SEGMENT_COMPRESSED_FLAG;
+				unsigned short consumed_bigendian = htons(consumed);
+				memcpy_s(content + SEGMENT_HEADER_SIZE, SEGMENT_RAW_LENGTH_SIZE, &consumed_bigendian, SEGMENT_RAW_LENGTH_SIZE);
+			}
+			CommitHistory(sender->send_history, bsend);
+		}
+		else if (sender->send_history != NULL) {
+			AppendHistory(sender->send_history, message + start_byte, bsend);
+		}
 		bremain = message_len - start_byte - bsend;
 
-		int bsend_bigendian = htons(bsend); // uniform with many architectures.
+		int bcurrent_bigendian = htons(bcurrent); // uniform with many architectures.
 		int bremain_bigendian = htons(bremain);
 
-		memcpy_s(content, SEGMENT_HEADER_CURRENT_SIZE, &bsend_bigendian, SEGMENT_HEADER_CURRENT_SIZE);
+		memcpy_s(content, SEGMENT_HEADER_CURRENT_SIZE, &bcurrent_bigendian, SEGMENT_HEADER_CURRENT_SIZE);
 		memcpy_s(content + SEGMENT_HEADER_CURRENT_SIZE, SEGMENT_HEADER_REMAIN_SIZE, &bremain_bigendian, SEGMENT_HEADER_REMAIN_SIZE);
-		memcpy_s(content + SEGMENT_HEADER_SIZE, bsend, message + start_byte, bsend);
+		if (bcurrent == bsend) {
+			memcpy_s(content + SEGMENT_HEADER_SIZE, bsend, message + start_byte, bsend);
+		}
 		// Send
-		int ret = Send(sender, bsend + SEGMENT_HEADER_SIZE, content);
+		int ret = Send(sender, (bcurrent & ~SEGMENT_COMPRESSED_FLAG) + SEGMENT_HEADER_SIZE, content);
+		if (segment_start != 0)
+			TraceSegment(TRACE_SEND, segment_start);
 		if (ret == 1) {
 			start_byte += bsend;
 		}
@@ -491,102 +1797,194 @@ int SegmentationSend(SOCKET sender, const char* message, int message_len, int* o
 	return 1;
 }
 
-int Receive(SOCKET receiver, int length, char** obyte_stream)
+int AppendSendBuffer(CONNECTION* sender, int bytes, const char* byte_stream)
 {
-	if (length > APPLICATION_BUFF_MAX_SIZE)
-	{
-		printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
-		length = APPLICATION_BUFF_MAX_SIZE;
+	if (sender->send_length + bytes > sender->send_capacity) {
+		int capacity = max(sender->send_capacity * 2, sender->send_length + bytes);
+		char* buffer = (char*)realloc(sender->send_buffer, capacity);
+		if (buffer == NULL) {
+			LogEvent(LOG_ALLOCATE_MEMORY_FAIL);
+			return -1;
+		}
+		sender->send_buffer = buffer;
+		sender->send_capacity = capacity;
 	}
-	char buffer[APPLICATION_BUFF_MAX_SIZE];
-
-	int ret = recv(receiver, buffer, length, 0);
-	if (ret == SOCKET_ERROR) {
-		int err = WSAGetLastError();
-		if (err == WSAECONNABORTED || err == WSAECONNRESET) {
-			printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
+	memcpy_s(sender->send_buffer + sender->send_length, sender->send_capacity - sender->send_length, byte_stream, bytes);
+	sender->send_length += bytes;
+	// counted when buffered: the completion engine sends the buffer in one piece, or closes the connection
+	CountBytesOut(bytes);
+	return 1;
+}
+int FillReceiveBuffer(CONNECTION* receiver, int bytes)
+{
+	while (receiver->length < bytes) {
+		// read into the free space right after the last unread byte, until the end of ring or the first unread byte
+		int tail = (receiver->head + receiver->length) % receiver->capacity;
+		int space = receiver->capacity - receiver->length;
+		if (tail + space > receiver->capacity)
+			space = receiver->capacity - tail;
+
+		int ret = receiver->channel != NULL ? SharedReceive(receiver->channel, receiver->buffer + tail, space) : recv(receiver->socket, receiver->buffer + tail, space, 0);
+		receiver->recv_calls++;
+		if (ret == SOCKET_ERROR) {
+			int err = WSAGetLastError();
+			if (err == WSAECONNABORTED || err == WSAECONNRESET) {
+				LogEvent(LOG_CONNECTION_DROP, err);
+			}
+			else {
+				LogEvent(LOG_RECEIVE_FAIL, err);
+			}
+			return -1;
 		}
-		else {
-			printf("[%s:%d] %s\n", WARNING_FLAGS, err, _RECEIVE_FAIL);
+		else if (ret == 0) {
+			return -1;
 		}
-		return -1;
+		receiver->length += ret;
+		CountBytesIn(ret);
 	}
-	else if (ret == 0) {
-		return -1;
+	return 1;
+}
+
+void ReadReceiveBuffer(CONNECTION* receiver, int bytes, char* odestination)
+{
+	// the unread bytes may wrap around the end of ring
+	int first = receiver->capacity - receiver->head;
+	if (first > bytes)
+		first = bytes;
+	memcpy_s(odestination, bytes, receiver->buffer + receiver->head, first);
+	memcpy_s(odestination + first, bytes - first, receiver->buffer, bytes - first);
+
+	receiver->head = (receiver->head + bytes) % receiver->capacity;
+	receiver->length -= bytes;
+}
+
+int Receive(CONNECTION* receiver, int length, char** obyte_stream)
+{
+	*obyte_stream = NULL;
+	if (length > receiver->capacity)
+	{
+		LogEvent(LOG_TOO_MUCH_BYTES);
+		length = receiver->capacity;
 	}
-	else if (ret < length) {
-		printf("[%s] %s\n", WARNING_FLAGS, _RECEIVE_UNEXPECTED_MESSAGE);
-		*obyte_stream = NULL;
-		return 0;
+
+	int ret = FillReceiveBuffer(receiver, length);
+	if (ret != 1) {
+		return ret;
 	}
-	else {
-		*obyte_stream = Clone(buffer, length);
+
+	*obyte_stream = (char*)malloc(length);
+	if (*obyte_stream == NULL) {
+		LogEvent(LOG_ALLOCATE_MEMORY_FAIL);
+		// drop the bytes to keep the stream at segment boundary
+		receiver->head = (receiver->head + length) % receiver->capacity;
+		receiver->length -= length;
+		return 0;
 	}
+	ReadReceiveBuffer(receiver, length, *obyte_stream);
 	return 1;
 }
 
-int ReceiveSegment(SOCKET receiver, char** obyte_stream, int* ostream_len, int* oremain)
+int ReceiveSegment(CONNECTION* receiver, char** obyte_stream, int* ostream_len, int* oremain)
 {
 	*obyte_stream = NULL;
-	char* read;
-	int remain;
-	int current;
+	*ostream_len = 0;
+	*oremain = 0;
+	char header[SEGMENT_HEADER_SIZE];
 	// read number of bytes remain | number of bytes current
-	int ret = Receive(receiver, SEGMENT_HEADER_SIZE, &read);
-	if (ret == 1) {
-		current = ntohs(*(unsigned short*)read);
-		remain = ntohs(*(unsigned short*)(read + SEGMENT_HEADER_CURRENT_SIZE));
-
-		*ostream_len = current;
-		*oremain = remain;
-		free(read);
-	}
-	else {
-		*ostream_len = 0;
-		*oremain = 0;
+	int ret = FillReceiveBuffer(receiver, SEGMENT_HEADER_SIZE);
+	if (ret != 1) {
 		return ret;
 	}
+	ReadReceiveBuffer(receiver, SEGMENT_HEADER_SIZE, header);
+	// from the header: the wait for a request to come is not part of it
+	LONG64 header_received = Config.trace_sample > 0 ? ReadMetricsClock() : 0;
+	int current = ntohs(*(unsigned short*)header);
+	int remain = ntohs(*(unsigned short*)(header + SEGMENT_HEADER_CURRENT_SIZE));
+	int is_compressed = (current & SEGMENT_COMPRESSED_FLAG) != 0;
+	current &= ~SEGMENT_COMPRESSED_FLAG;
+	if (current <= 0 || current + SEGMENT_HEADER_SIZE > APPLICATION_BUFF_MAX_SIZE
+		|| (is_compressed && (receiver->receive_history == NULL || current <= SEGMENT_RAW_LENGTH_SIZE))) {
+		LogEvent(LOG_RECEIVE_UNEXPECTED_MESSAGE);
+		return -1; // lost segment boundary
+	}
 
 	// read message content
-	ret = Receive(receiver, current, &read);
-	if (ret == 1) {
-		*obyte_stream = Clone(read, current);
-		free(read);
+	ret = Receive(receiver, current, obyte_stream);
+	if (ret != 1) {
+		// a dropped piece breaks the compression history
+		return receiver->receive_history != NULL ? -1 : ret;
 	}
-	else {
-		*ostream_len = 0;
-		*oremain = 0;
-		return ret;
+
+	if (is_compressed) {
+		int raw_length = ntohs(*(unsigned short*)*obyte_stream);
+		char* raw = NULL;
+		if (raw_length > 0 && raw_length <= COMPRESSION_CHUNK_SIZE)
+			raw = (char*)malloc(raw_length);
+		if (raw == NULL || !DecompressBlock(receiver->receive_history, *obyte_stream + SEGMENT_RAW_LENGTH_SIZE,
+			current - SEGMENT_RAW_LENGTH_SIZE, raw, raw_length)) {
+			LogEvent(LOG_RECEIVE_UNEXPECTED_MESSAGE);
+			free(raw);
+			free(*obyte_stream);
+			*obyte_stream = NULL;
+			return -1;
+		}
+		free(*obyte_stream);
+		*obyte_stream = raw;
+		current = raw_length;
 	}
+	else if (receiver->receive_history != NULL) {
+		AppendHistory(receiver->receive_history, *obyte_stream, current);
+	}
+	*ostream_len = current;
+	*oremain = remain;
+	if (header_received != 0)
+		TraceSegment(TRACE_RECEIVE, header_received);
 	return 1;
 }
 
-int SegmentationReceive(SOCKET socket, char** omessage)
+int MergeSegments(CONNECTION* connection, char* segment, int mlen, int remain, char** omessage)
 {
-	char* _message;
-	int mlen, remain, start_byte = 0;
+	int total = mlen + remain, start_byte = 0;
 	int status = 1;
-	*omessage = NULL;
+	*omessage = (char*)malloc((size_t)total);
+	if (*omessage == NULL) {
+		LogEvent(LOG_ALLOCATE_MEMORY_FAIL);
+		free(segment);
+		return 0;
+	}
 	while (1) {
-		status = ReceiveSegment(socket, &_message, &mlen, &remain);
-		if (status != 1) {
-			free(_message);
-			return status;
-		}
-		if (*omessage == NULL) {
-			*omessage = (char*)malloc((size_t)mlen + remain);
-			if (*omessage == NULL) {
-				printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
-				free(_message);
-				return 0;
-			}
+		if (start_byte + mlen > total) { // the segment does not belong to this message
+			LogEvent(LOG_RECEIVE_UNEXPECTED_MESSAGE);
+			free(segment);
+			return -1;
 		}
-		memcpy_s(*omessage + start_byte, mlen, _message, mlen);
+		memcpy_s(*omessage + start_byte, mlen, segment, mlen);
 		start_byte += mlen;
-		free(_message);
+		free(segment);
 		if (remain <= 0)
 			break;
+		status = ReceiveSegment(connection, &segment, &mlen, &remain);
+		if (status != 1) {
+			free(segment);
+			return status;
+		}
+	}
+	return status;
+}
+
+int SegmentationReceive(CONNECTION* connection, char** omessage)
+{
+	char* _message;
+	int mlen, remain;
+	*omessage = NULL;
+	int status = ReceiveSegment(connection, &_message, &mlen, &remain);
+	if (status != 1) {
+		free(_message);
+		return status;
 	}
+	status = MergeSegments(connection, _message, mlen, remain, omessage);
+	if (status == 1)
+		connection->messages++;
 	return status;
 }
 
@@ -615,6 +2013,135 @@ int ExtractCommand(int argc, char* argv[], int* oport)
 	return is_ok;
 }
 
+int ExtractOptions(int argc, char* argv[], SERVERCONFIG* oconfig)
+{
+	int is_ok = 1;
+	// options follow the port number, each has form: name=value
+	for (int i = 2; i < argc; ++i) {
+		char* equal_pos = strchr(argv[i], '=');
+		if (equal_pos == NULL) {
+			printf("[%s] %s: '%s'\n", WARNING_FLAGS, _UNKNOWN_OPTION, argv[i]);
+			is_ok = 0;
+			continue;
+		}
+		int name_len = (int)(equal_pos - argv[i]);
+		int value = atoi(equal_pos + 1);
+		if (ICompare(argv[i], OPT_READ_BUFFER, max(name_len, (int)strlen(OPT_READ_BUFFER))) == 0) {
+			oconfig->read_buffer_size = value;
+		}
+		else if (ICompare(argv[i], OPT_STREAM_THRESHOLD, max(name_len, (int)strlen(OPT_STREAM_THRESHOLD))) == 0) {
+			oconfig->stream_threshold = value;
+		}
+		else if (ICompare(argv[i], OPT_UDP, max(name_len, (int)strlen(OPT_UDP))) == 0) {
+			oconfig->udp = value;
+		}
+		else if (ICompare(argv[i], OPT_UNIX, max(name_len, (int)strlen(OPT_UNIX))) == 0) {
+			if (strlen(equal_pos + 1) < LOCAL_PATH_MAX_SIZE) {
+				oconfig->unix_path = equal_pos + 1;
+			}
+			else {
+				printf("[%s] %s: '%s'\n", WARNING_FLAGS, _LOCAL_PATH_TOO_LONG, argv[i]);
+				is_ok = 0;
+			}
+		}
+		else if (ICompare(argv[i], OPT_SHM, max(name_len, (int)strlen(OPT_SHM))) == 0) {
+			oconfig->shm_name = equal_pos + 1;
+		}
+		else if (ICompare(argv[i], OPT_ENGINE, max(name_len, (int)strlen(OPT_ENGINE))) == 0) {
+			if (ICompare(equal_pos + 1, ENGINE_NAME_COMPLETION) == 0) {
+				oconfig->engine = ENGINE_COMPLETION;
+			}
+			else if (ICompare(equal_pos + 1, ENGINE_NAME_COROUTINE) == 0) {
+				oconfig->engine = ENGINE_COROUTINE;
+			}
+			else if (ICompare(equal_pos + 1, ENGINE_NAME_THREADS) == 0) {
+				oconfig->engine = ENGINE_THREADS;
+			}
+			else {
+				printf("[%s] %s: '%s'\n", WARNING_FLAGS, _UNKNOWN_ENGINE, argv[i]);
+				is_ok = 0;
+			}
+		}
+		else if (ICompare(argv[i], OPT_WORKERS, max(name_len, (int)strlen(OPT_WORKERS))) == 0) {
+			oconfig->workers = value;
+		}
+		else if (ICompare(argv[i], OPT_ACCEPTORS, max(name_len, (int)strlen(OPT_ACCEPTORS))) == 0) {
+			oconfig->acceptors = max(value, 1);
+		}
+		else if (ICompare(argv[i], OPT_SCHEDULER, max(name_len, (int)strlen(OPT_SCHEDULER))) == 0) {
+			oconfig->scheduler = value;
+		}
+		else if (ICompare(argv[i], OPT_IDLE_TIMEOUT, max(name_len, (int)strlen(OPT_IDLE_TIMEOUT))) == 0) {
+			oconfig->idle_timeout = value;
+		}
+		else if (ICompare(argv[i], OPT_READ_TIMEOUT, max(name_len, (int)strlen(OPT_READ_TIMEOUT))) == 0) {
+			oconfig->read_timeout = value;
+		}
+		else if (ICompare(argv[i], OPT_LOGIN_TIMEOUT, max(name_len, (int)strlen(OPT_LOGIN_TIMEOUT))) == 0) {
+			oconfig->login_timeout = value;
+		}
+		else if (ICompare(argv[i], OPT_MAX_CONNECTIONS, max(name_len, (int)strlen(OPT_MAX_CONNECTIONS))) == 0) {
+			oconfig->max_connections = value;
+		}
+		else if (ICompare(argv[i], OPT_MAX_REQUESTS, max(name_len, (int)strlen(OPT_MAX_REQUESTS))) == 0) {
+			oconfig->max_requests = value;
+		}
+		else if (ICompare(argv[i], OPT_MAX_MEMORY, max(name_len, (int)strlen(OPT_MAX_MEMORY))) == 0) {
+			oconfig->max_memory = value;
+		}
+		else if (ICompare(argv[i], OPT_POST_RATE, max(name_len, (int)strlen(OPT_POST_RATE))) == 0) {
+			ExtractIntegerList(equal_pos + 1, oconfig->post_rate, RATE_CLASS_COUNT);
+		}
+		else if (ICompare(argv[i], OPT_POST_BURST, max(name_len, (int)strlen(OPT_POST_BURST))) == 0) {
+			ExtractIntegerList(equal_pos + 1, oconfig->post_burst, RATE_CLASS_COUNT);
+		}
+		else if (ICompare(argv[i], OPT_NUMA, max(name_len, (int)strlen(OPT_NUMA))) == 0) {
+			oconfig->numa = value;
+		}
+		else if (ICompare(argv[i], OPT_COMPRESSION, max(name_len, (int)strlen(OPT_COMPRESSION))) == 0) {
+			oconfig->compression = value;
+		}
+		else if (ICompare(argv[i], OPT_COMPRESS_THRESHOLD, max(name_len, (int)strlen(OPT_COMPRESS_THRESHOLD))) == 0) {
+			oconfig->compress_threshold = value;
+		}
+		else if (ICompare(argv[i], OPT_METRICS_PORT, max(name_len, (int)strlen(OPT_METRICS_PORT))) == 0) {
+			oconfig->metrics_port = value;
+		}
+		else if (ICompare(argv[i], OPT_ADMIN, max(name_len, (int)strlen(OPT_ADMIN))) == 0) {
+			oconfig->admin = equal_pos + 1;
+		}
+		else if (ICompare(argv[i], OPT_LOCK_PROFILE, max(name_len, (int)strlen(OPT_LOCK_PROFILE))) == 0) {
+			oconfig->lock_profile = value;
+		}
+		else if (ICompare(argv[i], OPT_LOG_RATE, max(name_len, (int)strlen(OPT_LOG_RATE))) == 0) {
+			oconfig->log_rate = value;
+		}
+		else if (ICompare(argv[i], OPT_TRACE_SAMPLE, max(name_len, (int)strlen(OPT_TRACE_SAMPLE))) == 0) {
+			oconfig->trace_sample = value;
+		}
+		else {
+			printf("[%s] %s: '%s'\n", WARNING_FLAGS, _UNKNOWN_OPTION, argv[i]);
+			is_ok = 0;
+		}
+	}
+	return is_ok;
+}
+
+int ExtractIntegerList(const char* text, int* ovalues, int capacity)
+{
+	int count = 0;
+	while (count < capacity) {
+		ovalues[count++] = atoi(text);
+		text = strchr(text, ',');
+		if (text == NULL)
+			break;
+		++text;
+	}
+	for (int i = count; i < capacity; ++i)
+		ovalues[i] = ovalues[count - 1];
+	return count;
+}
+
 IP CreateDefaultIP()
 {
 	IP addr;
@@ -627,7 +2154,7 @@ char* Clone(const char* source, int length, int start)
 	char* _clone = (char*)malloc((size_t)length + start);
 
 	if (_clone == NULL)
-		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		LogEvent(LOG_ALLOCATE_MEMORY_FAIL);
 	else
 		memcpy_s(_clone + start, length, source, length);
 	return _clone;
@@ -650,6 +2177,13 @@ MESSAGE CreateMessage(int status, const char* message)
 	return m;
 }
 
+int GetMessageStatus(MESSAGE m)
+{
+	if (m == NULL)
+		return 0;
+	return (m[0] - '0') * 10 + (m[1] - '0');
+}
+
 void DestroyMessage(MESSAGE m)
 {
 	free(m);
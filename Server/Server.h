@@ -2,9 +2,21 @@
 
 #pragma region Header Declarations
 
+#define _CRT_RAND_S // rand_s() for session tokens
+
 #include <process.h>
+#include <time.h>
+#include <psapi.h>
+#include <mstcpip.h>
 
 #include "CommonHeader.h"
+#include "CompletionEngine.h"
+#include "CoroutineSession.h"
+#include "TimerWheel.h"
+#include "Placement.h"
+#include "Metrics.h"
+#include "Logger.h"
+#include "Tracing.h"
 
 #pragma endregion
 
@@ -15,6 +27,67 @@
 #define LINE_MAX_SIZE 1024
 
 #define ACCOUNT_FILE_PATH ".//account.txt"
+#define ARTICLE_DIRECTORY ".//articles"
+
+#define POST_STREAM_THRESHOLD 4096
+
+#define UDP_BATCH_SIZE 64
+#define UDP_RECEIVE_BUFFER_SIZE (1 << 20)
+#define UDP_SEQUENCE_WINDOW 64
+#define UDP_REPORT_INTERVAL 10000
+
+#define ACCEPT_REPORT_INTERVAL 1000
+
+#define CLASSIFY_PEEK_SIZE 16 // Bytes of a buffered request read to find its command and priority class
+
+#define RATE_CLASS_COUNT 4 // Number of account classes with their own POST limits. The class is the third column of the account file
+
+#define ENGINE_THREADS 0 // One thread per connection, blocking calls
+#define ENGINE_COMPLETION 1 // Worker threads on an I/O completion port
+#define ENGINE_COROUTINE 2 // Coroutine sessions on the completion engine
+#define ENGINE_NAME_THREADS "threads"
+#define ENGINE_NAME_COMPLETION "iocp"
+#define ENGINE_NAME_COROUTINE "coroutine"
+
+#define TIMEOUT_IDLE 1 // No request completed in time
+#define TIMEOUT_READ 2 // A request started and not received in full in time
+#define TIMEOUT_LOGIN 3 // Not logged in in time
+
+#define ADMIN_ACCOUNT "admin" // The account allowed to read the statistics, by default
+
+#define OPT_READ_BUFFER "read_buffer"
+#define OPT_STREAM_THRESHOLD "stream_threshold"
+#define OPT_UDP "udp"
+#define OPT_UNIX "unix"
+#define OPT_SHM "shm"
+#define OPT_ENGINE "engine"
+#define OPT_WORKERS "workers"
+#define OPT_ACCEPTORS "acceptors"
+#define OPT_SCHEDULER "scheduler"
+#define OPT_IDLE_TIMEOUT "idle_timeout"
+#define OPT_READ_TIMEOUT "read_timeout"
+#define OPT_LOGIN_TIMEOUT "login_timeout"
+#define OPT_MAX_CONNECTIONS "max_connections"
+#define OPT_MAX_REQUESTS "max_requests"
+#define OPT_MAX_MEMORY "max_memory"
+#define OPT_POST_RATE "post_rate"
+#define OPT_POST_BURST "post_burst"
+#define OPT_NUMA "numa"
+#define OPT_COMPRESSION "compression"
+#define OPT_COMPRESS_THRESHOLD "compress_threshold"
+#define OPT_METRICS_PORT "metrics_port"
+#define OPT_ADMIN "admin"
+#define OPT_LOCK_PROFILE "lock_profile"
+#define OPT_LOG_RATE "log_rate"
+#define OPT_TRACE_SAMPLE "trace_sample"
+
+#define _UNKNOWN_OPTION "Unknown command-line option. Option ignored"
+#define _CREATE_SHARED_LISTENER_FAIL "Fail to create shared memory listener. The name may be used by another server"
+#define _LOCAL_PATH_TOO_LONG "Unix domain socket path is too long. Option ignored"
+#define _UNKNOWN_ENGINE "Unknown I/O engine. Option ignored"
+#define _CREATE_SCHEDULER_FAIL "Fail to create the task scheduler. Requests run on the I/O workers"
+#define _CREATE_TIMER_WHEEL_FAIL "Fail to create the timer wheel. Sessions never time out"
+#define _LOAD_NUMA_NODES_FAIL "Fail to find the NUMA nodes. Threads are not placed"
 
 #define S_LOGIN_SUCC 10
 #define S_ACCOUNT_LOCK 11
@@ -23,7 +96,16 @@
 #define S_LOGGEDIN 14
 #define S_POST_SUCC 20
 #define S_NOT_LOGIN 21
+#define S_POST_FAIL 22
+#define S_POST_LIMITED 23
 #define S_LOGOUT_SUCC 30
+#define S_COMPRESS_SUCC 40
+#define S_COMPRESS_REFUSED 41
+#define S_TOKEN_SUCC 50
+#define S_TOKEN_FAIL 51
+#define S_STATS_SUCC 60
+#define S_STATS_REFUSED 61
+#define S_SERVER_BUSY 98
 #define S_UNREGCONIZE_COMMAND 99
 
 #define SM_LOGIN_SUCC "Login successfully"
@@ -33,8 +115,17 @@
 #define SM_LOGGEDIN "You already logged in"
 #define SM_POST_SUCC "Post the article successfully"
 #define SM_NOT_LOGIN "No permission because you are not logged in"
+#define SM_POST_FAIL "Fail to store the article"
+#define SM_POST_LIMITED "Too many posts, slow down and try again later"
 #define SM_LOGOUT_SUCC "Log out successfully"
+#define SM_TOKEN_FAIL "Fail to create session token"
+#define SM_COMPRESS_SUCC "Compression enabled"
+#define SM_COMPRESS_UNSUPPORTED "Compression algorithm is not supported"
+#define SM_STATS_REFUSED "No permission, the statistics are for the administrator only"
+#define SM_STATS_TOO_LARGE "The statistics do not fit in a message, read them at the metrics port"
+#define SM_COMPRESS_TOO_LATE "Compression must be negotiated before other requests"
 #define SM_UNREGCONIZE_COMMAND "Unregconize command"
+#define SM_SERVER_BUSY "Server busy, try again later"
 
 #define AS_FREE 0
 #define AS_LOCK 1
@@ -51,10 +142,189 @@ typedef struct accountinfo {
 
 	int status; // Account status. See AS_ for some definitions of account status
 
+	unsigned long long token; // Session token for datagram posts. 0 if not issued
+
+	unsigned long long last_sequence; // Highest sequence number of accepted datagram posts
+
+	unsigned long long sequence_window; // Bit i is set if datagram post [last_sequence - i] was accepted. Detects duplicates
+
+	int rate_class; // Class of POST limits the account has, from 0 to RATE_CLASS_COUNT - 1
+
+	volatile LONG64 post_bucket; // Token bucket of posts, as the time it would be full again in QueryPerformanceCounter() ticks. Changed by compare-exchange, without lock
+
 	struct accountinfo* next; // Next account. Linked List
 
 }ACCOUNTINFO;
 
+typedef struct serverconfig {
+
+	int read_buffer_size; // Size of read-ahead buffer for each connection, in bytes. Option: read_buffer=<bytes>
+
+	int stream_threshold; // POST requests at least this size are streamed segment by segment. Option: stream_threshold=<bytes>
+	// [On the completion engine other requests are buffered whole, up to ENGINE_MESSAGE_MAX_SIZE: a larger threshold is lowered to it]
+
+	int compression; // 1 if clients may negotiate compression. Option: compression=<0|1>
+
+	int compress_threshold; // Messages shorter than this are sent without compression. Option: compress_threshold=<bytes>
+
+	int udp; // 1 if datagram posts are accepted on the same port number. Option: udp=<0|1>
+
+	const char* unix_path; // Path of the Unix domain socket listened as well as TCP. NULL if not used. Option: unix=<path>
+
+	const char* shm_name; // Name of the shared memory listener for clients on the same host. NULL if not used. Option: shm=<name>
+
+	int engine; // I/O engine serving TCP connections. See ENGINE_ for some definitions. Option: engine=<threads|iocp|coroutine>
+
+	int workers; // Number of worker threads of the completion engine. 0 for one per processor. Option: workers=<count>
+
+	int acceptors; // Number of threads accepting on the TCP listener [AcceptEx backlogs for the completion engine]. Option: acceptors=<count>
+
+	int scheduler; // Number of task workers running requests off the I/O workers of the completion engine. 0 to run them on the I/O workers. Option: scheduler=<count>
+
+	int idle_timeout; // A session is closed if no request completes for this long, in milliseconds. 0 if not used. Option: idle_timeout=<ms>
+
+	int read_timeout; // A session is closed if a started request is not received in full for this long, in milliseconds. 0 if not used. Option: read_timeout=<ms>
+
+	int login_timeout; // A session is closed if it is not logged in this long after it is accepted, in milliseconds. 0 if not used. Option: login_timeout=<ms>
+
+	int max_connections; // New connections are refused while this many are open. 0 if not limited. Option: max_connections=<count>
+
+	int max_requests; // Requests are refused while this many are being handled. 0 if not limited. Option: max_requests=<count>
+
+	int max_memory; // New connections and requests are refused while the server uses more private memory, in megabytes. 0 if not limited. Option: max_memory=<MB>
+
+	int post_rate[RATE_CLASS_COUNT]; // Posts an account may make per second, by rate class. 0 if not limited. Option: post_rate=<per second>[,<per second of next class>...]
+
+	int post_burst[RATE_CLASS_COUNT]; // Posts an account may make at once after a pause, by rate class. 0 for one second of posts. Option: post_burst=<posts>[,<posts of next class>...]
+
+	int numa; // 1 if threads are pinned to the processors of NUMA nodes, and connections stay on the node that accepted them. Option: numa=<0|1>
+
+	int metrics_port; // Port number on 127.0.0.1 where the metrics are served to Prometheus. 0 if not used. Option: metrics_port=<port>
+
+	const char* admin; // The account allowed to read the statistics with a STATS request. Option: admin=<account>
+
+	int lock_profile; // 1 if the acquires, waits and holds of critical_section are profiled by call site. Option: lock_profile=<0|1>
+
+	int log_rate; // Messages of each type written per second. The rest are counted and summarized. 0 if not limited. Option: log_rate=<messages>
+
+	int trace_sample; // One request in [trace_sample] is traced, and the traces served with the metrics. 0 if not traced. Option: trace_sample=<requests>
+
+}SERVERCONFIG;
+
+typedef struct streamhandler {
+
+	void* (*begin)(SOCKET socket, int length); // Start processing a request of [length] bytes from client [socket]. Return the stream state
+
+	int (*write)(void* state, const char* bytes, int length); // Consume next part of request. Return 0 if the rest should be dropped
+
+	MESSAGE (*end)(void* state, int completed); // Finish the stream and Free its state. Return the response message, NULL if not [completed]
+
+}STREAMHANDLER;
+
+typedef struct poststream {
+
+	FILE* file; // The article file being written
+
+	char path[LINE_MAX_SIZE]; // Path to the article file
+
+	int status; // S_POST_SUCC while the article is written without errors. S_NOT_LOGIN or S_POST_FAIL otherwise
+
+}POSTSTREAM;
+
+typedef struct segmentstream {
+
+	const STREAMHANDLER* handler; // Takes the segments. NULL if they are drained: the request is answered busy
+
+	void* state; // The state handler->begin() returned
+
+	int accepted; // 0 once handler->write() refused a part: the rest is drained
+
+	int admitted; // 1 if the request was admitted. It is finished with the stream
+
+}SEGMENTSTREAM; // A request streamed on the completion engine, as its segments arrive [CONNECTION.stream]
+
+typedef struct acceptedsocket {
+
+	SOCKET socket; // The connected socket
+
+	LONG64 accepted; // When accept() returned it, in QueryPerformanceCounter() ticks
+
+}ACCEPTEDSOCKET; // Passed to the thread that serves the connection
+
+typedef struct datagram {
+
+	char data[UDP_DATAGRAM_MAX_SIZE + 1]; // The datagram, null-terminated
+
+	int length; // Size of the datagram, in bytes
+
+}DATAGRAM;
+
+typedef struct datagramstatistics {
+
+	volatile LONG64 received; // Datagrams read from socket
+
+	volatile LONG64 batches; // Batches of datagrams processed
+
+	volatile LONG64 accepted; // Posts stored
+
+	volatile LONG64 malformed; // Dropped: not a valid datagram post, or too large
+
+	volatile LONG64 unauthorized; // Dropped: token unknown or account not logged in
+
+	volatile LONG64 duplicates; // Dropped: sequence number already accepted
+
+	volatile LONG64 stale; // Dropped: sequence number too old to check for duplicates
+
+	volatile LONG64 limited; // Dropped: the account is over its post rate
+
+}DATAGRAMSTATISTICS;
+
+typedef struct acceptstatistics {
+
+	volatile LONG64 accepted; // Connections accepted, on all listeners
+
+	volatile LONG64 failed; // Failed calls to accept()
+
+	LONG64 peak_rate; // Highest number of connections accepted in one report interval. Changed by reporter only
+
+}ACCEPTSTATISTICS;
+
+typedef struct ratelimit {
+
+	LONG64 interval; // Time one post takes from the bucket, in QueryPerformanceCounter() ticks. 0 if not limited
+
+	LONG64 tolerance; // How far the bucket may run ahead of now: [burst - 1] intervals
+
+}RATELIMIT;
+
+typedef struct admissionstatistics {
+
+	volatile LONG connections; // Socket connections admitted and not finished yet
+
+	volatile LONG requests; // Requests being handled now
+
+	volatile LONG64 refused_connections; // Connections answered busy and closed at accept
+
+	volatile LONG64 refused_requests; // Requests answered busy without being handled
+
+	volatile LONG over_memory; // 1 while the server uses more memory than max_memory. Changed by reporter only
+
+	volatile LONG64 memory; // Private memory of the server at the last report, in bytes. Changed by reporter only
+
+}ADMISSIONSTATISTICS;
+
+typedef struct sessionstate {
+
+	TIMER timer; // Due at the nearest deadline of the session. Must be the first field: expired timers are mapped back from it
+
+	SOCKET socket; // The connected socket
+
+	ULONGLONG login_deadline; // When the session must be logged in, in GetTickCount64() milliseconds. 0 if logged in or not used
+
+	volatile LONG timeout; // The timeout the timer is set for. See TIMEOUT_ for some definitions
+
+}SESSIONSTATE;
+
 #pragma endregion
 
 #pragma region Function Declarations
@@ -73,8 +343,9 @@ ACCOUNTINFO* Append(ACCOUNTINFO* prev, ACCOUNTINFO* current);
 /// <param name="username">The name is assigned to "account" field</param>
 /// <param name="namelen">The length of usernam used to assign</param>
 /// <param name="status">The status is assigned to "status" field</param>
+/// <param name="rate_class">The class of POST limits. Out of range classes are taken as 0</param>
 /// <returns>An ACCCOUNTINFO node that use INVALID_SOCKET for "socket" field and NULL for "next" field.</returns>
-ACCOUNTINFO* CreateAccountInfo(const char* username, int namelen, int status);
+ACCOUNTINFO* CreateAccountInfo(const char* username, int namelen, int status, int rate_class = 0);
 
 /// <summary>
 /// Find first ACCOUNTINFO node that has "socket" field is equal to [socket] argument.
@@ -92,6 +363,26 @@ ACCOUNTINFO* FindFirstAccountInfo(ACCOUNTINFO* start, SOCKET socket);
 /// <returns>The first found node. NULL if have no node satisfies</returns>
 ACCOUNTINFO* FindFirstAccountInfo(ACCOUNTINFO* start, const char* username);
 
+/// <summary>
+/// Find the ACCOUNTINFO node holds a session token.
+/// </summary>
+/// <param name="start">The start node that searching begins</param>
+/// <param name="token">The session token. 0 never matches</param>
+/// <returns>The found node. NULL if have no node satisfies</returns>
+ACCOUNTINFO* FindAccountInfoByToken(ACCOUNTINFO* start, unsigned long long token);
+
+/// <summary>
+/// Enter critical_section, which guards Accounts. A wait for it is added to the stage timing of the request being handled,
+/// and the acquire is profiled if lock_profile is set.
+/// </summary>
+/// <param name="site">The call site. See LOCK_SITE_ for some definitions</param>
+void LockAccounts(int site);
+
+/// <summary>
+/// Leave critical_section, and Count its hold if lock_profile is set.
+/// </summary>
+void UnlockAccounts();
+
 /// <summary>
 /// Free memory use for ACCOUNINFO linked list.
 /// </summary>
@@ -105,6 +396,14 @@ void FreeAccountList(ACCOUNTINFO* first);
 /// <returns>1 if success. 0 if have some errors on file operations.</returns>
 int LoadAccountList(const char* file);
 
+/// <summary>
+/// Find the priority class of the first buffered request from its command, without consuming it. [SESSIONHANDLER classify]
+/// Login, logout and compression negotiation are session control. Posts are bulk. Other requests are reads.
+/// </summary>
+/// <param name="connection">The connection. Its read-ahead buffer holds at least a segment header</param>
+/// <returns>The class. See TASK_PRIORITY_ for some definitions</returns>
+int ClassifyRequest(CONNECTION* connection);
+
 /// <summary>
 /// Extract command and arguments from a request.
 /// </summary>
@@ -113,6 +412,29 @@ int LoadAccountList(const char* file);
 /// <returns>The command code. See C_ for some command codes and CM_ for some commands text</returns>
 int ExtractRequestCommand(const char* request, char** oarguments);
 
+/// <summary>
+/// Create the directory used to store articles, if not exist.
+/// </summary>
+/// <param name="directory">The directory path</param>
+/// <returns>1 if success. 0 otherwise</returns>
+int CreateArticleStorage(const char* directory);
+
+/// <summary>
+/// Create a new article file on storage. The first line is the account name
+/// </summary>
+/// <param name="directory">The article directory</param>
+/// <param name="account">The account posts the article</param>
+/// <param name="opath">[Output] The path to the created file. At least LINE_MAX_SIZE bytes</param>
+/// <returns>The opened file. NULL if fail to create</returns>
+FILE* OpenArticle(const char* directory, const char* account, char* opath);
+
+/// <summary>
+/// Close an article file.
+/// </summary>
+/// <param name="fp">The article file</param>
+/// <returns>1 if all bytes are written to storage. 0 otherwise</returns>
+int CloseArticle(FILE* fp);
+
 /// <summary>
 /// Bind a socket to an address [IPv4, Port]
 /// </summary>
@@ -121,6 +443,23 @@ int ExtractRequestCommand(const char* request, char** oarguments);
 /// <returns>1 is bind successfully. 0 otherwise</returns>
 int BindSocket(SOCKET socket, ADDRESS addr);
 
+/// <summary>
+/// Bind a socket to a Unix domain socket path. A stale socket file left at the path is removed first
+/// </summary>
+/// <param name="socket">The socket want to bind</param>
+/// <param name="addr">A Unix domain socket address</param>
+/// <returns>1 is bind successfully. 0 otherwise</returns>
+int BindSocket(SOCKET socket, LOCAL_ADDRESS addr);
+
+/// <summary>
+/// Bind a socket to an address of any family, Print the reason if fail
+/// </summary>
+/// <param name="socket">The socket want to bind</param>
+/// <param name="addr">The socket address</param>
+/// <param name="addr_len">Size of the socket address, in bytes</param>
+/// <returns>1 is bind successfully. 0 otherwise</returns>
+int BindSocket(SOCKET socket, const SOCKADDR* addr, int addr_len);
+
 /// <summary>
 /// Set listen state for a socket.
 /// </summary>
@@ -142,22 +481,246 @@ SOCKET GetConnectionSocket(SOCKET listener, ADDRESS* osender_address = NULL);
 /// Create and Begin new thread for communicating on a connected socket
 /// </summary>
 /// <param name="socket">The connected socket used for communicating</param>
-/// <returns>The thread handle</returns>
-HANDLE CreateThreadForConnection(SOCKET socket);
+/// <param name="accepted">When accept() returned the socket, in QueryPerformanceCounter() ticks</param>
+/// <returns>The thread handle. 0 if have errors: the connection is then refused and its socket closed</returns>
+HANDLE CreateThreadForConnection(SOCKET socket, LONG64 accepted);
+
+/// <summary>
+/// Create a Unix domain socket listening on [path] and Begin new thread for accepting connections on it.
+/// Accepted connections are served the same as TCP connections.
+/// </summary>
+/// <param name="path">The socket file path</param>
+/// <returns>The thread handle. 0 if have errors</returns>
+HANDLE CreateThreadForLocalListener(const char* path);
+
+/// <summary>
+/// Create a TCP listener on 127.0.0.1:[port] and Begin new thread serving the metrics on it. See RunMetricsListener().
+/// Only local scrapers reach it: the metrics are not for clients.
+/// </summary>
+/// <param name="port">The port number</param>
+/// <returns>The thread handle. 0 if have errors</returns>
+HANDLE CreateThreadForMetrics(int port);
+
+/// <summary>
+/// Accept connections on a listening socket and Create a thread for each.
+/// Several threads may run on the same socket: each connection is given to one of them.
+/// </summary>
+/// <param name="arguments">The listening socket. [Cast directly]</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall RunListener(void* arguments);
+
+/// <summary>
+/// Create a shared memory listener named [name] and Begin new thread for accepting sessions on it.
+/// </summary>
+/// <param name="name">The listener name</param>
+/// <returns>The thread handle. 0 if have errors</returns>
+HANDLE CreateThreadForSharedListener(const char* name);
+
+/// <summary>
+/// Accept shared memory sessions and Create a thread for each. [Call on another thread created by CreateThreadForSharedListener()]
+/// </summary>
+/// <param name="arguments">The shared memory listener. [Cast directly]</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall RunSharedListener(void* arguments);
+
+/// <summary>
+/// Communicate on a shared memory channel. [Call on another thread created by RunSharedListener()]
+/// </summary>
+/// <param name="arguments">The channel. [Cast directly]</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall RunSharedSession(void* arguments);
+
+/// <summary>
+/// Create a UDP socket bound to [address] and Begin new thread for receiving datagram posts on it.
+/// </summary>
+/// <param name="address">The address the TCP listener is bound to</param>
+/// <returns>The thread handle. 0 if have errors</returns>
+HANDLE CreateThreadForDatagrams(ADDRESS address);
+
+/// <summary>
+/// Receive and Handle datagram posts in batches. [Call on another thread created by CreateThreadForDatagrams()]
+/// </summary>
+/// <param name="arguments">The bound UDP socket. [Cast directly]</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall RunDatagramListener(void* arguments);
+
+/// <summary>
+/// Wait for datagrams and Read all datagrams the socket has, up to [capacity], without blocking.
+/// </summary>
+/// <param name="receiver">The non-blocking UDP socket</param>
+/// <param name="obatch">[Output] The datagrams read</param>
+/// <param name="capacity">Maximum number of datagrams to read</param>
+/// <param name="timeout">Maximum time to wait for the first datagram, in milliseconds</param>
+/// <returns>Number of datagrams read. -1 if the socket cant be used anymore</returns>
+int ReceiveDatagramBatch(SOCKET receiver, DATAGRAM* obatch, int capacity, int timeout);
+
+/// <summary>
+/// Extract token, sequence number and article from a datagram post. Format: [token in hexadecimal] [sequence] POST [article]
+/// </summary>
+/// <param name="datagram">The datagram</param>
+/// <param name="otoken">[Output] The session token</param>
+/// <param name="osequence">[Output] The sequence number. Start from 1, increase for each post</param>
+/// <param name="oarticle">[Output] The article. Point into the datagram</param>
+/// <returns>1 if success. 0 if the datagram is malformed</returns>
+int ParseDatagram(DATAGRAM* datagram, unsigned long long* otoken, unsigned long long* osequence, char** oarticle);
+
+/// <summary>
+/// Check a sequence number of datagram post for an account, without recording it. [Call inside critical section]
+/// </summary>
+/// <param name="acc">The account</param>
+/// <param name="sequence">The sequence number</param>
+/// <returns>1 if it would be accepted. 0 if duplicate. -1 if too old (older than UDP_SEQUENCE_WINDOW posts)</returns>
+int CheckSequence(const ACCOUNTINFO* acc, unsigned long long sequence);
+
+/// <summary>
+/// Record a sequence number of datagram post for an account. [Call inside critical section]
+/// </summary>
+/// <param name="acc">The account</param>
+/// <param name="sequence">The sequence number</param>
+/// <returns>1 if accepted. 0 if duplicate. -1 if too old (older than UDP_SEQUENCE_WINDOW posts)</returns>
+int AcceptSequence(ACCOUNTINFO* acc, unsigned long long sequence);
+
+/// <summary>
+/// Take one post from the token bucket of an account. Lock free: one compare-exchange, retried only if another post raced it.
+/// </summary>
+/// <param name="acc">The account</param>
+/// <returns>1 if the account may post. 0 if it is over its rate</returns>
+int TakePostToken(ACCOUNTINFO* acc);
+
+/// <summary>
+/// Convert the POST rates and bursts of Config to bucket intervals, for each rate class. [Call before accepting connections]
+/// </summary>
+void PreparePostLimits();
+
+/// <summary>
+/// Authenticate a batch of datagram posts under one lock and Store accepted articles.
+/// </summary>
+/// <param name="batch">The datagrams</param>
+/// <param name="count">Number of datagrams</param>
+void HandleDatagramBatch(DATAGRAM* batch, int count);
+
+/// <summary>
+/// Print counters of datagram posts: received, accepted and dropped by reason.
+/// </summary>
+void PrintDatagramStatistics();
+
+/// <summary>
+/// Begin new thread for reporting the connection accept rate.
+/// </summary>
+/// <returns>The thread handle. 0 if have errors</returns>
+HANDLE CreateThreadForAcceptReport();
+
+/// <summary>
+/// Print the accept rate every ACCEPT_REPORT_INTERVAL, while connections are being accepted, the connections and requests refused, while some are,
+/// and the peak depth of the scheduler queues per class, while requests queue.
+/// Sample the memory usage for admission control at the same interval. [Call on another thread created by CreateThreadForAcceptReport()]
+/// </summary>
+/// <param name="arguments">Unused</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall RunAcceptReport(void* arguments);
 
 /// <summary>
 /// Communicate on a connected socket. [Call on another thread created by CreateThreadForConnecion()]
 /// </summary>
-/// <param name="arguments">The connected socket. [Cast directly]</param>
+/// <param name="arguments">The connected socket. [ACCEPTEDSOCKET*, freed here]</param>
 /// <returns>0. [The thread is also terminated]</returns>
 unsigned __stdcall Run(void* arguments);
 
+/// <summary>
+/// Handle requests on a connection until it is closed or broken, then End the session.
+/// </summary>
+/// <param name="connection">The connection. Its socket field identifies the session</param>
+void ServeConnection(CONNECTION* connection);
+
+/// <summary>
+/// Decide whether an accepted connection is served. Refuse it if the server is at its connection or memory limit. [SESSIONHANDLER admit]
+/// An admitted connection is counted open until FinishConnection(), or until it fails to start.
+/// </summary>
+/// <param name="socket">The accepted socket</param>
+/// <returns>1 if admitted. 0 if refused: the busy response is sent, and the caller closes the socket</returns>
+int AdmitConnection(SOCKET socket);
+
+/// <summary>
+/// Count a refused connection and Send it the pre-encoded busy response. The socket is not closed.
+/// </summary>
+/// <param name="socket">The accepted socket. It has not received anything yet</param>
+void RefuseConnection(SOCKET socket);
+
+/// <summary>
+/// Count a request that starts being handled, unless the server is at its request or memory limit. Call FinishRequest() after an admitted request.
+/// </summary>
+/// <returns>1 if admitted. 0 if the request must be refused</returns>
+int AdmitRequest();
+
+/// <summary>
+/// Count a request that is handled. [After AdmitRequest() returned 1]
+/// </summary>
+void FinishRequest();
+
+/// <summary>
+/// Drain the rest of a refused request and Send the busy response instead of handling it. The connection stays open.
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <param name="remain">Number of bytes of the request after its first segment</param>
+/// <returns>1 if success. 0 if cant read or send fully. -1 if have errors that the socket should be closed</returns>
+int RejectRequest(CONNECTION* connection, int remain);
+
+/// <summary>
+/// Encode the busy response once: header and message, ready to be sent as is. [Call before accepting connections]
+/// </summary>
+void PrepareBusyResponse();
+
+/// <summary>
+/// Read the private memory of the server and Update whether it is over max_memory.
+/// </summary>
+void SampleMemoryUsage();
+
+/// <summary>
+/// Count a connection that is accepted, and Start its timeouts if the server has any.
+/// </summary>
+/// <param name="connection">The new connection</param>
+void StartConnection(CONNECTION* connection);
+
+/// <summary>
+/// Stop the timeouts of a closing connection, End its session and Print its statistics.
+/// </summary>
+/// <param name="connection">The closing connection. Its socket field identifies the session</param>
+void FinishConnection(CONNECTION* connection);
+
+/// <summary>
+/// Set the session timer of a connection for a timeout from now, or for the login deadline if that comes first.
+/// </summary>
+/// <param name="connection">The connection. Nothing is done if it has no session state</param>
+/// <param name="timeout">TIMEOUT_IDLE or TIMEOUT_READ. A timeout that is not used keeps the timer as is, except idle: it stops the timer</param>
+void ArmSessionTimer(CONNECTION* connection, int timeout);
+
+/// <summary>
+/// Close the connection of a session that timed out. [TIMERWHEEL expire]
+/// The socket is shut down and its pending I/O canceled, not closed: the thread or coroutine serving it sees the receive fail
+/// and ends the session through FinishConnection() as if the peer closed.
+/// </summary>
+/// <param name="timer">The timer of the session. [SESSIONSTATE*]</param>
+void ExpireSession(TIMER* timer);
+
 /// <summary>
 /// End session for a connected socket. [Log out the account working on that socket, if have any]
 /// </summary>
 /// <param name="socket">The connected socket</param>
 void EndSession(SOCKET socket);
 
+/// <summary>
+/// Log the number of requests and system calls made on a connection, and the running totals of the server.
+/// </summary>
+/// <param name="connection">The closed connection</param>
+void PrintConnectionStatistics(CONNECTION* connection);
+
+/// <summary>
+/// Write the waiting log records, and Print the lock profile if any, when the console is closed or Ctrl+C is pressed. [SetConsoleCtrlHandler() routine]
+/// </summary>
+/// <param name="event">The control event</param>
+/// <returns>FALSE: the next handler ends the process</returns>
+BOOL WINAPI HandleConsoleControl(DWORD event);
+
 /// <summary>
 /// Processing the post request
 /// </summary>
@@ -166,6 +729,31 @@ void EndSession(SOCKET socket);
 /// <returns>The response message for client</returns>
 MESSAGE HandlePostRequest(SOCKET socket, const char* arguments);
 
+/// <summary>
+/// Begin a post stream: Check the client is logged in and Open an article file on storage. [See STREAMHANDLER]
+/// </summary>
+/// <param name="socket">The connected socket identify the client</param>
+/// <param name="length">The article length, in bytes</param>
+/// <returns>The POSTSTREAM state. NULL if fail to allocate memory</returns>
+void* BeginPostStream(SOCKET socket, int length);
+
+/// <summary>
+/// Write a part of article to the article file. [See STREAMHANDLER]
+/// </summary>
+/// <param name="state">The POSTSTREAM state</param>
+/// <param name="bytes">The part of article</param>
+/// <param name="length">The length of the part</param>
+/// <returns>1 if written. 0 if the stream does not accept more bytes</returns>
+int WritePostStream(void* state, const char* bytes, int length);
+
+/// <summary>
+/// End a post stream: Close the article file and Free the state. [See STREAMHANDLER]
+/// </summary>
+/// <param name="state">The POSTSTREAM state</param>
+/// <param name="completed">0 if the request was not received fully</param>
+/// <returns>The response message for client. NULL if not [completed]</returns>
+MESSAGE EndPostStream(void* state, int completed);
+
 /// <summary>
 /// Processing the login request
 /// </summary>
@@ -181,13 +769,77 @@ MESSAGE HandleLoginRequest(SOCKET socket, const char* arguments);
 /// <returns>The response message for client</returns>
 MESSAGE HandleLogoutRequest(SOCKET socket);
 
+/// <summary>
+/// Processing the token request: Issue a new session token for datagram posts of the logged in account.
+/// The token is dropped when the account logs out.
+/// </summary>
+/// <param name="socket">The connected socket identify the client</param>
+/// <returns>The response message for client. The message text is the token in hexadecimal</returns>
+MESSAGE HandleTokenRequest(SOCKET socket);
+
+/// <summary>
+/// Processing the statistics request: Collect the metrics of all threads, for the administrator account only.
+/// </summary>
+/// <param name="socket">The connected socket identify the client</param>
+/// <returns>The response message for client. The message text is the metrics, one per line</returns>
+MESSAGE HandleStatsRequest(SOCKET socket);
+
+/// <summary>
+/// Processing the compression handshake. Compression is only accepted as the first request of a connection.
+/// </summary>
+/// <param name="connection">The connection to the remote process</param>
+/// <param name="arguments">The arguments for compression request [The algorithm name. See COMPRESSION_ALGORITHM]</param>
+/// <param name="oaccepted">[Output] 1 if compression should be enabled after the response is sent</param>
+/// <returns>The response message for client</returns>
+MESSAGE HandleCompressRequest(CONNECTION* connection, const char* arguments, int* oaccepted);
+
+/// <summary>
+/// Check whether a request is a [command] request large enough to be streamed. [See SERVERCONFIG.stream_threshold]
+/// </summary>
+/// <param name="segment">The first segment of the request</param>
+/// <param name="mlen">The first segment size, in bytes</param>
+/// <param name="remain">Number of bytes in request after the first segment</param>
+/// <param name="command">The command text. See CM_ for some command texts</param>
+/// <returns>1 if the request should be streamed. 0 otherwise</returns>
+int IsStreamRequest(const char* segment, int mlen, int remain, const char* command);
+
+/// <summary>
+/// Handle a large request segment by segment without merging: Pass each segment to the stream handler and Send response back.
+/// Memory use is bounded by a segment regardless of request size.
+/// </summary>
+/// <param name="connection">The connection to the remote process</param>
+/// <param name="handler">The stream handler for the request command</param>
+/// <param name="segment">The first segment of the request. [Freed by this function]</param>
+/// <param name="mlen">The first segment size, in bytes</param>
+/// <param name="remain">Number of bytes in request after the first segment</param>
+/// <returns>1 if have no errors. 0 if request cant be processed completely. 
+/// -1 if have errors and the socket cant be used anymore (lost connection to remote process)</returns>
+int HandleStreamRequest(CONNECTION* connection, const STREAMHANDLER* handler, char* segment, int mlen, int remain);
+
+/// <summary>
+/// Stream a large post on the completion engine: Pass its buffered segments to the stream handler as they arrive, and Send the response
+/// after the last one. Start the stream if the first buffered segment begins a post at least stream_threshold long. [SESSIONHANDLER stream]
+/// A compressed first segment is taken for a post, as ClassifyRequest() does: a request of another command that large is answered busy.
+/// </summary>
+/// <param name="connection">The connection. Segments not buffered whole are left in its read-ahead buffer</param>
+/// <returns>1 while the stream goes on. 0 if no request is streamed [anymore]. -1 if the connection should be closed</returns>
+int StreamRequest(CONNECTION* connection);
+
+/// <summary>
+/// End the request a connection streams: End the stream handler, Send the response if the request is complete, and Free the stream.
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <param name="completed">1 if all segments were taken. 0 if the connection is closing</param>
+/// <returns>1 if have no errors. 0 or -1 if the response could not be sent. [See SegmentationSend()]</returns>
+int FinishStreamRequest(CONNECTION* connection, int completed);
+
 /// <summary>
 /// Handle request: Read requests from buffer, Processing requests and Send response back.
 /// </summary>
-/// <param name="socket">The connected socket to the remote process</param>
+/// <param name="connection">The connection to the remote process</param>
 /// <returns>1 if have no errors. 0 if request cant be processed completely. 
 /// -1 if have errors and the socket cant be used anymore (lost connection to remote process)</returns>
-int HandleRequest(SOCKET socket);
+int HandleRequest(CONNECTION* connection);
 
 /// <summary>
 /// Extract port number from command-line arguments.
@@ -199,6 +851,25 @@ int HandleRequest(SOCKET socket);
 /// <returns>1 if extract successfully. 0 otherwise</returns>
 int ExtractCommand(int argc, char* argv[], int* oport);
 
+/// <summary>
+/// Extract server options from command-line arguments. Each option follows the port number and has form: name=value.
+/// Options not specified keep their current values.
+/// </summary>
+/// <param name="argc">Number of Arguments [From main()]</param>
+/// <param name="argv">Arguments value [From main()]</param>
+/// <param name="oconfig">[Output] The server configuration</param>
+/// <returns>1 if all options are recognized. 0 otherwise</returns>
+int ExtractOptions(int argc, char* argv[], SERVERCONFIG* oconfig);
+
+/// <summary>
+/// Extract comma separated integers into an array. The last value fills the entries after it.
+/// </summary>
+/// <param name="text">The values. Example: 10,100</param>
+/// <param name="ovalues">[Output] The values</param>
+/// <param name="capacity">Number of entries of ovalues</param>
+/// <returns>Number of values given in text. [Not counting the filled entries]</returns>
+int ExtractIntegerList(const char* text, int* ovalues, int capacity);
+
 /// <summary>
 /// Create a INADDR_ANY IP Address
 /// </summary>
@@ -214,6 +885,13 @@ IP CreateDefaultIP();
 /// <returns>A command message. NULL if memory allocation fail</returns>
 MESSAGE CreateMessage(int status, const char* message);
 
+/// <summary>
+/// Get the status code of a Message object.
+/// </summary>
+/// <param name="m">The message</param>
+/// <returns>The status code. See S_ for some status code. 0 if the message is NULL</returns>
+int GetMessageStatus(MESSAGE m);
+
 /// <summary>
 /// Free memory for Message object
 /// </summary>
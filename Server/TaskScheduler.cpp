@@ -0,0 +1,188 @@
+#include "TaskScheduler.h"
+
+TASKSCHEDULER* CreateTaskScheduler(int workers, const NUMANODE* nodes, int node_count)
+{
+	if (workers <= 0 && node_count > 0) {
+		workers = 0;
+		for (int i = 0; i < node_count; ++i)
+			workers += nodes[i].processors;
+	}
+	else if (workers <= 0) {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		workers = (int)info.dwNumberOfProcessors;
+	}
+	TASKSCHEDULER* scheduler = (TASKSCHEDULER*)calloc(1, sizeof(TASKSCHEDULER));
+	TASKQUEUE* queues = (TASKQUEUE*)calloc(workers * TASK_PRIORITY_COUNT, sizeof(TASKQUEUE));
+	if (scheduler == NULL || queues == NULL) {
+		free(scheduler);
+		free(queues);
+		return NULL;
+	}
+	scheduler->queues = queues;
+	scheduler->workers = workers;
+	scheduler->node_count = min(node_count, workers);
+	scheduler->next = 0;
+	scheduler->pending = 0;
+	scheduler->idle = 0;
+	InitializeCriticalSection(&scheduler->sleep_lock);
+	InitializeConditionVariable(&scheduler->wake);
+	for (int i = 0; i < workers * TASK_PRIORITY_COUNT; ++i) {
+		InitializeCriticalSection(&queues[i].lock);
+		queues[i].tasks = NULL;
+		queues[i].capacity = 0;
+		queues[i].head = 0;
+		queues[i].tail = 0;
+	}
+
+	int started = 0;
+	for (int i = 0; i < workers; ++i) {
+		TASKWORKER* worker = (TASKWORKER*)malloc(sizeof(TASKWORKER));
+		if (worker == NULL)
+			continue;
+		worker->scheduler = scheduler;
+		worker->index = i;
+		worker->turns = 0;
+		const NUMANODE* node = scheduler->node_count > 0 ? &nodes[i % scheduler->node_count] : NULL;
+		if (BeginPlacedThread(RunTaskWorker, (void*)worker, node, -1) == 0)
+			free(worker);
+		else
+			++started;
+	}
+	// a queue without its worker is still drained by stealing
+	return started > 0 ? scheduler : NULL;
+}
+
+int SubmitTask(TASKSCHEDULER* scheduler, TASK task, int node)
+{
+	unsigned long next = (unsigned long)InterlockedIncrement(&scheduler->next);
+	int index;
+	if (node >= 0 && node < scheduler->node_count) {
+		// the workers of the node are node, node + node_count, ...
+		int workers = (scheduler->workers - node + scheduler->node_count - 1) / scheduler->node_count;
+		index = node + (int)(next % (unsigned long)workers) * scheduler->node_count;
+	}
+	else {
+		index = (int)(next % (unsigned long)scheduler->workers);
+	}
+	if (!PushTask(&scheduler->queues[index * TASK_PRIORITY_COUNT + task.priority], task))
+		return 0;
+	LONG depth = InterlockedIncrement(&scheduler->depth[task.priority]);
+	LONG peak = scheduler->peak_depth[task.priority];
+	while (depth > peak) {
+		LONG seen = InterlockedCompareExchange(&scheduler->peak_depth[task.priority], depth, peak);
+		if (seen == peak)
+			break;
+		peak = seen;
+	}
+	// a worker counts itself idle before it checks pending, so one of the two sides sees the other
+	InterlockedIncrement(&scheduler->pending);
+	if (InterlockedCompareExchange(&scheduler->idle, 0, 0) > 0) {
+		EnterCriticalSection(&scheduler->sleep_lock);
+		WakeConditionVariable(&scheduler->wake);
+		LeaveCriticalSection(&scheduler->sleep_lock);
+	}
+	return 1;
+}
+
+unsigned __stdcall RunTaskWorker(void* arguments)
+{
+	TASKWORKER* worker = (TASKWORKER*)arguments;
+	TASKSCHEDULER* scheduler = worker->scheduler;
+	TASK task;
+	while (1) {
+		if (FindTask(scheduler, worker, &task)) {
+			InterlockedDecrement(&scheduler->pending);
+			task.run(task.context, task.argument);
+			continue;
+		}
+		EnterCriticalSection(&scheduler->sleep_lock);
+		InterlockedIncrement(&scheduler->idle);
+		while (InterlockedCompareExchange(&scheduler->pending, 0, 0) <= 0)
+			SleepConditionVariableCS(&scheduler->wake, &scheduler->sleep_lock, INFINITE);
+		InterlockedDecrement(&scheduler->idle);
+		LeaveCriticalSection(&scheduler->sleep_lock);
+	}
+	free(worker);
+	return 0;
+}
+
+int FindTask(TASKSCHEDULER* scheduler, TASKWORKER* worker, TASK* otask)
+{
+	int first = 0;
+	unsigned int turn = worker->turns++;
+	if (turn % TASK_FAIR_SHARE == TASK_FAIR_SHARE - 1) {
+		// fair turn: the classes below the highest take turns going first
+		first = 1 + (int)(turn / TASK_FAIR_SHARE % (TASK_PRIORITY_COUNT - 1));
+	}
+	for (int i = 0; i < TASK_PRIORITY_COUNT; ++i) {
+		int priority = (first + i) % TASK_PRIORITY_COUNT;
+		if (FindTaskOfClass(scheduler, worker->index, priority, otask)) {
+			InterlockedDecrement(&scheduler->depth[priority]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int FindTaskOfClass(TASKSCHEDULER* scheduler, int index, int priority, TASK* otask)
+{
+	if (TakeTask(&scheduler->queues[index * TASK_PRIORITY_COUNT + priority], otask))
+		return 1;
+	// workers [node_count] apart are on the same node: steal their tasks first, memory of the tasks is local
+	int stride = max(scheduler->node_count, 1);
+	for (int is_local = 1; is_local >= 0; --is_local) {
+		for (int i = 1; i < scheduler->workers; ++i) {
+			if ((i % stride == 0) == (is_local == 1)
+				&& TakeTask(&scheduler->queues[(index + i) % scheduler->workers * TASK_PRIORITY_COUNT + priority], otask))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+LONG TakePeakDepth(TASKSCHEDULER* scheduler, int priority)
+{
+	return InterlockedExchange(&scheduler->peak_depth[priority], scheduler->depth[priority]);
+}
+
+int PushTask(TASKQUEUE* queue, TASK task)
+{
+	EnterCriticalSection(&queue->lock);
+	if (queue->tail - queue->head == queue->capacity) {
+		int capacity = queue->capacity > 0 ? queue->capacity * 2 : TASK_QUEUE_INITIAL_SIZE;
+		TASK* tasks = (TASK*)malloc(sizeof(TASK) * capacity);
+		if (tasks == NULL) {
+			LeaveCriticalSection(&queue->lock);
+			return 0;
+		}
+		// move the tasks to the front of the new storage
+		for (long long i = queue->head; i < queue->tail; ++i)
+			tasks[i - queue->head] = queue->tasks[i % queue->capacity];
+		free(queue->tasks);
+		queue->tasks = tasks;
+		queue->tail -= queue->head;
+		queue->head = 0;
+		queue->capacity = capacity;
+	}
+	queue->tasks[queue->tail % queue->capacity] = task;
+	queue->tail++;
+	LeaveCriticalSection(&queue->lock);
+	return 1;
+}
+
+int TakeTask(TASKQUEUE* queue, TASK* otask)
+{
+	// skip the lock of an empty queue: a task added meanwhile is found on the next search
+	if (queue->head == queue->tail)
+		return 0;
+	int is_taken = 0;
+	EnterCriticalSection(&queue->lock);
+	if (queue->head < queue->tail) {
+		*otask = queue->tasks[queue->head % queue->capacity];
+		queue->head++;
+		is_taken = 1;
+	}
+	LeaveCriticalSection(&queue->lock);
+	return is_taken;
+}
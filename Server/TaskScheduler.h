@@ -0,0 +1,167 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <process.h>
+#include <WinSock2.h>
+
+#include "Placement.h"
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define TASK_QUEUE_INITIAL_SIZE 256 // Initial number of tasks a queue holds. Grown when full
+
+#define TASK_PRIORITY_CONTROL 0 // Highest class. Tasks of a class run before tasks of the classes after it
+#define TASK_PRIORITY_READ 1
+#define TASK_PRIORITY_BULK 2
+#define TASK_PRIORITY_COUNT 3
+#define TASK_FAIR_SHARE 8 // Every TASK_FAIR_SHARE-th task a worker takes is searched from a lower class first: no class starves
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef struct task {
+
+	void (*run)(void* context, void* argument); // The work
+
+	void* context; // First argument of run
+
+	void* argument; // Second argument of run
+
+	int priority; // Class of the task. See TASK_PRIORITY_ for some definitions
+
+}TASK;
+
+typedef struct taskqueue {
+
+	CRITICAL_SECTION lock; // Guards the fields below. Taken by the owner and by thieves
+
+	TASK* tasks; // Ring storage. Task i is at tasks[i % capacity]
+
+	int capacity; // Size of tasks, in tasks
+
+	long long head; // Index of the oldest task. Tasks are taken from here
+
+	long long tail; // Index after the newest task. Tasks are added here
+
+	char padding[64]; // Keep queues of different workers on separate cache lines
+
+}TASKQUEUE;
+
+typedef struct taskscheduler {
+
+	TASKQUEUE* queues; // One queue per worker and class. The queue of worker w for class p is at [w * TASK_PRIORITY_COUNT + p]
+
+	int workers; // Number of worker threads
+
+	int node_count; // Number of nodes the workers are placed on. Worker w is on node [w % node_count]. 0 if not placed
+
+	volatile LONG next; // Queue the next submitted task goes to, round robin
+
+	volatile LONG pending; // Tasks submitted and not taken yet, on all queues
+
+	volatile LONG idle; // Workers going to sleep or sleeping
+
+	CRITICAL_SECTION sleep_lock; // Guards sleeping on wake
+
+	CONDITION_VARIABLE wake; // Signaled when a task is submitted and a worker is idle
+
+	volatile LONG depth[TASK_PRIORITY_COUNT]; // Tasks queued now, per class
+
+	volatile LONG peak_depth[TASK_PRIORITY_COUNT]; // Highest depth per class since the last TakePeakDepth()
+
+}TASKSCHEDULER;
+
+typedef struct taskworker {
+
+	TASKSCHEDULER* scheduler; // The scheduler
+
+	int index; // Index of the worker. It owns one queue per class
+
+	unsigned int turns; // Number of tasks taken. Every TASK_FAIR_SHARE-th is a fair turn
+
+}TASKWORKER;
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Create a scheduler and Begin its worker threads.
+/// </summary>
+/// <param name="workers">Number of worker threads. 0 for one per processor</param>
+/// <param name="nodes">The NUMA nodes to spread the workers over, each pinned to its node. NULL if not placed</param>
+/// <param name="node_count">Number of nodes</param>
+/// <returns>The scheduler. NULL if have errors</returns>
+TASKSCHEDULER* CreateTaskScheduler(int workers, const NUMANODE* nodes = NULL, int node_count = 0);
+
+/// <summary>
+/// Queue a task on the queue of the next worker for its class, and Wake an idle worker to take it.
+/// Tasks of one submitter run in any order and on any worker: order dependent tasks by submitting the next one from the previous.
+/// </summary>
+/// <param name="scheduler">The scheduler</param>
+/// <param name="task">The task</param>
+/// <param name="node">Index of the node whose workers should run the task. -1 for any worker</param>
+/// <returns>1 if queued. 0 if fail to allocate memory</returns>
+int SubmitTask(TASKSCHEDULER* scheduler, TASK task, int node = -1);
+
+/// <summary>
+/// Run tasks from the own queue. Steal from another worker when it is empty, and Sleep when all are.
+/// [Call on threads created by CreateTaskScheduler()]
+/// </summary>
+/// <param name="arguments">The worker. [TASKWORKER*]</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall RunTaskWorker(void* arguments);
+
+/// <summary>
+/// Take a task for a worker, from the highest class that has one: from its own queue, or else steal one from the others.
+/// On a fair turn the search starts from a lower class instead, the read and bulk classes in rotation, and wraps around.
+/// </summary>
+/// <param name="scheduler">The scheduler</param>
+/// <param name="worker">The worker</param>
+/// <param name="otask">[Output] The task</param>
+/// <returns>1 if a task is taken. 0 if all queues are empty</returns>
+int FindTask(TASKSCHEDULER* scheduler, TASKWORKER* worker, TASK* otask);
+
+/// <summary>
+/// Take a task of one class: from the own queue of a worker, or else steal one from the others, on the same node first.
+/// </summary>
+/// <param name="scheduler">The scheduler</param>
+/// <param name="index">Index of the worker</param>
+/// <param name="priority">The class</param>
+/// <param name="otask">[Output] The task</param>
+/// <returns>1 if a task is taken. 0 if the queues of the class are empty</returns>
+int FindTaskOfClass(TASKSCHEDULER* scheduler, int index, int priority, TASK* otask);
+
+/// <summary>
+/// Get the highest queue depth of a class since the last call, and Start the next period from the current depth.
+/// </summary>
+/// <param name="scheduler">The scheduler</param>
+/// <param name="priority">The class</param>
+/// <returns>The peak depth</returns>
+LONG TakePeakDepth(TASKSCHEDULER* scheduler, int priority);
+
+/// <summary>
+/// Add a task at the tail of a queue. Grow the queue if it is full.
+/// </summary>
+/// <param name="queue">The queue</param>
+/// <param name="task">The task</param>
+/// <returns>1 if added. 0 if fail to allocate memory</returns>
+int PushTask(TASKQUEUE* queue, TASK task);
+
+/// <summary>
+/// Take the oldest task from the head of a queue. Used by the owner and by thieves alike:
+/// tasks come from I/O threads, so running the newest first would only starve the oldest.
+/// </summary>
+/// <param name="queue">The queue</param>
+/// <param name="otask">[Output] The task</param>
+/// <returns>1 if a task is taken. 0 if the queue is empty</returns>
+int TakeTask(TASKQUEUE* queue, TASK* otask);
+
+#pragma endregion
@@ -0,0 +1,125 @@
+#include "TimerWheel.h"
+
+TIMERWHEEL* CreateTimerWheel(void (*expire)(TIMER* timer))
+{
+	TIMERWHEEL* wheel = (TIMERWHEEL*)calloc(1, sizeof(TIMERWHEEL));
+	if (wheel == NULL)
+		return NULL;
+	InitializeCriticalSection(&wheel->lock);
+	wheel->current = GetTickCount64() / TIMER_WHEEL_TICK;
+	wheel->expire = expire;
+	if (_beginthreadex(NULL, 0, RunTimerWheel, (void*)wheel, 0, 0) == 0) {
+		DeleteCriticalSection(&wheel->lock);
+		free(wheel);
+		return NULL;
+	}
+	return wheel;
+}
+
+void InitializeTimer(TIMER* timer)
+{
+	timer->next = NULL;
+	timer->pprev = NULL;
+	timer->deadline = 0;
+	timer->expires = 0;
+	timer->period = 0;
+}
+
+void SetTimerDeadline(TIMERWHEEL* wheel, TIMER* timer, ULONGLONG deadline)
+{
+	InterlockedExchange64(&timer->deadline, (LONG64)deadline);
+	// read unlocked: if the wheel is moving the timer meanwhile, it sees the new deadline [and drops it if 0]
+	if (deadline == 0 || (timer->pprev != NULL && deadline >= timer->expires * TIMER_WHEEL_TICK))
+		return;
+	EnterCriticalSection(&wheel->lock);
+	UnlinkTimer(timer);
+	LinkTimer(wheel, timer);
+	LeaveCriticalSection(&wheel->lock);
+}
+
+void StopTimer(TIMERWHEEL* wheel, TIMER* timer)
+{
+	EnterCriticalSection(&wheel->lock);
+	UnlinkTimer(timer);
+	LeaveCriticalSection(&wheel->lock);
+}
+
+unsigned __stdcall RunTimerWheel(void* arguments)
+{
+	TIMERWHEEL* wheel = (TIMERWHEEL*)arguments;
+	while (1) {
+		Sleep(TIMER_WHEEL_TICK);
+		unsigned long long now = GetTickCount64() / TIMER_WHEEL_TICK;
+		EnterCriticalSection(&wheel->lock);
+		// catch up on ticks missed while the thread was not scheduled
+		while (wheel->current <= now)
+			AdvanceTimerWheel(wheel);
+		LeaveCriticalSection(&wheel->lock);
+	}
+	return 0;
+}
+
+void AdvanceTimerWheel(TIMERWHEEL* wheel)
+{
+	unsigned long long tick = wheel->current;
+	TIMER* timer;
+	// higher levels first: their timers may land in a lower level slot reached at the same tick
+	for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; --level) {
+		int shift = TIMER_WHEEL_BITS * level;
+		if ((tick & ((1ULL << shift) - 1)) != 0)
+			continue;
+		TIMER** slot = &wheel->slots[level][(tick >> shift) & (TIMER_WHEEL_SLOTS - 1)];
+		while ((timer = *slot) != NULL) {
+			UnlinkTimer(timer);
+			LinkTimer(wheel, timer);
+		}
+	}
+
+	TIMER** slot = &wheel->slots[0][tick & (TIMER_WHEEL_SLOTS - 1)];
+	while ((timer = *slot) != NULL) {
+		UnlinkTimer(timer);
+		unsigned long long deadline = (unsigned long long)timer->deadline;
+		if (deadline > tick * TIMER_WHEEL_TICK) {
+			LinkTimer(wheel, timer); // moved on by SetTimerDeadline() since it was queued
+		}
+		else if (deadline != 0) { // 0: stopped by SetTimerDeadline() since it was queued, dropped
+			wheel->expire(timer);
+		}
+	}
+	wheel->current = tick + 1;
+}
+
+void LinkTimer(TIMERWHEEL* wheel, TIMER* timer)
+{
+	unsigned long long expires = ((unsigned long long)timer->deadline + TIMER_WHEEL_TICK - 1) / TIMER_WHEEL_TICK;
+	if (expires < wheel->current)
+		expires = wheel->current;
+	if (expires - wheel->current >= TIMER_WHEEL_RANGE)
+		expires = wheel->current + TIMER_WHEEL_RANGE - 1;
+	// looked at again within the period: a deadline set earlier by up to the period is then written down without the lock
+	if (timer->period > 0 && expires - wheel->current > max(timer->period / TIMER_WHEEL_TICK, 1))
+		expires = wheel->current + max(timer->period / TIMER_WHEEL_TICK, 1);
+
+	int level = 0;
+	while (level < TIMER_WHEEL_LEVELS - 1 && expires - wheel->current >= (1ULL << (TIMER_WHEEL_BITS * (level + 1))))
+		++level;
+	TIMER** slot = &wheel->slots[level][(expires >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+
+	timer->expires = expires;
+	timer->next = *slot;
+	if (timer->next != NULL)
+		timer->next->pprev = &timer->next;
+	timer->pprev = slot;
+	*slot = timer;
+}
+
+void UnlinkTimer(TIMER* timer)
+{
+	if (timer->pprev == NULL)
+		return;
+	*timer->pprev = timer->next;
+	if (timer->next != NULL)
+		timer->next->pprev = timer->pprev;
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
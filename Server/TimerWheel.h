@@ -0,0 +1,114 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <process.h>
+#include <WinSock2.h>
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define TIMER_WHEEL_TICK 100 // Resolution of the wheel, in milliseconds
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS) // Slots per level
+#define TIMER_WHEEL_LEVELS 4 // Level i holds timers due in [64^i, 64^(i+1)) ticks. About 19 days for 4 levels at 100 ms
+#define TIMER_WHEEL_RANGE (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) // Number of ticks the wheel covers. Later timers are queued at the end and moved on when reached
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef struct timer {
+
+	struct timer* next; // Next timer in the same slot. Linked List
+
+	struct timer** pprev; // The pointer to this timer in the slot. NULL if not queued
+
+	volatile LONG64 deadline; // When the timer is due, in GetTickCount64() milliseconds. Changed without the wheel lock
+
+	unsigned long long expires; // The tick of the slot the timer is queued in. May be earlier than deadline, never later
+
+	unsigned long long period; // Longest a timer is queued before the wheel looks at it again, in milliseconds. 0 if only at its deadline
+
+}TIMER;
+
+typedef struct timerwheel {
+
+	CRITICAL_SECTION lock; // Guards the slots and the queue links of all timers
+
+	TIMER* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; // Queued timers, by level and slot
+
+	unsigned long long current; // The next tick to process
+
+	void (*expire)(TIMER* timer); // Called for each due timer, with the lock held: it must not call the timer functions
+
+}TIMERWHEEL;
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Create a timer wheel and Begin its thread.
+/// Timers are embedded in the state of their owner: the wheel allocates nothing per timer.
+/// </summary>
+/// <param name="expire">Called on the thread of the wheel for each due timer. The timer is no longer queued</param>
+/// <returns>The wheel. NULL if have errors</returns>
+TIMERWHEEL* CreateTimerWheel(void (*expire)(TIMER* timer));
+
+/// <summary>
+/// Initialize a timer. It is not queued until it has a deadline.
+/// </summary>
+/// <param name="timer">The timer</param>
+void InitializeTimer(TIMER* timer);
+
+/// <summary>
+/// Queue a timer, or Change the deadline of a queued one. O(1).
+/// A later deadline only is written down, without the lock: the timer is moved on when its old slot is reached.
+/// So is deadline 0 [the timer is dropped when its slot is reached]: an unqueued timer is not locked for to be stopped.
+/// </summary>
+/// <param name="wheel">The wheel</param>
+/// <param name="timer">The timer</param>
+/// <param name="deadline">When the timer is due, in GetTickCount64() milliseconds. 0 to stop it, except that it may still expire if it is due meanwhile</param>
+void SetTimerDeadline(TIMERWHEEL* wheel, TIMER* timer, ULONGLONG deadline);
+
+/// <summary>
+/// Remove a timer from the wheel. Once it returns, the timer does not expire and can be freed. O(1).
+/// Always takes the lock, even for an unqueued timer: the wheel may be expiring it.
+/// </summary>
+/// <param name="wheel">The wheel</param>
+/// <param name="timer">The timer</param>
+void StopTimer(TIMERWHEEL* wheel, TIMER* timer);
+
+/// <summary>
+/// Process the ticks passed at each TIMER_WHEEL_TICK: Expire due timers. [Call on another thread created by CreateTimerWheel()]
+/// </summary>
+/// <param name="arguments">The wheel. [Cast directly]</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall RunTimerWheel(void* arguments);
+
+/// <summary>
+/// Process one tick: Move the timers of each higher level slot reached to lower levels, then Expire the timers of the lowest level slot.
+/// [Call with the lock held]
+/// </summary>
+/// <param name="wheel">The wheel</param>
+void AdvanceTimerWheel(TIMERWHEEL* wheel);
+
+/// <summary>
+/// Queue a timer in the slot of its deadline. [Call with the lock held]
+/// </summary>
+/// <param name="wheel">The wheel</param>
+/// <param name="timer">The timer. Must not be queued</param>
+void LinkTimer(TIMERWHEEL* wheel, TIMER* timer);
+
+/// <summary>
+/// Remove a timer from its slot, if it is queued. [Call with the lock held]
+/// </summary>
+/// <param name="timer">The timer</param>
+void UnlinkTimer(TIMER* timer);
+
+#pragma endregion
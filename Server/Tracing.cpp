@@ -0,0 +1,183 @@
+#include "Tracing.h"
+
+TRACEREQUEST* TraceBuffer = NULL; // The traced requests, at index % TRACE_BUFFER_SIZE. NULL if tracing is not enabled
+LONG64 TraceCount = 0; // Number of requests put in the trace buffer. Guarded by TraceLock
+CRITICAL_SECTION TraceLock; // Taken to put a traced request in the buffer, and to write the buffer out
+int TraceSample = 0; // One request in TraceSample is traced
+LONG64 TraceFrequency = 0; // Ticks of the clock per second
+LONG64 TraceEpoch = 0; // Time stamps are written from here, in ticks
+volatile LONG64 NextRequestId = 0; // ID of the last request received
+const char* TraceSpanNames[TRACE_KIND_COUNT] = { "accept", "receive segment", "parse", "lock wait", "handler", "send segment" };
+const METRICSPAGE TracePage = { TRACE_PATH, TRACE_HTTP_OK, FormatTrace };
+
+__declspec(thread) TRACEREQUEST CurrentTrace; // The request the calling thread traces. id is 0 if none
+__declspec(thread) LONG64 PendingSegmentStart = 0; // The last segment received while no request was traced
+__declspec(thread) LONG64 PendingSegmentEnd = 0;
+__declspec(thread) LONG64 TraceAccepted = 0; // When the connection of the calling thread was accepted. 0 once traced or dropped
+__declspec(thread) LONG64 TraceReady = 0; // When the calling thread was ready to serve the connection
+
+int EnableTracing(int sample)
+{
+	TraceBuffer = (TRACEREQUEST*)calloc(TRACE_BUFFER_SIZE, sizeof(TRACEREQUEST));
+	if (TraceBuffer == NULL)
+		return 0;
+	InitializeCriticalSection(&TraceLock);
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	TraceFrequency = frequency.QuadPart;
+	TraceEpoch = ReadMetricsClock();
+	TraceSample = sample > 0 ? sample : 1;
+	AddMetricsPage(&TracePage);
+	return 1;
+}
+
+LONG64 BeginTrace()
+{
+	if (TraceBuffer == NULL)
+		return 0;
+	LONG64 id = InterlockedIncrement64(&NextRequestId);
+	// the accept belongs to the first request of the connection only, sampled or not
+	LONG64 accepted = TraceAccepted;
+	TraceAccepted = 0;
+	if (id % TraceSample != 0)
+		return id;
+
+	TRACEREQUEST* trace = &CurrentTrace;
+	trace->id = id;
+	trace->command = 0;
+	trace->status = -1;
+	trace->thread = GetCurrentThreadId();
+	trace->received = 0;
+	trace->sent = 0;
+	trace->count = 0;
+	trace->dropped = 0;
+	trace->start = PendingSegmentStart;
+	trace->end = 0;
+	if (accepted != 0)
+		TraceSpan(TRACE_ACCEPT, 0, accepted, TraceReady);
+	// the first segment came before the request was known
+	TraceSpan(TRACE_RECEIVE, ++trace->received, PendingSegmentStart, PendingSegmentEnd);
+	return id;
+}
+
+int IsRequestTraced()
+{
+	return CurrentTrace.id != 0;
+}
+
+void TraceSpan(int kind, int detail, LONG64 start, LONG64 end)
+{
+	TRACEREQUEST* trace = &CurrentTrace;
+	if (trace->id == 0)
+		return;
+	if (trace->count >= TRACE_SPAN_MAX) {
+		trace->dropped++;
+		return;
+	}
+	TRACESPAN* span = &trace->spans[trace->count++];
+	span->kind = kind;
+	span->detail = detail;
+	span->start = start;
+	span->end = end;
+}
+
+void TraceSegment(int kind, LONG64 start)
+{
+	LONG64 end = ReadMetricsClock();
+	TRACEREQUEST* trace = &CurrentTrace;
+	if (trace->id != 0)
+		TraceSpan(kind, kind == TRACE_SEND ? ++trace->sent : ++trace->received, start, end);
+	else if (kind == TRACE_RECEIVE) {
+		PendingSegmentStart = start;
+		PendingSegmentEnd = end;
+	}
+}
+
+void TraceAccept(LONG64 accepted)
+{
+	if (TraceBuffer == NULL)
+		return;
+	TraceAccepted = accepted;
+	TraceReady = ReadMetricsClock();
+}
+
+void EndTrace(int command, int status)
+{
+	TRACEREQUEST* trace = &CurrentTrace;
+	if (trace->id == 0)
+		return;
+	trace->command = command;
+	trace->status = status;
+	trace->end = ReadMetricsClock();
+	// only the spans kept are copied: sampled requests hold the lock briefly
+	EnterCriticalSection(&TraceLock);
+	TRACEREQUEST* slot = &TraceBuffer[TraceCount % TRACE_BUFFER_SIZE];
+	memcpy(slot, trace, offsetof(TRACEREQUEST, spans) + trace->count * sizeof(TRACESPAN));
+	TraceCount++;
+	LeaveCriticalSection(&TraceLock);
+	trace->id = 0;
+}
+
+int FormatTrace(char** obody)
+{
+	*obody = NULL;
+	if (TraceBuffer == NULL)
+		return -1;
+	TRACEREQUEST* requests = (TRACEREQUEST*)malloc(TRACE_BUFFER_SIZE * sizeof(TRACEREQUEST));
+	if (requests == NULL)
+		return -1;
+
+	// only the copy is made under the lock: sampled requests wait for a memcpy(), not for the formatting
+	EnterCriticalSection(&TraceLock);
+	LONG64 first = TraceCount > TRACE_BUFFER_SIZE ? TraceCount - TRACE_BUFFER_SIZE : 0;
+	int count = (int)(TraceCount - first);
+	for (int i = 0; i < count; i++) {
+		const TRACEREQUEST* request = &TraceBuffer[(first + i) % TRACE_BUFFER_SIZE];
+		memcpy(&requests[i], request, offsetof(TRACEREQUEST, spans) + request->count * sizeof(TRACESPAN));
+	}
+	LeaveCriticalSection(&TraceLock);
+
+	size_t size = 2 * TRACE_EVENT_MAX_SIZE;
+	for (int i = 0; i < count; i++)
+		size += (size_t)(requests[i].count + 1) * TRACE_EVENT_MAX_SIZE;
+	char* body = (char*)malloc(size);
+	if (body == NULL) {
+		free(requests);
+		return -1;
+	}
+	// the process name goes first: every event after it starts with a comma
+	int length = snprintf(body, size, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+		"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Server\"}}");
+	for (int i = 0; i < count; i++)
+		length += FormatTraceRequest(&requests[i], body + length, (int)(size - length));
+	length += snprintf(body + length, size - length, "\n]}\n");
+	free(requests);
+	*obody = body;
+	return length;
+}
+
+int FormatTraceRequest(const TRACEREQUEST* request, char* obuffer, int size)
+{
+	// time stamps and durations are in microseconds
+	double scale = 1000000.0 / TraceFrequency;
+	int length = snprintf(obuffer, size,
+		",\n{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%lu,"
+		"\"args\":{\"request\":%lld,\"status\":%d,\"segments received\":%d,\"segments sent\":%d,\"spans dropped\":%d}}",
+		GetCommandName(request->command), (request->start - TraceEpoch) * scale, (request->end - request->start) * scale,
+		(unsigned long)request->thread, request->id, request->status, request->received, request->sent, request->dropped);
+
+	for (int i = 0; i < request->count; i++) {
+		const TRACESPAN* span = &request->spans[i];
+		char detail[64] = "";
+		if (span->kind == TRACE_RECEIVE || span->kind == TRACE_SEND)
+			snprintf(detail, sizeof(detail), ",\"segment\":%d", span->detail);
+		else if (span->kind == TRACE_LOCK)
+			snprintf(detail, sizeof(detail), ",\"site\":\"%s\"", GetLockSiteName(span->detail));
+		length += snprintf(obuffer + length, size - length,
+			",\n{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%lu,"
+			"\"args\":{\"request\":%lld%s}}",
+			TraceSpanNames[span->kind], (span->start - TraceEpoch) * scale, (span->end - span->start) * scale,
+			(unsigned long)request->thread, request->id, detail);
+	}
+	return length;
+}
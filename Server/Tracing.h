@@ -0,0 +1,147 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CommonHeader.h"
+#include "Metrics.h"
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define TRACE_SPAN_MAX 64 // Spans kept per request. The spans after are counted, not kept
+#define TRACE_BUFFER_SIZE 1024 // Traced requests kept in memory. The oldest are overwritten
+#define TRACE_EVENT_MAX_SIZE 256 // Largest size of one trace event, in bytes
+#define TRACE_PATH "/trace"
+#define TRACE_HTTP_OK "HTTP/1.0 200 OK\r\nContent-Type: application/json\r\nContent-Length: %d\r\nConnection: close\r\n\r\n"
+
+#define TRACE_ACCEPT 0 // From accept() to the connection thread ready to serve it. First request of a connection only
+#define TRACE_RECEIVE 1 // A segment received, from its header. [segment number]
+#define TRACE_PARSE 2 // The command extracted
+#define TRACE_LOCK 3 // Waiting for critical_section. [call site: see LOCK_SITE_ for some definitions]
+#define TRACE_HANDLER 4 // The handler, its lock waits included
+#define TRACE_SEND 5 // A segment compressed and sent. [segment number]
+#define TRACE_KIND_COUNT 6
+
+#define TRACE_CLOCK(variable) LONG64 variable = IsRequestTraced() ? ReadMetricsClock() : 0 // Declare a time stamp of a traced request. 0 if not traced
+
+#define _ENABLE_TRACING_FAIL "Fail to allocate the trace buffer. Requests are not traced"
+#define _TRACE_NOT_SERVED "Traces are served with the metrics only. Set metrics_port to read them"
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+typedef struct tracespan {
+
+	int kind; // What the span covers. See TRACE_ for some definitions
+
+	int detail; // The segment number or the lock call site, by kind. 0 if none
+
+	LONG64 start; // In QueryPerformanceCounter() ticks
+
+	LONG64 end; // In QueryPerformanceCounter() ticks
+
+}TRACESPAN;
+
+typedef struct tracerequest {
+
+	LONG64 id; // The request ID. 0 while the thread traces no request
+
+	int command; // The command code. See C_ for some definitions. 0 if not parsed
+
+	int status; // The response status. -1 if no response
+
+	DWORD thread; // The thread that handled the request
+
+	int received; // Number of segments received
+
+	int sent; // Number of segments sent
+
+	int count; // Number of spans kept
+
+	int dropped; // Number of spans not kept: more than TRACE_SPAN_MAX
+
+	LONG64 start; // The header of the first segment received, in QueryPerformanceCounter() ticks
+
+	LONG64 end; // The last segment sent, in QueryPerformanceCounter() ticks
+
+	TRACESPAN spans[TRACE_SPAN_MAX]; // The spans, in the order they ended
+
+}TRACEREQUEST;
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Begin tracing requests, and Serve the traces with the metrics as Chrome trace-event JSON at TRACE_PATH.
+/// </summary>
+/// <param name="sample">One request in [sample] is traced</param>
+/// <returns>1 if success. 0 if have errors</returns>
+int EnableTracing(int sample);
+
+/// <summary>
+/// Give the request the calling thread received the first segment of an ID, and Start tracing it if it is sampled.
+/// </summary>
+/// <returns>The request ID. 0 if tracing is not enabled</returns>
+LONG64 BeginTrace();
+
+/// <summary>
+/// Check whether the calling thread traces a request.
+/// </summary>
+/// <returns>1 if a request is traced. 0 otherwise</returns>
+int IsRequestTraced();
+
+/// <summary>
+/// Add a span to the request the calling thread traces. Nothing if no request is traced.
+/// </summary>
+/// <param name="kind">What the span covers. See TRACE_ for some definitions</param>
+/// <param name="detail">The segment number or the lock call site, by kind. 0 if none</param>
+/// <param name="start">In QueryPerformanceCounter() ticks</param>
+/// <param name="end">In QueryPerformanceCounter() ticks</param>
+void TraceSpan(int kind, int detail, LONG64 start, LONG64 end);
+
+/// <summary>
+/// Add a span of a segment, ending now, to the request the calling thread traces. A segment received while
+/// no request is traced is kept for BeginTrace(): it may be the first segment of the next request.
+/// </summary>
+/// <param name="kind">TRACE_RECEIVE or TRACE_SEND</param>
+/// <param name="start">In QueryPerformanceCounter() ticks</param>
+void TraceSegment(int kind, LONG64 start);
+
+/// <summary>
+/// Keep when the connection the calling thread serves was accepted: the accept is traced with its first request.
+/// </summary>
+/// <param name="accepted">When accept() returned the connection, in QueryPerformanceCounter() ticks</param>
+void TraceAccept(LONG64 accepted);
+
+/// <summary>
+/// End tracing the request of the calling thread, and Put it in the trace buffer. Nothing if no request is traced.
+/// </summary>
+/// <param name="command">The command code. See C_ for some definitions</param>
+/// <param name="status">The response status. -1 if no response</param>
+void EndTrace(int command, int status);
+
+/// <summary>
+/// Write the trace buffer as Chrome trace-event JSON: a complete event per request and per span, oldest first.
+/// The buffer is copied under the trace lock and formatted after: sampled requests ending meanwhile wait for the copy only.
+/// [METRICSPAGE format]
+/// </summary>
+/// <param name="obody">[Output] The JSON. Free with free(). NULL if failed</param>
+/// <returns>Length of the JSON, in bytes. -1 if have errors</returns>
+int FormatTrace(char** obody);
+
+/// <summary>
+/// Write the events of a traced request, each after a comma.
+/// </summary>
+/// <param name="request">The traced request</param>
+/// <param name="obuffer">[Output] The events</param>
+/// <param name="size">Size of obuffer, in bytes. TRACE_EVENT_MAX_SIZE per event is enough</param>
+/// <returns>Length of the events, in bytes</returns>
+int FormatTraceRequest(const TRACEREQUEST* request, char* obuffer, int size);
+
+#pragma endregion